@@ -0,0 +1,179 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "Platform.h"
+#include "DsmrReading.h"
+#include "DsmrJson.h"
+#include "MeterTime.h"
+#include "PowerStats.h"
+
+/*==================================================================================================*
+ * Aggregation of the actual power values in fixed time windows.
+ *
+ * Every telegram is added to three tumbling windows of 1 minute, 15 minutes and 1 hour, aligned to
+ * the (UTC) clock of the meter. Each window keeps the min/max/mean/last per channel (PowerStats.h)
+ * and the energy per channel: the power integrated over time, every value held until the next
+ * telegram, and split exactly at the window boundary. A window is closed (and can be published)
+ * by the first telegram past its end. Memory use is constant, whatever the telegram rate.
+ *==================================================================================================*/
+
+const int cnAggWindows = 3;
+static const uint16_t auAggSeconds[cnAggWindows] PROGMEM = { 60, 900, 3600 };
+static const char achAggName[cnAggWindows][4] PROGMEM = { "1m", "15m", "1h" };
+
+const uint32_t cuAggMaxGap = 120;   //Don't integrate over gaps between telegrams longer than this (s)
+
+struct AggWindow
+{
+    uint32_t uStart;                //Start of the window (UTC seconds since 2000)
+    bool bDst;                      //Meter was on summer time at the start
+    bool bActive;                   //Window has been started
+    bool bClosed;                   //Window is complete, waiting to be restarted
+    PowerStats xStats;              //Min/max/mean/last per channel
+    int64_t allEnergy[cnStatChannels];  //Energy per channel (Ws)
+};
+
+struct Aggregator
+{
+    AggWindow axWindow[cnAggWindows];
+    bool bHaveLast;                 //alLast/uLast are valid
+    uint32_t uLast;                 //Time of the last telegram (UTC seconds since 2000)
+    long alLast[cnStatChannels];    //Values of the last telegram (W)
+};
+
+/*--- Length of a window in seconds ---*/
+static inline uint32_t AggLength(int nWindow)
+{
+    return pgm_read_word(&auAggSeconds[nWindow]);
+}
+
+/*--- Add the last values, held from uFrom until uTo, to the energy of a window ---*/
+static void AggIntegrate(Aggregator *pxAgg, AggWindow *pxWindow, uint32_t uFrom, uint32_t uTo)
+{
+    if (!pxAgg->bHaveLast || uTo <= uFrom)
+        return;
+    for (int i = 0; i < cnStatChannels; i++)
+        pxWindow->allEnergy[i] += (int64_t)pxAgg->alLast[i] * (uTo - uFrom);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * AggReset: Start without any windows.
+ *------------------------------------------------------------------------------------------------*/
+void AggReset(Aggregator *pxAgg)
+{
+    memset(pxAgg, 0, sizeof(*pxAgg));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * AggClose: Close the windows that end at or before the time of a new telegram.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Call for every telegram before AggAdd(). Windows that end at or before uTime get the energy up
+ *  to their end and are marked closed; they keep their data until the AggAdd() that follows, so
+ *  publish them in between.
+ *INPUT:
+ *	Aggregator *pxAgg - aggregation state
+ *  uint32_t uTime - telegram time (UTC seconds since 2000, see MeterTimeUtc())
+ *OUTPUT:
+ *	(uint8_t) bit n set if window n was closed.
+ *------------------------------------------------------------------------------------------------*/
+uint8_t AggClose(Aggregator *pxAgg, uint32_t uTime)
+{
+    uint8_t uClosed = 0;
+
+    for (int n = 0; n < cnAggWindows; n++) {
+        AggWindow *pxWindow = &pxAgg->axWindow[n];
+        uint32_t uEnd = pxWindow->uStart + AggLength(n);
+
+        if (!pxWindow->bActive || pxWindow->bClosed || uTime < uEnd)
+            continue;
+        if (uTime - pxAgg->uLast <= cuAggMaxGap)
+            AggIntegrate(pxAgg, pxWindow, pxAgg->uLast > pxWindow->uStart ? pxAgg->uLast : pxWindow->uStart, uEnd);
+        pxWindow->bClosed = true;
+        uClosed |= 1 << n;
+    }
+    return uClosed;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * AggAdd: Add the actual power values of a telegram to all windows.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Windows that are closed (or not started yet) are restarted at the boundary at or before uTime.
+ *  The previous values are integrated up to uTime, then the new values are accumulated.
+ *INPUT:
+ *	Aggregator *pxAgg - aggregation state
+ *  const DsmrReading *pxReading - readings of the telegram
+ *  uint32_t uTime - telegram time (UTC seconds since 2000, see MeterTimeUtc())
+ *  bool bDst - meter is on summer time (only used to show the window start in meter time)
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void AggAdd(Aggregator *pxAgg, const DsmrReading *pxReading, uint32_t uTime, bool bDst)
+{
+    bool bIntegrate = pxAgg->bHaveLast && uTime > pxAgg->uLast && uTime - pxAgg->uLast <= cuAggMaxGap;
+
+    for (int n = 0; n < cnAggWindows; n++) {
+        AggWindow *pxWindow = &pxAgg->axWindow[n];
+
+        if (!pxWindow->bActive || pxWindow->bClosed) {
+            pxWindow->uStart = uTime - uTime % AggLength(n);
+            pxWindow->bDst = bDst;
+            pxWindow->bActive = true;
+            pxWindow->bClosed = false;
+            StatsReset(&pxWindow->xStats);
+            memset(pxWindow->allEnergy, 0, sizeof(pxWindow->allEnergy));
+        }
+        if (bIntegrate)
+            AggIntegrate(pxAgg, pxWindow, pxAgg->uLast > pxWindow->uStart ? pxAgg->uLast : pxWindow->uStart, uTime);
+        StatsAdd(&pxWindow->xStats, pxReading);
+    }
+
+    for (int i = 0; i < cnStatChannels; i++)
+        pxAgg->alLast[i] = StatValue(pxReading, i);
+    pxAgg->uLast = uTime;
+    pxAgg->bHaveLast = true;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * AggName: Name of a window, e.g. '15m'.
+ *------------------------------------------------------------------------------------------------*/
+const char *AggName(int nWindow, char *pchName)
+{
+    memcpy_P(pchName, achAggName[nWindow], sizeof(achAggName[nWindow]));
+    return pchName;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * AggToJson: Serialize a (closed) window.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	{"window":"15m","start":"181121093000W","samples":"90","use":{"total":{"min":..,"max":..,
+ *  "avg":..,"last":..,"energy":"12.345"},"L1":{..},..},"return":{..}}, start in meter (local)
+ *  time, power in W, energy in Wh with 3 decimals.
+ *INPUT:
+ *	const Aggregator *pxAgg - aggregation state
+ *  int nWindow - window to serialize
+ *  char *pchBuf - output buffer
+ *  int nSize - size of the output buffer
+ *OUTPUT:
+ *	(int) length of the document (excluding the terminating '\0'), -1 if it did not fit.
+ *------------------------------------------------------------------------------------------------*/
+int AggToJson(const Aggregator *pxAgg, int nWindow, char *pchBuf, int nSize)
+{
+    const AggWindow *pxWindow = &pxAgg->axWindow[nWindow];
+    char achText[cnMeterTimeLen + 1];
+    long alEnergy[cnStatChannels];
+    JsonWriter xWriter;
+
+    for (int i = 0; i < cnStatChannels; i++)
+        alEnergy[i] = (long)(pxWindow->allEnergy[i] * 1000 / 3600); //Ws to mWh
+
+    JsonBegin(&xWriter, pchBuf, nSize);
+    JsonText(&xWriter, "window", AggName(nWindow, achText));
+    MeterTimeFormat(MeterTimeLocal(pxWindow->uStart, pxWindow->bDst), pxWindow->bDst, achText);
+    JsonText(&xWriter, "start", achText);
+    JsonStats(&xWriter, &pxWindow->xStats, alEnergy);
+    return JsonEnd(&xWriter);
+}
+#endif
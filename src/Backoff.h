@@ -0,0 +1,94 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include "Platform.h"
+
+/*==================================================================================================*
+ * Retry scheduling with jittered exponential backoff.
+ *
+ * Instead of blocking until a connection attempt succeeds, the caller asks BackoffDue() from its
+ * main loop whether the next attempt may be made. Every failure doubles the delay (up to a maximum)
+ * and randomizes it between half and the full delay, so a number of sensors don't all hammer the
+ * broker at the same moment after it comes back. Time is passed in by the caller (millis()), which
+ * keeps this usable in host builds.
+ *==================================================================================================*/
+
+const unsigned long culBackoffMin = 1000UL;     //First retry after 0.5-1 s
+const unsigned long culBackoffMax = 60000UL;    //Retry at least every minute
+
+struct Backoff
+{
+    unsigned long ulNextTry;        //Time (millis) the next attempt is due
+    unsigned long ulDelay;          //Current (maximum) delay between attempts
+    uint32_t uAttempts;             //Failed attempts since the last success
+    uint32_t uRandom;               //Jitter generator state, never 0
+};
+
+/*------------------------------------------------------------------------------------------------*
+ * BackoffReset: Initialize the schedule; the first attempt is due immediately.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	Backoff *pxBackoff - schedule to initialize
+ *  unsigned long ulNow - current time (millis)
+ *  uint32_t uSeed - seed for the jitter, e.g. the chip ID or a hardware random number
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void BackoffReset(Backoff *pxBackoff, unsigned long ulNow, uint32_t uSeed)
+{
+    pxBackoff->ulNextTry = ulNow;
+    pxBackoff->ulDelay = culBackoffMin;
+    pxBackoff->uAttempts = 0;
+    pxBackoff->uRandom = uSeed ? uSeed : 0x9E3779B9UL;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * BackoffDue: Check if the next attempt may be made (safe across the millis() wrap-around).
+ *------------------------------------------------------------------------------------------------*/
+bool BackoffDue(const Backoff *pxBackoff, unsigned long ulNow)
+{
+    return (long)(ulNow - pxBackoff->ulNextTry) >= 0;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * BackoffFailed: Schedule the next attempt after a failed one.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The next attempt is due after a random time between half and the full current delay, then the
+ *  delay is doubled for the attempt after that, until culBackoffMax.
+ *INPUT:
+ *	Backoff *pxBackoff - schedule
+ *  unsigned long ulNow - time (millis) of the failed attempt
+ *OUTPUT:
+ *	(unsigned long) milliseconds until the next attempt.
+ *------------------------------------------------------------------------------------------------*/
+unsigned long BackoffFailed(Backoff *pxBackoff, unsigned long ulNow)
+{
+    /*--- xorshift32, plenty for spreading retries ---*/
+    uint32_t uRandom = pxBackoff->uRandom;
+    uRandom ^= uRandom << 13;
+    uRandom ^= uRandom >> 17;
+    uRandom ^= uRandom << 5;
+    pxBackoff->uRandom = uRandom;
+
+    unsigned long ulHalf = pxBackoff->ulDelay / 2;
+    unsigned long ulWait = ulHalf + uRandom % (ulHalf + 1);
+
+    pxBackoff->ulNextTry = ulNow + ulWait;
+    pxBackoff->uAttempts++;
+    if (pxBackoff->ulDelay < culBackoffMax / 2)
+        pxBackoff->ulDelay *= 2;
+    else
+        pxBackoff->ulDelay = culBackoffMax;
+    return ulWait;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * BackoffSucceeded: Start over with the shortest delay after a successful attempt.
+ *------------------------------------------------------------------------------------------------*/
+void BackoffSucceeded(Backoff *pxBackoff)
+{
+    pxBackoff->ulDelay = culBackoffMin;
+    pxBackoff->uAttempts = 0;
+}
+#endif
@@ -0,0 +1,233 @@
+#ifndef DEMAND_H
+#define DEMAND_H
+
+#include "Platform.h"
+#include "DsmrReading.h"
+#include "DsmrJson.h"
+#include "MeterTime.h"
+#include "StateFile.h"
+
+/*==================================================================================================*
+ * Quarter-hour demand and monthly peak (capacity tariff).
+ *
+ * Capacity tariffs bill the highest average power taken from the grid in any quarter-hour of the
+ * month. The average is derived from the energy registers (use T1 + T2), not from the sampled
+ * actual power: the register delta over a quarter is exact, whatever the telegram rate or gaps.
+ *
+ * Per quarter-hour (aligned to the meter clock) the registers at its first telegram are the base.
+ * Every telegram updates the deltas since the base and the running average demand (delta over the
+ * elapsed time). The first telegram of the next quarter completes the quarter: its average demand
+ * is the last demand and, if higher, the new peak of the month. A new month (meter time) starts a
+ * new peak; the final peak of the month that closed, which includes its last quarter (completed by
+ * the first telegram of the new month), is kept as the previous peak. A quarter spanning a reboot
+ * still counts, as long as the telegrams around it are at most cuDemandMaxSpan apart.
+ *
+ * The base and the peaks are saved (StateFile.h) once per quarter and picked up again at boot.
+ *==================================================================================================*/
+
+const uint32_t cuDemandQuarter = 900;       //Length of a demand interval (s)
+const uint32_t cuDemandMaxSpan = 1800;      //Longest span a completed quarter may cover (s)
+const char *const pchDemandFile = "/demand.bin";
+
+/*--- Saved state, changes once per quarter (a record of another size is not loaded) ---*/
+struct DemandState
+{
+    uint16_t uMonth;                //Month of the peak, yymm in meter time (e.g. 1811), 0 = none
+    uint8_t bPeakDst;               //Peak quarter started on summer time
+    uint8_t bBase;                  //The base below is valid
+    uint16_t uPrevMonth;            //Month of the previous peak, yymm, 0 = none
+    uint8_t bPrevPeakDst;           //Previous peak quarter started on summer time
+    long lPeak;                     //Highest quarter average of the month (W)
+    uint32_t uPeakStart;            //Start of the peak quarter (UTC seconds since 2000)
+    uint32_t uQuarter;              //Start of the current quarter (UTC seconds since 2000)
+    uint32_t uBaseTime;             //Time the base registers were taken (UTC seconds since 2000)
+    uint32_t uPrevPeakStart;        //Start of the previous peak quarter (UTC seconds since 2000)
+    long lUseBase;                  //Use T1 + T2 at uBaseTime (Wh)
+    long lReturnBase;               //Return T1 + T2 at uBaseTime (Wh)
+    long lPrevPeak;                 //Final peak of the month before uMonth (W)
+};
+static_assert(sizeof(DemandState) <= cnStateMaxLen, "DemandState must fit in a state record");
+
+struct Demand
+{
+    DemandState xState;
+    bool bDst;                      //Current quarter started on summer time
+    bool bRunning;                  //A telegram was added in the current quarter
+    long lUse;                      //Use since the start of the quarter (Wh)
+    long lReturn;                   //Return since the start of the quarter (Wh)
+    long lAverage;                  //Running average demand of the quarter (W)
+    bool bLast;                     //lLast is valid
+    long lLast;                     //Average demand of the last completed quarter (W)
+    bool bDirty;                    //xState changed, save it
+};
+
+/*--- Average power (W) of an energy delta (Wh) over a number of seconds ---*/
+static long DemandAverage(long lEnergy, uint32_t uSeconds)
+{
+    return uSeconds ? (long)((int64_t)lEnergy * 3600 / uSeconds) : 0;
+}
+
+/*--- Month of a (valid) meter timestamp as yymm ---*/
+static uint16_t DemandMonth(const char *pchTime)
+{
+    return (pchTime[0] - '0') * 1000 + (pchTime[1] - '0') * 100 + (pchTime[2] - '0') * 10 + (pchTime[3] - '0');
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DemandBegin: Start the demand computation, picking up the state saved before a reboot.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	Demand *pxDemand - demand state
+ *OUTPUT:
+ *	(bool) true if a saved state was found.
+ *------------------------------------------------------------------------------------------------*/
+bool DemandBegin(Demand *pxDemand)
+{
+    memset(pxDemand, 0, sizeof(*pxDemand));
+    return StateLoad(pchDemandFile, &pxDemand->xState, sizeof(pxDemand->xState));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DemandAdd: Add the energy registers of a telegram.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Completes the quarter when the telegram belongs to a later one, then updates the deltas and the
+ *  running average of the current quarter. Telegrams without a valid timestamp are ignored; a
+ *  telegram older than the base (clock set back) or a register going down (meter exchanged)
+ *  starts a new base.
+ *INPUT:
+ *	Demand *pxDemand - demand state
+ *  const DsmrReading *pxReading - readings of a telegram with a valid CRC16
+ *OUTPUT:
+ *	None. pxDemand->bDirty is set when the state should be saved (see DemandSave()).
+ *------------------------------------------------------------------------------------------------*/
+void DemandAdd(Demand *pxDemand, const DsmrReading *pxReading)
+{
+    DemandState *pxState = &pxDemand->xState;
+    uint32_t uTime;
+    bool bDst;
+
+    if (!MeterTimeParse(pxReading->achPwrTime, &uTime, &bDst))
+        return; //No (valid) timestamp in the telegram
+    uTime = MeterTimeUtc(uTime, bDst);
+
+    uint32_t uQuarter = uTime - uTime % cuDemandQuarter;
+    uint16_t uMonth = DemandMonth(pxReading->achPwrTime);
+    long lUse = pxReading->lPwrLow + pxReading->lPwrHigh;
+    long lReturn = pxReading->lReturnLow + pxReading->lReturnHigh;
+
+    if (pxState->bBase && (uTime < pxState->uBaseTime || lUse < pxState->lUseBase || lReturn < pxState->lReturnBase))
+        pxState->bBase = false; //Clock set back or meter exchanged, start over
+
+    /*--- First telegram of a later quarter: complete the previous one ---*/
+    if (pxState->bBase && uQuarter != pxState->uQuarter) {
+        uint32_t uSpan = uTime - pxState->uBaseTime;
+        pxDemand->bLast = uSpan <= cuDemandMaxSpan;
+        if (pxDemand->bLast) {
+            pxDemand->lLast = DemandAverage(lUse - pxState->lUseBase, uSpan);
+            if (pxDemand->lLast > pxState->lPeak || pxState->uPeakStart == 0) { //Peak of the month the quarter started in
+                pxState->lPeak = pxDemand->lLast;
+                pxState->uPeakStart = pxState->uQuarter;
+                pxState->bPeakDst = pxDemand->bDst;
+            }
+        }
+        pxState->bBase = false;
+    }
+
+    /*--- New month (meter time): keep the final peak of the month that closed, start over ---*/
+    if (pxState->uMonth != uMonth) {
+        if (pxState->uPeakStart) {
+            pxState->uPrevMonth = pxState->uMonth;
+            pxState->lPrevPeak = pxState->lPeak;
+            pxState->uPrevPeakStart = pxState->uPeakStart;
+            pxState->bPrevPeakDst = pxState->bPeakDst;
+        }
+        pxState->uMonth = uMonth;
+        pxState->lPeak = 0;
+        pxState->uPeakStart = 0;
+        pxState->bPeakDst = false;
+        pxDemand->bDirty = true;
+    }
+
+    /*--- Start a quarter at this telegram ---*/
+    if (!pxState->bBase) {
+        pxState->bBase = true;
+        pxState->uQuarter = uQuarter;
+        pxState->uBaseTime = uTime;
+        pxState->lUseBase = lUse;
+        pxState->lReturnBase = lReturn;
+        pxDemand->bDst = bDst;
+        pxDemand->bDirty = true;
+    }
+    else if (!pxDemand->bRunning)
+        pxDemand->bDst = bDst; //Quarter picked up after a reboot
+    pxDemand->bRunning = true;
+
+    pxDemand->lUse = lUse - pxState->lUseBase;
+    pxDemand->lReturn = lReturn - pxState->lReturnBase;
+    pxDemand->lAverage = DemandAverage(pxDemand->lUse, uTime - pxState->uBaseTime);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DemandSave: Save the state if it changed since the last save.
+ *------------------------------------------------------------------------------------------------*/
+bool DemandSave(Demand *pxDemand)
+{
+    if (!pxDemand->bDirty)
+        return true;
+    pxDemand->bDirty = false;
+    return StateSave(pchDemandFile, &pxDemand->xState, sizeof(pxDemand->xState));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonDemand: Write the demand figures as a "demand" member.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	"demand":{"quarter":{"start":"181121093000W","use":"123","return":"0","avg":"1234"},
+ *  "last":"1500","peak":{"start":"181105181500W","avg":"2345"},
+ *  "previous":{"month":"1810","start":"181017190000S","avg":"3456"}}, times in meter (local) time,
+ *  energy in Wh, power in W. Members without a value yet are left out.
+ *INPUT:
+ *	JsonWriter *pxWriter - document being written
+ *  const Demand *pxDemand - demand state
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void JsonDemand(JsonWriter *pxWriter, const Demand *pxDemand)
+{
+    const DemandState *pxState = &pxDemand->xState;
+    char achTime[cnMeterTimeLen + 1];
+
+    if (!pxDemand->bRunning)
+        return;
+    JsonOpen(pxWriter, "demand");
+    JsonOpen(pxWriter, "quarter");
+    MeterTimeFormat(MeterTimeLocal(pxState->uQuarter, pxDemand->bDst), pxDemand->bDst, achTime);
+    JsonText(pxWriter, "start", achTime);
+    JsonNumber(pxWriter, "use", pxDemand->lUse);
+    JsonNumber(pxWriter, "return", pxDemand->lReturn);
+    JsonNumber(pxWriter, "avg", pxDemand->lAverage);
+    JsonClose(pxWriter);
+    if (pxDemand->bLast)
+        JsonNumber(pxWriter, "last", pxDemand->lLast);
+    if (pxState->uPeakStart) {
+        JsonOpen(pxWriter, "peak");
+        MeterTimeFormat(MeterTimeLocal(pxState->uPeakStart, pxState->bPeakDst), pxState->bPeakDst, achTime);
+        JsonText(pxWriter, "start", achTime);
+        JsonNumber(pxWriter, "avg", pxState->lPeak);
+        JsonClose(pxWriter);
+    }
+    if (pxState->uPrevPeakStart) {
+        JsonOpen(pxWriter, "previous");
+        for (int i = 3, nMonth = pxState->uPrevMonth; i >= 0; i--, nMonth /= 10)
+            achTime[i] = '0' + nMonth % 10;
+        achTime[4] = '\0';
+        JsonText(pxWriter, "month", achTime);
+        MeterTimeFormat(MeterTimeLocal(pxState->uPrevPeakStart, pxState->bPrevPeakDst), pxState->bPrevPeakDst, achTime);
+        JsonText(pxWriter, "start", achTime);
+        JsonNumber(pxWriter, "avg", pxState->lPrevPeak);
+        JsonClose(pxWriter);
+    }
+    JsonClose(pxWriter);
+}
+#endif
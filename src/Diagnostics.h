@@ -0,0 +1,99 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "Platform.h"
+#include "DsmrJson.h"
+
+/*==================================================================================================*
+ * Device health and pipeline counters.
+ *
+ * The counters only ever go up (since boot), so a collector can compute rates and spot a sensor
+ * that starts losing telegrams, reconnecting or running out of heap. The gauges are a snapshot
+ * taken when the document is written; the longest loop() pass covers the interval since the
+ * previous document. The platform figures (RSSI, heap) are filled in by the caller, which keeps
+ * this usable in host builds.
+ *==================================================================================================*/
+
+struct Diagnostics
+{
+    /*--- Counters since boot ---*/
+    uint32_t uTelegrams;            //Telegrams started ('/')
+    uint32_t uCrcOk;                //Telegrams with a valid CRC16
+    uint32_t uCrcBad;               //Telegrams with a CRC16 mismatch
+    uint32_t uTruncated;            //Lines dropped, a value group did not fit in cnGroupLen
+    uint32_t uOverflows;            //P1 receive buffer overflows
+    uint32_t uPublishFailed;        //Readings that could not be published
+    uint32_t uMqttConnects;         //Successful MQTT connects
+    uint32_t uMqttFailed;           //Failed MQTT connect attempts
+    uint32_t uWifiConnects;         //Times the WiFi link came up
+    uint32_t uWifiDisconnects;      //Times the WiFi link was lost
+    unsigned long ulWifiDown;       //Total WiFi downtime (ms)
+
+    /*--- Gauges ---*/
+    unsigned long ulUptime;         //Time since boot (s)
+    long lRssi;                     //WiFi signal strength (dBm)
+    uint32_t uHeapFree;             //Free heap (bytes)
+    uint32_t uHeapMin;              //Lowest free heap seen at the end of a loop() pass (bytes), 0 = none yet
+    uint32_t uHeapMaxBlock;         //Largest free heap block (bytes)
+    uint8_t uHeapFragmentation;     //Heap fragmentation (%)
+    unsigned long ulLoopMax;        //Longest loop() pass since the previous document (us)
+};
+
+/*------------------------------------------------------------------------------------------------*
+ * DiagLoop: Account for the duration of a loop() pass and the free heap after it.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The steady state path does not allocate, so the low-water mark of the free heap should settle
+ *  soon after boot; one that keeps going down points at a leak or at fragmentation.
+ *------------------------------------------------------------------------------------------------*/
+static inline void DiagLoop(Diagnostics *pxDiag, unsigned long ulMicros, uint32_t uHeapFree)
+{
+    if (ulMicros > pxDiag->ulLoopMax)
+        pxDiag->ulLoopMax = ulMicros;
+    if (pxDiag->uHeapMin == 0 || uHeapFree < pxDiag->uHeapMin)
+        pxDiag->uHeapMin = uHeapFree;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DiagToJson: Serialize the counters and gauges.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Same style as the readings document (all values quoted):
+ *  {"uptime":"86400","telegrams":"8640","crc_ok":"8638","crc_failed":"2","truncated":"0",
+ *  "overflows":"0","publish_failed":"1","mqtt_connects":"2","mqtt_failed":"5","wifi_connects":"1",
+ *  "wifi_disconnects":"0","wifi_down":"3021","rssi":"-67","heap_free":"31000","heap_min":"30500",
+ *  "heap_max_block":"28000","heap_fragmentation":"9","loop_max":"2150"}
+ *  uptime in s, WiFi downtime in ms, loop_max in us.
+ *INPUT:
+ *	const Diagnostics *pxDiag - counters and gauges
+ *  char *pchBuf - output buffer
+ *  int nSize - size of the output buffer
+ *OUTPUT:
+ *	(int) length of the document (excluding the terminating '\0'), -1 if it did not fit.
+ *------------------------------------------------------------------------------------------------*/
+int DiagToJson(const Diagnostics *pxDiag, char *pchBuf, int nSize)
+{
+    JsonWriter xWriter;
+
+    JsonBegin(&xWriter, pchBuf, nSize);
+    JsonNumber(&xWriter, "uptime", (long)pxDiag->ulUptime);
+    JsonNumber(&xWriter, "telegrams", (long)pxDiag->uTelegrams);
+    JsonNumber(&xWriter, "crc_ok", (long)pxDiag->uCrcOk);
+    JsonNumber(&xWriter, "crc_failed", (long)pxDiag->uCrcBad);
+    JsonNumber(&xWriter, "truncated", (long)pxDiag->uTruncated);
+    JsonNumber(&xWriter, "overflows", (long)pxDiag->uOverflows);
+    JsonNumber(&xWriter, "publish_failed", (long)pxDiag->uPublishFailed);
+    JsonNumber(&xWriter, "mqtt_connects", (long)pxDiag->uMqttConnects);
+    JsonNumber(&xWriter, "mqtt_failed", (long)pxDiag->uMqttFailed);
+    JsonNumber(&xWriter, "wifi_connects", (long)pxDiag->uWifiConnects);
+    JsonNumber(&xWriter, "wifi_disconnects", (long)pxDiag->uWifiDisconnects);
+    JsonNumber(&xWriter, "wifi_down", (long)pxDiag->ulWifiDown);
+    JsonNumber(&xWriter, "rssi", pxDiag->lRssi);
+    JsonNumber(&xWriter, "heap_free", (long)pxDiag->uHeapFree);
+    JsonNumber(&xWriter, "heap_min", (long)pxDiag->uHeapMin);
+    JsonNumber(&xWriter, "heap_max_block", (long)pxDiag->uHeapMaxBlock);
+    JsonNumber(&xWriter, "heap_fragmentation", pxDiag->uHeapFragmentation);
+    JsonNumber(&xWriter, "loop_max", (long)pxDiag->ulLoopMax);
+    return JsonEnd(&xWriter);
+}
+#endif
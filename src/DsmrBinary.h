@@ -0,0 +1,174 @@
+#ifndef DSMRBINARY_H
+#define DSMRBINARY_H
+
+#include "Platform.h"
+#include "DsmrReading.h"
+#include "MeterTime.h"
+
+/*==================================================================================================*
+ * Compact binary encoding of the meter readings.
+ *
+ * The same reading model as the JSON document in a fixed layout of 112 bytes, all numbers little
+ * endian, timestamps as seconds since 2000-01-01 in meter local time (see MeterTime.h):
+ *
+ *   offset  size  content
+ *        0     1  schema version (cuBinarySchema)
+ *        1     1  DSMR version, e.g. 42
+ *        2     1  active tariff (1 or 2)
+ *        3     1  flags: bit 0 power time valid, bit 1 power time is summer time,
+ *                        bit 2 gas time valid, bit 3 gas time is summer time
+ *        4     4  power timestamp
+ *        8     4  gas timestamp
+ *       12     4  use T1 (Wh)             36     4  return T1 (Wh)
+ *       16     4  use T2 (Wh)             40     4  return T2 (Wh)
+ *       20     4  use actual total (W)    44     4  return actual total (W)
+ *       24     4  use actual L1 (W)       48     4  return actual L1 (W)
+ *       28     4  use actual L2 (W)       52     4  return actual L2 (W)
+ *       32     4  use actual L3 (W)       56     4  return actual L3 (W)
+ *       60     4  gas (dm3)
+ *   schema 2:
+ *       64    48  M-Bus channel 1-4, 12 bytes each:
+ *                   +0  1  device type (0-1:24.1.0), e.g. 3 gas, 7 water
+ *                   +1  1  unit of the reading (ObisUnit, e.g. 5 m3)
+ *                   +2  1  flags: MBUS_* bits of MbusChannel (type/id/reading/time valid, summer time)
+ *                   +3  1  reserved (0)
+ *                   +4  4  time of the reading
+ *                   +8  4  reading (3 decimals, e.g. dm3)
+ *
+ * Fields are only ever appended (with a new schema version); a decoder reads the fields it knows
+ * and ignores the rest. DsmrFromBinary() is the reference decoder, it has no Arduino dependencies.
+ *==================================================================================================*/
+
+const uint8_t cuBinarySchema = 2;   //Schema version of the layout above
+const int cnBinaryLenV1 = 64;       //Length of the schema 1 payload
+const int cnBinaryLen = cnBinaryLenV1 + cnMbusChannels * 12; //Length of the schema 2 payload
+
+#define BINARY_PWR_TIME 0x01        //Power timestamp is valid
+#define BINARY_PWR_DST 0x02         //Power timestamp is summer time
+#define BINARY_GAS_TIME 0x04        //Gas timestamp is valid
+#define BINARY_GAS_DST 0x08         //Gas timestamp is summer time
+
+/*--- Store/load a 32-bit number, little endian ---*/
+static inline uint8_t *BinaryPut32(uint8_t *puBuf, uint32_t uValue)
+{
+    for (int i = 0; i < 4; i++, uValue >>= 8)
+        *puBuf++ = (uint8_t)uValue;
+    return puBuf;
+}
+
+static inline uint32_t BinaryGet32(const uint8_t *puBuf)
+{
+    return puBuf[0] | ((uint32_t)puBuf[1] << 8) | ((uint32_t)puBuf[2] << 16) | ((uint32_t)puBuf[3] << 24);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DsmrToBinary: Encode the meter readings in the binary layout.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	const DsmrReading *pxReading - meter readings to encode
+ *  uint8_t *puBuf - output buffer
+ *  int nSize - size of the output buffer
+ *OUTPUT:
+ *	(int) length of the payload (cnBinaryLen), -1 if it did not fit.
+ *------------------------------------------------------------------------------------------------*/
+int DsmrToBinary(const DsmrReading *pxReading, uint8_t *puBuf, int nSize)
+{
+    uint32_t uPwrTime = 0, uGasTime = 0;
+    uint8_t uFlags = 0;
+    bool bDst;
+
+    if (nSize < cnBinaryLen)
+        return -1;
+
+    if (MeterTimeParse(pxReading->achPwrTime, &uPwrTime, &bDst))
+        uFlags |= BINARY_PWR_TIME | (bDst ? BINARY_PWR_DST : 0);
+    if (MeterTimeParse(pxReading->achGasTime, &uGasTime, &bDst))
+        uFlags |= BINARY_GAS_TIME | (bDst ? BINARY_GAS_DST : 0);
+
+    uint8_t *puPos = puBuf;
+    *puPos++ = cuBinarySchema;
+    *puPos++ = (uint8_t)pxReading->lDsmrVersion;
+    *puPos++ = (uint8_t)pxReading->lPwrTariff;
+    *puPos++ = uFlags;
+    puPos = BinaryPut32(puPos, uPwrTime);
+    puPos = BinaryPut32(puPos, uGasTime);
+    puPos = BinaryPut32(puPos, pxReading->lPwrLow);
+    puPos = BinaryPut32(puPos, pxReading->lPwrHigh);
+    puPos = BinaryPut32(puPos, pxReading->lPwrActual);
+    puPos = BinaryPut32(puPos, pxReading->lPwrL1);
+    puPos = BinaryPut32(puPos, pxReading->lPwrL2);
+    puPos = BinaryPut32(puPos, pxReading->lPwrL3);
+    puPos = BinaryPut32(puPos, pxReading->lReturnLow);
+    puPos = BinaryPut32(puPos, pxReading->lReturnHigh);
+    puPos = BinaryPut32(puPos, pxReading->lReturnActual);
+    puPos = BinaryPut32(puPos, pxReading->lReturnL1);
+    puPos = BinaryPut32(puPos, pxReading->lReturnL2);
+    puPos = BinaryPut32(puPos, pxReading->lReturnL3);
+    puPos = BinaryPut32(puPos, pxReading->lGasMeter);
+    for (int i = 0; i < cnMbusChannels; i++) {
+        const MbusChannel *pxChannel = &pxReading->axMbus[i];
+        *puPos++ = pxChannel->nType;
+        *puPos++ = pxChannel->nUnit;
+        *puPos++ = pxChannel->uFlags;
+        *puPos++ = 0;
+        puPos = BinaryPut32(puPos, pxChannel->uTime);
+        puPos = BinaryPut32(puPos, pxChannel->lValue);
+    }
+
+    return puPos - puBuf;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DsmrFromBinary: Decode a binary payload back into meter readings.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	const uint8_t *puBuf - payload as received
+ *  int nLen - length of the payload
+ *  DsmrReading *pxReading - receives the meter readings
+ *OUTPUT:
+ *	(bool) true if decoded, false if the payload is too short or not a known schema. A schema 1
+ *  payload decodes without M-Bus channels.
+ *------------------------------------------------------------------------------------------------*/
+bool DsmrFromBinary(const uint8_t *puBuf, int nLen, DsmrReading *pxReading)
+{
+    if (nLen < cnBinaryLenV1 || puBuf[0] < 1 || (puBuf[0] >= 2 && nLen < cnBinaryLen))
+        return false;
+
+    memset(pxReading, 0, sizeof(*pxReading));
+    pxReading->lDsmrVersion = puBuf[1];
+    pxReading->lPwrTariff = puBuf[2];
+    uint8_t uFlags = puBuf[3];
+    if (uFlags & BINARY_PWR_TIME)
+        MeterTimeFormat(BinaryGet32(puBuf + 4), uFlags & BINARY_PWR_DST, pxReading->achPwrTime);
+    if (uFlags & BINARY_GAS_TIME)
+        MeterTimeFormat(BinaryGet32(puBuf + 8), uFlags & BINARY_GAS_DST, pxReading->achGasTime);
+
+    const uint8_t *puPos = puBuf + 12;
+    pxReading->lPwrLow = (int32_t)BinaryGet32(puPos);
+    pxReading->lPwrHigh = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lPwrActual = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lPwrL1 = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lPwrL2 = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lPwrL3 = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lReturnLow = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lReturnHigh = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lReturnActual = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lReturnL1 = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lReturnL2 = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lReturnL3 = (int32_t)BinaryGet32(puPos += 4);
+    pxReading->lGasMeter = (int32_t)BinaryGet32(puPos += 4);
+    if (puBuf[0] < 2)
+        return true;
+
+    puPos = puBuf + cnBinaryLenV1;
+    for (int i = 0; i < cnMbusChannels; i++, puPos += 12) {
+        MbusChannel *pxChannel = &pxReading->axMbus[i];
+        pxChannel->nType = puPos[0];
+        pxChannel->nUnit = puPos[1] < UNIT_UNKNOWN ? (ObisUnit)puPos[1] : UNIT_UNKNOWN;
+        pxChannel->uFlags = puPos[2] & ~MBUS_ID; //The id is not in the payload
+        pxChannel->uTime = BinaryGet32(puPos + 4);
+        pxChannel->lValue = (int32_t)BinaryGet32(puPos + 8);
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,451 @@
+#ifndef DSMRJSON_H
+#define DSMRJSON_H
+
+#include "Platform.h"
+#include "DsmrReading.h"
+
+/*==================================================================================================*
+ * JSON serialization of the meter readings.
+ *
+ * Writes the fixed, nested MQTT document straight into a caller supplied buffer: no heap, no
+ * String temporaries, no intermediate document tree. The output is compact (no whitespace) and
+ * all values are quoted strings, exactly as the ArduinoJson based serializer used to produce it.
+ *==================================================================================================*/
+
+struct JsonWriter
+{
+    char *pchBuf;               //Output buffer
+    int nSize;                  //Size of the output buffer
+    int nLen;                   //Characters written so far (excluding the terminating '\0')
+    bool bComma;                //Next member needs a ',' separator
+    bool bOverflow;             //Output did not fit in the buffer
+};
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonPut: Append a single character to the output.
+ *------------------------------------------------------------------------------------------------*/
+static inline void JsonPut(JsonWriter *pxWriter, char ch)
+{
+    if (pxWriter->nLen < pxWriter->nSize - 1)
+        pxWriter->pchBuf[pxWriter->nLen++] = ch;
+    else
+        pxWriter->bOverflow = true;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonPutString: Append a quoted, escaped string to the output.
+ *------------------------------------------------------------------------------------------------*/
+static void JsonPutString(JsonWriter *pxWriter, const char *pchText)
+{
+    JsonPut(pxWriter, '"');
+    for (; *pchText; pchText++) {
+        char ch = *pchText;
+        char chEscape = 0;
+
+        switch (ch) {
+        case '"': chEscape = '"'; break;
+        case '\\': chEscape = '\\'; break;
+        case '\b': chEscape = 'b'; break;
+        case '\f': chEscape = 'f'; break;
+        case '\n': chEscape = 'n'; break;
+        case '\r': chEscape = 'r'; break;
+        case '\t': chEscape = 't'; break;
+        default: break;
+        }
+        if (chEscape) {
+            JsonPut(pxWriter, '\\');
+            ch = chEscape;
+        }
+        JsonPut(pxWriter, ch);
+    }
+    JsonPut(pxWriter, '"');
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonKey: Start a new member, writing the separator (if needed) and the key.
+ *------------------------------------------------------------------------------------------------*/
+static void JsonKey(JsonWriter *pxWriter, const char *pchKey)
+{
+    if (pxWriter->bComma)
+        JsonPut(pxWriter, ',');
+    JsonPutString(pxWriter, pchKey);
+    JsonPut(pxWriter, ':');
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonBegin: Start a JSON document (the root object) in the passed buffer.
+ *------------------------------------------------------------------------------------------------*/
+void JsonBegin(JsonWriter *pxWriter, char *pchBuf, int nSize)
+{
+    pxWriter->pchBuf = pchBuf;
+    pxWriter->nSize = nSize;
+    pxWriter->nLen = 0;
+    pxWriter->bComma = false;
+    pxWriter->bOverflow = false;
+    JsonPut(pxWriter, '{');
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonEnd: Close the root object and terminate the output.
+ *------------------------------------------------------------------------------------------------*
+ *OUTPUT:
+ *	(int) length of the document, or -1 if it did not fit in the buffer.
+ *------------------------------------------------------------------------------------------------*/
+int JsonEnd(JsonWriter *pxWriter)
+{
+    JsonPut(pxWriter, '}');
+    if (pxWriter->nSize > 0)
+        pxWriter->pchBuf[pxWriter->nLen] = 0;
+    return pxWriter->bOverflow ? -1 : pxWriter->nLen;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonOpen/JsonClose: Start and end a nested object member.
+ *------------------------------------------------------------------------------------------------*/
+void JsonOpen(JsonWriter *pxWriter, const char *pchKey)
+{
+    JsonKey(pxWriter, pchKey);
+    JsonPut(pxWriter, '{');
+    pxWriter->bComma = false;
+}
+
+void JsonClose(JsonWriter *pxWriter)
+{
+    JsonPut(pxWriter, '}');
+    pxWriter->bComma = true;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonOpenArray/JsonCloseArray: Start and end an array member; JsonOpenElement starts an object
+ * element of it, ended with JsonClose.
+ *------------------------------------------------------------------------------------------------*/
+void JsonOpenArray(JsonWriter *pxWriter, const char *pchKey)
+{
+    JsonKey(pxWriter, pchKey);
+    JsonPut(pxWriter, '[');
+    pxWriter->bComma = false;
+}
+
+void JsonOpenElement(JsonWriter *pxWriter)
+{
+    if (pxWriter->bComma)
+        JsonPut(pxWriter, ',');
+    JsonPut(pxWriter, '{');
+    pxWriter->bComma = false;
+}
+
+void JsonCloseArray(JsonWriter *pxWriter)
+{
+    JsonPut(pxWriter, ']');
+    pxWriter->bComma = true;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonText: Add a string member.
+ *------------------------------------------------------------------------------------------------*/
+void JsonText(JsonWriter *pxWriter, const char *pchKey, const char *pchText)
+{
+    JsonKey(pxWriter, pchKey);
+    JsonPutString(pxWriter, pchText);
+    pxWriter->bComma = true;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * FormatLong: Format a number as a decimal string, without using the heap or printf.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	long lValue - number to format
+ *  char *pchBuf - buffer of at least cnLongTextLen characters
+ *OUTPUT:
+ *	(const char *) start of the '\0' terminated text, somewhere inside pchBuf.
+ *------------------------------------------------------------------------------------------------*/
+const int cnLongTextLen = 21;   //Enough for a 64-bit long, sign included
+
+const char *FormatLong(long lValue, char *pchBuf)
+{
+    int nPos = cnLongTextLen;
+    unsigned long ulValue = lValue < 0 ? 0UL - (unsigned long)lValue : (unsigned long)lValue;
+
+    /*--- Convert from the right, so no reversing is needed ---*/
+    pchBuf[--nPos] = 0;
+    do {
+        pchBuf[--nPos] = '0' + ulValue % 10;
+        ulValue /= 10;
+    } while (ulValue && nPos > 1);
+    if (lValue < 0)
+        pchBuf[--nPos] = '-';
+
+    return pchBuf + nPos;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * FormatFixed: Format a scaled number with a decimal point, e.g. 1667 with 3 decimals as '1.667'.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	long lValue - number to format, scaled by 10^nDecimals
+ *  int nDecimals - number of decimals (at most cnLongTextLen - 3)
+ *  char *pchBuf - buffer of at least cnLongTextLen + 1 characters
+ *OUTPUT:
+ *	(const char *) start of the '\0' terminated text, somewhere inside pchBuf.
+ *------------------------------------------------------------------------------------------------*/
+const char *FormatFixed(long lValue, int nDecimals, char *pchBuf)
+{
+    int nPos = cnLongTextLen + 1;
+    unsigned long ulValue = lValue < 0 ? 0UL - (unsigned long)lValue : (unsigned long)lValue;
+
+    pchBuf[--nPos] = 0;
+    for (int i = 0; i < nDecimals; i++) {
+        pchBuf[--nPos] = '0' + ulValue % 10;
+        ulValue /= 10;
+    }
+    if (nDecimals > 0)
+        pchBuf[--nPos] = '.';
+    do {
+        pchBuf[--nPos] = '0' + ulValue % 10;
+        ulValue /= 10;
+    } while (ulValue && nPos > 1);
+    if (lValue < 0)
+        pchBuf[--nPos] = '-';
+
+    return pchBuf + nPos;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonNumber: Add a number member, formatted as a (quoted) decimal string.
+ *------------------------------------------------------------------------------------------------*/
+void JsonNumber(JsonWriter *pxWriter, const char *pchKey, long lValue)
+{
+    char achDigits[cnLongTextLen];
+
+    JsonText(pxWriter, pchKey, FormatLong(lValue, achDigits));
+}
+
+/*--- Field sets of the nested objects, an object is only written if one of its fields is ---*/
+const uint32_t cuUseTotal = FieldBit(FIELD_PWR_LOW) | FieldBit(FIELD_PWR_HIGH);
+const uint32_t cuUseActual = FieldBit(FIELD_PWR_ACTUAL) | FieldBit(FIELD_PWR_L1) | FieldBit(FIELD_PWR_L2) | FieldBit(FIELD_PWR_L3);
+const uint32_t cuReturnTotal = FieldBit(FIELD_RET_LOW) | FieldBit(FIELD_RET_HIGH);
+const uint32_t cuReturnActual = FieldBit(FIELD_RET_ACTUAL) | FieldBit(FIELD_RET_L1) | FieldBit(FIELD_RET_L2) | FieldBit(FIELD_RET_L3);
+const uint32_t cuPower = FieldBit(FIELD_PWR_TIMESTAMP) | FieldBit(FIELD_PWR_TARIFF) | cuUseTotal | cuUseActual | cuReturnTotal | cuReturnActual;
+
+/*--- Write a number member only if its field is in the mask ---*/
+static inline void JsonField(JsonWriter *pxWriter, uint32_t uMask, DsmrField nField, const char *pchKey, long lValue)
+{
+    if (uMask & FieldBit(nField))
+        JsonNumber(pxWriter, pchKey, lValue);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonObjects: Write the generic objects received as a "meter" member.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	One member per object, in the order of axObisTable, named after its slot and formatted with
+ *  its scale: "meter":{"id":"E0016021687934515","long_failures":"5","failures":"15",
+ *  "voltage_L1":"230.1","current_L1":"1.00",...}. Objects the meter did not send are left out.
+ *  The entries of the power failure log follow as "failure_events":[{"end":"170520130938S",
+ *  "duration":"5627"},...], end in meter time, duration in seconds. In a delta only the objects
+ *  of the fields in uMask are written (FIELD_VOLTAGE, FIELD_CURRENT, FIELD_OBJECTS for the rest).
+ *INPUT:
+ *	JsonWriter *pxWriter - document being written
+ *  const DsmrObjects *pxObjects - generic objects
+ *  uint32_t uMask - FieldBit() set of the fields to write
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void JsonObjects(JsonWriter *pxWriter, const DsmrObjects *pxObjects, uint32_t uMask)
+{
+    char achName[sizeof(achObisValueName[0])];
+    char achValue[cnLongTextLen + 1];
+
+    JsonOpen(pxWriter, "meter");
+    for (int i = 0; i < cnObisEntries; i++) {
+        const ObisEntry *pxEntry = &axObisTable[i];
+        int nSlot = pxEntry->nSlot;
+
+        if (!ObisIsGeneric(pxEntry->nField) || !(uMask & FieldBit(pxEntry->nField)))
+            continue;
+        if (ObisIsText(pxEntry->nType)) {
+            if (pxObjects->uTexts & (1 << nSlot)) {
+                memcpy_P(achName, achObisTextName[nSlot], sizeof(achName));
+                JsonText(pxWriter, achName, pxObjects->achText[nSlot]);
+            }
+        }
+        else if (pxObjects->uValues & (1 << nSlot)) {
+            memcpy_P(achName, achObisValueName[nSlot], sizeof(achName));
+            JsonText(pxWriter, achName, FormatFixed(pxObjects->alValue[nSlot], pxEntry->nDecimals, achValue));
+        }
+    }
+
+    const FailureLog *pxLog = &pxObjects->xFailures;
+    if (pxLog->nEvents > 0 && (uMask & FieldBit(FIELD_OBJECTS))) {
+        char achTime[cnMeterTimeLen + 1];
+        JsonOpenArray(pxWriter, "failure_events");
+        for (int i = 0; i < pxLog->nEvents; i++) {
+            bool bDst = pxLog->uDst & (1 << i);
+            JsonOpenElement(pxWriter);
+            MeterTimeFormat(pxLog->axEvent[i].uEnd, bDst, achTime);
+            JsonText(pxWriter, "end", achTime);
+            JsonNumber(pxWriter, "duration", (long)pxLog->axEvent[i].uDuration);
+            JsonClose(pxWriter);
+        }
+        JsonCloseArray(pxWriter);
+    }
+    JsonClose(pxWriter);
+}
+
+/*--- Names of the M-Bus device types (EN 13757-3), by type code ---*/
+static const char achMbusDevice[][16] PROGMEM = {
+    "other", "oil", "electricity", "gas", "heat", "steam", "warm_water", "water", "heat_cost", "compressed_air"
+};
+const int cnMbusDevices = sizeof(achMbusDevice) / sizeof(achMbusDevice[0]);
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonMbus: Write the M-Bus devices as an "mbus" array member.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	One element per channel that reported anything: "mbus":[{"channel":"1","type":"3",
+ *  "device":"gas","id":"G0018543","time":"181121090000W","value":"5135.305","unit":"m3"},...],
+ *  the value with 3 decimals in its unit as sent. Members without a value are left out.
+ *INPUT:
+ *	JsonWriter *pxWriter - document being written
+ *  const MbusChannel *pxChannels - the cnMbusChannels channels
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void JsonMbus(JsonWriter *pxWriter, const MbusChannel *pxChannels)
+{
+    char achText[cnLongTextLen + 1];
+
+    JsonOpenArray(pxWriter, "mbus");
+    for (int i = 0; i < cnMbusChannels; i++) {
+        const MbusChannel *pxChannel = &pxChannels[i];
+
+        if (!pxChannel->uFlags)
+            continue;
+        JsonOpenElement(pxWriter);
+        JsonNumber(pxWriter, "channel", i + 1);
+        if (pxChannel->uFlags & MBUS_TYPE) {
+            JsonNumber(pxWriter, "type", pxChannel->nType);
+            if (pxChannel->nType < cnMbusDevices) {
+                memcpy_P(achText, achMbusDevice[pxChannel->nType], sizeof(achMbusDevice[0]));
+                JsonText(pxWriter, "device", achText);
+            }
+        }
+        if (pxChannel->uFlags & MBUS_ID)
+            JsonText(pxWriter, "id", pxChannel->achId);
+        if (pxChannel->uFlags & MBUS_TIME) {
+            MeterTimeFormat(pxChannel->uTime, pxChannel->uFlags & MBUS_DST, achText);
+            JsonText(pxWriter, "time", achText);
+        }
+        if (pxChannel->uFlags & MBUS_VALUE) {
+            JsonText(pxWriter, "value", FormatFixed(pxChannel->lValue, 3, achText));
+            memcpy_P(achText, achObisUnit[pxChannel->nUnit], sizeof(achObisUnit[0]));
+            JsonText(pxWriter, "unit", achText);
+        }
+        JsonClose(pxWriter);
+    }
+    JsonCloseArray(pxWriter);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonReading: Write the meter readings as members of the current object.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Member order and formatting are identical to the ArduinoJson based serializer it replaces.
+ *  With a partial field mask only the selected members (and the objects containing them) are
+ *  written, giving a sparse document with the same structure.
+ *INPUT:
+ *	JsonWriter *pxWriter - document being written
+ *  const DsmrReading *pxReading - meter readings to serialize
+ *  uint32_t uMask - FieldBit() set of the fields to write, cuAllFields for all of them
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void JsonReading(JsonWriter *pxWriter, const DsmrReading *pxReading, uint32_t uMask)
+{
+    JsonField(pxWriter, uMask, FIELD_VERSION, "dsmr", pxReading->lDsmrVersion);
+    if (uMask & cuPower) {
+        JsonOpen(pxWriter, "power");
+        if (uMask & FieldBit(FIELD_PWR_TIMESTAMP))
+            JsonText(pxWriter, "time", pxReading->achPwrTime);                          //Power reading timestamp + Summer/Winter time
+        JsonField(pxWriter, uMask, FIELD_PWR_TARIFF, "tariff", pxReading->lPwrTariff);  //Active power tariff (T1 or T2)
+        /*---  Power consumption entries ---*/
+        if (uMask & (cuUseTotal | cuUseActual)) {
+            JsonOpen(pxWriter, "use");
+            if (uMask & cuUseTotal) {
+                JsonOpen(pxWriter, "total");
+                JsonField(pxWriter, uMask, FIELD_PWR_LOW, "T1", pxReading->lPwrLow);    //Power consumption low tariff
+                JsonField(pxWriter, uMask, FIELD_PWR_HIGH, "T2", pxReading->lPwrHigh);  //Power consumption high tariff
+                JsonClose(pxWriter);
+            }
+            if (uMask & cuUseActual) {
+                JsonOpen(pxWriter, "actual");
+                JsonField(pxWriter, uMask, FIELD_PWR_ACTUAL, "total", pxReading->lPwrActual);   //Power actual consumption
+                JsonField(pxWriter, uMask, FIELD_PWR_L1, "L1", pxReading->lPwrL1);              //Power actual L1 consumption
+                JsonField(pxWriter, uMask, FIELD_PWR_L2, "L2", pxReading->lPwrL2);              //Power actual L2 consumption
+                JsonField(pxWriter, uMask, FIELD_PWR_L3, "L3", pxReading->lPwrL3);              //Power actual L3 consumption
+                JsonClose(pxWriter);
+            }
+            JsonClose(pxWriter);
+        }
+        /*--- Power return entries ---*/
+        if (uMask & (cuReturnTotal | cuReturnActual)) {
+            JsonOpen(pxWriter, "return");
+            if (uMask & cuReturnTotal) {
+                JsonOpen(pxWriter, "total");
+                JsonField(pxWriter, uMask, FIELD_RET_LOW, "T1", pxReading->lReturnLow);     //Power return low tariff (solar panels)
+                JsonField(pxWriter, uMask, FIELD_RET_HIGH, "T2", pxReading->lReturnHigh);   //Power return high tariff (solar panels)
+                JsonClose(pxWriter);
+            }
+            if (uMask & cuReturnActual) {
+                JsonOpen(pxWriter, "actual");
+                JsonField(pxWriter, uMask, FIELD_RET_ACTUAL, "total", pxReading->lReturnActual);    //Power actual return (solar panels)
+                JsonField(pxWriter, uMask, FIELD_RET_L1, "L1", pxReading->lReturnL1);               //Power actual L1 return (solar panels)
+                JsonField(pxWriter, uMask, FIELD_RET_L2, "L2", pxReading->lReturnL2);               //Power actual L2 return (solar panels)
+                JsonField(pxWriter, uMask, FIELD_RET_L3, "L3", pxReading->lReturnL3);               //Power actual L3 return (solar panels)
+                JsonClose(pxWriter);
+            }
+            JsonClose(pxWriter);
+        }
+        JsonClose(pxWriter);
+    }
+    /*--- Gas meter entries ---*/
+    if (uMask & FieldBit(FIELD_GAS_METER)) {
+        JsonOpen(pxWriter, "gas");
+        JsonText(pxWriter, "time", pxReading->achGasTime);                      //Gas reading timestamp + Summer/Winter time
+        JsonNumber(pxWriter, "total", pxReading->lGasMeter);                    //Gas meter reading (~hourly updated)
+        JsonClose(pxWriter);
+    }
+    /*--- M-Bus devices ---*/
+    if (uMask & FieldBit(FIELD_MBUS)) {
+        bool bMbus = false;
+        for (int i = 0; i < cnMbusChannels; i++)
+            bMbus = bMbus || pxReading->axMbus[i].uFlags;
+        if (bMbus)
+            JsonMbus(pxWriter, pxReading->axMbus);
+    }
+    /*--- All other objects the meter sent ---*/
+    if ((uMask & cuObjectFields) && (pxReading->xObjects.uValues || pxReading->xObjects.uTexts ||
+                                     pxReading->xObjects.xFailures.nEvents))
+        JsonObjects(pxWriter, &pxReading->xObjects, uMask);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DsmrToJson: Serialize the meter readings to the MQTT JSON document.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	const DsmrReading *pxReading - meter readings to serialize
+ *  uint32_t uMask - FieldBit() set of the fields to write, cuAllFields for the complete document
+ *  char *pchBuf - output buffer
+ *  int nSize - size of the output buffer
+ *OUTPUT:
+ *	(int) length of the document (excluding the terminating '\0'), -1 if it did not fit.
+ *------------------------------------------------------------------------------------------------*/
+int DsmrToJson(const DsmrReading *pxReading, uint32_t uMask, char *pchBuf, int nSize)
+{
+    JsonWriter xWriter;
+
+    JsonBegin(&xWriter, pchBuf, nSize);
+    JsonReading(&xWriter, pxReading, uMask);
+    return JsonEnd(&xWriter);
+}
+#endif
@@ -0,0 +1,646 @@
+#ifndef DSMRREADING_H
+#define DSMRREADING_H
+
+#include "Platform.h"
+#include <limits.h>
+#include "P1Parser.h"
+#include "FixedPoint.h"
+#include "MeterTime.h"
+
+/*==================================================================================================*
+ * Meter readings and the decoding of telegram lines into them.
+ *
+ * All power readings are in Wh (or W for actual values), the gas reading is in dm3 (1/1000 m3).
+ * The M-Bus devices are kept in a fixed slot per channel (MbusChannel), all other objects in the
+ * OBIS table (OBIS.h) in the generic slots of DsmrObjects.
+ *==================================================================================================*/
+
+const int cnFailureLogLen = 10;     //Entries of the power failure log kept (the most DSMR allows)
+
+/*--- A long power failure, from the power failure event log (1-0:99.97.0) ---*/
+struct FailureEvent
+{
+    uint32_t uEnd;              //End of the failure, meter time in seconds since 2000 (MeterTime.h)
+    uint32_t uDuration;         //Duration of the failure (s)
+};
+
+/*--- Power failure event log ---*/
+struct FailureLog
+{
+    uint8_t nCount;             //Entries the meter reported
+    uint8_t nEvents;            //Entries decoded into axEvent
+    uint16_t uDst;              //Bit n set: axEvent[n].uEnd is summer time
+    FailureEvent axEvent[cnFailureLogLen];
+    uint32_t uPendingEnd;       //Time the entry being decoded ended, kept until its duration decodes
+    bool bPending;              //uPendingEnd is valid
+    bool bPendingDst;           //uPendingEnd is summer time
+};
+
+/*--- Generic objects, scaled as given in axObisTable ---*/
+struct DsmrObjects
+{
+    uint16_t uValues;           //Value slots received (bit n for alValue[n])
+    uint16_t uTexts;            //Text slots received (bit n for achText[n])
+    int32_t alValue[cnObisValues];
+    char achText[cnObisTexts][cnObisTextLen];
+    FailureLog xFailures;       //Entries of the OBIS_LOG object
+};
+
+/*--- M-Bus device on a channel (0-n:24.1.0 type, 0-n:96.1.0 id, 0-n:24.2.1 reading) ---*/
+#define MBUS_TYPE 0x01              //nType was reported
+#define MBUS_ID 0x02                //achId was reported
+#define MBUS_VALUE 0x04             //lValue/nUnit were reported
+#define MBUS_TIME 0x08              //uTime is valid
+#define MBUS_DST 0x10               //uTime is summer time
+
+const uint8_t cuMbusGas = 3;        //Device type of a gas meter
+
+struct MbusChannel
+{
+    uint8_t nType;              //Device type, e.g. 3 gas, 7 water (EN 13757-3)
+    uint8_t uFlags;             //MBUS_* bits
+    ObisUnit nUnit;             //Unit of lValue
+    uint8_t uReserved;          //Keeps the struct free of padding (compared with memcmp)
+    int32_t lValue;             //Last reading, 3 decimals (e.g. dm3 for m3)
+    uint32_t uTime;             //Time of the reading, meter time in seconds since 2000 (MeterTime.h)
+    char achId[cnObisTextLen];  //Equipment identifier
+};
+
+struct DsmrReading
+{
+    long lDsmrVersion;          //DSMR telegram version number
+    char achPwrTime[16];        //Timestamp of power reading
+    long lPwrLow;               //Power consumption low tariff
+    long lPwrHigh;              //Power consumption high tariff
+    long lPwrActual;            //Power actual consumption
+    long lPwrL1;                //Power actual L1 consumption
+    long lPwrL2;                //Power actual L2 consumption
+    long lPwrL3;                //Power actual L3 consumption
+    long lReturnLow;            //Power return low tariff (solar panels)
+    long lReturnHigh;           //Power return high tariff (solar panels)
+    long lReturnActual;         //Power actual return (solar panels)
+    long lReturnL1;             //Power actual L1 return
+    long lReturnL2;             //Power actual L2 return
+    long lReturnL3;             //Power actual L3 return
+    long lPwrTariff;            //Active power tariff (T1 or T2)
+    char achGasTime[16];        //Timestamp of gas reading
+    long lGasMeter;             //Gas meter reading (~hourly updated)
+    MbusChannel axMbus[cnMbusChannels]; //M-Bus devices on channel 1-4
+    DsmrObjects xObjects;       //All other objects
+};
+
+/*--- Sets of fields, one bit per DsmrField (FIELD_GAS_METER covers both gas time and value,
+      FIELD_VOLTAGE and FIELD_CURRENT those objects on all phases, FIELD_OBJECTS all other generic
+      objects, FIELD_MBUS all M-Bus channels) ---*/
+constexpr uint32_t FieldBit(DsmrField nField)
+{
+    return 1UL << nField;
+}
+const uint32_t cuAllFields = FieldBit(FIELD_CURRENT) * 2 - FieldBit(FIELD_VERSION);
+const uint32_t cuObjectFields = FieldBit(FIELD_OBJECTS) | FieldBit(FIELD_VOLTAGE) | FieldBit(FIELD_CURRENT);
+
+/*--- Double buffered readings: telegram lines are decoded into the staging copy, which only
+      becomes the published copy when the telegram CRC16 checks out ---*/
+struct DsmrSnapshot
+{
+    DsmrReading axReading[2];
+    uint8_t nPublished;         //Index of the published copy, the other one is staging
+};
+
+/*------------------------------------------------------------------------------------------------*
+ * GetValue: Get usage value from a value group
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Retreive the number from the passed value group as an integer, keeping the given number of
+ *  decimals (3 for usage values in the DSMR standard telegram, to get Wh and dm3).
+ *  Value groups are passed without their brackets, like '0123.456*kWh' or '0002'.
+ *INPUT:
+ *	const char *pchGroup - value group
+ *  int nGroupLen - length of the value group
+ *  int nDecimals - number of decimals to keep (value is multiplied by 10^nDecimals)
+ *OUTPUT:
+ *	(long) value retreived from the value group or 0 if no valid number found
+ *------------------------------------------------------------------------------------------------*/
+long GetValue(const char *pchGroup, int nGroupLen, int nDecimals = 3)
+{
+    int64_t llValue;
+
+    if (!DecodeFixed(pchGroup, nGroupLen, nDecimals, &llValue) || llValue > LONG_MAX)
+        return 0;
+    return (long)llValue;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * GetText: Get a text parameter from a value group
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Copy the text of the passed value group, like '180924132132S', to the output buffer.
+ *INPUT:
+ *	const char *pchGroup - value group, terminated by '\0'
+ *  int nGroupLen - length of the value group
+ *  char *pchText - output buffer
+ *  int nMaxLen - size of the output buffer (including the terminating '\0')
+ *OUTPUT:
+ *	(int) length of the text, 0 if no text found and pchText is empty string.
+ *------------------------------------------------------------------------------------------------*/
+int GetText(const char *pchGroup, int nGroupLen, char *pchText, int nMaxLen)
+{
+    pchText[0] = 0;
+
+    if (nGroupLen < 1 || nGroupLen >= nMaxLen) //Do some sanity checks
+        return 0;
+
+    /*--- Copy the text to the output buffer and terminate it with '\0x00' ---*/
+    memcpy(pchText, pchGroup, nGroupLen);
+    pchText[nGroupLen] = 0;
+
+    return nGroupLen;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * GetHexText: Get the text of a hex encoded octet string, like '4530303136' for "E0016".
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Characters that can't be shown are replaced by '?'. A value group that is not hex encoded is
+ *  copied as it is.
+ *INPUT:
+ *	const char *pchGroup - value group
+ *  int nGroupLen - length of the value group
+ *  char *pchText - output buffer
+ *  int nMaxLen - size of the output buffer (including the terminating '\0')
+ *OUTPUT:
+ *	(int) length of the text, 0 if empty or it does not fit (pchText is then an empty string).
+ *------------------------------------------------------------------------------------------------*/
+int GetHexText(const char *pchGroup, int nGroupLen, char *pchText, int nMaxLen)
+{
+    pchText[0] = 0;
+
+    if (nGroupLen % 2 != 0)
+        return GetText(pchGroup, nGroupLen, pchText, nMaxLen);
+    if (nGroupLen / 2 >= nMaxLen)
+        return 0;
+    for (int i = 0; i < nGroupLen; i += 2) {
+        int nHigh = P1HexValue(pchGroup[i]);
+        int nLow = P1HexValue(pchGroup[i + 1]);
+        if (nHigh < 0 || nLow < 0)
+            return GetText(pchGroup, nGroupLen, pchText, nMaxLen);
+        char ch = (char)(nHigh << 4 | nLow);
+        pchText[i / 2] = (ch >= ' ' && ch < 0x7F) ? ch : '?';
+    }
+    pchText[nGroupLen / 2] = 0;
+    return nGroupLen / 2;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DecodeGeneric: Decode a telegram line of a generic object into its slot.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Driven by the object's entry in axObisTable: numbers are scaled to integers (and must have
+ *  the expected unit), octet strings are decoded from hex, and a log keeps its number of entries.
+ *INPUT:
+ *	DsmrObjects *pxObjects - generic objects to update
+ *  const P1Parser *pxParser - parser holding the object and value groups of the line
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void DecodeGeneric(DsmrObjects *pxObjects, const P1Parser *pxParser)
+{
+    const ObisEntry *pxEntry = &axObisTable[pxParser->nObject];
+    int64_t llValue;
+
+    switch (pxEntry->nType) {
+    // Example: 1-0:32.7.0(230.1*V)
+    case OBIS_NUMBER:
+        if (!ObisUnitMatch(pxParser->achLast, pxParser->nLastLen, pxEntry->nUnit) ||
+            !DecodeFixed(pxParser->achLast, pxParser->nLastLen, pxEntry->nDecimals, &llValue) || llValue > INT32_MAX)
+            return;
+        pxObjects->alValue[pxEntry->nSlot] = (int32_t)llValue;
+        pxObjects->uValues |= 1 << pxEntry->nSlot;
+        break;
+
+    // Example: 1-0:99.97.0(2)(0-0:96.7.19)(101208152415W)(0000000240*s)(101208151004W)(0000000301*s)
+    case OBIS_LOG:
+        if (!DecodeFixed(pxParser->achFirst, pxParser->nFirstLen, 0, &llValue) || llValue > INT32_MAX)
+            return;
+        pxObjects->alValue[pxEntry->nSlot] = (int32_t)llValue;
+        pxObjects->uValues |= 1 << pxEntry->nSlot;
+        break;
+
+    // Example: 0-0:96.1.1(4B384547303034303436333935353037)
+    case OBIS_TEXT:
+        (void)GetHexText(pxParser->achLast, pxParser->nLastLen, pxObjects->achText[pxEntry->nSlot], cnObisTextLen);
+        pxObjects->uTexts |= 1 << pxEntry->nSlot;
+        break;
+
+    case OBIS_TIME:
+        (void)GetText(pxParser->achLast, pxParser->nLastLen, pxObjects->achText[pxEntry->nSlot], cnObisTextLen);
+        pxObjects->uTexts |= 1 << pxEntry->nSlot;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DecodeMbus: Decode a telegram line of an M-Bus device into the slot of its channel.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The channel is B of the OBIS reference (0-2:24.2.1 is channel 2). The device type discovers
+ *  what is on the channel; the reading keeps its unit as sent, so water (m3) and heat (GJ) are
+ *  decoded the same way as gas. The reading of the gas meter (type 3, or channel 1 as long as its
+ *  type is unknown) is also stored as the gas reading, for the existing payloads.
+ *INPUT:
+ *	DsmrReading *pxReading - meter readings to update
+ *  const P1Parser *pxParser - parser holding the object and value groups of the line
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void DecodeMbus(DsmrReading *pxReading, const P1Parser *pxParser)
+{
+    const ObisEntry *pxEntry = &axObisTable[pxParser->nObject];
+    int nChannel = (pxEntry->uKey >> 24) & 0x0F;
+    int64_t llValue;
+    bool bDst;
+
+    if (nChannel < 1 || nChannel > cnMbusChannels)
+        return;
+    MbusChannel *pxChannel = &pxReading->axMbus[nChannel - 1];
+
+    switch (pxEntry->nType) {
+    // Example: 0-1:24.1.0(003)
+    case OBIS_NUMBER:
+        if (!DecodeFixed(pxParser->achLast, pxParser->nLastLen, 0, &llValue) || llValue > UINT8_MAX)
+            return;
+        pxChannel->nType = (uint8_t)llValue;
+        pxChannel->uFlags |= MBUS_TYPE;
+        break;
+
+    // Example: 0-1:96.1.0(4730303339303031363532303530323136)
+    case OBIS_TEXT:
+        (void)GetHexText(pxParser->achLast, pxParser->nLastLen, pxChannel->achId, cnObisTextLen);
+        pxChannel->uFlags |= MBUS_ID;
+        break;
+
+    // Example: 0-1:24.2.1(150531200000S)(00811.923*m3)
+    case OBIS_READING:
+        if (!DecodeFixed(pxParser->achLast, pxParser->nLastLen, pxEntry->nDecimals, &llValue) ||
+            llValue > INT32_MAX || llValue < INT32_MIN)
+            return;
+        pxChannel->lValue = (int32_t)llValue;
+        pxChannel->nUnit = ObisUnitOf(pxParser->achLast, pxParser->nLastLen);
+        pxChannel->uFlags &= ~(MBUS_TIME | MBUS_DST);
+        if (MeterTimeParse(pxParser->achFirst, &pxChannel->uTime, &bDst))
+            pxChannel->uFlags |= MBUS_TIME | (bDst ? MBUS_DST : 0);
+        pxChannel->uFlags |= MBUS_VALUE;
+
+        if (pxChannel->nType == cuMbusGas || (!(pxChannel->uFlags & MBUS_TYPE) && nChannel == 1)) {
+            pxReading->lGasMeter = pxChannel->lValue;
+            (void)GetText(pxParser->achFirst, pxParser->nFirstLen, pxReading->achGasTime, sizeof(pxReading->achGasTime));
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DecodeGroup: Decode a value group of a log line.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The power failure event log is decoded group by group as the parser reports them, so the
+ *  line (over 200 characters with 10 entries) is never stored:
+ *      1-0:99.97.0(2)(0-0:96.7.19)(101208152415W)(0000000240*s)(101208151004W)(0000000301*s)
+ *  group 0 is the number of entries, group 1 the reference of the entries, then every entry is a
+ *  pair of groups: the time the failure ended and its duration. The end time is held in
+ *  uPendingEnd until the duration decodes, so an entry that doesn't decode leaves nothing behind in
+ *  axEvent; such entries are skipped, as are entries beyond cnFailureLogLen.
+ *INPUT:
+ *	DsmrReading *pxReading - meter readings to update
+ *  const P1Parser *pxParser - parser that reported P1_EVENT_GROUP
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void DecodeGroup(DsmrReading *pxReading, const P1Parser *pxParser)
+{
+    FailureLog *pxLog = &pxReading->xObjects.xFailures;
+    P1Group xGroup = P1CurrentGroup(pxParser);
+    int64_t llValue;
+    uint32_t uEnd;
+    bool bDst;
+
+    if (xGroup.nIndex == 0) {
+        memset(pxLog, 0, sizeof(*pxLog)); //A new log replaces the previous one
+        if (xGroup.nKind == P1_GROUP_NUMBER && DecodeFixed(xGroup.pchText, xGroup.nLen, 0, &llValue))
+            pxLog->nCount = llValue > UINT8_MAX ? UINT8_MAX : (uint8_t)llValue;
+        return;
+    }
+    if (xGroup.nIndex < 2 || pxLog->nEvents >= cnFailureLogLen || pxLog->nEvents >= pxLog->nCount)
+        return;
+
+    if (xGroup.nIndex % 2 == 0) {
+        // Time the failure ended, e.g. 101208152415W
+        pxLog->bPending = xGroup.nKind == P1_GROUP_TIME && MeterTimeParse(xGroup.pchText, &uEnd, &bDst);
+        pxLog->uPendingEnd = pxLog->bPending ? uEnd : 0;
+        pxLog->bPendingDst = pxLog->bPending && bDst;
+    }
+    else if (pxLog->bPending) {
+        // Duration of the failure, e.g. 0000000240*s
+        pxLog->bPending = false;
+        if (xGroup.nKind == P1_GROUP_NUMBER && ObisUnitMatch(xGroup.pchText, xGroup.nLen, UNIT_S) &&
+            DecodeFixed(xGroup.pchText, xGroup.nLen, 0, &llValue) && llValue <= UINT32_MAX) {
+            FailureEvent *pxEvent = &pxLog->axEvent[pxLog->nEvents];
+            pxEvent->uEnd = pxLog->uPendingEnd;
+            pxEvent->uDuration = (uint32_t)llValue;
+            if (pxLog->bPendingDst)
+                pxLog->uDst |= 1 << pxLog->nEvents;
+            pxLog->nEvents++;
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DecodeObject: Decode a completed telegram line.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Extract the meter value from the value group(s) of a line the parser recognized.
+ *INPUT:
+ *	DsmrReading *pxReading - meter readings to update
+ *  const P1Parser *pxParser - parser holding the field and value groups of the line
+ *OUTPUT:
+ *	None. The meter value is stored in its member of pxReading.
+ *------------------------------------------------------------------------------------------------*/
+void DecodeObject(DsmrReading *pxReading, const P1Parser *pxParser)
+{
+    const char *pchValue = pxParser->achLast;
+    int nLen = pxParser->nLastLen;
+
+    switch (pxParser->nField) {
+    // DSMR version
+    // Example: 1-3:0.2.8(42)
+    case FIELD_VERSION:
+        pxReading->lDsmrVersion = GetValue(pchValue, nLen, 0);
+        break;
+
+    // Power reading timestamp (DSMR v4.0)
+    // Example: 0-0:1.0.0(180924132132S)
+    case FIELD_PWR_TIMESTAMP:
+        (void)GetText(pchValue, nLen, pxReading->achPwrTime, sizeof(pxReading->achPwrTime));
+        break;
+
+    // Power consumption low tariff (DSMR v4.0)
+    // Example: 1-0:1.8.1(000992.992*kWh)
+    case FIELD_PWR_LOW:
+        pxReading->lPwrLow = GetValue(pchValue, nLen);
+        break;
+
+    // Power consumption high tariff (DSMR v4.0)
+    // Example: 1-0:1.8.2(000560.157*kWh)
+    case FIELD_PWR_HIGH:
+        pxReading->lPwrHigh = GetValue(pchValue, nLen);
+        break;
+
+    // Power return low tariff (DSMR v4.0)
+    // Example: 1-0:2.8.1(000348.890*kWh)
+    case FIELD_RET_LOW:
+        pxReading->lReturnLow = GetValue(pchValue, nLen);
+        break;
+
+    // Power return high tariff (DSMR v4.0)
+    // Example: 1-0:2.8.2(000859.885*kWh)
+    case FIELD_RET_HIGH:
+        pxReading->lReturnHigh = GetValue(pchValue, nLen);
+        break;
+
+    // Power consumption actual total (DSMR v4.0)
+    // Example: 1-0:1.7.0(00.424*kW)
+    case FIELD_PWR_ACTUAL:
+        pxReading->lPwrActual = GetValue(pchValue, nLen);
+        break;
+
+    // Power consumption actual L1 (DSMR v4.0)
+    // Example: 1-0:21.7.0(00.086*kW)
+    case FIELD_PWR_L1:
+        pxReading->lPwrL1 = GetValue(pchValue, nLen);
+        break;
+
+    // Power consumption actual L2 (DSMR v4.0)
+    // Example: 1-0:41.7.0(00.086*kW)
+    case FIELD_PWR_L2:
+        pxReading->lPwrL2 = GetValue(pchValue, nLen);
+        break;
+
+    // Power consumption actual L3 (DSMR v4.0)
+    // Example: 1-0:61.7.0(00.086*kW)
+    case FIELD_PWR_L3:
+        pxReading->lPwrL3 = GetValue(pchValue, nLen);
+        break;
+
+    // Power return actual total (DSMR v4.0)
+    // Example: 1-0:2.7.0(00.000*kW)
+    case FIELD_RET_ACTUAL:
+        pxReading->lReturnActual = GetValue(pchValue, nLen);
+        break;
+
+    // Power return actual L1 (DSMR v4.0)
+    // Example: 1-0:22.7.0(00.086*kW)
+    case FIELD_RET_L1:
+        pxReading->lReturnL1 = GetValue(pchValue, nLen);
+        break;
+
+    // Power return actual L2 (DSMR v4.0)
+    // Example: 1-0:42.7.0(00.086*kW)
+    case FIELD_RET_L2:
+        pxReading->lReturnL2 = GetValue(pchValue, nLen);
+        break;
+
+    // Power return actual L3 (DSMR v4.0)
+    // Example: 1-0:62.7.0(00.086*kW)
+    case FIELD_RET_L3:
+        pxReading->lReturnL3 = GetValue(pchValue, nLen);
+        break;
+
+    // Power current tariff (DSMR v4.0)
+    // Example: 0-0:96.14.0(0002)
+    case FIELD_PWR_TARIFF:
+        pxReading->lPwrTariff = GetValue(pchValue, nLen, 0);
+        break;
+
+    // M-Bus devices (gas, water, heat, ...) on channel 1-4, the gas reading included
+    // Example: 0-1:24.2.1(150531200000S)(00811.923*m3)
+    case FIELD_MBUS:
+        DecodeMbus(pxReading, pxParser);
+        break;
+
+    // All other objects we know, see axObisTable
+    case FIELD_OBJECTS:
+    case FIELD_VOLTAGE:
+    case FIELD_CURRENT:
+        DecodeGeneric(&pxReading->xObjects, pxParser);
+        break;
+
+    default:
+        break;
+    }
+}
+/*------------------------------------------------------------------------------------------------*
+ * SnapshotBegin: Start decoding a new telegram.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Initialize the staging copy from the published readings, so values missing from the new
+ *  telegram keep their last verified value.
+ *INPUT:
+ *	DsmrSnapshot *pxSnapshot - double buffered readings
+ *OUTPUT:
+ *	(DsmrReading *) the staging copy to decode the telegram lines into.
+ *------------------------------------------------------------------------------------------------*/
+DsmrReading *SnapshotBegin(DsmrSnapshot *pxSnapshot)
+{
+    DsmrReading *pxStaging = &pxSnapshot->axReading[pxSnapshot->nPublished ^ 1];
+    *pxStaging = pxSnapshot->axReading[pxSnapshot->nPublished];
+    return pxStaging;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * SnapshotStaging: Get the copy telegram lines are decoded into.
+ *------------------------------------------------------------------------------------------------*/
+DsmrReading *SnapshotStaging(DsmrSnapshot *pxSnapshot)
+{
+    return &pxSnapshot->axReading[pxSnapshot->nPublished ^ 1];
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * SnapshotCommit: Make the staging copy the published readings (telegram CRC16 verified).
+ *------------------------------------------------------------------------------------------------*/
+void SnapshotCommit(DsmrSnapshot *pxSnapshot)
+{
+    pxSnapshot->nPublished ^= 1;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * SnapshotPublished: Get the readings of the last telegram with a valid CRC16.
+ *------------------------------------------------------------------------------------------------*/
+const DsmrReading *SnapshotPublished(const DsmrSnapshot *pxSnapshot)
+{
+    return &pxSnapshot->axReading[pxSnapshot->nPublished];
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * SnapshotFeed: Feed a P1 byte to the parser and decode what it completes.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	A new telegram starts a staging copy, completed lines and log groups are decoded into it, and
+ *  a valid CRC16 commits it. The same path is used on the device and by the replay tool.
+ *INPUT:
+ *	DsmrSnapshot *pxSnapshot - double buffered readings
+ *  P1Parser *pxParser - telegram parser
+ *  char ch - byte received on the P1 port
+ *OUTPUT:
+ *	(P1Event) what the byte completed; after P1_EVENT_TELEGRAM_OK the new readings are published.
+ *------------------------------------------------------------------------------------------------*/
+P1Event SnapshotFeed(DsmrSnapshot *pxSnapshot, P1Parser *pxParser, char ch)
+{
+    P1Event nEvent = P1ParserFeed(pxParser, ch);
+
+    switch (nEvent) {
+    case P1_EVENT_TELEGRAM_START:
+        (void)SnapshotBegin(pxSnapshot);
+        break;
+    case P1_EVENT_GROUP:
+        DecodeGroup(SnapshotStaging(pxSnapshot), pxParser); //Decode a value of a log line (failure log)
+        break;
+    case P1_EVENT_OBJECT:
+        DecodeObject(SnapshotStaging(pxSnapshot), pxParser); //Decode the value(s) on this telegram line
+        break;
+    case P1_EVENT_TELEGRAM_OK:
+        SnapshotCommit(pxSnapshot);
+        break;
+    default:
+        break;
+    }
+    return nEvent;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * FailureLogChanged: Compare the decoded entries of two power failure logs.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Only what is published counts: the number of entries and the first nEvents entries. The
+ *  pending end time of an entry that didn't decode is left out.
+ *INPUT:
+ *	const FailureLog *pxOld - previous log
+ *  const FailureLog *pxNew - current log
+ *OUTPUT:
+ *	(bool) true if the logs differ.
+ *------------------------------------------------------------------------------------------------*/
+bool FailureLogChanged(const FailureLog *pxOld, const FailureLog *pxNew)
+{
+    uint16_t uUsed = (uint16_t)((1 << pxNew->nEvents) - 1);
+
+    return pxOld->nCount != pxNew->nCount || pxOld->nEvents != pxNew->nEvents ||
+           ((pxOld->uDst ^ pxNew->uDst) & uUsed) ||
+           memcmp(pxOld->axEvent, pxNew->axEvent, pxNew->nEvents * sizeof(FailureEvent));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * DsmrChanged: Find the fields that differ between two sets of readings.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The generic objects are compared slot by slot, each setting the field of its entry in
+ *  axObisTable: a new voltage or current only sets FIELD_VOLTAGE or FIELD_CURRENT, the other
+ *  objects (and the power failure log) set FIELD_OBJECTS.
+ *INPUT:
+ *	const DsmrReading *pxOld - previous readings
+ *  const DsmrReading *pxNew - current readings
+ *OUTPUT:
+ *	(uint32_t) FieldBit() set of the fields with a different value, 0 if nothing changed.
+ *------------------------------------------------------------------------------------------------*/
+uint32_t DsmrChanged(const DsmrReading *pxOld, const DsmrReading *pxNew)
+{
+    uint32_t uMask = 0;
+
+    if (pxOld->lDsmrVersion != pxNew->lDsmrVersion) uMask |= FieldBit(FIELD_VERSION);
+    if (strcmp(pxOld->achPwrTime, pxNew->achPwrTime)) uMask |= FieldBit(FIELD_PWR_TIMESTAMP);
+    if (pxOld->lPwrLow != pxNew->lPwrLow) uMask |= FieldBit(FIELD_PWR_LOW);
+    if (pxOld->lPwrHigh != pxNew->lPwrHigh) uMask |= FieldBit(FIELD_PWR_HIGH);
+    if (pxOld->lReturnLow != pxNew->lReturnLow) uMask |= FieldBit(FIELD_RET_LOW);
+    if (pxOld->lReturnHigh != pxNew->lReturnHigh) uMask |= FieldBit(FIELD_RET_HIGH);
+    if (pxOld->lPwrActual != pxNew->lPwrActual) uMask |= FieldBit(FIELD_PWR_ACTUAL);
+    if (pxOld->lPwrL1 != pxNew->lPwrL1) uMask |= FieldBit(FIELD_PWR_L1);
+    if (pxOld->lPwrL2 != pxNew->lPwrL2) uMask |= FieldBit(FIELD_PWR_L2);
+    if (pxOld->lPwrL3 != pxNew->lPwrL3) uMask |= FieldBit(FIELD_PWR_L3);
+    if (pxOld->lReturnActual != pxNew->lReturnActual) uMask |= FieldBit(FIELD_RET_ACTUAL);
+    if (pxOld->lReturnL1 != pxNew->lReturnL1) uMask |= FieldBit(FIELD_RET_L1);
+    if (pxOld->lReturnL2 != pxNew->lReturnL2) uMask |= FieldBit(FIELD_RET_L2);
+    if (pxOld->lReturnL3 != pxNew->lReturnL3) uMask |= FieldBit(FIELD_RET_L3);
+    if (pxOld->lPwrTariff != pxNew->lPwrTariff) uMask |= FieldBit(FIELD_PWR_TARIFF);
+    if (pxOld->lGasMeter != pxNew->lGasMeter || strcmp(pxOld->achGasTime, pxNew->achGasTime))
+        uMask |= FieldBit(FIELD_GAS_METER);
+    if (memcmp(pxOld->axMbus, pxNew->axMbus, sizeof(pxNew->axMbus)))
+        uMask |= FieldBit(FIELD_MBUS);
+
+    const DsmrObjects *pxOldObjects = &pxOld->xObjects;
+    const DsmrObjects *pxNewObjects = &pxNew->xObjects;
+    for (int i = 0; i < cnObisEntries; i++) {
+        const ObisEntry *pxEntry = &axObisTable[i];
+        int nSlot = pxEntry->nSlot;
+        bool bChanged;
+
+        if (!ObisIsGeneric(pxEntry->nField) || (uMask & FieldBit(pxEntry->nField)))
+            continue;
+        if (ObisIsText(pxEntry->nType))
+            bChanged = ((pxOldObjects->uTexts ^ pxNewObjects->uTexts) & (1 << nSlot)) ||
+                       strcmp(pxOldObjects->achText[nSlot], pxNewObjects->achText[nSlot]);
+        else
+            bChanged = ((pxOldObjects->uValues ^ pxNewObjects->uValues) & (1 << nSlot)) ||
+                       pxOldObjects->alValue[nSlot] != pxNewObjects->alValue[nSlot];
+        if (bChanged)
+            uMask |= FieldBit(pxEntry->nField);
+    }
+    if (FailureLogChanged(&pxOldObjects->xFailures, &pxNewObjects->xFailures))
+        uMask |= FieldBit(FIELD_OBJECTS);
+
+    return uMask;
+}
+#endif
@@ -0,0 +1,106 @@
+#ifndef DSMRTOPICS_H
+#define DSMRTOPICS_H
+
+#include "Platform.h"
+#include <stddef.h>
+#include "DsmrReading.h"
+#include "DsmrJson.h"
+
+/*==================================================================================================*
+ * Per-field MQTT topics.
+ *
+ * Every value of the JSON document can also be published as a plain value on its own topic, named
+ * after its place in the document, e.g. 'sensor/dsmr/power/use/actual/L1'. Only the topic suffixes
+ * are stored, in flash; MqttBatchAdd() puts the base topic and the suffix together while it
+ * encodes the message, so the topic names take no RAM.
+ *==================================================================================================*/
+
+const int cnTopicSuffixLen = 26;    //Longest suffix, including its '\0'
+
+/*--- Topic suffixes, in the order of axDsmrLeaves ---*/
+static const char aachTopicSuffix[][cnTopicSuffixLen] PROGMEM = {
+    "dsmr",
+    "power/time",
+    "power/tariff",
+    "power/use/total/T1",
+    "power/use/total/T2",
+    "power/use/actual/total",
+    "power/use/actual/L1",
+    "power/use/actual/L2",
+    "power/use/actual/L3",
+    "power/return/total/T1",
+    "power/return/total/T2",
+    "power/return/actual/total",
+    "power/return/actual/L1",
+    "power/return/actual/L2",
+    "power/return/actual/L3",
+    "gas/time",
+    "gas/total"
+};
+
+/*--- Values of the JSON document (leaves): field they belong to and where to find them ---*/
+struct DsmrLeaf
+{
+    uint16_t nOffset;           //Offset of the value in DsmrReading
+    uint8_t nField;             //DsmrField of the value
+    uint8_t bText;              //Value is a char array instead of a long
+};
+
+static const DsmrLeaf axDsmrLeaves[] PROGMEM = {
+    { offsetof(DsmrReading, lDsmrVersion), FIELD_VERSION, false },
+    { offsetof(DsmrReading, achPwrTime), FIELD_PWR_TIMESTAMP, true },
+    { offsetof(DsmrReading, lPwrTariff), FIELD_PWR_TARIFF, false },
+    { offsetof(DsmrReading, lPwrLow), FIELD_PWR_LOW, false },
+    { offsetof(DsmrReading, lPwrHigh), FIELD_PWR_HIGH, false },
+    { offsetof(DsmrReading, lPwrActual), FIELD_PWR_ACTUAL, false },
+    { offsetof(DsmrReading, lPwrL1), FIELD_PWR_L1, false },
+    { offsetof(DsmrReading, lPwrL2), FIELD_PWR_L2, false },
+    { offsetof(DsmrReading, lPwrL3), FIELD_PWR_L3, false },
+    { offsetof(DsmrReading, lReturnLow), FIELD_RET_LOW, false },
+    { offsetof(DsmrReading, lReturnHigh), FIELD_RET_HIGH, false },
+    { offsetof(DsmrReading, lReturnActual), FIELD_RET_ACTUAL, false },
+    { offsetof(DsmrReading, lReturnL1), FIELD_RET_L1, false },
+    { offsetof(DsmrReading, lReturnL2), FIELD_RET_L2, false },
+    { offsetof(DsmrReading, lReturnL3), FIELD_RET_L3, false },
+    { offsetof(DsmrReading, achGasTime), FIELD_GAS_METER, true },
+    { offsetof(DsmrReading, lGasMeter), FIELD_GAS_METER, false }
+};
+
+const int cnDsmrLeaves = sizeof(axDsmrLeaves) / sizeof(axDsmrLeaves[0]);
+static_assert(sizeof(aachTopicSuffix) / sizeof(aachTopicSuffix[0]) == cnDsmrLeaves, "A topic suffix for every leaf");
+
+/*------------------------------------------------------------------------------------------------*
+ * LeafTopic: Topic suffix of a leaf (in flash), e.g. 'power/use/actual/L1'.
+ *------------------------------------------------------------------------------------------------*/
+const char *LeafTopic(int nLeaf)
+{
+    return aachTopicSuffix[nLeaf];
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * LeafField: FieldBit() of the field a leaf belongs to.
+ *------------------------------------------------------------------------------------------------*/
+uint32_t LeafField(int nLeaf)
+{
+    return FieldBit((DsmrField)pgm_read_byte(&axDsmrLeaves[nLeaf].nField));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * LeafText: Get the value of a leaf as text.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	const DsmrReading *pxReading - meter readings
+ *  int nLeaf - index in axDsmrLeaves
+ *  char *pchBuf - buffer of cnLongTextLen characters, used for numbers
+ *OUTPUT:
+ *	(const char *) the '\0' terminated value.
+ *------------------------------------------------------------------------------------------------*/
+const char *LeafText(const DsmrReading *pxReading, int nLeaf, char *pchBuf)
+{
+    const char *pchValue = (const char *)pxReading + pgm_read_word(&axDsmrLeaves[nLeaf].nOffset);
+
+    if (pgm_read_byte(&axDsmrLeaves[nLeaf].bText))
+        return pchValue;
+    return FormatLong(*(const long *)pchValue, pchBuf);
+}
+#endif
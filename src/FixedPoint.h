@@ -0,0 +1,74 @@
+#ifndef FIXEDPOINT_H
+#define FIXEDPOINT_H
+
+#include "Platform.h"
+
+/*==================================================================================================*
+ * Fixed-point decoding of DSMR values.
+ *
+ * Meter values like '012094.358*kWh' are decoded with integer arithmetic only, straight into a
+ * value scaled by 10^nDecimals (e.g. 12094358 Wh for 3 decimals). No floating point is involved,
+ * so there are no rounding errors and no soft-float code on the FPU-less ESP8266.
+ *==================================================================================================*/
+
+const int cnMaxFixedDigits = 18;    //Integer plus scaled fraction digits; 10^18 still fits int64_t
+
+/*------------------------------------------------------------------------------------------------*
+ * DecodeFixed: Decode a decimal value group into a scaled integer.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Parse '[digits][.digits][*unit]' and return the value multiplied by 10^nDecimals. Fraction
+ *  digits beyond nDecimals are truncated; missing ones are taken as zero.
+ *INPUT:
+ *	const char *pchGroup - value group without brackets, e.g. '012094.358*kWh' or '0002'
+ *  int nGroupLen - length of the value group
+ *  int nDecimals - number of decimals to keep (scale of the result)
+ *  int64_t *pllValue - receives the scaled value
+ *OUTPUT:
+ *	(bool) true if a valid number was decoded, false otherwise (*pllValue is then 0).
+ *------------------------------------------------------------------------------------------------*/
+bool DecodeFixed(const char *pchGroup, int nGroupLen, int nDecimals, int64_t *pllValue)
+{
+    int64_t llValue = 0;
+    int nDigits = 0;            //Significant digits accumulated in llValue
+    int nFraction = -1;         //Fraction digits seen, -1 before the decimal point
+    bool bAnyDigit = false;
+    int nPos = 0;
+
+    *pllValue = 0;
+
+    for (; nPos < nGroupLen && pchGroup[nPos] != '*'; nPos++) {
+        char ch = pchGroup[nPos];
+
+        if (ch == '.') {
+            if (nFraction >= 0)
+                return false; //Second decimal point
+            nFraction = 0;
+            continue;
+        }
+        if (ch < '0' || ch > '9')
+            return false;
+        bAnyDigit = true;
+        if (nFraction >= 0 && nFraction++ >= nDecimals)
+            continue; //Truncate extra fraction digits
+
+        if (llValue != 0 || ch != '0') { //Leading zeros don't count towards the digit limit
+            if (++nDigits > cnMaxFixedDigits)
+                return false;
+        }
+        llValue = llValue * 10 + (ch - '0');
+    }
+    if (!bAnyDigit)
+        return false;
+
+    /*--- Scale up for the fraction digits that were not sent ---*/
+    for (int i = (nFraction < 0 ? 0 : nFraction); i < nDecimals; i++) {
+        if (llValue != 0 && ++nDigits > cnMaxFixedDigits)
+            return false;
+        llValue *= 10;
+    }
+
+    *pllValue = llValue;
+    return true;
+}
+#endif
@@ -0,0 +1,421 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "Platform.h"
+#include "CRC16.h"
+#include "DsmrReading.h"
+#include "MeterTime.h"
+
+/*==================================================================================================*
+ * Store-and-forward journal of meter readings.
+ *
+ * Readings that could not be published are appended to a queue in flash and sent later, oldest
+ * first, with their original meter timestamps. The queue is a ring of segment files of about one
+ * flash sector each: records are appended to the newest segment, drained from the oldest one, and
+ * a segment is deleted as soon as it is drained. When all segments are in use the oldest one is
+ * dropped. Rotating through new files (and LittleFS' own wear levelling) spreads the writes over
+ * the flash.
+ *
+ * Delivery is at least once: after a reboot the partly drained oldest segment is sent again from
+ * its start, the drain position is not written to flash for every record.
+ *
+ * The storage is selected at build time with -D JOURNAL_BACKEND=...: LittleFS on the ESP8266, or
+ * RAM in host builds.
+ *==================================================================================================*/
+
+#define JOURNAL_BACKEND_LITTLEFS 0  //Segment files in /journal on LittleFS
+#define JOURNAL_BACKEND_RAM 1       //Segments in RAM (host builds)
+
+#ifndef JOURNAL_BACKEND
+#ifdef ARDUINO
+#define JOURNAL_BACKEND JOURNAL_BACKEND_LITTLEFS
+#else
+#define JOURNAL_BACKEND JOURNAL_BACKEND_RAM
+#endif
+#endif
+
+/*--- One reading in 68 bytes, far less than a DsmrReading (generic objects and M-Bus channels are not kept) ---*/
+struct JournalRecord
+{
+    uint16_t uCrc;                  //CRC16 over the rest of the record, detects torn writes
+    uint8_t nVersion;               //DSMR version
+    uint8_t nTariff;                //Active power tariff
+    uint8_t uFlags;                 //JOURNAL_* flags below
+    uint8_t auReserved[3];
+    uint32_t uPwrTime;              //Power timestamp, seconds since 2000-01-01 (MeterTime.h)
+    uint32_t uGasTime;              //Gas timestamp, seconds since 2000-01-01
+    int32_t alValue[13];            //Meter values, in DsmrReading order
+};
+
+static_assert(sizeof(JournalRecord) == 68, "JournalRecord is stored in flash, its layout must not change");
+static_assert(2 * sizeof(JournalRecord) < sizeof(DsmrReading), "JournalRecord must stay compact");
+
+#define JOURNAL_PWR_TIME 0x01       //uPwrTime is valid
+#define JOURNAL_PWR_DST 0x02        //Power timestamp is summer time
+#define JOURNAL_GAS_TIME 0x04       //uGasTime is valid
+#define JOURNAL_GAS_DST 0x08        //Gas timestamp is summer time
+
+const int cnJournalSegRecords = 60; //Records per segment, 4080 bytes (one 4KB flash sector)
+
+#if JOURNAL_BACKEND == JOURNAL_BACKEND_LITTLEFS
+#include <LittleFS.h>
+#ifndef JOURNAL_SEGMENTS
+#define JOURNAL_SEGMENTS 64         //At most 3840 readings (~10h at 10s, ~1h at 1s), 256KB of flash
+#endif
+#else
+#ifndef JOURNAL_SEGMENTS
+#define JOURNAL_SEGMENTS 4
+#endif
+struct JournalRamSeg
+{
+    uint32_t uSeg;                  //Segment number
+    int nRecords;                   //Records stored, 0 = unused
+    JournalRecord axRecord[cnJournalSegRecords];
+};
+JournalRamSeg axJournalRam[JOURNAL_SEGMENTS];
+#endif
+
+struct Journal
+{
+    bool bReady;                    //Storage is available
+    uint32_t uHead;                 //Segment records are appended to
+    int nHeadRecords;               //Records in the head segment
+    uint32_t uTail;                 //Segment records are drained from
+    int nTailPos;                   //Next record to drain from the tail segment
+    uint32_t uQueued;               //Records waiting to be drained
+    uint32_t uDropped;              //Records lost because the journal was full, or corrupt
+};
+
+/*==================================================================================================*
+ * Segment storage (backend specific).
+ *==================================================================================================*/
+
+#if JOURNAL_BACKEND == JOURNAL_BACKEND_LITTLEFS
+/*--- File name of a segment: /journal/<8 hex digits> ---*/
+static void JournalPath(uint32_t uSeg, char *pchPath)
+{
+    static const char achHex[] = "0123456789abcdef";
+
+    memcpy(pchPath, "/journal/", 9);
+    for (int i = 0; i < 8; i++)
+        pchPath[9 + i] = achHex[(uSeg >> (28 - 4 * i)) & 0x0F];
+    pchPath[17] = 0;
+}
+#else
+/*--- RAM slot holding a segment, or NULL ---*/
+static JournalRamSeg *JournalRamFind(uint32_t uSeg)
+{
+    for (int i = 0; i < JOURNAL_SEGMENTS; i++)
+        if (axJournalRam[i].nRecords > 0 && axJournalRam[i].uSeg == uSeg)
+            return &axJournalRam[i];
+    return NULL;
+}
+#endif
+
+/*--- Number of records in a segment, 0 if it doesn't exist ---*/
+static int JournalSegRecords(uint32_t uSeg)
+{
+#if JOURNAL_BACKEND == JOURNAL_BACKEND_LITTLEFS
+    char achPath[18];
+    JournalPath(uSeg, achPath);
+    File hFile = LittleFS.open(achPath, "r");
+    if (!hFile)
+        return 0;
+    int nRecords = hFile.size() / sizeof(JournalRecord);
+    hFile.close();
+    return nRecords;
+#else
+    JournalRamSeg *pxSeg = JournalRamFind(uSeg);
+    return pxSeg ? pxSeg->nRecords : 0;
+#endif
+}
+
+/*--- Append a record to a segment, creating it if needed ---*/
+static bool JournalSegAppend(uint32_t uSeg, const JournalRecord *pxRecord)
+{
+#if JOURNAL_BACKEND == JOURNAL_BACKEND_LITTLEFS
+    char achPath[18];
+    JournalPath(uSeg, achPath);
+    File hFile = LittleFS.open(achPath, "a");
+    if (!hFile)
+        return false;
+    bool bOk = hFile.write((const uint8_t *)pxRecord, sizeof(*pxRecord)) == sizeof(*pxRecord);
+    hFile.close();
+    return bOk;
+#else
+    JournalRamSeg *pxSeg = JournalRamFind(uSeg);
+    for (int i = 0; !pxSeg && i < JOURNAL_SEGMENTS; i++)
+        if (axJournalRam[i].nRecords == 0) {
+            pxSeg = &axJournalRam[i];
+            pxSeg->uSeg = uSeg;
+        }
+    if (!pxSeg || pxSeg->nRecords >= cnJournalSegRecords)
+        return false;
+    pxSeg->axRecord[pxSeg->nRecords++] = *pxRecord;
+    return true;
+#endif
+}
+
+/*--- Read a record from a segment ---*/
+static bool JournalSegRead(uint32_t uSeg, int nPos, JournalRecord *pxRecord)
+{
+#if JOURNAL_BACKEND == JOURNAL_BACKEND_LITTLEFS
+    char achPath[18];
+    JournalPath(uSeg, achPath);
+    File hFile = LittleFS.open(achPath, "r");
+    if (!hFile)
+        return false;
+    bool bOk = hFile.seek(nPos * sizeof(*pxRecord)) &&
+               hFile.read((uint8_t *)pxRecord, sizeof(*pxRecord)) == sizeof(*pxRecord);
+    hFile.close();
+    return bOk;
+#else
+    JournalRamSeg *pxSeg = JournalRamFind(uSeg);
+    if (!pxSeg || nPos >= pxSeg->nRecords)
+        return false;
+    *pxRecord = pxSeg->axRecord[nPos];
+    return true;
+#endif
+}
+
+/*--- Delete a segment ---*/
+static void JournalSegRemove(uint32_t uSeg)
+{
+#if JOURNAL_BACKEND == JOURNAL_BACKEND_LITTLEFS
+    char achPath[18];
+    JournalPath(uSeg, achPath);
+    LittleFS.remove(achPath);
+#else
+    JournalRamSeg *pxSeg = JournalRamFind(uSeg);
+    if (pxSeg)
+        pxSeg->nRecords = 0;
+#endif
+}
+
+/*--- Add a segment number to the oldest/newest found so far ---*/
+static void JournalSegFound(uint32_t uSeg, bool *pbFound, uint32_t *puFirst, uint32_t *puLast)
+{
+    if (!*pbFound || uSeg < *puFirst)
+        *puFirst = uSeg;
+    if (!*pbFound || uSeg > *puLast)
+        *puLast = uSeg;
+    *pbFound = true;
+}
+
+/*--- Mount the storage and find the oldest and newest segment, false if there are none ---*/
+static bool JournalSegScan(bool *pbReady, uint32_t *puFirst, uint32_t *puLast)
+{
+    bool bFound = false;
+
+#if JOURNAL_BACKEND == JOURNAL_BACKEND_LITTLEFS
+    *pbReady = LittleFS.begin();
+    if (!*pbReady)
+        return false;
+    Dir hDir = LittleFS.openDir("/journal");
+    while (hDir.next())
+        JournalSegFound(strtoul(hDir.fileName().c_str(), NULL, 16), &bFound, puFirst, puLast); //Boot only, String is fine
+#else
+    *pbReady = true;
+    for (int i = 0; i < JOURNAL_SEGMENTS; i++)
+        if (axJournalRam[i].nRecords > 0)
+            JournalSegFound(axJournalRam[i].uSeg, &bFound, puFirst, puLast);
+#endif
+    return bFound;
+}
+
+/*==================================================================================================*
+ * Journal.
+ *==================================================================================================*/
+
+/*--- CRC16 of a record, excluding the CRC itself ---*/
+static unsigned int JournalCrc(const JournalRecord *pxRecord)
+{
+    return Crc16(0x0000, (unsigned char *)pxRecord + sizeof(pxRecord->uCrc), sizeof(*pxRecord) - sizeof(pxRecord->uCrc));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JournalEncode/JournalDecode: Convert a reading to its compact record and back.
+ *------------------------------------------------------------------------------------------------*/
+void JournalEncode(const DsmrReading *pxReading, JournalRecord *pxRecord)
+{
+    bool bDst;
+
+    memset(pxRecord, 0, sizeof(*pxRecord));
+    pxRecord->nVersion = (uint8_t)pxReading->lDsmrVersion;
+    pxRecord->nTariff = (uint8_t)pxReading->lPwrTariff;
+    if (MeterTimeParse(pxReading->achPwrTime, &pxRecord->uPwrTime, &bDst))
+        pxRecord->uFlags |= JOURNAL_PWR_TIME | (bDst ? JOURNAL_PWR_DST : 0);
+    if (MeterTimeParse(pxReading->achGasTime, &pxRecord->uGasTime, &bDst))
+        pxRecord->uFlags |= JOURNAL_GAS_TIME | (bDst ? JOURNAL_GAS_DST : 0);
+
+    int32_t *plValue = pxRecord->alValue;
+    *plValue++ = pxReading->lPwrLow;
+    *plValue++ = pxReading->lPwrHigh;
+    *plValue++ = pxReading->lPwrActual;
+    *plValue++ = pxReading->lPwrL1;
+    *plValue++ = pxReading->lPwrL2;
+    *plValue++ = pxReading->lPwrL3;
+    *plValue++ = pxReading->lReturnLow;
+    *plValue++ = pxReading->lReturnHigh;
+    *plValue++ = pxReading->lReturnActual;
+    *plValue++ = pxReading->lReturnL1;
+    *plValue++ = pxReading->lReturnL2;
+    *plValue++ = pxReading->lReturnL3;
+    *plValue++ = pxReading->lGasMeter;
+
+    pxRecord->uCrc = JournalCrc(pxRecord);
+}
+
+void JournalDecode(const JournalRecord *pxRecord, DsmrReading *pxReading)
+{
+    memset(pxReading, 0, sizeof(*pxReading));
+    pxReading->lDsmrVersion = pxRecord->nVersion;
+    pxReading->lPwrTariff = pxRecord->nTariff;
+    if (pxRecord->uFlags & JOURNAL_PWR_TIME)
+        MeterTimeFormat(pxRecord->uPwrTime, pxRecord->uFlags & JOURNAL_PWR_DST, pxReading->achPwrTime);
+    if (pxRecord->uFlags & JOURNAL_GAS_TIME)
+        MeterTimeFormat(pxRecord->uGasTime, pxRecord->uFlags & JOURNAL_GAS_DST, pxReading->achGasTime);
+
+    const int32_t *plValue = pxRecord->alValue;
+    pxReading->lPwrLow = *plValue++;
+    pxReading->lPwrHigh = *plValue++;
+    pxReading->lPwrActual = *plValue++;
+    pxReading->lPwrL1 = *plValue++;
+    pxReading->lPwrL2 = *plValue++;
+    pxReading->lPwrL3 = *plValue++;
+    pxReading->lReturnLow = *plValue++;
+    pxReading->lReturnHigh = *plValue++;
+    pxReading->lReturnActual = *plValue++;
+    pxReading->lReturnL1 = *plValue++;
+    pxReading->lReturnL2 = *plValue++;
+    pxReading->lReturnL3 = *plValue++;
+    pxReading->lGasMeter = *plValue++;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JournalBegin: Open the journal, picking up the readings queued before a reboot.
+ *------------------------------------------------------------------------------------------------*
+ *OUTPUT:
+ *	(bool) true if the storage is available, false if not (readings can't be queued then).
+ *------------------------------------------------------------------------------------------------*/
+bool JournalBegin(Journal *pxJournal)
+{
+    uint32_t uFirst = 0, uLast = 0;
+
+    memset(pxJournal, 0, sizeof(*pxJournal));
+    if (JournalSegScan(&pxJournal->bReady, &uFirst, &uLast)) {
+        pxJournal->uTail = uFirst;
+        pxJournal->uHead = uLast;
+        for (uint32_t uSeg = uFirst; uSeg != uLast + 1; uSeg++)
+            pxJournal->uQueued += JournalSegRecords(uSeg);
+        pxJournal->nHeadRecords = JournalSegRecords(uLast);
+    }
+    return pxJournal->bReady;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JournalCount: Number of readings waiting to be sent.
+ *------------------------------------------------------------------------------------------------*/
+uint32_t JournalCount(const Journal *pxJournal)
+{
+    return pxJournal->uQueued;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JournalPush: Queue a reading.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Appends the reading to the newest segment, starting a new segment when it is full. When that
+ *  would exceed JOURNAL_SEGMENTS, the oldest segment is dropped to make room.
+ *INPUT:
+ *	Journal *pxJournal - journal
+ *  const DsmrReading *pxReading - reading to queue
+ *OUTPUT:
+ *	(bool) true if queued, false if the storage failed.
+ *------------------------------------------------------------------------------------------------*/
+bool JournalPush(Journal *pxJournal, const DsmrReading *pxReading)
+{
+    JournalRecord xRecord;
+
+    if (!pxJournal->bReady)
+        return false;
+
+    if (pxJournal->nHeadRecords >= cnJournalSegRecords) {
+        pxJournal->uHead++;
+        pxJournal->nHeadRecords = 0;
+    }
+    if (pxJournal->uHead - pxJournal->uTail >= JOURNAL_SEGMENTS) {
+        /*--- Full: drop the oldest segment ---*/
+        uint32_t uLost = JournalSegRecords(pxJournal->uTail) - pxJournal->nTailPos;
+        pxJournal->uDropped += uLost;
+        pxJournal->uQueued -= uLost;
+        JournalSegRemove(pxJournal->uTail);
+        pxJournal->uTail++;
+        pxJournal->nTailPos = 0;
+    }
+
+    JournalEncode(pxReading, &xRecord);
+    if (!JournalSegAppend(pxJournal->uHead, &xRecord))
+        return false;
+    pxJournal->nHeadRecords++;
+    pxJournal->uQueued++;
+    return true;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JournalPop: Remove the oldest queued reading (after it has been sent).
+ *------------------------------------------------------------------------------------------------*/
+void JournalPop(Journal *pxJournal)
+{
+    if (pxJournal->uQueued == 0)
+        return;
+    pxJournal->uQueued--;
+    pxJournal->nTailPos++;
+
+    if (pxJournal->uTail == pxJournal->uHead) {
+        if (pxJournal->nTailPos < pxJournal->nHeadRecords)
+            return;
+        /*--- Everything sent: delete the segment and start over in a fresh one ---*/
+        JournalSegRemove(pxJournal->uTail);
+        pxJournal->uHead = pxJournal->uTail = pxJournal->uTail + 1;
+        pxJournal->nHeadRecords = 0;
+        pxJournal->nTailPos = 0;
+    }
+    else if (pxJournal->nTailPos >= JournalSegRecords(pxJournal->uTail)) {
+        JournalSegRemove(pxJournal->uTail);
+        pxJournal->uTail++;
+        pxJournal->nTailPos = 0;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JournalPeek: Get the oldest queued reading, without removing it.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Records that can't be read or fail their CRC16 check are dropped (and counted) on the way.
+ *INPUT:
+ *	Journal *pxJournal - journal
+ *  DsmrReading *pxReading - receives the reading
+ *OUTPUT:
+ *	(bool) true if a reading was returned, false if the journal is empty.
+ *------------------------------------------------------------------------------------------------*/
+bool JournalPeek(Journal *pxJournal, DsmrReading *pxReading)
+{
+    JournalRecord xRecord;
+
+    while (pxJournal->uQueued > 0) {
+        if (pxJournal->uTail != pxJournal->uHead && pxJournal->nTailPos >= JournalSegRecords(pxJournal->uTail)) {
+            pxJournal->uTail++; //Missing segment (e.g. deleted after a power loss), skip it
+            pxJournal->nTailPos = 0;
+            continue;
+        }
+        if (JournalSegRead(pxJournal->uTail, pxJournal->nTailPos, &xRecord) && JournalCrc(&xRecord) == xRecord.uCrc) {
+            JournalDecode(&xRecord, pxReading);
+            return true;
+        }
+        pxJournal->uDropped++;
+        JournalPop(pxJournal);
+    }
+    return false;
+}
+#endif
@@ -0,0 +1,123 @@
+#ifndef METERTIME_H
+#define METERTIME_H
+
+#include "Platform.h"
+
+/*==================================================================================================*
+ * Meter timestamps.
+ *
+ * The meter sends its (local) time as 'YYMMDDhhmmssX', X being 'S' for summer time (DST) or 'W' for
+ * winter time. For compact storage and time arithmetic it is converted to the number of seconds
+ * since 2000-01-01 00:00:00 of the same local time, plus the DST flag.
+ *==================================================================================================*/
+
+const int cnMeterTimeLen = 13;      //Length of 'YYMMDDhhmmssX' (excluding the '\0')
+
+/*--- Calendar arithmetic counts days from 0000-03-01, so the leap day is the last day of a year ---*/
+const uint32_t cuMeterEpochDays = 730425;   //Days from 0000-03-01 to 2000-01-01
+
+/*--- Days from 2000-01-01 to the given date (Gregorian calendar, year >= 2000) ---*/
+static inline uint32_t MeterDays(int nYear, int nMonth, int nDay)
+{
+    if (nMonth <= 2)
+        nYear--;
+    uint32_t uEra = nYear / 400;
+    uint32_t uYearOfEra = nYear - uEra * 400;
+    uint32_t uDayOfYear = (153 * (nMonth > 2 ? nMonth - 3 : nMonth + 9) + 2) / 5 + nDay - 1;
+    uint32_t uDayOfEra = uYearOfEra * 365 + uYearOfEra / 4 - uYearOfEra / 100 + uDayOfYear;
+    return uEra * 146097 + uDayOfEra - cuMeterEpochDays;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MeterTimeParse: Convert a meter timestamp to seconds since 2000-01-01 (meter local time).
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	const char *pchTime - timestamp 'YYMMDDhhmmssX', e.g. '181121094755W'
+ *  uint32_t *puSeconds - receives the seconds since 2000-01-01 00:00:00
+ *  bool *pbDst - receives true for summer time ('S'), false for winter time ('W')
+ *OUTPUT:
+ *	(bool) true if the timestamp is valid, false otherwise.
+ *------------------------------------------------------------------------------------------------*/
+bool MeterTimeParse(const char *pchTime, uint32_t *puSeconds, bool *pbDst)
+{
+    int anPart[6];
+
+    for (int i = 0; i < 6; i++) {
+        char chHigh = pchTime[2 * i];
+        char chLow = chHigh ? pchTime[2 * i + 1] : 0;
+        if (chHigh < '0' || chHigh > '9' || chLow < '0' || chLow > '9')
+            return false;
+        anPart[i] = (chHigh - '0') * 10 + (chLow - '0');
+    }
+    if (pchTime[12] != 'S' && pchTime[12] != 'W')
+        return false;
+    if (anPart[1] < 1 || anPart[1] > 12 || anPart[2] < 1 || anPart[2] > 31 ||
+        anPart[3] > 23 || anPart[4] > 59 || anPart[5] > 59)
+        return false;
+
+    *puSeconds = MeterDays(2000 + anPart[0], anPart[1], anPart[2]) * 86400UL +
+                 anPart[3] * 3600UL + anPart[4] * 60UL + anPart[5];
+    *pbDst = (pchTime[12] == 'S');
+    return true;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MeterTimeFormat: Convert seconds since 2000-01-01 back to a meter timestamp.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	uint32_t uSeconds - seconds since 2000-01-01 00:00:00 (meter local time)
+ *  bool bDst - summer time ('S') or winter time ('W')
+ *  char *pchTime - buffer of at least cnMeterTimeLen + 1 characters
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void MeterTimeFormat(uint32_t uSeconds, bool bDst, char *pchTime)
+{
+    uint32_t uDays = uSeconds / 86400UL;
+    uint32_t uTime = uSeconds % 86400UL;
+
+    /*--- Civil date from the day number (inverse of MeterDays) ---*/
+    uint32_t uShifted = uDays + cuMeterEpochDays;
+    uint32_t uEra = uShifted / 146097;
+    uint32_t uDayOfEra = uShifted % 146097;
+    uint32_t uYearOfEra = (uDayOfEra - uDayOfEra / 1460 + uDayOfEra / 36524 - uDayOfEra / 146096) / 365;
+    uint32_t uDayOfYear = uDayOfEra - (365 * uYearOfEra + uYearOfEra / 4 - uYearOfEra / 100);
+    uint32_t uMonthIndex = (5 * uDayOfYear + 2) / 153;      //0 = March
+    int nDay = uDayOfYear - (153 * uMonthIndex + 2) / 5 + 1;
+    int nMonth = uMonthIndex < 10 ? uMonthIndex + 3 : uMonthIndex - 9;
+    int nYear = uEra * 400 + uYearOfEra + (nMonth <= 2 ? 1 : 0);
+
+    int anPart[6] = { nYear % 100, nMonth, nDay, (int)(uTime / 3600), (int)(uTime / 60 % 60), (int)(uTime % 60) };
+    for (int i = 0; i < 6; i++) {
+        pchTime[2 * i] = '0' + anPart[i] / 10;
+        pchTime[2 * i + 1] = '0' + anPart[i] % 10;
+    }
+    pchTime[12] = bDst ? 'S' : 'W';
+    pchTime[13] = 0;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MeterTimeUtc: Convert meter local time (seconds since 2000-01-01) to UTC.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Dutch (and Belgian) meters run on CET (UTC+1), CEST (UTC+2) in summer. UTC doesn't jump at
+ *  the DST changes, so it can be used for intervals and time differences.
+ *INPUT:
+ *	uint32_t uSeconds - meter local time, as returned by MeterTimeParse()
+ *  bool bDst - summer time flag, as returned by MeterTimeParse()
+ *OUTPUT:
+ *	(uint32_t) seconds since 2000-01-01 00:00:00 UTC; add cuUnixEpoch2000 for a Unix timestamp.
+ *------------------------------------------------------------------------------------------------*/
+const uint32_t cuUnixEpoch2000 = 946684800UL;  //Unix time of 2000-01-01 00:00:00 UTC
+
+uint32_t MeterTimeUtc(uint32_t uSeconds, bool bDst)
+{
+    return uSeconds - (bDst ? 7200 : 3600);
+}
+
+/*--- Inverse of MeterTimeUtc() ---*/
+uint32_t MeterTimeLocal(uint32_t uUtc, bool bDst)
+{
+    return uUtc + (bDst ? 7200 : 3600);
+}
+#endif
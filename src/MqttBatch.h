@@ -0,0 +1,100 @@
+#ifndef MQTTBATCH_H
+#define MQTTBATCH_H
+
+#include "Platform.h"
+
+/*==================================================================================================*
+ * Batching of MQTT publish packets.
+ *
+ * Publishing many small messages one by one costs a TCP segment (and WiFi airtime) each. Here the
+ * MQTT 3.1.1 PUBLISH packets (QoS 0) are encoded back to back in a buffer the size of one TCP
+ * segment, which is then handed to the network client with a single write.
+ *==================================================================================================*/
+
+const int cnMqttBatchLen = 1460;    //One TCP segment (Ethernet MSS)
+
+struct MqttBatch
+{
+    uint8_t auBuf[cnMqttBatchLen];  //Encoded PUBLISH packets
+    int nLen;                       //Bytes used in auBuf
+    int nPackets;                   //Packets in auBuf
+};
+
+/*------------------------------------------------------------------------------------------------*
+ * MqttBatchReset: Empty the batch (after it has been written to the network).
+ *------------------------------------------------------------------------------------------------*/
+void MqttBatchReset(MqttBatch *pxBatch)
+{
+    pxBatch->nLen = 0;
+    pxBatch->nPackets = 0;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MqttRemainingLength: Encode the remaining length of a fixed header, 7 bits per byte.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	unsigned long ulLength - bytes after the fixed header, at most 268435455 (4 bytes)
+ *  uint8_t *puOut - receives the encoded length, up to 4 bytes
+ *OUTPUT:
+ *	(int) number of bytes written.
+ *------------------------------------------------------------------------------------------------*/
+int MqttRemainingLength(unsigned long ulLength, uint8_t *puOut)
+{
+    int nLen = 0;
+
+    do {
+        uint8_t uDigit = ulLength % 128;
+        ulLength /= 128;
+        puOut[nLen++] = uDigit | (ulLength ? 0x80 : 0x00);
+    } while (ulLength && nLen < 4);
+    return nLen;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MqttBatchAdd: Append a PUBLISH packet (QoS 0) to the batch.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The topic is the base topic and the suffix, joined with a '/'. The suffix is copied straight
+ *  from flash, so per-field topic names never need to be in RAM.
+ *INPUT:
+ *	MqttBatch *pxBatch - batch to add to
+ *  const char *pchBase - base topic, e.g. 'sensor/dsmr'
+ *  const char *pchSuffix - rest of the topic (PROGMEM), e.g. 'power/use/actual/L1'
+ *  const char *pchPayload - message
+ *  int nPayloadLen - length of the message
+ *  bool bRetain - set the retain flag
+ *OUTPUT:
+ *	(bool) true if added, false if the packet does not fit (write out the batch and retry).
+ *------------------------------------------------------------------------------------------------*/
+bool MqttBatchAdd(MqttBatch *pxBatch, const char *pchBase, const char *pchSuffix, const char *pchPayload, int nPayloadLen, bool bRetain)
+{
+    int nBaseLen = strlen(pchBase);
+    int nSuffixLen = strlen_P(pchSuffix);
+    int nTopicLen = nBaseLen + 1 + nSuffixLen;
+    uint8_t auHeader[5];
+
+    /*--- Fixed header: packet type and flags, then the remaining length ---*/
+    auHeader[0] = 0x30 | (bRetain ? 0x01 : 0x00);
+    int nHeaderLen = 1 + MqttRemainingLength(2 + nTopicLen + nPayloadLen, auHeader + 1);
+
+    if (pxBatch->nLen + nHeaderLen + 2 + nTopicLen + nPayloadLen > cnMqttBatchLen)
+        return false;
+
+    uint8_t *puOut = pxBatch->auBuf + pxBatch->nLen;
+    memcpy(puOut, auHeader, nHeaderLen);
+    puOut += nHeaderLen;
+    *puOut++ = nTopicLen >> 8;      //Variable header: topic name, length first (big endian)
+    *puOut++ = nTopicLen & 0xFF;
+    memcpy(puOut, pchBase, nBaseLen);
+    puOut += nBaseLen;
+    *puOut++ = '/';
+    memcpy_P(puOut, pchSuffix, nSuffixLen);
+    puOut += nSuffixLen;
+    memcpy(puOut, pchPayload, nPayloadLen);
+    puOut += nPayloadLen;
+
+    pxBatch->nLen = puOut - pxBatch->auBuf;
+    pxBatch->nPackets++;
+    return true;
+}
+#endif
@@ -0,0 +1,196 @@
+#ifndef MQTTLINK_H
+#define MQTTLINK_H
+
+#include "Platform.h"
+#include "Backoff.h"
+
+/*==================================================================================================*
+ * MQTT connection sequencer.
+ *
+ * Decides which step towards a broker connection the main loop takes next, so that no loop() pass
+ * blocks for longer than one bounded step and the P1 input is read between the steps:
+ *   - resolve the broker name, once each time the WiFi link comes up (and again after a number of
+ *     failed attempts, in case the broker moved). Resolving must not block: it completes later,
+ *     reported with MqttLinkDone();
+ *   - open the TCP connection to the resolved address, with a timeout below the time the P1
+ *     receive buffer lasts;
+ *   - in a later pass, send the MQTT CONNECT and wait for the broker's CONNACK (the caller keeps
+ *     the P1 input serviced during that wait, see P1ReaderPump()).
+ * Failed attempts are retried with jittered exponential backoff (Backoff.h). The network itself is
+ * left to the caller, which performs the step MqttLinkPoll() returns and reports its outcome with
+ * MqttLinkDone(); time is passed in (millis()), so the sequencer also runs in host builds.
+ *==================================================================================================*/
+
+const unsigned long culMqttResolveTimeout = 5000UL;    //Give up on a name lookup after 5s
+const uint32_t cuMqttResolveAgain = 4;                  //Resolve again after this many failed attempts
+
+/*--- Connection states ---*/
+enum MqttLinkState : uint8_t
+{
+    MQTT_LINK_OFFLINE,              //No network, nothing to do
+    MQTT_LINK_UNRESOLVED,           //Broker address unknown, resolve when due
+    MQTT_LINK_RESOLVING,            //Name lookup in progress
+    MQTT_LINK_IDLE,                 //Address known, not connected, connect when due
+    MQTT_LINK_TCP_OPEN,             //TCP connection open, MQTT CONNECT in the next pass
+    MQTT_LINK_UP                    //Connected to the broker
+};
+
+/*--- Step for the caller to take, returned by MqttLinkPoll() ---*/
+enum MqttLinkStep : uint8_t
+{
+    MQTT_STEP_NONE,                 //Nothing to do in this pass
+    MQTT_STEP_RESOLVE,              //Start resolving the broker name, without waiting for the result
+    MQTT_STEP_TCP,                  //Open the TCP connection to the broker address
+    MQTT_STEP_CONNECT               //Send the MQTT CONNECT and wait for the CONNACK
+};
+
+struct MqttLink
+{
+    MqttLinkState nState;
+    Backoff xBackoff;               //Schedule of the attempts
+    unsigned long ulResolveStart;   //Time (millis) the current name lookup started
+    uint32_t uResolves;             //Name lookups started
+    uint32_t uConnects;             //Times the connection came up
+    uint32_t uFailed;               //Failed attempts (lookup, TCP or MQTT)
+};
+
+/*------------------------------------------------------------------------------------------------*
+ * MqttLinkBegin: Initialize the sequencer, without network.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	MqttLink *pxLink - connection state
+ *  unsigned long ulNow - current time (millis)
+ *  uint32_t uSeed - seed for the backoff jitter
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void MqttLinkBegin(MqttLink *pxLink, unsigned long ulNow, uint32_t uSeed)
+{
+    memset(pxLink, 0, sizeof(*pxLink));
+    pxLink->nState = MQTT_LINK_OFFLINE;
+    BackoffReset(&pxLink->xBackoff, ulNow, uSeed);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MqttLinkNetwork: Report that the network (WiFi) came up or went down.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	When it comes up the broker name is resolved again and the first attempt is due right away.
+ *INPUT:
+ *	MqttLink *pxLink - connection state
+ *  bool bUp - network up
+ *  unsigned long ulNow - current time (millis)
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void MqttLinkNetwork(MqttLink *pxLink, bool bUp, unsigned long ulNow)
+{
+    pxLink->nState = bUp ? MQTT_LINK_UNRESOLVED : MQTT_LINK_OFFLINE;
+    BackoffSucceeded(&pxLink->xBackoff);
+    pxLink->xBackoff.ulNextTry = ulNow;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MqttLinkUp: Check if the connection to the broker is up.
+ *------------------------------------------------------------------------------------------------*/
+bool MqttLinkUp(const MqttLink *pxLink)
+{
+    return pxLink->nState == MQTT_LINK_UP;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MqttLinkPoll: Decide on the next step; call it from every loop().
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Returns at most one step per call. A connection that was up and is no longer (bConnected
+ *  false) is set up again, starting with the TCP connection. A name lookup that takes longer than
+ *  culMqttResolveTimeout counts as a failed attempt.
+ *INPUT:
+ *	MqttLink *pxLink - connection state
+ *  bool bConnected - the MQTT client is connected
+ *  unsigned long ulNow - current time (millis)
+ *OUTPUT:
+ *	(MqttLinkStep) step to take now; report its outcome with MqttLinkDone() (a resolve step when
+ *  the lookup completes, possibly in a later pass).
+ *------------------------------------------------------------------------------------------------*/
+MqttLinkStep MqttLinkPoll(MqttLink *pxLink, bool bConnected, unsigned long ulNow)
+{
+    switch (pxLink->nState) {
+    case MQTT_LINK_UP:
+        if (bConnected)
+            break;
+        pxLink->nState = MQTT_LINK_IDLE; //Connection lost, reconnect when due
+        /* fall through */
+    case MQTT_LINK_IDLE:
+        if (BackoffDue(&pxLink->xBackoff, ulNow))
+            return MQTT_STEP_TCP;
+        break;
+
+    case MQTT_LINK_UNRESOLVED:
+        if (BackoffDue(&pxLink->xBackoff, ulNow)) {
+            pxLink->nState = MQTT_LINK_RESOLVING;
+            pxLink->ulResolveStart = ulNow;
+            pxLink->uResolves++;
+            return MQTT_STEP_RESOLVE;
+        }
+        break;
+
+    case MQTT_LINK_RESOLVING:
+        if (ulNow - pxLink->ulResolveStart >= culMqttResolveTimeout) {
+            pxLink->uFailed++;
+            BackoffFailed(&pxLink->xBackoff, ulNow);
+            pxLink->nState = MQTT_LINK_UNRESOLVED;
+        }
+        break;
+
+    case MQTT_LINK_TCP_OPEN:
+        return MQTT_STEP_CONNECT;
+
+    default:
+        break;
+    }
+    return MQTT_STEP_NONE;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * MqttLinkDone: Report the outcome of a step.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	MqttLink *pxLink - connection state
+ *  MqttLinkStep nStep - step taken
+ *  bool bOk - the step succeeded
+ *  unsigned long ulNow - current time (millis)
+ *OUTPUT:
+ *	(unsigned long) milliseconds until the next attempt after a failure, 0 otherwise.
+ *------------------------------------------------------------------------------------------------*/
+unsigned long MqttLinkDone(MqttLink *pxLink, MqttLinkStep nStep, bool bOk, unsigned long ulNow)
+{
+    if (nStep == MQTT_STEP_RESOLVE && pxLink->nState != MQTT_LINK_RESOLVING)
+        return 0; //Lookup completed after it was given up on, or after the network went down
+
+    if (bOk) {
+        switch (nStep) {
+        case MQTT_STEP_RESOLVE:
+            pxLink->nState = MQTT_LINK_IDLE; //Connect right away
+            break;
+        case MQTT_STEP_TCP:
+            pxLink->nState = MQTT_LINK_TCP_OPEN;
+            break;
+        case MQTT_STEP_CONNECT:
+            pxLink->nState = MQTT_LINK_UP;
+            pxLink->uConnects++;
+            BackoffSucceeded(&pxLink->xBackoff);
+            break;
+        default:
+            break;
+        }
+        return 0;
+    }
+
+    pxLink->uFailed++;
+    pxLink->nState = MQTT_LINK_IDLE;
+    if (nStep == MQTT_STEP_RESOLVE || (pxLink->xBackoff.uAttempts + 1) % cuMqttResolveAgain == 0)
+        pxLink->nState = MQTT_LINK_UNRESOLVED;
+    return BackoffFailed(&pxLink->xBackoff, ulNow);
+}
+#endif
@@ -0,0 +1,242 @@
+#ifndef OBIS_H
+#define OBIS_H
+
+#include "Platform.h"
+
+/*==================================================================================================*
+ * OBIS object registry.
+ *
+ * Every data line of a P1 telegram starts with an OBIS reference 'A-B:C.D.E', e.g. '1-0:21.7.0'.
+ * The reference is parsed once into a packed 32-bit key (4 bits for A and B, 8 bits for C, D and
+ * E) which is looked up in a sorted table describing every object of the DSMR P1 standard we know:
+ * its value type, unit and scale, and where it is stored. The main meter values map to their own
+ * field of the readings (DsmrField); the objects of the M-Bus devices (gas, water, heat, ...) on
+ * channel 1-4 (the B in the reference) go to the slot of their channel; all other objects share the
+ * generic, fixed-size storage of DsmrObjects, in a value or text slot. Adding an object is adding
+ * a line to the table.
+ *==================================================================================================*/
+
+/*--- Meter values we extract from the telegram ---*/
+enum DsmrField : uint8_t
+{
+    FIELD_NONE = 0,         //Unknown or unused OBIS reference
+    FIELD_VERSION,          //DSMR version
+    FIELD_PWR_TIMESTAMP,    //P1 telegram timestamp
+    FIELD_PWR_LOW,          //Power consumption meter (low tariff)
+    FIELD_PWR_HIGH,         //Power consumption meter (high tariff)
+    FIELD_RET_LOW,          //Power return meter (low tariff)
+    FIELD_RET_HIGH,         //Power return meter (high tariff)
+    FIELD_PWR_ACTUAL,       //Power consumption actual
+    FIELD_PWR_L1,           //Power consumption L1 actual
+    FIELD_PWR_L2,           //Power consumption L2 actual
+    FIELD_PWR_L3,           //Power consumption L3 actual
+    FIELD_RET_ACTUAL,       //Power return actual
+    FIELD_RET_L1,           //Power return L1 actual
+    FIELD_RET_L2,           //Power return L2 actual
+    FIELD_RET_L3,           //Power return L3 actual
+    FIELD_PWR_TARIFF,       //Power current tariff (1=Low,2=High)
+    FIELD_GAS_METER,        //Gas on Kaifa MA105 + Landis+Gyr 350 meters (the M-Bus channel with the gas meter)
+    FIELD_OBJECTS,          //Any other object, stored in DsmrObjects
+    FIELD_MBUS,             //Objects of an M-Bus device, stored in the slot of its channel
+    FIELD_VOLTAGE,          //Voltage L1-L3, stored in DsmrObjects (changes with every telegram)
+    FIELD_CURRENT           //Current L1-L3, stored in DsmrObjects (changes with every telegram)
+};
+
+/*--- Value types ---*/
+enum ObisType : uint8_t
+{
+    OBIS_NUMBER,            //Decimal number, stored scaled to an integer: '230.1*V' -> 2301 for 1 decimal
+    OBIS_TEXT,              //Octet string, hex encoded in the telegram: '4530' -> "E0"
+    OBIS_TIME,              //Timestamp 'YYMMDDhhmmssX', stored as text
+    OBIS_LOG,               //Buffer '(count)(reference)(time)(value)...', the count is stored
+    OBIS_READING            //Timestamped reading '(time)(value*unit)' of an M-Bus device
+};
+
+/*--- Units, as sent after the '*' of a value ---*/
+enum ObisUnit : uint8_t
+{
+    UNIT_NONE,
+    UNIT_KWH,
+    UNIT_KW,
+    UNIT_V,
+    UNIT_A,
+    UNIT_M3,
+    UNIT_S,
+    UNIT_GJ,
+    UNIT_UNKNOWN            //A unit not in the list
+};
+static const char achObisUnit[][4] PROGMEM = { "", "kWh", "kW", "V", "A", "m3", "s", "GJ", "?" };
+
+/*--- Storage of the generic objects ---*/
+const int cnObisValues = 15;        //Value slots (OBIS_NUMBER, OBIS_LOG)
+const int cnObisTexts = 2;          //Text slots (OBIS_TEXT, OBIS_TIME)
+const int cnObisTextLen = 24;       //Longest text kept (+1 for \0)
+const int cnMbusChannels = 4;       //M-Bus channels 0-1 .. 0-4
+
+/*--- Pack an OBIS reference A-B:C.D.E into a single key ---*/
+constexpr uint32_t ObisKey(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e)
+{
+    return (a << 28) | (b << 24) | (c << 16) | (d << 8) | e;
+}
+
+struct ObisEntry
+{
+    uint32_t uKey;          //Packed OBIS reference
+    DsmrField nField;       //Meter value it maps to, FIELD_OBJECTS (or VOLTAGE/CURRENT) for a generic object
+    ObisType nType;         //Value type
+    ObisUnit nUnit;         //Unit the value must have (UNIT_NONE: no unit)
+    uint8_t nDecimals;      //Scale: decimals kept in the stored integer (OBIS_NUMBER)
+    uint8_t nSlot;          //Generic object: value slot (number, log) or text slot (text, time);
+                            //  M-Bus object: not used, the channel is B of the reference
+};
+
+/*--- Object table, MUST be sorted on key (checked at compile time below).
+      Kept in RAM: it is small and searched for every telegram line. ---*/
+static constexpr ObisEntry axObisTable[] = {
+    { ObisKey(0, 0,  1,  0,  0), FIELD_PWR_TIMESTAMP, OBIS_TIME,    UNIT_NONE, 0,  0 },  //0-0:1.0.0 Timestamp
+    { ObisKey(0, 0, 96,  1,  1), FIELD_OBJECTS,       OBIS_TEXT,    UNIT_NONE, 0,  0 },  //0-0:96.1.1 Equipment identifier
+    { ObisKey(0, 0, 96,  7,  9), FIELD_OBJECTS,       OBIS_NUMBER,  UNIT_NONE, 0,  1 },  //0-0:96.7.9 Long power failures
+    { ObisKey(0, 0, 96,  7, 21), FIELD_OBJECTS,       OBIS_NUMBER,  UNIT_NONE, 0,  0 },  //0-0:96.7.21 Power failures
+    { ObisKey(0, 0, 96, 13,  0), FIELD_OBJECTS,       OBIS_TEXT,    UNIT_NONE, 0,  1 },  //0-0:96.13.0 Text message
+    { ObisKey(0, 0, 96, 14,  0), FIELD_PWR_TARIFF,    OBIS_NUMBER,  UNIT_NONE, 0,  0 },  //0-0:96.14.0 Tariff
+    { ObisKey(0, 1, 24,  1,  0), FIELD_MBUS,          OBIS_NUMBER,  UNIT_NONE, 0,  0 },  //0-1:24.1.0 Device type
+    { ObisKey(0, 1, 24,  2,  1), FIELD_MBUS,          OBIS_READING, UNIT_NONE, 3,  0 },  //0-1:24.2.1 Reading
+    { ObisKey(0, 1, 24,  2,  3), FIELD_MBUS,          OBIS_READING, UNIT_NONE, 3,  0 },  //0-1:24.2.3 Reading (not temperature corrected)
+    { ObisKey(0, 1, 96,  1,  0), FIELD_MBUS,          OBIS_TEXT,    UNIT_NONE, 0,  0 },  //0-1:96.1.0 Equipment identifier
+    { ObisKey(0, 2, 24,  1,  0), FIELD_MBUS,          OBIS_NUMBER,  UNIT_NONE, 0,  0 },  //0-2:24.1.0 Device type
+    { ObisKey(0, 2, 24,  2,  1), FIELD_MBUS,          OBIS_READING, UNIT_NONE, 3,  0 },  //0-2:24.2.1 Reading
+    { ObisKey(0, 2, 24,  2,  3), FIELD_MBUS,          OBIS_READING, UNIT_NONE, 3,  0 },  //0-2:24.2.3 Reading (not temperature corrected)
+    { ObisKey(0, 2, 96,  1,  0), FIELD_MBUS,          OBIS_TEXT,    UNIT_NONE, 0,  0 },  //0-2:96.1.0 Equipment identifier
+    { ObisKey(0, 3, 24,  1,  0), FIELD_MBUS,          OBIS_NUMBER,  UNIT_NONE, 0,  0 },  //0-3:24.1.0 Device type
+    { ObisKey(0, 3, 24,  2,  1), FIELD_MBUS,          OBIS_READING, UNIT_NONE, 3,  0 },  //0-3:24.2.1 Reading
+    { ObisKey(0, 3, 24,  2,  3), FIELD_MBUS,          OBIS_READING, UNIT_NONE, 3,  0 },  //0-3:24.2.3 Reading (not temperature corrected)
+    { ObisKey(0, 3, 96,  1,  0), FIELD_MBUS,          OBIS_TEXT,    UNIT_NONE, 0,  0 },  //0-3:96.1.0 Equipment identifier
+    { ObisKey(0, 4, 24,  1,  0), FIELD_MBUS,          OBIS_NUMBER,  UNIT_NONE, 0,  0 },  //0-4:24.1.0 Device type
+    { ObisKey(0, 4, 24,  2,  1), FIELD_MBUS,          OBIS_READING, UNIT_NONE, 3,  0 },  //0-4:24.2.1 Reading
+    { ObisKey(0, 4, 24,  2,  3), FIELD_MBUS,          OBIS_READING, UNIT_NONE, 3,  0 },  //0-4:24.2.3 Reading (not temperature corrected)
+    { ObisKey(0, 4, 96,  1,  0), FIELD_MBUS,          OBIS_TEXT,    UNIT_NONE, 0,  0 },  //0-4:96.1.0 Equipment identifier
+    { ObisKey(1, 0,  1,  7,  0), FIELD_PWR_ACTUAL,    OBIS_NUMBER,  UNIT_KW,   3,  0 },  //1-0:1.7.0
+    { ObisKey(1, 0,  1,  8,  1), FIELD_PWR_LOW,       OBIS_NUMBER,  UNIT_KWH,  3,  0 },  //1-0:1.8.1
+    { ObisKey(1, 0,  1,  8,  2), FIELD_PWR_HIGH,      OBIS_NUMBER,  UNIT_KWH,  3,  0 },  //1-0:1.8.2
+    { ObisKey(1, 0,  2,  7,  0), FIELD_RET_ACTUAL,    OBIS_NUMBER,  UNIT_KW,   3,  0 },  //1-0:2.7.0
+    { ObisKey(1, 0,  2,  8,  1), FIELD_RET_LOW,       OBIS_NUMBER,  UNIT_KWH,  3,  0 },  //1-0:2.8.1
+    { ObisKey(1, 0,  2,  8,  2), FIELD_RET_HIGH,      OBIS_NUMBER,  UNIT_KWH,  3,  0 },  //1-0:2.8.2
+    { ObisKey(1, 0, 21,  7,  0), FIELD_PWR_L1,        OBIS_NUMBER,  UNIT_KW,   3,  0 },  //1-0:21.7.0
+    { ObisKey(1, 0, 22,  7,  0), FIELD_RET_L1,        OBIS_NUMBER,  UNIT_KW,   3,  0 },  //1-0:22.7.0
+    { ObisKey(1, 0, 31,  7,  0), FIELD_CURRENT,       OBIS_NUMBER,  UNIT_A,    2, 12 },  //1-0:31.7.0 Current L1
+    { ObisKey(1, 0, 32,  7,  0), FIELD_VOLTAGE,       OBIS_NUMBER,  UNIT_V,    1,  9 },  //1-0:32.7.0 Voltage L1
+    { ObisKey(1, 0, 32, 32,  0), FIELD_OBJECTS,       OBIS_NUMBER,  UNIT_NONE, 0,  3 },  //1-0:32.32.0 Voltage sags L1
+    { ObisKey(1, 0, 32, 36,  0), FIELD_OBJECTS,       OBIS_NUMBER,  UNIT_NONE, 0,  6 },  //1-0:32.36.0 Voltage swells L1
+    { ObisKey(1, 0, 41,  7,  0), FIELD_PWR_L2,        OBIS_NUMBER,  UNIT_KW,   3,  0 },  //1-0:41.7.0
+    { ObisKey(1, 0, 42,  7,  0), FIELD_RET_L2,        OBIS_NUMBER,  UNIT_KW,   3,  0 },  //1-0:42.7.0
+    { ObisKey(1, 0, 51,  7,  0), FIELD_CURRENT,       OBIS_NUMBER,  UNIT_A,    2, 13 },  //1-0:51.7.0 Current L2
+    { ObisKey(1, 0, 52,  7,  0), FIELD_VOLTAGE,       OBIS_NUMBER,  UNIT_V,    1, 10 },  //1-0:52.7.0 Voltage L2
+    { ObisKey(1, 0, 52, 32,  0), FIELD_OBJECTS,       OBIS_NUMBER,  UNIT_NONE, 0,  4 },  //1-0:52.32.0 Voltage sags L2
+    { ObisKey(1, 0, 52, 36,  0), FIELD_OBJECTS,       OBIS_NUMBER,  UNIT_NONE, 0,  7 },  //1-0:52.36.0 Voltage swells L2
+    { ObisKey(1, 0, 61,  7,  0), FIELD_PWR_L3,        OBIS_NUMBER,  UNIT_KW,   3,  0 },  //1-0:61.7.0
+    { ObisKey(1, 0, 62,  7,  0), FIELD_RET_L3,        OBIS_NUMBER,  UNIT_KW,   3,  0 },  //1-0:62.7.0
+    { ObisKey(1, 0, 71,  7,  0), FIELD_CURRENT,       OBIS_NUMBER,  UNIT_A,    2, 14 },  //1-0:71.7.0 Current L3
+    { ObisKey(1, 0, 72,  7,  0), FIELD_VOLTAGE,       OBIS_NUMBER,  UNIT_V,    1, 11 },  //1-0:72.7.0 Voltage L3
+    { ObisKey(1, 0, 72, 32,  0), FIELD_OBJECTS,       OBIS_NUMBER,  UNIT_NONE, 0,  5 },  //1-0:72.32.0 Voltage sags L3
+    { ObisKey(1, 0, 72, 36,  0), FIELD_OBJECTS,       OBIS_NUMBER,  UNIT_NONE, 0,  8 },  //1-0:72.36.0 Voltage swells L3
+    { ObisKey(1, 0, 99, 97,  0), FIELD_OBJECTS,       OBIS_LOG,     UNIT_NONE, 0,  2 },  //1-0:99.97.0 Power failure event log
+    { ObisKey(1, 3,  0,  2,  8), FIELD_VERSION,       OBIS_NUMBER,  UNIT_NONE, 0,  0 }   //1-3:0.2.8 DSMR version
+};
+
+/*--- Names of the generic objects (JSON keys), by slot ---*/
+static const char achObisValueName[cnObisValues][14] PROGMEM = {
+    "failures", "long_failures", "failure_log",
+    "sags_L1", "sags_L2", "sags_L3", "swells_L1", "swells_L2", "swells_L3",
+    "voltage_L1", "voltage_L2", "voltage_L3", "current_L1", "current_L2", "current_L3"
+};
+static const char achObisTextName[cnObisTexts][14] PROGMEM = { "id", "message" };
+
+const int cnObisEntries = sizeof(axObisTable) / sizeof(axObisTable[0]);
+
+constexpr bool ObisTableSorted(int i)
+{
+    return i + 1 >= cnObisEntries || (axObisTable[i].uKey < axObisTable[i + 1].uKey && ObisTableSorted(i + 1));
+}
+static_assert(ObisTableSorted(0), "axObisTable must be sorted on key");
+
+/*--- Generic objects are stored in DsmrObjects; voltage and current have their own field, so a
+      delta does not resend all objects when only they change ---*/
+constexpr bool ObisIsGeneric(DsmrField nField)
+{
+    return nField == FIELD_OBJECTS || nField == FIELD_VOLTAGE || nField == FIELD_CURRENT;
+}
+
+/*--- Text objects use the text slots, the others the value slots ---*/
+constexpr bool ObisIsText(ObisType nType)
+{
+    return nType == OBIS_TEXT || nType == OBIS_TIME;
+}
+
+constexpr bool ObisSlotsValid(int i)
+{
+    return i >= cnObisEntries || ((!ObisIsGeneric(axObisTable[i].nField) ||
+        axObisTable[i].nSlot < (ObisIsText(axObisTable[i].nType) ? cnObisTexts : cnObisValues)) && ObisSlotsValid(i + 1));
+}
+static_assert(ObisSlotsValid(0), "axObisTable slot out of range");
+
+/*------------------------------------------------------------------------------------------------*
+ * ObisFind: Find the object a packed OBIS key refers to.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Binary search through the sorted object table: at most 6 compares for the 48 objects, so the
+ *  cost per telegram line is constant.
+ *INPUT:
+ *	uint32_t uKey - packed OBIS key, as assembled by the P1 parser
+ *OUTPUT:
+ *	(int) index of the object in axObisTable, -1 if the reference is not one we know.
+ *------------------------------------------------------------------------------------------------*/
+int ObisFind(uint32_t uKey)
+{
+    int nLow = 0;
+    int nHigh = cnObisEntries - 1;
+
+    while (nLow <= nHigh)
+    {
+        int nMid = (nLow + nHigh) / 2;
+        if (axObisTable[nMid].uKey == uKey)
+            return nMid;
+        if (axObisTable[nMid].uKey < uKey)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid - 1;
+    }
+    return -1;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ObisUnitOf: Get the unit of a value group, UNIT_NONE if it has none, UNIT_UNKNOWN if not listed.
+ *------------------------------------------------------------------------------------------------*/
+ObisUnit ObisUnitOf(const char *pchGroup, int nGroupLen)
+{
+    const char *pchStar = (const char *)memchr(pchGroup, '*', nGroupLen);
+    char achUnit[sizeof(achObisUnit[0])];
+
+    if (!pchStar)
+        return UNIT_NONE;
+    int nLen = nGroupLen - (pchStar + 1 - pchGroup);
+    for (int n = UNIT_NONE + 1; n < UNIT_UNKNOWN; n++) {
+        memcpy_P(achUnit, achObisUnit[n], sizeof(achUnit));
+        if (nLen == (int)strlen(achUnit) && memcmp(pchStar + 1, achUnit, nLen) == 0)
+            return (ObisUnit)n;
+    }
+    return UNIT_UNKNOWN;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ObisUnitMatch: Check that a value group has the unit of its object.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	'230.1*V' matches UNIT_V. A value without a unit is accepted (as before), a different unit is
+ *  not: it would be scaled wrong (e.g. 'W' where 'kW' is expected).
+ *------------------------------------------------------------------------------------------------*/
+bool ObisUnitMatch(const char *pchGroup, int nGroupLen, ObisUnit nUnit)
+{
+    ObisUnit nFound = ObisUnitOf(pchGroup, nGroupLen);
+    return nFound == UNIT_NONE || nFound == nUnit;
+}
+#endif
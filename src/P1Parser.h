@@ -0,0 +1,347 @@
+#ifndef P1PARSER_H
+#define P1PARSER_H
+
+#include "Platform.h"
+#include "CRC16.h"
+#include "OBIS.h"
+
+/*==================================================================================================*
+ * Streaming P1 telegram parser.
+ *
+ * Bytes are fed one at a time as they arrive on the P1 port; the parser never waits for a complete
+ * line. In a single pass it updates the CRC16, packs the OBIS reference into a key and collects the
+ * bracketed value groups of the lines we are interested in. Lines with an unknown reference are
+ * skipped without buffering anything. The CRC16 is computed over spans of up to cnCrcSpanLen bytes
+ * with the engine selected by CRC16_ENGINE (CRC16.h), so a faster engine speeds up the parser.
+ *
+ * Lines are never buffered as a whole: only the first and the current value group are kept. For
+ * lines with any number of groups (a log like 1-0:99.97.0) every group is reported as it
+ * completes, as a span into the parser (P1CurrentGroup()), so the line is decoded group by group.
+ *==================================================================================================*/
+
+const int cnGroupLen = 48;          //Longest value group we keep (+1 for \0), e.g. '(012094.358*kWh)' or
+                                    //  a 34 digit equipment identifier
+const int cnCrcSpanLen = 32;        //Bytes collected before they are added to the CRC16 in one go
+
+/*--- Parser states ---*/
+enum P1State : uint8_t
+{
+    P1_WAIT_START,                  //Waiting for the '/' that starts a telegram
+    P1_HEADER,                      //Identification line, e.g. '/XMX5LGBBFFB231314239'
+    P1_REFERENCE,                   //OBIS reference at the start of a data line
+    P1_GROUP,                       //Inside a '(...)' value group
+    P1_BETWEEN,                     //After a ')', waiting for the next group or the end of line
+    P1_SKIP_LINE,                   //Ignore the rest of the line
+    P1_CRC                          //Collecting the CRC16 digits following the '!'
+};
+
+/*--- Result of feeding a byte ---*/
+enum P1Event : uint8_t
+{
+    P1_EVENT_NONE,                  //Nothing completed yet
+    P1_EVENT_TELEGRAM_START,        //A '/' started a new telegram
+    P1_EVENT_GROUP,                 //A value group of a log line is complete (see P1CurrentGroup())
+    P1_EVENT_OBJECT,                //A line for a known object is complete (see nField/nObject/achFirst/achLast)
+    P1_EVENT_TELEGRAM_OK,           //End of telegram, CRC16 matches
+    P1_EVENT_TELEGRAM_BAD           //End of telegram, CRC16 mismatch
+};
+
+struct P1Parser
+{
+    P1State nState;                 //Current parser state
+    unsigned int uCrc;              //Running CRC16 from '/' up to the bytes in auCrcSpan
+    unsigned char auCrcSpan[cnCrcSpanLen]; //Bytes received but not yet added to uCrc (up to and including '!')
+    uint8_t nCrcSpan;               //Number of bytes in auCrcSpan
+    uint32_t uKey;                  //OBIS key being assembled
+    uint16_t uPart;                 //Value of the OBIS reference part being parsed
+    uint8_t nPart;                  //Index of that part (0=A .. 4=E)
+    uint8_t nDigits;                //Digits seen in that part
+    DsmrField nField;               //Field the current line maps to
+    int8_t nObject;                 //Index of its object in axObisTable, -1 if unknown
+    uint8_t nGroups;                //Number of value groups completed on the current line
+    bool bTruncated;                //A value group on this line did not fit in cnGroupLen
+    bool bGroupTruncated;           //The current value group did not fit in cnGroupLen
+    char achFirst[cnGroupLen];      //First value group of the line (without brackets)
+    int nFirstLen;
+    char achLast[cnGroupLen];       //Last (or current) value group of the line (without brackets)
+    int nLastLen;
+    char achCrc[4];                 //CRC16 characters received after the '!'
+    int nCrcLen;
+    uint32_t uTruncated;            //Lines dropped since the reset because a value group did not fit
+};
+
+/*--- Kind of a value group, by its contents ---*/
+enum P1GroupKind : uint8_t
+{
+    P1_GROUP_EMPTY,                 //'()'
+    P1_GROUP_NUMBER,                //'00015', '0000005627*s', '230.1*V'
+    P1_GROUP_TIME,                  //'170520130938S'
+    P1_GROUP_REFERENCE,             //'0-0:96.7.19'
+    P1_GROUP_TEXT                   //Anything else, e.g. a hex encoded octet string with letters
+};
+
+/*--- A value group, pointing into the parser (valid until the next group starts) ---*/
+struct P1Group
+{
+    const char *pchText;            //Contents, without brackets, '\0' terminated
+    int nLen;                       //Length of the contents
+    uint8_t nIndex;                 //Position on the line, 0 for the first group
+    P1GroupKind nKind;
+};
+
+/*------------------------------------------------------------------------------------------------*
+ * P1ParserReset: Put the parser in its initial state, waiting for the start of a telegram.
+ *------------------------------------------------------------------------------------------------*/
+void P1ParserReset(P1Parser *pxParser)
+{
+    memset(pxParser, 0, sizeof(*pxParser));
+    pxParser->nState = P1_WAIT_START;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1StartLine: Prepare for the OBIS reference of the next data line.
+ *------------------------------------------------------------------------------------------------*/
+static inline void P1StartLine(P1Parser *pxParser)
+{
+    pxParser->nState = P1_REFERENCE;
+    pxParser->uKey = 0;
+    pxParser->uPart = 0;
+    pxParser->nPart = 0;
+    pxParser->nDigits = 0;
+    pxParser->nField = FIELD_NONE;
+    pxParser->nObject = -1;
+    pxParser->nGroups = 0;
+    pxParser->bTruncated = false;
+    pxParser->bGroupTruncated = false;
+    pxParser->nFirstLen = 0;
+    pxParser->nLastLen = 0;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1CrcFlush: Add the bytes collected in the span to the CRC16.
+ *------------------------------------------------------------------------------------------------*/
+static inline void P1CrcFlush(P1Parser *pxParser)
+{
+    pxParser->uCrc = Crc16(pxParser->uCrc, pxParser->auCrcSpan, pxParser->nCrcSpan);
+    pxParser->nCrcSpan = 0;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1CrcAdd: Collect a byte for the CRC16, hashing the span when it is full.
+ *------------------------------------------------------------------------------------------------*/
+static inline void P1CrcAdd(P1Parser *pxParser, char ch)
+{
+    pxParser->auCrcSpan[pxParser->nCrcSpan++] = (unsigned char)ch;
+    if (pxParser->nCrcSpan == cnCrcSpanLen)
+        P1CrcFlush(pxParser);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1HexValue: Convert a hexadecimal digit to its value, -1 if not a hex digit.
+ *------------------------------------------------------------------------------------------------*/
+static inline int P1HexValue(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'A' && ch <= 'F')
+        return ch - 'A' + 10;
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    return -1;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1ReferenceChar: Process a character of the OBIS reference 'A-B:C.D.E('.
+ *------------------------------------------------------------------------------------------------*/
+static inline void P1ReferenceChar(P1Parser *pxParser, char ch)
+{
+    static const char achSeparator[] = "-:..(";
+    static const uint16_t auMax[] = { 15, 15, 255, 255, 255 };
+
+    if (ch >= '0' && ch <= '9') {
+        pxParser->uPart = pxParser->uPart * 10 + (ch - '0');
+        if (++pxParser->nDigits > 3)
+            pxParser->nState = P1_SKIP_LINE;
+        return;
+    }
+
+    /*--- Must be the separator that ends this part of the reference ---*/
+    int nPart = pxParser->nPart;
+    if (ch != achSeparator[nPart] || pxParser->nDigits == 0 || pxParser->uPart > auMax[nPart]) {
+        pxParser->nState = P1_SKIP_LINE;
+        return;
+    }
+    pxParser->uKey = (pxParser->uKey << (nPart < 2 ? 4 : 8)) | pxParser->uPart;
+    pxParser->uPart = 0;
+    pxParser->nDigits = 0;
+
+    if (++pxParser->nPart < 5)
+        return;
+
+    /*--- Complete reference followed by '(': only collect values for objects we know ---*/
+    pxParser->nObject = ObisFind(pxParser->uKey);
+    pxParser->nField = (pxParser->nObject < 0) ? FIELD_NONE : axObisTable[pxParser->nObject].nField;
+    pxParser->nState = (pxParser->nField == FIELD_NONE) ? P1_SKIP_LINE : P1_GROUP;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1GroupKindOf: Classify the contents of a value group.
+ *------------------------------------------------------------------------------------------------*/
+static P1GroupKind P1GroupKindOf(const char *pchText, int nLen)
+{
+    int nDigits = 0;
+    int nDots = 0;
+    bool bReference = false;
+    int i = 0;
+
+    if (nLen == 0)
+        return P1_GROUP_EMPTY;
+    for (; i < nLen && pchText[i] != '*'; i++) {
+        char ch = pchText[i];
+        if (ch >= '0' && ch <= '9')
+            nDigits++;
+        else if (ch == '.')
+            nDots++;
+        else if (ch == '-' || ch == ':')
+            bReference = true;
+        else if (!((ch == 'S' || ch == 'W') && i == nLen - 1))
+            return P1_GROUP_TEXT;
+    }
+    if (bReference)
+        return P1_GROUP_REFERENCE;
+    if (nDigits == 12 && nLen == 13 && pchText[12] != '*' && nDots == 0)
+        return P1_GROUP_TIME;
+    if (nDigits > 0 && nDots <= 1 && nDigits + nDots == i)
+        return P1_GROUP_NUMBER;
+    return P1_GROUP_TEXT;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1CurrentGroup: Get the value group just completed (on P1_EVENT_GROUP), without copying it.
+ *------------------------------------------------------------------------------------------------*/
+P1Group P1CurrentGroup(const P1Parser *pxParser)
+{
+    P1Group xGroup;
+
+    xGroup.pchText = pxParser->achLast;
+    xGroup.nLen = pxParser->nLastLen;
+    xGroup.nIndex = pxParser->nGroups - 1;
+    xGroup.nKind = P1GroupKindOf(pxParser->achLast, pxParser->nLastLen);
+    return xGroup;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1ParserFeed: Feed the next byte received on the P1 port to the parser.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Advance the parser state machine by one byte. Never blocks; returns an event when a line of
+ *  interest or a complete telegram has been received.
+ *INPUT:
+ *	P1Parser *pxParser - parser state
+ *  char ch - received byte
+ *OUTPUT:
+ *	(P1Event) P1_EVENT_TELEGRAM_START on the '/' that starts a telegram,
+ *  P1_EVENT_GROUP for every complete value group of a log line (OBIS_LOG objects),
+ *  P1_EVENT_OBJECT when pxParser holds a complete line for a known object (valid until
+ *  the next line starts), P1_EVENT_TELEGRAM_OK/BAD at the end of a telegram, P1_EVENT_NONE otherwise.
+ *------------------------------------------------------------------------------------------------*/
+P1Event P1ParserFeed(P1Parser *pxParser, char ch)
+{
+    /*--- A '/' always starts a new telegram, even if the previous one was incomplete ---*/
+    if (ch == '/' && pxParser->nState != P1_GROUP) {
+        pxParser->uCrc = 0x0000;
+        pxParser->nCrcSpan = 0;
+        P1CrcAdd(pxParser, ch);
+        pxParser->nState = P1_HEADER;
+        return P1_EVENT_TELEGRAM_START;
+    }
+    if (pxParser->nState == P1_WAIT_START)
+        return P1_EVENT_NONE;
+    if (pxParser->nState != P1_CRC)
+        P1CrcAdd(pxParser, ch);
+
+    switch (pxParser->nState) {
+    case P1_HEADER:
+    case P1_SKIP_LINE:
+        if (ch == '\n')
+            P1StartLine(pxParser);
+        break;
+
+    case P1_REFERENCE:
+        if (ch == '\r' || ch == '\n') {
+            if (pxParser->nPart != 0 || pxParser->nDigits != 0)
+                P1StartLine(pxParser); //Malformed line, start over
+            break;
+        }
+        if (pxParser->nPart == 0 && pxParser->nDigits == 0) {
+            if (ch == '!') {
+                P1CrcFlush(pxParser); //The CRC16 covers up to and including the '!'
+                pxParser->nState = P1_CRC;
+                pxParser->nCrcLen = 0;
+                break;
+            }
+            P1StartLine(pxParser); //First character of a new line, drop the previous line's data
+        }
+        P1ReferenceChar(pxParser, ch);
+        break;
+
+    case P1_GROUP:
+        if (ch == ')') {
+            pxParser->achLast[pxParser->nLastLen] = 0;
+            if (pxParser->nGroups == 0) {
+                memcpy(pxParser->achFirst, pxParser->achLast, pxParser->nLastLen + 1);
+                pxParser->nFirstLen = pxParser->nLastLen;
+            }
+            if (pxParser->nGroups < UINT8_MAX)
+                pxParser->nGroups++;
+            pxParser->nState = P1_BETWEEN;
+            if (axObisTable[pxParser->nObject].nType == OBIS_LOG && !pxParser->bGroupTruncated)
+                return P1_EVENT_GROUP;
+        }
+        else if (ch == '\n')
+            P1StartLine(pxParser); //Unterminated group, drop the line
+        else if (pxParser->nLastLen < cnGroupLen - 1)
+            pxParser->achLast[pxParser->nLastLen++] = ch;
+        else
+            pxParser->bTruncated = pxParser->bGroupTruncated = true;
+        break;
+
+    case P1_BETWEEN:
+        if (ch == '(') {
+            pxParser->nLastLen = 0;
+            pxParser->bGroupTruncated = false;
+            pxParser->nState = P1_GROUP;
+        }
+        else if (ch == '\n') {
+            /*--- Line complete; its data stays available until the next line starts ---*/
+            pxParser->nState = P1_REFERENCE;
+            pxParser->nPart = 0;
+            pxParser->nDigits = 0;
+            if (pxParser->bTruncated) {
+                pxParser->uTruncated++;
+                return P1_EVENT_NONE;
+            }
+            return P1_EVENT_OBJECT;
+        }
+        break;
+
+    case P1_CRC:
+        if (P1HexValue(ch) >= 0 && pxParser->nCrcLen < 4)
+            pxParser->achCrc[pxParser->nCrcLen++] = ch;
+        else if (ch == '\n' || pxParser->nCrcLen == 4) {
+            unsigned int uReceived = 0;
+            for (int i = 0; i < pxParser->nCrcLen; i++)
+                uReceived = (uReceived << 4) | P1HexValue(pxParser->achCrc[i]);
+            pxParser->nState = P1_WAIT_START;
+            return (pxParser->nCrcLen == 4 && uReceived == pxParser->uCrc) ? P1_EVENT_TELEGRAM_OK
+                                                                            : P1_EVENT_TELEGRAM_BAD;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return P1_EVENT_NONE;
+}
+#endif
@@ -0,0 +1,202 @@
+#ifndef P1READER_H
+#define P1READER_H
+
+#include "Platform.h"
+
+/*==================================================================================================*
+ * P1 serial input.
+ *
+ * The bytes of the P1 port are read through one of the backends below, selected at build time
+ * with -D P1_BACKEND=... in platformio.ini. All backends offer the same interface, and all count
+ * receive buffer overflows (bytes lost because the buffer was full).
+ *
+ * Code that has to wait for something other than the P1 input (the broker's CONNACK) calls
+ * P1ReaderPump() while it waits. With SoftwareSerial that moves the received bytes into a larger
+ * hold buffer, read before the SoftwareSerial buffer; the other backends fill their buffer from an
+ * interrupt and need no pumping.
+ *==================================================================================================*/
+
+#define P1_BACKEND_SOFTSERIAL 0     //SoftwareSerial on any pin (default: D5)
+#define P1_BACKEND_UART 1           //Hardware UART0 swapped to GPIO13 (D7); console moves to Serial1 (D4)
+#define P1_BACKEND_FAKE 2           //Bytes put in a RAM buffer with P1ReaderInject() (host builds)
+
+#ifndef P1_BACKEND
+#ifdef ARDUINO
+#define P1_BACKEND P1_BACKEND_SOFTSERIAL
+#else
+#define P1_BACKEND P1_BACKEND_FAKE
+#endif
+#endif
+
+#if P1_BACKEND == P1_BACKEND_SOFTSERIAL
+#include <SoftwareSerial.h>
+const int cnP1BufLen = 256;         //Receive buffer, ~22ms of data at 115,200 baud
+const int cnP1HoldLen = 2048;       //Hold buffer filled by P1ReaderPump(), a second of telegrams at 1 Hz
+SoftwareSerial hP1Serial;
+char achP1Hold[cnP1HoldLen];
+int nP1HoldHead = 0;                //Next position to write
+int nP1HoldTail = 0;                //Next position to read
+#define CONSOLE Serial
+#elif P1_BACKEND == P1_BACKEND_UART
+const int cnP1BufLen = 2048;        //Receive ring buffer, ~180ms of data at 115,200 baud
+#define CONSOLE Serial1
+#else
+const int cnP1BufLen = 1024;        //Receive ring buffer of the fake backend
+char achP1Fake[cnP1BufLen];
+int nP1FakeHead = 0;                //Next position to write
+int nP1FakeTail = 0;                //Next position to read
+uint32_t uP1FakeDropped = 0;        //Bytes dropped since the last P1ReaderOverflows() call
+#ifdef ARDUINO
+#define CONSOLE Serial
+#endif
+#endif
+
+uint32_t uP1Overflows = 0;          //Receive buffer overflows since boot
+
+/*------------------------------------------------------------------------------------------------*
+ * P1ReaderBegin: Initialize the P1 serial input.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Start receiving at the given baud rate with 8N1 framing and inverted RX (the P1 data line is
+ *  an inverted open collector signal).
+ *INPUT:
+ *	unsigned long ulBaud - baud rate of the P1 port
+ *  int nRxPin - input pin (SoftwareSerial only; the UART backend always uses GPIO13)
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void P1ReaderBegin(unsigned long ulBaud, int nRxPin)
+{
+#if P1_BACKEND == P1_BACKEND_SOFTSERIAL
+    hP1Serial.begin(ulBaud, SWSERIAL_8N1, nRxPin, -1, true, cnP1BufLen);
+#elif P1_BACKEND == P1_BACKEND_UART
+    (void)nRxPin;
+    Serial.setRxBufferSize(cnP1BufLen);
+    Serial.begin(ulBaud, SERIAL_8N1, SERIAL_RX_ONLY, 1, true);
+    Serial.swap();                                      //RX on GPIO13 instead of the USB serial chip
+#else
+    (void)ulBaud;
+    (void)nRxPin;
+    nP1FakeHead = nP1FakeTail = 0;
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1ReaderAvailable: Number of received bytes waiting to be read.
+ *------------------------------------------------------------------------------------------------*/
+int P1ReaderAvailable(void)
+{
+#if P1_BACKEND == P1_BACKEND_SOFTSERIAL
+    return (nP1HoldHead - nP1HoldTail + cnP1HoldLen) % cnP1HoldLen + hP1Serial.available();
+#elif P1_BACKEND == P1_BACKEND_UART
+    return Serial.available();
+#else
+    return (nP1FakeHead - nP1FakeTail + cnP1BufLen) % cnP1BufLen;
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1ReaderRead: Read the next received byte, -1 if none is available.
+ *------------------------------------------------------------------------------------------------*/
+int P1ReaderRead(void)
+{
+#if P1_BACKEND == P1_BACKEND_SOFTSERIAL
+    if (nP1HoldTail != nP1HoldHead) {
+        char ch = achP1Hold[nP1HoldTail];
+        nP1HoldTail = (nP1HoldTail + 1) % cnP1HoldLen;
+        return (unsigned char)ch;
+    }
+    return hP1Serial.read();
+#elif P1_BACKEND == P1_BACKEND_UART
+    return Serial.read();
+#else
+    if (nP1FakeTail == nP1FakeHead)
+        return -1;
+    char ch = achP1Fake[nP1FakeTail];
+    nP1FakeTail = (nP1FakeTail + 1) % cnP1BufLen;
+    return (unsigned char)ch;
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1ReaderPump: Keep receiving while the main loop is held up; call it from any wait loop.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	SoftwareSerial: moves the received bytes into the hold buffer, so its own buffer (~22ms) does
+ *  not overflow during the wait. Bytes that don't fit in the hold buffer are left where they are.
+ *  The other backends receive from an interrupt into their own buffer: nothing to do.
+ *INPUT:
+ *	None.
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void P1ReaderPump(void)
+{
+#if P1_BACKEND == P1_BACKEND_SOFTSERIAL
+    int nNext = (nP1HoldHead + 1) % cnP1HoldLen;
+    while (nNext != nP1HoldTail && hP1Serial.available() > 0) {
+        achP1Hold[nP1HoldHead] = (char)hP1Serial.read();
+        nP1HoldHead = nNext;
+        nNext = (nP1HoldHead + 1) % cnP1HoldLen;
+    }
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * P1ReaderOverflows: Number of receive buffer overflows since boot.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Collect the overflow indication of the backend and add it to the total. The serial backends
+ *  only report that an overflow happened (at least one byte lost) since the last check, so call
+ *  this regularly; the fake backend counts every dropped byte.
+ *INPUT:
+ *	None.
+ *OUTPUT:
+ *	(uint32_t) total number of overflows (serial backends) or dropped bytes (fake backend).
+ *------------------------------------------------------------------------------------------------*/
+uint32_t P1ReaderOverflows(void)
+{
+#if P1_BACKEND == P1_BACKEND_SOFTSERIAL
+    if (hP1Serial.overflow())
+        uP1Overflows++;
+#elif P1_BACKEND == P1_BACKEND_UART
+    if (Serial.hasOverrun())
+        uP1Overflows++;
+#else
+    uP1Overflows += uP1FakeDropped;
+    uP1FakeDropped = 0;
+#endif
+    return uP1Overflows;
+}
+
+#if P1_BACKEND == P1_BACKEND_FAKE
+/*------------------------------------------------------------------------------------------------*
+ * P1ReaderInject: Put bytes in the receive buffer of the fake backend, as if received.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Behaves like the serial backends: bytes that don't fit in the receive buffer are dropped
+ *  and counted as overflows.
+ *INPUT:
+ *	const char *pchData - bytes to inject
+ *  int nLen - number of bytes
+ *OUTPUT:
+ *	(int) number of bytes actually stored.
+ *------------------------------------------------------------------------------------------------*/
+int P1ReaderInject(const char *pchData, int nLen)
+{
+    int nStored = 0;
+
+    for (int i = 0; i < nLen; i++) {
+        int nNext = (nP1FakeHead + 1) % cnP1BufLen;
+        if (nNext == nP1FakeTail) {
+            uP1FakeDropped += nLen - i;
+            break;
+        }
+        achP1Fake[nP1FakeHead] = pchData[i];
+        nP1FakeHead = nNext;
+        nStored++;
+    }
+    return nStored;
+}
+#endif
+#endif
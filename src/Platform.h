@@ -0,0 +1,28 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/*==================================================================================================*
+ * Platform abstraction for the portable P1 core (CRC16, OBIS dispatch, parser, value decoding).
+ *
+ * On the ESP8266 this pulls in the Arduino framework; on any other platform (e.g. a Linux host) it
+ * provides the few definitions the core needs, so the core can be compiled and run without the
+ * Arduino libraries. The core must not use anything else from the framework (Serial, String, ...).
+ *==================================================================================================*/
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#endif
+
+#endif
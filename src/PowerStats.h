@@ -0,0 +1,159 @@
+#ifndef POWERSTATS_H
+#define POWERSTATS_H
+
+#include "Platform.h"
+#include <stddef.h>
+#include <limits.h>
+#include "DsmrReading.h"
+#include "DsmrJson.h"
+
+/*==================================================================================================*
+ * Statistics of the actual power values.
+ *
+ * With a telegram every second (DSMR 5) it is often enough to publish every N seconds, as long as
+ * the peaks in between are not lost. The actual power values (use and return, total and per phase)
+ * of every telegram are accumulated into min/max/sum/last per channel, in constant memory.
+ *==================================================================================================*/
+
+const int cnStatChannels = 8;       //Use total, L1, L2, L3, return total, L1, L2, L3
+
+/*--- Offset of the value of each channel in DsmrReading ---*/
+static const uint16_t auStatOffset[cnStatChannels] PROGMEM = {
+    offsetof(DsmrReading, lPwrActual),
+    offsetof(DsmrReading, lPwrL1),
+    offsetof(DsmrReading, lPwrL2),
+    offsetof(DsmrReading, lPwrL3),
+    offsetof(DsmrReading, lReturnActual),
+    offsetof(DsmrReading, lReturnL1),
+    offsetof(DsmrReading, lReturnL2),
+    offsetof(DsmrReading, lReturnL3)
+};
+
+struct PowerStat
+{
+    long lMin;                      //Lowest value (W)
+    long lMax;                      //Highest value (W)
+    long lLast;                     //Most recent value (W)
+    int64_t llSum;                  //Sum of the values, for the mean
+};
+
+struct PowerStats
+{
+    uint32_t uCount;                //Telegrams accumulated
+    PowerStat axStat[cnStatChannels];
+};
+
+/*--- Value of a channel in a reading ---*/
+static inline long StatValue(const DsmrReading *pxReading, int nChannel)
+{
+    return *(const long *)((const char *)pxReading + pgm_read_word(&auStatOffset[nChannel]));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * StatsReset: Start a new interval.
+ *------------------------------------------------------------------------------------------------*/
+void StatsReset(PowerStats *pxStats)
+{
+    pxStats->uCount = 0;
+    for (int i = 0; i < cnStatChannels; i++) {
+        pxStats->axStat[i].lMin = LONG_MAX;
+        pxStats->axStat[i].lMax = LONG_MIN;
+        pxStats->axStat[i].lLast = 0;
+        pxStats->axStat[i].llSum = 0;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * StatsAdd: Accumulate the actual power values of a telegram.
+ *------------------------------------------------------------------------------------------------*/
+void StatsAdd(PowerStats *pxStats, const DsmrReading *pxReading)
+{
+    pxStats->uCount++;
+    for (int i = 0; i < cnStatChannels; i++) {
+        PowerStat *pxStat = &pxStats->axStat[i];
+        long lValue = StatValue(pxReading, i);
+
+        if (lValue < pxStat->lMin)
+            pxStat->lMin = lValue;
+        if (lValue > pxStat->lMax)
+            pxStat->lMax = lValue;
+        pxStat->lLast = lValue;
+        pxStat->llSum += lValue;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * StatMean: Mean of a channel (rounded to the nearest W), 0 if nothing was accumulated.
+ *------------------------------------------------------------------------------------------------*/
+long StatMean(const PowerStat *pxStat, uint32_t uCount)
+{
+    if (uCount == 0)
+        return 0;
+    int64_t llHalf = pxStat->llSum < 0 ? -(int64_t)(uCount / 2) : (int64_t)(uCount / 2);
+    return (long)((pxStat->llSum + llHalf) / (int64_t)uCount);
+}
+
+/*--- Write the statistics of one channel as an object, with its energy (mWh) if there is one ---*/
+static void JsonStat(JsonWriter *pxWriter, const char *pchKey, const PowerStats *pxStats, int nChannel, const long *plEnergy)
+{
+    const PowerStat *pxStat = &pxStats->axStat[nChannel];
+
+    JsonOpen(pxWriter, pchKey);
+    JsonNumber(pxWriter, "min", pxStats->uCount ? pxStat->lMin : 0);
+    JsonNumber(pxWriter, "max", pxStats->uCount ? pxStat->lMax : 0);
+    JsonNumber(pxWriter, "avg", StatMean(pxStat, pxStats->uCount));
+    JsonNumber(pxWriter, "last", pxStat->lLast);
+    if (plEnergy) {
+        char achEnergy[cnLongTextLen + 1];
+        JsonText(pxWriter, "energy", FormatFixed(plEnergy[nChannel], 3, achEnergy)); //Wh, 3 decimals
+    }
+    JsonClose(pxWriter);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * JsonStats: Write the sample count and the statistics of all channels as members.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	JsonWriter *pxWriter - document being written
+ *  const PowerStats *pxStats - accumulated statistics
+ *  const long *plEnergy - energy per channel in mWh, NULL to leave it out
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void JsonStats(JsonWriter *pxWriter, const PowerStats *pxStats, const long *plEnergy)
+{
+    static const char *const apchGroup[] = { "use", "return" };
+    static const char *const apchKey[] = { "total", "L1", "L2", "L3" };
+
+    JsonNumber(pxWriter, "samples", pxStats->uCount);
+    for (int nGroup = 0; nGroup < 2; nGroup++) {
+        JsonOpen(pxWriter, apchGroup[nGroup]);
+        for (int i = 0; i < 4; i++)
+            JsonStat(pxWriter, apchKey[i], pxStats, nGroup * 4 + i, plEnergy);
+        JsonClose(pxWriter);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * StatsToJson: Serialize the statistics of an interval.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Same style as the readings document (all values quoted, in W):
+ *  {"samples":"10","use":{"total":{"min":..,"max":..,"avg":..,"last":..},"L1":{..},"L2":{..},
+ *  "L3":{..}},"return":{..same..}}
+ *INPUT:
+ *	const PowerStats *pxStats - accumulated statistics
+ *  char *pchBuf - output buffer
+ *  int nSize - size of the output buffer
+ *OUTPUT:
+ *	(int) length of the document (excluding the terminating '\0'), -1 if it did not fit.
+ *------------------------------------------------------------------------------------------------*/
+int StatsToJson(const PowerStats *pxStats, char *pchBuf, int nSize)
+{
+    JsonWriter xWriter;
+
+    JsonBegin(&xWriter, pchBuf, nSize);
+    JsonStats(&xWriter, pxStats, NULL);
+    return JsonEnd(&xWriter);
+}
+#endif
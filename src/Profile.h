@@ -0,0 +1,204 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "Platform.h"
+#include "DsmrJson.h"
+
+/*==================================================================================================*
+ * Timing of the pipeline stages.
+ *
+ * Built with -D DSMR_PROFILE, the time spent in every stage of the pipeline is measured with the
+ * CPU cycle counter (ESP.getCycleCount(), or the monotonic clock in host builds) and counted in a
+ * fixed-bucket histogram per stage. The per-byte stages (read, parse, decode) are summed over a
+ * telegram and counted once per telegram; the others once per call. Without DSMR_PROFILE the
+ * PROFILE_* macros expand to nothing and there is no cost at all.
+ *
+ * Bucket 0 counts durations below 1 us, bucket n (n >= 1) those of 2^(n-1) up to 2^n us; the last
+ * bucket everything longer. Percentiles are reported as the upper bound of their bucket (capped at
+ * the exact maximum), so they are accurate to a factor of two.
+ *==================================================================================================*/
+
+/*--- Stages of the pipeline ---*/
+enum ProfileStage : uint8_t
+{
+    PROFILE_READ,               //Taking the bytes from the P1 receive buffer (per telegram)
+    PROFILE_PARSE,              //Parser: CRC16, OBIS reference, value groups (per telegram)
+    PROFILE_DECODE,             //Decoding the completed lines into the readings (per telegram)
+    PROFILE_SERIALIZE,          //Writing the JSON document (per publish)
+    PROFILE_PUBLISH,            //Handing the document to the MQTT client (per publish)
+    PROFILE_LOOP,               //One pass of loop()
+    PROFILE_STAGES
+};
+
+#ifdef DSMR_PROFILE
+#ifndef ARDUINO
+#include <time.h>
+#endif
+
+const int cnProfileBuckets = 20;    //Up to 2^18 us (262 ms), the last bucket is open-ended
+const int cnProfileTelegramStages = PROFILE_DECODE + 1; //Stages summed per telegram
+static const char achProfileStage[PROFILE_STAGES][10] PROGMEM = {
+    "read", "parse", "decode", "serialize", "publish", "loop"
+};
+
+struct ProfileHistogram
+{
+    uint32_t uCount;                //Samples
+    uint32_t uMax;                  //Longest sample (us)
+    uint64_t ullSum;                //Sum of the samples (us), for the mean
+    uint32_t auBucket[cnProfileBuckets];
+};
+
+struct Profile
+{
+    uint32_t auTelegram[cnProfileTelegramStages];   //Ticks of the per-telegram stages so far
+    ProfileHistogram axStage[PROFILE_STAGES];
+};
+Profile xProfile;
+
+/*--- Current time in ticks: CPU cycles on the ESP8266, nanoseconds in host builds ---*/
+static inline uint32_t ProfileTicks(void)
+{
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    struct timespec xTime;
+    clock_gettime(CLOCK_MONOTONIC, &xTime);
+    return (uint32_t)((uint64_t)xTime.tv_sec * 1000000000ULL + xTime.tv_nsec);
+#endif
+}
+
+static inline uint32_t ProfileTicksToUs(uint32_t uTicks)
+{
+#ifdef ARDUINO
+    return uTicks / ESP.getCpuFreqMHz();
+#else
+    return uTicks / 1000;
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ProfileRecord: Count a duration in the histogram of a stage.
+ *------------------------------------------------------------------------------------------------*/
+void ProfileRecord(ProfileStage nStage, uint32_t uTicks)
+{
+    ProfileHistogram *pxHistogram = &xProfile.axStage[nStage];
+    uint32_t uUs = ProfileTicksToUs(uTicks);
+    int nBucket = 0;
+
+    while (nBucket < cnProfileBuckets - 1 && (uUs >> nBucket))
+        nBucket++;
+    pxHistogram->auBucket[nBucket]++;
+    pxHistogram->uCount++;
+    pxHistogram->ullSum += uUs;
+    if (uUs > pxHistogram->uMax)
+        pxHistogram->uMax = uUs;
+}
+
+/*--- Add the time since *puTick to a per-telegram stage, and restart the measurement ---*/
+static inline void ProfileAdd(ProfileStage nStage, uint32_t *puTick)
+{
+    uint32_t uNow = ProfileTicks();
+    xProfile.auTelegram[nStage] += uNow - *puTick;
+    *puTick = uNow;
+}
+
+/*--- Count the time since *puTick in the histogram of a stage, and restart the measurement ---*/
+static inline void ProfileSample(ProfileStage nStage, uint32_t *puTick)
+{
+    uint32_t uNow = ProfileTicks();
+    ProfileRecord(nStage, uNow - *puTick);
+    *puTick = uNow;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ProfileTelegram: Count the per-telegram stages at the end of a telegram and start over.
+ *------------------------------------------------------------------------------------------------*/
+void ProfileTelegram(void)
+{
+    for (int i = 0; i < cnProfileTelegramStages; i++) {
+        ProfileRecord((ProfileStage)i, xProfile.auTelegram[i]);
+        xProfile.auTelegram[i] = 0;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ProfileReset: Clear the histograms, to start a new interval.
+ *------------------------------------------------------------------------------------------------*/
+void ProfileReset(void)
+{
+    memset(xProfile.axStage, 0, sizeof(xProfile.axStage));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ProfilePercentile: Estimate a percentile of a histogram (us).
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	const ProfileHistogram *pxHistogram - histogram
+ *  uint32_t uPermille - percentile in 1/1000, e.g. 990 for p99
+ *OUTPUT:
+ *	(uint32_t) upper bound of the bucket holding the percentile, at most the maximum; 0 if empty.
+ *------------------------------------------------------------------------------------------------*/
+uint32_t ProfilePercentile(const ProfileHistogram *pxHistogram, uint32_t uPermille)
+{
+    uint64_t ullRank = ((uint64_t)pxHistogram->uCount * uPermille + 999) / 1000; //Samples at or below it
+    uint64_t ullSeen = 0;
+
+    for (int n = 0; n < cnProfileBuckets - 1; n++) {
+        ullSeen += pxHistogram->auBucket[n];
+        if (ullSeen >= ullRank && ullSeen > 0) {
+            uint32_t uBound = n == 0 ? 0 : (1UL << n) - 1;
+            return uBound < pxHistogram->uMax ? uBound : pxHistogram->uMax;
+        }
+    }
+    return pxHistogram->uMax;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ProfileToJson: Serialize the histograms of all stages.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	{"interval":"60000","read":{"count":"6","p50":"127","p99":"255","max":"161","avg":"98"},
+ *  "parse":{..},"decode":{..},"serialize":{..},"publish":{..},"loop":{..}}, all times in us.
+ *INPUT:
+ *	unsigned long ulInterval - length of the interval the histograms cover (ms)
+ *  char *pchBuf - output buffer
+ *  int nSize - size of the output buffer
+ *OUTPUT:
+ *	(int) length of the document (excluding the terminating '\0'), -1 if it did not fit.
+ *------------------------------------------------------------------------------------------------*/
+int ProfileToJson(unsigned long ulInterval, char *pchBuf, int nSize)
+{
+    char achName[sizeof(achProfileStage[0])];
+    JsonWriter xWriter;
+
+    JsonBegin(&xWriter, pchBuf, nSize);
+    JsonNumber(&xWriter, "interval", (long)ulInterval);
+    for (int i = 0; i < PROFILE_STAGES; i++) {
+        const ProfileHistogram *pxHistogram = &xProfile.axStage[i];
+
+        memcpy_P(achName, achProfileStage[i], sizeof(achName));
+        JsonOpen(&xWriter, achName);
+        JsonNumber(&xWriter, "count", (long)pxHistogram->uCount);
+        JsonNumber(&xWriter, "p50", (long)ProfilePercentile(pxHistogram, 500));
+        JsonNumber(&xWriter, "p99", (long)ProfilePercentile(pxHistogram, 990));
+        JsonNumber(&xWriter, "max", (long)pxHistogram->uMax);
+        JsonNumber(&xWriter, "avg", pxHistogram->uCount ? (long)(pxHistogram->ullSum / pxHistogram->uCount) : 0);
+        JsonClose(&xWriter);
+    }
+    return JsonEnd(&xWriter);
+}
+
+#define PROFILE_BEGIN(uTick) uint32_t uTick = ProfileTicks()
+#define PROFILE_RESTART(uTick) uTick = ProfileTicks()
+#define PROFILE_ADD(nStage, uTick) ProfileAdd(nStage, &uTick)
+#define PROFILE_SAMPLE(nStage, uTick) ProfileSample(nStage, &uTick)
+#define PROFILE_TELEGRAM() ProfileTelegram()
+#else
+#define PROFILE_BEGIN(uTick)
+#define PROFILE_RESTART(uTick) (void)0
+#define PROFILE_ADD(nStage, uTick) (void)0
+#define PROFILE_SAMPLE(nStage, uTick) (void)0
+#define PROFILE_TELEGRAM() (void)0
+#endif
+#endif
@@ -0,0 +1,135 @@
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include "Platform.h"
+#include "CRC16.h"
+
+/*==================================================================================================*
+ * Small state records that survive a reboot.
+ *
+ * A record is a fixed size struct stored in a file of its own, followed by a CRC16 over its
+ * contents. LittleFS only makes the new contents visible when the file is closed, so a power loss
+ * during a save leaves the previous record; the CRC catches anything else (and a record of an older
+ * layout, which has a different size). Save records only when they change in a meaningful way, not
+ * for every telegram, to spare the flash.
+ *
+ * The storage is selected at build time with -D STATE_BACKEND=...: LittleFS on the ESP8266, or RAM
+ * in host builds.
+ *==================================================================================================*/
+
+#define STATE_BACKEND_LITTLEFS 0    //One file per record on LittleFS
+#define STATE_BACKEND_RAM 1         //Records in RAM (host builds)
+
+#ifndef STATE_BACKEND
+#ifdef ARDUINO
+#define STATE_BACKEND STATE_BACKEND_LITTLEFS
+#else
+#define STATE_BACKEND STATE_BACKEND_RAM
+#endif
+#endif
+
+const int cnStateMaxLen = 64;       //Largest record (excluding the CRC)
+
+#if STATE_BACKEND == STATE_BACKEND_LITTLEFS
+#include <LittleFS.h>
+#else
+const int cnStateRamRecords = 4;    //Records kept
+struct StateRamRecord
+{
+    const char *pchName;            //File name the record was saved as, NULL = unused
+    int nLen;                       //Length of the record, including the CRC
+    uint8_t auData[cnStateMaxLen + 2];
+};
+StateRamRecord axStateRam[cnStateRamRecords];
+
+/*--- RAM slot of a record, a free one if bCreate, or NULL ---*/
+static StateRamRecord *StateRamFind(const char *pchName, bool bCreate)
+{
+    for (int i = 0; i < cnStateRamRecords; i++)
+        if (axStateRam[i].pchName && strcmp(axStateRam[i].pchName, pchName) == 0)
+            return &axStateRam[i];
+    for (int i = 0; bCreate && i < cnStateRamRecords; i++)
+        if (!axStateRam[i].pchName)
+            return &axStateRam[i];
+    return NULL;
+}
+#endif
+
+/*------------------------------------------------------------------------------------------------*
+ * StateLoad: Load a record saved with StateSave().
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	const char *pchName - file name, e.g. "/demand.bin"
+ *  void *pvData - receives the record
+ *  int nLen - size of the record, at most cnStateMaxLen
+ *OUTPUT:
+ *	(bool) true if loaded, false if there is no (valid) record; pvData is unchanged then.
+ *------------------------------------------------------------------------------------------------*/
+bool StateLoad(const char *pchName, void *pvData, int nLen)
+{
+    uint8_t auCrc[2];
+
+    if (nLen > cnStateMaxLen)
+        return false;
+#if STATE_BACKEND == STATE_BACKEND_LITTLEFS
+    if (!LittleFS.begin())
+        return false;
+    File hFile = LittleFS.open(pchName, "r");
+    if (!hFile)
+        return false;
+    bool bOk = (int)hFile.size() == nLen + 2;
+    uint8_t auData[cnStateMaxLen];  //Don't touch pvData before the record is checked
+    bOk = bOk && hFile.read(auData, nLen) == nLen && hFile.read(auCrc, 2) == 2;
+    hFile.close();
+#else
+    StateRamRecord *pxRecord = StateRamFind(pchName, false);
+    bool bOk = pxRecord && pxRecord->nLen == nLen + 2;
+    const uint8_t *auData = pxRecord ? pxRecord->auData : NULL;
+    if (bOk)
+        memcpy(auCrc, auData + nLen, 2);
+#endif
+    if (!bOk || Crc16(0x0000, (unsigned char *)auData, nLen) != (uint16_t)(auCrc[0] | (auCrc[1] << 8)))
+        return false;
+    memcpy(pvData, auData, nLen);
+    return true;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * StateSave: Save a record, replacing the previous one.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	const char *pchName - file name, e.g. "/demand.bin"
+ *  const void *pvData - record to save
+ *  int nLen - size of the record, at most cnStateMaxLen
+ *OUTPUT:
+ *	(bool) true if saved, false if the storage is not available or full.
+ *------------------------------------------------------------------------------------------------*/
+bool StateSave(const char *pchName, const void *pvData, int nLen)
+{
+    if (nLen > cnStateMaxLen)
+        return false;
+
+    uint16_t uCrc = Crc16(0x0000, (unsigned char *)pvData, nLen);
+    uint8_t auCrc[2] = { (uint8_t)uCrc, (uint8_t)(uCrc >> 8) };
+
+#if STATE_BACKEND == STATE_BACKEND_LITTLEFS
+    if (!LittleFS.begin())
+        return false;
+    File hFile = LittleFS.open(pchName, "w");
+    if (!hFile)
+        return false;
+    bool bOk = hFile.write((const uint8_t *)pvData, nLen) == (size_t)nLen && hFile.write(auCrc, 2) == 2;
+    hFile.close();
+    return bOk;
+#else
+    StateRamRecord *pxRecord = StateRamFind(pchName, true);
+    if (!pxRecord)
+        return false;
+    pxRecord->pchName = pchName;
+    pxRecord->nLen = nLen + 2;
+    memcpy(pxRecord->auData, pvData, nLen);
+    memcpy(pxRecord->auData + nLen, auCrc, 2);
+    return true;
+#endif
+}
+#endif
@@ -0,0 +1,176 @@
+#ifndef WIFILINK_H
+#define WIFILINK_H
+
+#include <ESP8266WiFi.h>
+#include "Backoff.h"
+
+/*==================================================================================================*
+ * WiFi link manager.
+ *
+ * Brings up the WiFi station and keeps it up without ever blocking: the SDK's connect and
+ * disconnect events only set flags, WifiLinkPoll() (called from loop()) acts on them, starts
+ * connection attempts with jittered exponential backoff and gives up on an attempt that takes too
+ * long. The SDK's own auto-reconnect is switched off, so all (re)connects follow the backoff.
+ * Outages are measured: number of disconnects, duration of the last and the longest outage, total
+ * downtime and the duration of the attempt that restored the link.
+ *==================================================================================================*/
+
+const unsigned long culWifiAttemptTimeout = 20000UL;   //Give up on a connection attempt after 20s
+
+/*--- Link states ---*/
+enum WifiLinkState : uint8_t
+{
+    WIFI_LINK_DOWN,                 //Not connected, waiting for the next attempt
+    WIFI_LINK_CONNECTING,           //Connection attempt in progress
+    WIFI_LINK_UP                    //Connected, with an IP address
+};
+
+/*--- Result of a WifiLinkPoll() ---*/
+enum WifiLinkEvent : uint8_t
+{
+    WIFI_LINK_EVENT_NONE,           //Nothing changed
+    WIFI_LINK_EVENT_UP,             //Link (re)established
+    WIFI_LINK_EVENT_DOWN,           //Link lost
+    WIFI_LINK_EVENT_FAILED          //Connection attempt failed, next one is scheduled
+};
+
+struct WifiLink
+{
+    WifiLinkState nState;
+    volatile bool bGotIp;           //Set by the SDK event handler: got an IP address
+    volatile bool bLost;            //Set by the SDK event handler: station disconnected
+    const char *pchSsid;
+    const char *pchPwd;
+    Backoff xBackoff;               //Schedule of the connection attempts
+    unsigned long ulAttempt;        //Time (millis) the current attempt started
+    unsigned long ulDownSince;      //Time (millis) the link went down (or boot)
+    uint32_t uConnects;             //Times the link came up
+    uint32_t uDisconnects;          //Times the link was lost
+    unsigned long ulLastAttempt;    //Duration (ms) of the attempt that brought the link up last
+    unsigned long ulLastOutage;     //Duration (ms) of the last outage
+    unsigned long ulLongestOutage;  //Duration (ms) of the longest outage since boot
+    unsigned long ulTotalDown;      //Total duration (ms) of the finished outages since boot
+};
+
+/*--- SDK event subscriptions, they are cancelled when the handles are destroyed ---*/
+WiFiEventHandler hWifiGotIp;
+WiFiEventHandler hWifiLost;
+
+/*------------------------------------------------------------------------------------------------*
+ * WifiLinkBegin: Set up the WiFi station; the first connection attempt starts at the next poll.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	WifiLink *pxLink - link state
+ *  const char *pchSsid - network name
+ *  const char *pchPwd - network password
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void WifiLinkBegin(WifiLink *pxLink, const char *pchSsid, const char *pchPwd)
+{
+    memset(pxLink, 0, sizeof(*pxLink));
+    pxLink->nState = WIFI_LINK_DOWN;
+    pxLink->pchSsid = pchSsid;
+    pxLink->pchPwd = pchPwd;
+    pxLink->ulDownSince = millis();
+    BackoffReset(&pxLink->xBackoff, millis(), ESP.random());
+
+    WiFi.persistent(false);         //Don't write the credentials to flash on every begin()
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);   //We reconnect ourselves, with backoff
+
+    hWifiGotIp = WiFi.onStationModeGotIP([pxLink](const WiFiEventStationModeGotIP &) {
+        pxLink->bGotIp = true;
+    });
+    hWifiLost = WiFi.onStationModeDisconnected([pxLink](const WiFiEventStationModeDisconnected &) {
+        pxLink->bLost = true;
+    });
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * WifiLinkUp: Check if the link is up.
+ *------------------------------------------------------------------------------------------------*/
+bool WifiLinkUp(const WifiLink *pxLink)
+{
+    return pxLink->nState == WIFI_LINK_UP;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * WifiLinkDowntime: Total downtime (ms) since boot, including a current outage.
+ *------------------------------------------------------------------------------------------------*/
+unsigned long WifiLinkDowntime(const WifiLink *pxLink)
+{
+    if (pxLink->nState == WIFI_LINK_UP)
+        return pxLink->ulTotalDown;
+    return pxLink->ulTotalDown + (millis() - pxLink->ulDownSince);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * WifiLinkPoll: Advance the link state machine; call it from every loop().
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Handles the flags set by the SDK events, starts a connection attempt when one is due, and
+ *  abandons an attempt after culWifiAttemptTimeout. Never waits.
+ *INPUT:
+ *	WifiLink *pxLink - link state
+ *OUTPUT:
+ *	(WifiLinkEvent) what changed, WIFI_LINK_EVENT_NONE most of the time.
+ *------------------------------------------------------------------------------------------------*/
+WifiLinkEvent WifiLinkPoll(WifiLink *pxLink)
+{
+    unsigned long ulNow = millis();
+    bool bFailed = false;
+
+    /*--- Link lost, or an attempt rejected (wrong password, no access point) ---*/
+    if (pxLink->bLost) {
+        pxLink->bLost = false;
+        if (pxLink->nState == WIFI_LINK_UP) {
+            pxLink->nState = WIFI_LINK_DOWN;
+            pxLink->ulDownSince = ulNow;
+            pxLink->uDisconnects++;
+            pxLink->xBackoff.ulNextTry = ulNow; //First attempt right away
+            return WIFI_LINK_EVENT_DOWN;
+        }
+        bFailed = (pxLink->nState == WIFI_LINK_CONNECTING);
+    }
+
+    /*--- Got an IP address: the link is up ---*/
+    if (pxLink->bGotIp) {
+        pxLink->bGotIp = false;
+        if (pxLink->nState != WIFI_LINK_UP) {
+            pxLink->nState = WIFI_LINK_UP;
+            pxLink->uConnects++;
+            pxLink->ulLastAttempt = ulNow - pxLink->ulAttempt;
+            pxLink->ulLastOutage = ulNow - pxLink->ulDownSince;
+            if (pxLink->ulLastOutage > pxLink->ulLongestOutage)
+                pxLink->ulLongestOutage = pxLink->ulLastOutage;
+            pxLink->ulTotalDown += pxLink->ulLastOutage;
+            BackoffSucceeded(&pxLink->xBackoff);
+            return WIFI_LINK_EVENT_UP;
+        }
+    }
+
+    switch (pxLink->nState) {
+    case WIFI_LINK_DOWN:
+        if (BackoffDue(&pxLink->xBackoff, ulNow)) {
+            WiFi.begin(pxLink->pchSsid, pxLink->pchPwd);
+            pxLink->nState = WIFI_LINK_CONNECTING;
+            pxLink->ulAttempt = ulNow;
+        }
+        break;
+
+    case WIFI_LINK_CONNECTING:
+        if (bFailed || ulNow - pxLink->ulAttempt >= culWifiAttemptTimeout) {
+            WiFi.disconnect();
+            BackoffFailed(&pxLink->xBackoff, ulNow);
+            pxLink->nState = WIFI_LINK_DOWN;
+            return WIFI_LINK_EVENT_FAILED;
+        }
+        break;
+
+    default:
+        break;
+    }
+    return WIFI_LINK_EVENT_NONE;
+}
+#endif
@@ -95,15 +95,19 @@
  *      }
  * 
  * All power readings are specified in Wh, gas reading is 1/1000 dm3.
+ * All other objects the meter sends (see OBIS.h) are added as a "meter" object, e.g.
+ * "meter": { "id": "E0016021687934515", "failures": "15", "voltage_L1": "230.1", ... }.
+ * The M-Bus devices (gas, water, heat, ...) on channel 1-4 are added as an "mbus" array, e.g.
+ * "mbus": [ { "channel": "1", "type": "3", "device": "gas", "time": "180924130000S", "value": "4890.857", "unit": "m3" } ].
  * 
  * The advantage of using a nested JSON structure like above is that we can add
  * elements without affecting existing logic to extract values. 
  *
  * NOTE:
  * The default MQTT packet size of the used Arduino PubSubClient library is too small for
- * the messages we are sending. Increase it to 512 in the PubSubClient.h file.
- * Be aware that adding a '#define MQTT_MAX_PACKET_SIZE' to this source file before the include
- * doesn't work because of the order the library headers are processed during pre-compile!
+ * the messages we are sending. It is increased at startup with setBufferSize() (PubSubClient 2.8+).
+ * Adding a '#define MQTT_MAX_PACKET_SIZE' to this source file before the include doesn't work
+ * because of the order the library headers are processed during pre-compile!
  * See also: https://github.com/knolleary/pubsubclient/issues/431.
  *
  *VERSION HISTORY:
@@ -137,17 +141,29 @@
 #include <Arduino.h>
 #include <ArduinoOTA.h>
 
-#include <SoftwareSerial.h>
 #include <ESP8266WiFi.h>
 #include <ESP8266mDNS.h>
 #include <WiFiUdp.h>
+#include <lwip/dns.h>   // Non-blocking name lookup of the broker
 
 #include <TimeLib.h>
-#include <PubSubClient.h>   // Increase MQTT_MAX_PACKET_SIZE to 512 (default 128) !!
-#include <ArduinoJson.h>
-#include <ctype.h>
-
-#include "CRC16.h"
+#include <PubSubClient.h>   // Packet buffer is increased at runtime, see cuMqttPacketLen
+
+#include "Backoff.h"
+#include "MqttLink.h"
+#include "DsmrReading.h"
+#include "DsmrJson.h"
+#include "DsmrBinary.h"
+#include "DsmrTopics.h"
+#include "Journal.h"
+#include "PowerStats.h"
+#include "Aggregate.h"
+#include "Demand.h"
+#include "MqttBatch.h"
+#include "Profile.h"
+#include "Diagnostics.h"
+#include "P1Reader.h"
+#include "WifiLink.h"
 #include "secrets.h"        // Contains all the super secret stuff (not committed to GitHub!)
 
 
@@ -166,11 +182,59 @@ const PROGMEM char *MQTT_CLIENT_ID = "dsmrv4";                  //MQTT Client ID
 const PROGMEM char *MQTT_SERVER = "mosquitto.moerman.online";   //MQTT Server (Mosquitto)
 const PROGMEM unsigned int MQTT_SERVER_PORT = 1883;             //Port# on the MQTT Server
 const PROGMEM char *MQTT_TOPIC = "sensor/dsmr";                 //MQTT topic to create and publish to
+const PROGMEM char *MQTT_DELTA_TOPIC = "sensor/dsmr/delta";     //MQTT topic for changed fields only (MQTT_DELTA)
+const PROGMEM char *MQTT_BINARY_TOPIC = "sensor/dsmr/bin";       //MQTT topic for the binary payload (MQTT_BINARY)
+const PROGMEM char *MQTT_STATS_TOPIC = "sensor/dsmr/stats";     //MQTT topic for the interval statistics (MQTT_DECIMATE)
+const PROGMEM char *MQTT_AGGREGATE_TOPIC = "sensor/dsmr/aggregate"; //MQTT topic base for the windows (MQTT_AGGREGATE)
+const PROGMEM char *MQTT_BACKLOG_TOPIC = "sensor/dsmr/backlog"; //MQTT topic for readings sent late (MQTT_JOURNAL)
+const PROGMEM char *MQTT_DIAG_TOPIC = "sensor/dsmr/diag";       //MQTT topic for the health counters (MQTT_DIAG)
+const PROGMEM char *MQTT_PROFILE_TOPIC = "sensor/dsmr/stats/timing"; //MQTT topic for the stage timing (DSMR_PROFILE)
+
+/*--- Delta publishing: publish only the changed fields on MQTT_DELTA_TOPIC and the complete
+      (retained) document on MQTT_TOPIC every MQTT_KEYFRAME_INTERVAL milliseconds ---*/
+// #define MQTT_DELTA                                              //Enable delta publishing
+#define MQTT_KEYFRAME_INTERVAL 300000UL                         //Complete document every 5 minutes
+
+/*--- Per-field topics: also publish every value (retained) on its own topic below MQTT_TOPIC,
+      e.g. sensor/dsmr/power/use/actual/L1 ---*/
+// #define MQTT_FIELD_TOPICS                                       //Enable per-field topics
+
+/*--- Decimation, for DSMR 5 meters sending a telegram every second: publish at most once every
+      MQTT_DECIMATE milliseconds, with the min/max/avg/last of the actual power values over all
+      telegrams of the interval on MQTT_STATS_TOPIC ---*/
+// #define MQTT_DECIMATE 10000UL                                   //Enable decimation, publish every 10s
+
+/*--- Aggregation: publish the min/max/avg/last and the energy of the actual power values over
+      1 minute, 15 minute and 1 hour windows to MQTT_AGGREGATE_TOPIC/1m, /15m and /1h at the end
+      of every window ---*/
+// #define MQTT_AGGREGATE                                          //Enable the aggregation windows
+
+/*--- Capacity tariff: add the energy used in the current quarter-hour, its running average demand,
+      the demand of the last quarter and the peaks of this and the previous month to the JSON
+      document (the state is kept in flash over reboots) ---*/
+// #define MQTT_DEMAND                                             //Enable the demand figures
+
+/*--- Binary payload: also publish the readings (retained) in the 112 byte binary layout of
+      DsmrBinary.h on MQTT_BINARY_TOPIC ---*/
+// #define MQTT_BINARY                                             //Enable the binary payload
+
+/*--- Store-and-forward: readings that could not be published are queued in flash (LittleFS) and
+      sent to MQTT_BACKLOG_TOPIC, oldest first, once the broker is reachable again ---*/
+#define MQTT_JOURNAL                                            //Enable the store-and-forward journal
+#define JOURNAL_DRAIN_INTERVAL 200UL                            //Milliseconds between queued readings sent
+
+/*--- Diagnostics: publish the health and pipeline counters (telegrams, CRC failures, reconnects,
+      heap, RSSI, ...) retained to MQTT_DIAG_TOPIC every MQTT_DIAG milliseconds ---*/
+#define MQTT_DIAG 300000UL                                      //Enable diagnostics, publish every 5 minutes
+
+/*--- Stage timing: built with -D DSMR_PROFILE (see platformio.ini and Profile.h), the timing
+      histograms of the pipeline stages are published to MQTT_PROFILE_TOPIC every interval ---*/
+#define PROFILE_INTERVAL 60000UL                                //Publish the timing every minute
 
 /*--- Define serial input ---*/
-#define SERIAL_RX D5                                            //P1 serial input pin
-#define BAUDRATE 115200                                         //DSMRv4 runs P1 port at 115,200 baud,
-#define SERIAL_CONFIG SWSERIAL_8N1                              //  8 data bits, no parity, 1 stop bit (8N1)
+#define SERIAL_RX D5                                            //P1 serial input pin (SoftwareSerial backend only)
+#define BAUDRATE 115200                                         //DSMRv4 runs P1 port at 115,200 baud, 8N1
+                                                                //  (select the input backend with P1_BACKEND, see P1Reader.h)
 
 /*--- Define OTA port ---*/
 #define OTA_PORT 8266                                           //This is the default port for Arduino OTA library.
@@ -183,25 +247,16 @@ const PROGMEM char *MQTT_TOPIC = "sensor/dsmr";                 //MQTT topic to
 
 #define SENSOR_VERSION "0.9"                                    //Sensor client software version
 
-/*--- DSMR definitions ---*/
-#define DSMR_VERSION "1-3:0.2.8"                //DSMR version
-#define DSMR_PWR_TIMESTAMP "0-0:1.0.0"          //P1 telegram timestamp
-#define DSMR_PWR_LOW "1-0:1.8.1"                //Power consumption meter (low tariff)
-#define DSMR_PWR_HIGH "1-0:1.8.2"               //Power consumption meter (high tariff)
-#define DSMR_RET_LOW "1-0:2.8.1"                //Power return meter (low tariff)
-#define DSMR_RET_HIGH "1-0:2.8.2"               //Power return meter (high tariff)
-#define DSMR_PWR_ACTUAL "1-0:1.7.0"             //Power consumption actual
-#define DSMR_PWR_L1 "1-0:21.7.0"                //Power consumption L1 actual
-#define DSMR_PWR_L2 "1-0:41.7.0"                //Power consumption L2 actual
-#define DSMR_PWR_L3 "1-0:61.7.0"                //Power consumption L3 actual
-#define DSMR_RET_L1 "1-0:22.7.0"                //Power return L1 actual
-#define DSMR_RET_L2 "1-0:42.7.0"                //Power return L2 actual
-#define DSMR_RET_L3 "1-0:62.7.0"                //Power return L3 actual
-#define DSMR_RET_ACTUAL "1-0:2.7.0"             //Power return actual
-#define DSMR_PWR_TARIFF "0-0:96.14.0"           //Power current tariff (1=Low,2=High)
-#define DSMR_GAS_METER "0-1:24.2.1"             //Gas on Kaifa MA105 + Landis+Gyr 350 meters
-
-const int cnLineLen = 250;                                      //Longest normal line is 201 char (+3 for \r\n\0)
+const int cnPayloadLen = 1600;                                  //MQTT message buffer, the JSON document is ~800 bytes
+                                                                //  with all generic objects and the demand figures,
+                                                                //  up to ~1570 with all 4 M-Bus channels in use,
+                                                                //  an aggregation window up to ~750 bytes
+const uint16_t cuMqttPacketLen = 1700;                          //PubSubClient packet buffer (payload + topic + header)
+const int cnMaxBytesPerLoop = 256;                              //Bytes parsed per loop() before servicing MQTT/OTA
+const unsigned long culP1BufferTime = cnP1BufLen * 10000UL / BAUDRATE; //Time (ms) the P1 receive buffer lasts, 10 bits/byte
+const unsigned long culMqttTcpTimeout = culP1BufferTime * 2 / 3; //Longest the TCP connect to the broker may block, ~14ms
+                                                                //  with SoftwareSerial (broker on the LAN), ~118ms with the UART
+const uint16_t cuMqttSocketTimeout = 1;                         //Seconds to wait for the broker's CONNACK (P1 is pumped meanwhile)
 
 #define MQTT_VERSION MQTT_VERSION_3_1_1                         //The MQTT version we use
 
@@ -209,87 +264,98 @@ const int cnLineLen = 250;                                      //Longest normal
  *                           G L O B A L   V A R I A B L E S                                        *
  *==================================================================================================*/
 
-/*--- Variables to store the relevant meter readings ---*/
-long lDsmrVersion = 0;          //DSMR telegram version number
-char achPwrTime[16];            //Timestamp of power reading
-long lPwrLow = 0;               //Power consumption low tariff
-long lPwrHigh = 0;              //Power consumption high tariff
-long lPwrActual = 0;            //Power actual consumption
-long lPwrL1 = 0;                //Power actual L1 consumption
-long lPwrL2 = 0;                //Power actual L2 consumption
-long lPwrL3 = 0;                //Power actual L3 consumption
-long lReturnLow = 0;            //Power return low tariff (solar panels)
-long lReturnHigh = 0;           //Power return high tariff (solar panels)
-long lReturnActual = 0;         //Power actual return (solar panels)
-long lReturnL1 = 0;             //Power actual L1 return
-long lReturnL2 = 0;             //Power actual L2 return
-long lReturnL3 = 0;             //Power actual L3 return
-long lPwrTariff = 0;            //Active power tariff (T1 or T2)
-char achGasTime[16];            //Timestamp of gas reading
-long lGasMeter = 0;             //Gas meter reading (~hourly updated)
-
-/*--- Buffer for storing and processing a line of the P1 telegram --- */
-char achTelegram[cnLineLen];
-
-/*--- Define the P1 serial interface ---*/
-SoftwareSerial hP1Serial;
-
-/*--- Cumulated CRC16 value ---*/
-unsigned int nCurrentCrc = 0;
-
-/*--- WiFi connection handle/instance ---*/
-WiFiClient hEspClient;
+/*--- The relevant meter readings, committed only for telegrams with a valid CRC16 ---*/
+DsmrSnapshot xSnapshot;
 
-/*--- MQTT PubSub client handle/instance ---*/
-PubSubClient hMqttClient;
+/*--- State of the P1 telegram parser --- */
+P1Parser xParser;
 
-/*==================================================================================================*
- *                                     F U N C T I O N S                                            *
- *==================================================================================================*/
+/*--- Buffer the MQTT message is serialized into ---*/
+char achPayload[cnPayloadLen];
 
-/*------------------------------------------------------------------------------------------------*
- * SetupWiFi: Setup the WiFi connection to the IoT network.
- *------------------------------------------------------------------------------------------------*
- *DESCRIPTION:
- *	Connect to the IoT WiFi network, for now with hard-coded WiFi parameters, by setting the
- *  ESP8266 in STA-mode. In case of failure, retry for 60 seconds and if it still fails, reboot
- *  the system to try allover again.
- *INPUT:
- *	None.
- *OUTPUT:
- *	None. Returns only after succesful connect.
- *NOTES:
- *	For now the WiFi parameters are hard-coded in the program (*to be fixed*).
- *------------------------------------------------------------------------------------------------*/
-void SetupWiFi()
-{
-    delay(10); //Let the SoC WiFi stabilize
+#ifdef MQTT_DELTA
+/*--- Readings last published, to find the changed fields ---*/
+DsmrReading xLastSent;
+bool bKeyframeSent = false;                 //Complete document published at least once
+unsigned long ulLastKeyframe = 0;           //Time (millis) the complete document was last published
+#endif
 
-    /*--- Initialize the WiFi connection ---*/
-    Serial.print("Connecting to "); //Tell the world we are connecting
-    Serial.print(WIFI_SSID);
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(WIFI_SSID, WIFI_PWD);
+#ifdef MQTT_DECIMATE
+/*--- Statistics of the telegrams since the last publish ---*/
+PowerStats xStats;
+bool bDecimating = false;                   //Readings published at least once
+unsigned long ulLastPublish = 0;            //Time (millis) of the last publish
+#endif
 
-    /*--- Wait up to 60 seconds for the connection ---*/
-    int nWait = 60;
-    while (WiFi.status() != WL_CONNECTED)
+#ifdef MQTT_AGGREGATE
+/*--- Aggregation windows ---*/
+Aggregator xAgg;
+#endif
+
+#ifdef MQTT_DEMAND
+/*--- Quarter-hour demand and monthly peak ---*/
+Demand xDemand;
+#endif
+
+#ifdef MQTT_FIELD_TOPICS
+/*--- Buffer the per-field messages are batched in ---*/
+MqttBatch xBatch;
+#endif
+
+#ifdef MQTT_DIAG
+/*--- Health and pipeline counters ---*/
+Diagnostics xDiag;
+bool bDiagSent = false;                     //Diagnostics published at least once
+unsigned long ulLastDiag = 0;               //Time (millis) the diagnostics were last published
+#endif
+
+#ifdef DSMR_PROFILE
+unsigned long ulLastProfile = 0;            //Time (millis) the stage timing was last published
+#endif
+
+#ifdef MQTT_JOURNAL
+/*--- Readings waiting to be sent ---*/
+Journal xJournal;
+unsigned long ulLastDrain = 0;              //Time (millis) a queued reading was last sent
+#endif
+
+/*--- Boot timing, milliseconds since power-on (0 = not yet) ---*/
+unsigned long ulP1Started = 0;              //P1 input started
+unsigned long ulFirstTelegram = 0;          //First telegram with a valid CRC16 received
+unsigned long ulFirstPublish = 0;           //First readings published
+
+/*--- Receive buffer overflows reported so far ---*/
+uint32_t uLastOverflows = 0;
+
+/*--- WiFi link state and outage statistics ---*/
+WifiLink xWifi;
+bool bOtaStarted = false;                   //OTA service started (after the first WiFi connect)
+
+/*--- WiFi connection handle/instance, keeps the P1 input received while the MQTT client waits on it ---*/
+class P1PumpClient : public WiFiClient
+{
+public:
+    int available() override
     {
-        delay(1000);
-        Serial.print(".");
-        if (!--nWait)
-        {
-            /*--- Restart and retry if still not connected ---*/
-            Serial.println("");
-            Serial.println("Connection Failed! Rebooting...");
-            ESP.restart();
-        }
+        P1ReaderPump();
+        return WiFiClient::available();
     }
+};
+P1PumpClient hEspClient;
 
-    /*--- WiFi connection established ---*/
-    Serial.print(" WiFi connected with IP address: "); //Show DHCP-provided IP address on console
-    Serial.println(WiFi.localIP());
-}
+/*--- MQTT PubSub client handle/instance ---*/
+PubSubClient hMqttClient;
+
+/*--- Steps and schedule of the MQTT (re)connect attempts ---*/
+MqttLink xMqttLink;
+
+/*--- Broker address, resolved once per WiFi connect ---*/
+IPAddress xMqttAddress;
+volatile int8_t nMqttResolved = 0;          //Name lookup: 0 = in progress, 1 = resolved, -1 = failed
+
+/*==================================================================================================*
+ *                                     F U N C T I O N S                                            *
+ *==================================================================================================*/
 
 /*------------------------------------------------------------------------------------------------*
  * SetupOTA: Setup for OTA updates.
@@ -309,544 +375,614 @@ void SetupOTA(void)
     //ArduinoOTA.setPassword((const char *)"123456");           //No authentication by default
 
     ArduinoOTA.onStart([]() {
-        Serial.println("OTA Start");
+        CONSOLE.println("OTA Start");
     });
     ArduinoOTA.onEnd([]() {
-        Serial.println("\nOTA End");
+        CONSOLE.println("\nOTA End");
     });
     ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-        Serial.printf("OTA Progress: %u%%\r", (progress / (total / 100)));
+        CONSOLE.printf("OTA Progress: %u%%\r", (progress / (total / 100)));
     });
     ArduinoOTA.onError([](ota_error_t error) {
-        Serial.printf("OTA Error[%u]: ", error);
+        CONSOLE.printf("OTA Error[%u]: ", error);
         if (error == OTA_AUTH_ERROR)
-            Serial.println("Auth Failed");
+            CONSOLE.println("Auth Failed");
         else if (error == OTA_BEGIN_ERROR)
-            Serial.println("Begin Failed");
+            CONSOLE.println("Begin Failed");
         else if (error == OTA_CONNECT_ERROR)
-            Serial.println("Connect Failed");
+            CONSOLE.println("Connect Failed");
         else if (error == OTA_RECEIVE_ERROR)
-            Serial.println("Receive Failed");
+            CONSOLE.println("Receive Failed");
         else if (error == OTA_END_ERROR)
-            Serial.println("End Failed");
+            CONSOLE.println("End Failed");
     });
 
     ArduinoOTA.begin();
 }
 
 /*------------------------------------------------------------------------------------------------*
- * ConnectMqtt: (Re)connect to the MQTT broker.
+ * DoWiFi: Keep the WiFi connection to the IoT network up.
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Check if there is an active MQTT connection. If not try to re-establish a connection for 10
- *  seconds (retry 5 times, every other second), before quiting (to prevent stalling).
+ *	Step the WiFi link manager (see WifiLink.h), for now with hard-coded WiFi parameters. It
+ *  connects and reconnects in the background with backoff, so the P1 input is never held up by
+ *  the network. Reports link changes and outage durations on the console, and starts the OTA
+ *  service the first time the link comes up.
  *INPUT:
  *	None.
  *OUTPUT:
- *	(bool) true if a connection is established (within 10s), false if it failed.
+ *	None.
+ *NOTES:
+ *	For now the WiFi parameters are hard-coded in the program (*to be fixed*).
  *------------------------------------------------------------------------------------------------*/
-bool ConnectMqtt(void)
+void DoWiFi(void)
 {
-    if (!hMqttClient.connected())
-    {
-        Serial.print("Setup MQTT...");
-
-        /*--- Loop until we're (re)connected for 5 seconds ---*/
-        for (int nLoop = 0; nLoop < 5; ++nLoop)
-        {
-            /*--- Attempt to connect ---*/
-            if (hMqttClient.connect(MQTT_CLIENT_ID))
-            {
-                Serial.print("connected as ");
-                Serial.print(MQTT_CLIENT_ID);
-                Serial.print(" with topic ");
-                Serial.println(MQTT_TOPIC);
-                return true; //We're done!
-            }
-            else
-            {
-#ifdef MQTT_DEBUG
-                Serial.print("failed, rc=");
-                Serial.print(hMqttClient.state());
-                Serial.println("");
-#else
-                Serial.print(".");
-#endif
-                yield();
-                delay(1000); //Wait 1s before retrying
-            }
+    switch (WifiLinkPoll(&xWifi)) {
+    case WIFI_LINK_EVENT_UP:
+        CONSOLE.print("WiFi connected with IP address: "); //Show DHCP-provided IP address on console
+        CONSOLE.print(WiFi.localIP());
+        CONSOLE.print(", connect took ");
+        CONSOLE.print(xWifi.ulLastAttempt);
+        CONSOLE.print("ms, down for ");
+        CONSOLE.print(xWifi.ulLastOutage);
+        CONSOLE.println("ms");
+        MqttLinkNetwork(&xMqttLink, true, millis()); //Resolve the broker and connect right away
+        if (!bOtaStarted) {
+            SetupOTA(); //Setup OTA update service
+            bOtaStarted = true;
         }
-        /*--- MQTT connection failed ---*/
-#ifndef MQTT_DEBUG
-        Serial.print("failed, rc=");
-        Serial.print(hMqttClient.state());
-        Serial.println("");
-#endif
-        return false;
+        break;
+    case WIFI_LINK_EVENT_DOWN:
+        CONSOLE.println("WARNING: WIFI CONNECTION LOST!");
+        MqttLinkNetwork(&xMqttLink, false, millis());
+        break;
+    case WIFI_LINK_EVENT_FAILED:
+        CONSOLE.print("WiFi connection to ");
+        CONSOLE.print(WIFI_SSID);
+        CONSOLE.println(" failed, retrying");
+        break;
+    default:
+        break;
     }
-#ifdef MQTT_DEBUG
-    Serial.println("MQTT connecting alive");
-#endif
-
-    // /*--- Increase MQTT buffer size ---*/
-    // if (!hMqttClient.setBufferSize(512)) {
-    //     Serial.println("MQTT buffer increase failed!");
-    //     return false;
-    // }
+}
 
-    return true; //We were already connected
+/*------------------------------------------------------------------------------------------------*
+ * MqttResolved: Name lookup callback of lwIP, runs in the SDK context: only store the result.
+ *------------------------------------------------------------------------------------------------*/
+void MqttResolved(const char *pchName, const ip_addr_t *pxAddr, void *pvArg)
+{
+    if (pxAddr)
+        xMqttAddress = IPAddress(pxAddr);
+    nMqttResolved = pxAddr ? 1 : -1;
 }
 
 /*------------------------------------------------------------------------------------------------*
- * PublishToTopic: Publish the meter values to MQTT topic.
+ * ResolveMqtt: Start looking up the address of the broker; never waits.
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Create a JSON object with all the current smart meter values (including gas) and publish it to
- *  the defined topic.
- *INPUT:
- *	None. Values are in global variables.
- *OUTPUT:
- *	(bool) true if succeeded, false if failed (either connection lost or message too large).
+ *	An IP address or a name in the lwIP cache resolves right away, otherwise the DNS answer comes
+ *  in later through MqttResolved(). nMqttResolved tells when the lookup is done.
  *------------------------------------------------------------------------------------------------*/
-bool PublishToTopic(void)
+void ResolveMqtt(void)
 {
-    /*--- create JSON object and fill with meter values
-        see https://github.com/bblanchon/ArduinoJson/wiki/API%20Reference ---*/
-    StaticJsonBuffer<800> jsonBuffer;       //Be generous: too small will drop last entrie(s)
-    JsonObject &root = jsonBuffer.createObject();
-    root["dsmr"] = (String)lDsmrVersion;
-    JsonObject &jPwr = root.createNestedObject("power");
-    jPwr["time"] = (String)achPwrTime;      //Power reading timestamp + Summer/Winter time
-    jPwr["tariff"] = (String)lPwrTariff;    //Active power tariff (T1 or T2)
-    /*--- Create Gas meter entries ---*/
-    JsonObject &jGas = root.createNestedObject("gas");
-    jGas["time"] = (String)achGasTime;      //Gas reading timestamp + Summer/Winter time
-    jGas["total"] = (String)lGasMeter;      //Gas meter reading (~hourly updated)
-    /*---  Create power consumption entries ---*/
-    JsonObject &jUse = jPwr.createNestedObject("use");
-    JsonObject &jTotalUse = jUse.createNestedObject("total");
-    jTotalUse["T1"] = (String)lPwrLow;  //Power consumption low tariff
-    jTotalUse["T2"] = (String)lPwrHigh; //Power consumption high tariff
-    JsonObject &jActualUse = jUse.createNestedObject("actual");
-    jActualUse["total"] = (String)lPwrActual; //Power actual consumption
-    jActualUse["L1"] = (String)lPwrL1;        //Power actual L1 consumption
-    jActualUse["L2"] = (String)lPwrL2;        //Power actual L2 consumption
-    jActualUse["L3"] = (String)lPwrL3;        //Power actual L3 consumption
-    /*--- Create power return entries ---*/
-    JsonObject &jReturn = jPwr.createNestedObject("return");
-    JsonObject &jTotalReturn = jReturn.createNestedObject("total");
-    jTotalReturn["T1"] = (String)lReturnLow;  //Power return low tariff (solar panels)
-    jTotalReturn["T2"] = (String)lReturnHigh; //Power return high tariff (solar panels)
-    JsonObject &jActualReturn = jReturn.createNestedObject("actual");
-    jActualReturn["total"] = (String)lReturnActual; //Power actual return (solar panels)
-    jActualReturn["L1"] = (String)lReturnL1;        //Power actual L1 return (solar panels)
-    jActualReturn["L2"] = (String)lReturnL2;        //Power actual L2 return (solar panels)
-    jActualReturn["L3"] = (String)lReturnL3;        //Power actual L3 return (solar panels)
-
-    /*--- Publish the JSON data to the MQTT topic ---*/
-    char achData[600]; //Temporary packet buffer
-    root.printTo(achData, root.measureLength() + 1);
-    achData[root.measureLength() + 1] = 0;
-#ifdef MQTT_DEBUG
-    Serial.print("MQTT topic: ");
-    Serial.println(MQTT_TOPIC);
-    Serial.print("MQTT message: ");
-    Serial.println(achData);
-#endif
-    return hMqttClient.publish(MQTT_TOPIC, achData, true);
+    ip_addr_t xAddr;
+
+    nMqttResolved = 0;
+    if (xMqttAddress.fromString(MQTT_SERVER)) {
+        nMqttResolved = 1;
+        return;
+    }
+    err_t nErr = dns_gethostbyname(MQTT_SERVER, &xAddr, MqttResolved, NULL);
+    if (nErr == ERR_OK) {
+        xMqttAddress = IPAddress(&xAddr);
+        nMqttResolved = 1;
+    }
+    else if (nErr != ERR_INPROGRESS)
+        nMqttResolved = -1;
 }
 
 /*------------------------------------------------------------------------------------------------*
- * IsNumber: Check if the passed character is a valid digit or decimal point.
+ * ConnectMqtt: Keep the connection to the MQTT broker up; call it from every loop().
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Test the passed character for a valid digit or decimal point.
+ *	Takes the step the connection sequencer (see MqttLink.h) decides on, at most one per call:
+ *  start the (non-blocking) lookup of the broker name, open the TCP connection (blocks at most
+ *  culMqttTcpTimeout, less than the P1 receive buffer lasts), or send the MQTT CONNECT on the open
+ *  connection and wait for the CONNACK (up to cuMqttSocketTimeout, while P1ReaderPump() keeps the
+ *  P1 input received). After a failure the next attempt is scheduled with jittered exponential
+ *  backoff (see Backoff.h), so the P1 input keeps being processed while the broker is unreachable.
  *INPUT:
- *	char chNum - character to test
+ *	None.
  *OUTPUT:
- *	(bool) true if the character is a valid number character, false otherwise.
+ *	(bool) true if connected, false if not (yet).
  *------------------------------------------------------------------------------------------------*/
-bool IsNumber(char chNum)
+bool ConnectMqtt(void)
 {
-    return (isdigit(chNum) || chNum == '.' || chNum == 0);
+    MqttLinkStep nStep = MqttLinkPoll(&xMqttLink, hMqttClient.connected(), millis());
+    bool bOk = false;
+
+    switch (nStep) {
+    case MQTT_STEP_RESOLVE:
+        ResolveMqtt(); //The result is picked up below, in this or a later call
+        break;
+    case MQTT_STEP_TCP:
+        CONSOLE.print("Setup MQTT...");
+        bOk = hEspClient.connect(xMqttAddress, MQTT_SERVER_PORT) == 1;
+        break;
+    case MQTT_STEP_CONNECT:
+        bOk = hMqttClient.connect(MQTT_CLIENT_ID); //Uses the open TCP connection
+        break;
+    default:
+        break;
+    }
+
+    /*--- Name lookup completed ---*/
+    if (xMqttLink.nState == MQTT_LINK_RESOLVING) {
+        if (nMqttResolved == 0)
+            return false;
+        nStep = MQTT_STEP_RESOLVE;
+        bOk = nMqttResolved > 0;
+    }
+    if (nStep == MQTT_STEP_NONE)
+        return MqttLinkUp(&xMqttLink);
+
+    unsigned long ulWait = MqttLinkDone(&xMqttLink, nStep, bOk, millis());
+    if (bOk) {
+        if (nStep == MQTT_STEP_CONNECT) {
+#ifdef MQTT_DIAG
+            xDiag.uMqttConnects++;
+#endif
+            CONSOLE.print("connected as ");
+            CONSOLE.print(MQTT_CLIENT_ID);
+            CONSOLE.print(" with topic ");
+            CONSOLE.println(MQTT_TOPIC);
+        }
+        return MqttLinkUp(&xMqttLink);
+    }
+
+    /*--- Failed, the next attempt is scheduled ---*/
+#ifdef MQTT_DIAG
+    xDiag.uMqttFailed++;
+#endif
+    if (nStep == MQTT_STEP_RESOLVE) {
+        CONSOLE.print("MQTT broker ");
+        CONSOLE.print(MQTT_SERVER);
+        CONSOLE.print(" not found");
+    }
+    else if (nStep == MQTT_STEP_TCP) {
+        hEspClient.stop();
+        CONSOLE.print("failed, no TCP connection");
+    }
+    else {
+        CONSOLE.print("failed, rc=");
+        CONSOLE.print(hMqttClient.state());
+    }
+    CONSOLE.print(", retry in ");
+    CONSOLE.print(ulWait);
+    CONSOLE.println("ms");
+    return false;
 }
 
+#ifdef MQTT_FIELD_TOPICS
 /*------------------------------------------------------------------------------------------------*
- * FindLastChar: Find the position of the last character specified.
+ * WriteBatch: Write the batched MQTT messages to the broker connection.
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Look for the specified characters in the past string, starting at the passed position and
- *  going backwards to the beginning.
- *INPUT:
- *	char achBuffer[] - character array to search through
- *  char chSearch - character to look for
- *  int nLen - position in string to start looking backward
+ *	Written through the MQTT client, which then counts it as activity for its keepalive. A short
+ *  write leaves a partial packet in the stream, which the broker cannot parse any further, so the
+ *  connection is closed then; the MQTT client sees it lost and it is set up again in the background.
  *OUTPUT:
- *	(int) position of the last character specified, or -1 if not found.
+ *	(bool) true if succeeded, false if failed (connection closed).
  *------------------------------------------------------------------------------------------------*/
-int FindLastChar(char achBuffer[], char chSearch, int nLen)
+bool WriteBatch(void)
 {
-    for (int i = nLen - 1; i >= 0; i--)
-    {
-        if (achBuffer[i] == chSearch)
-            return i;
+    size_t nWritten = 0;
+
+    if (xBatch.nLen > 0)
+        nWritten = hMqttClient.write(xBatch.auBuf, xBatch.nLen);
+    bool bOk = (nWritten == (size_t)xBatch.nLen);
+    MqttBatchReset(&xBatch);
+    if (!bOk) {
+        hEspClient.stop();
+        hMqttClient.connected(); //Lets the MQTT client notice the lost connection
     }
-    return -1;
+    return bOk;
 }
 
 /*------------------------------------------------------------------------------------------------*
- * FindFirstChar: Find the position of the first character specified.
+ * PublishFields: Publish meter values to their per-field topics.
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Look for the specified characters in the past string, starting at the first position and
- *  going forwards to the end.
+ *	The messages are encoded back to back and written with as few writes (TCP segments) as
+ *  possible, instead of one write per message.
  *INPUT:
- *	char achBuffer[] - character array to search through
- *  char chSearch - character to look for
- *  int nLen - Length of string passed
+ *	const DsmrReading *pxReading - meter readings
+ *  uint32_t uMask - FieldBit() set of the fields to publish
  *OUTPUT:
- *	(int) position of the First character specified, or -1 if not found.
+ *	(bool) true if succeeded, false if failed (connection lost).
  *------------------------------------------------------------------------------------------------*/
-int FindFirstChar(char achBuffer[], char chSearch, int nLen)
+bool PublishFields(const DsmrReading *pxReading, uint32_t uMask)
 {
-    for (int i = 0; i <= nLen; i++)
-    {
-        if (achBuffer[i] == 0)
-            break; //Double check: end of string reached?
-        if (achBuffer[i] == chSearch)
-            return i; //Found character
+    char achValue[cnLongTextLen];
+
+    if (!hMqttClient.connected())
+        return false;
+
+    MqttBatchReset(&xBatch);
+    for (int i = 0; i < cnDsmrLeaves; i++) {
+        if (!(uMask & LeafField(i)))
+            continue;
+        const char *pchValue = LeafText(pxReading, i, achValue);
+        if (MqttBatchAdd(&xBatch, MQTT_TOPIC, LeafTopic(i), pchValue, strlen(pchValue), true))
+            continue;
+        if (!WriteBatch()) //Batch full, send it and start a new one
+            return false;
+        if (!MqttBatchAdd(&xBatch, MQTT_TOPIC, LeafTopic(i), pchValue, strlen(pchValue), true))
+            return false;
     }
-    return -1;
+    return WriteBatch();
 }
+#endif
 
 /*------------------------------------------------------------------------------------------------*
- * GetValue: Get usage value from the string passed
+ * PublishToTopic: Publish the meter values to MQTT topic.
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Retreive the number from the end of the passed string and multiply by 1000 to remove the decimal
- *  point from the value sent by the P1 interface for usage values in the DSMR standard telegram.
- *  Numbers are surrounded by brackets, like '(0123.456)'.
+ *	Create a JSON object with all the current smart meter values (including gas) and publish it to
+ *  the defined topic.
+ *  With MQTT_DELTA defined, only the values that changed since the last publish are sent (as a
+ *  sparse JSON object with the same structure) to MQTT_DELTA_TOPIC, and the complete object is
+ *  sent to MQTT_TOPIC every MQTT_KEYFRAME_INTERVAL.
+ *  With MQTT_DEMAND defined, the demand figures are added to the JSON object.
+ *  With MQTT_DECIMATE defined, the statistics of the interval are sent to MQTT_STATS_TOPIC.
+ *  With MQTT_BINARY defined, the complete readings are also sent in binary to MQTT_BINARY_TOPIC.
+ *  These extra payloads follow the JSON object; if one of them fails it is only reported, as the
+ *  readings did get out (queueing them in the journal would publish them twice).
  *INPUT:
- *	char * pchBuffer - string to read the last number from (looking from end of string)
- *  int nMaxLen - length of string to consider
- *  bool bMultiply - Multiply by 1000 to get rid of decimal
+ *	None. Values are the published readings in the global 'xSnapshot'.
  *OUTPUT:
- *	(long) value retreived from string (char array) or 0 if no valid number found
+ *	(bool) true if the JSON object was published, false if failed (either connection lost or
+ *  message too large).
  *------------------------------------------------------------------------------------------------*/
-long GetValue(char *pchBuffer, int nMaxLen, bool bMultiply = true)
+bool PublishToTopic(void)
 {
-    /*--- Find start of the value by looking at the corresponding opening bracket '(' ---*/
-    int nStart = FindLastChar(pchBuffer, '(', nMaxLen - 1);
-    /*--- Do some sanity checks ---*/
-    if (nStart < 8) {
-#ifdef P1_DEBUG
-        Serial.println("ERROR[0]");
-#endif
-        return 0;
+    const DsmrReading *pxReading = SnapshotPublished(&xSnapshot);
+    const char *pchTopic = MQTT_TOPIC;
+    uint32_t uMask = cuAllFields;
+    bool bRetain = true;
+
+#ifdef MQTT_DELTA
+    bool bKeyframe = !bKeyframeSent || millis() - ulLastKeyframe >= MQTT_KEYFRAME_INTERVAL;
+    if (!bKeyframe) {
+        uMask = DsmrChanged(&xLastSent, pxReading);
+        if (uMask == 0)
+            return true; //Nothing changed, nothing to publish
+        pchTopic = MQTT_DELTA_TOPIC;
+        bRetain = false;
     }
-    if (nStart > 32) {
-#ifdef P1_DEBUG
-        Serial.println("ERROR[1]");
 #endif
-        return 0;
-    }
 
-    /*--- Look for the '*', separating the value from the unit (e.g. kWh)---*/
-    int nLen = FindLastChar(pchBuffer, '*', nMaxLen - 1) - nStart - 1;
-    /*--- Some number strings have no *, so check for that too ---*/
-    if (nLen < 0)
-        nLen = FindLastChar(pchBuffer, ')', nMaxLen - 1) - nStart - 1;
-
-    /*--- Sanity check: values should have between 1 and 12 digits ---*/
-    if (nLen < 1 || nLen > 12) {
-#ifdef P1_DEBUG
-        Serial.println("ERROR[5]");
+    /*--- Serialize the meter values straight into the packet buffer ---*/
+    PROFILE_BEGIN(uTick);
+#ifdef MQTT_DEMAND
+    JsonWriter xWriter;
+    JsonBegin(&xWriter, achPayload, sizeof(achPayload));
+    JsonReading(&xWriter, pxReading, uMask);
+    JsonDemand(&xWriter, &xDemand); //Changes with every telegram, also in a delta
+    int nLen = JsonEnd(&xWriter);
+#else
+    int nLen = DsmrToJson(pxReading, uMask, achPayload, sizeof(achPayload));
 #endif
-        return 0;
+    PROFILE_SAMPLE(PROFILE_SERIALIZE, uTick);
+    if (nLen < 0) {
+        CONSOLE.println("ERROR: MQTT MESSAGE TOO LARGE!");
+        return false;
     }
-
-    /*--- Check if it is a valid number and return its value (or 0) ---*/
-    char *pchValue = pchBuffer + nStart + 1; //Point at start of value string
-    for (int i = 0; i < nLen; i++) {
-        if (!IsNumber(*(pchValue + i))) {
-#ifdef P1_DEBUG
-            Serial.println("ERROR[6]");
+#ifdef MQTT_DEBUG
+    CONSOLE.print("MQTT topic: ");
+    CONSOLE.println(pchTopic);
+    CONSOLE.print("MQTT message: ");
+    CONSOLE.println(achPayload);
 #endif
-            return 0;
-        }
+    PROFILE_RESTART(uTick); //Don't count the debug output
+    if (!hMqttClient.publish(pchTopic, (const uint8_t *)achPayload, nLen, bRetain))
+        return false;
+    PROFILE_SAMPLE(PROFILE_PUBLISH, uTick);
+
+#ifdef MQTT_DELTA
+    /*--- The next delta is relative to what was just published, whatever happens below ---*/
+    xLastSent = *pxReading;
+    if (bKeyframe) {
+        bKeyframeSent = true;
+        ulLastKeyframe = millis();
     }
+#endif
 
-    /*--- Return value without decimal point ---*/
-    if (bMultiply)
-        return 1000 * atof(pchValue);
-    else
-        return atof(pchValue);
+    /*--- Extra payloads, stop at the first failure (most likely the connection is lost) ---*/
+    const char *pchFailed = NULL;
+#ifdef MQTT_FIELD_TOPICS
+    if (!pchFailed && !PublishFields(pxReading, uMask))
+        pchFailed = "FIELD TOPICS";
+#endif
+#ifdef MQTT_DECIMATE
+    nLen = StatsToJson(&xStats, achPayload, sizeof(achPayload));
+    if (!pchFailed && (nLen < 0 || !hMqttClient.publish(MQTT_STATS_TOPIC, (const uint8_t *)achPayload, nLen, false)))
+        pchFailed = "STATISTICS";
+#endif
+#ifdef MQTT_BINARY
+    uint8_t auBinary[cnBinaryLen]; //Always the complete readings, smaller than any JSON delta
+    nLen = DsmrToBinary(pxReading, auBinary, sizeof(auBinary));
+    if (!pchFailed && !hMqttClient.publish(MQTT_BINARY_TOPIC, auBinary, nLen, true))
+        pchFailed = "BINARY";
+#endif
+    if (pchFailed) {
+        CONSOLE.print("WARNING: MQTT PUBLISH OF ");
+        CONSOLE.print(pchFailed);
+        CONSOLE.println(" FAILED, readings not queued");
+    }
+    return true;
 }
 
+#ifdef MQTT_JOURNAL
 /*------------------------------------------------------------------------------------------------*
- * GetLastText: Get last text parameter from the string passed (between brackets)
+ * DrainJournal: Send the oldest reading queued in the journal.
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Retreive the text from the end of the passed string.
- *  Text is surrounded by brackets, like '(180924132132S)'.
+ *	Publishes one queued reading (the complete JSON document, with its original timestamps) to
+ *  MQTT_BACKLOG_TOPIC every JOURNAL_DRAIN_INTERVAL, so the backlog doesn't flood the broker or
+ *  delay the P1 input. The reading is only removed from the journal once it is published.
  *INPUT:
- *	char* pchBuffer - string to read the last text from (looking from end of string)
- *  int nMaxLen - length of string to consider
- *  char* pchText - Pointer to start of the parsed text (max 32)
+ *	None.
  *OUTPUT:
- *	(int) length of parsed text, 0 if no text found and pchText is empty string.
+ *	None.
  *------------------------------------------------------------------------------------------------*/
-int GetLastText(char *pchBuffer, int nMaxLen, char *pchText)
+void DrainJournal(void)
 {
-    pchText[0] = 0;
-
-    /*--- Find start of the text by looking at the corresponding opening bracket '(' ---*/
-    int nStart = FindLastChar(pchBuffer, '(', nMaxLen - 1); //9
-    if (nStart < 8 || nStart > 39) { //Do some sanity checks
-#ifdef P1_DEBUG
-        Serial.println("ERROR[1]");
-#endif
-        return 0;
-    }
+    DsmrReading xQueued;
+
+    if (JournalCount(&xJournal) == 0 || !hMqttClient.connected())
+        return;
+    if (millis() - ulLastDrain < JOURNAL_DRAIN_INTERVAL)
+        return;
+    ulLastDrain = millis();
+
+    if (!JournalPeek(&xJournal, &xQueued))
+        return;
+    int nLen = DsmrToJson(&xQueued, cuAllFields, achPayload, sizeof(achPayload));
+    if (nLen < 0 || hMqttClient.publish(MQTT_BACKLOG_TOPIC, (const uint8_t *)achPayload, nLen, false))
+        JournalPop(&xJournal); //Sent (or can never be sent)
+    if (JournalCount(&xJournal) == 0)
+        CONSOLE.println("INFO: JOURNAL DRAINED");
+}
 
-    /*--- Look for the ')', terminating the text ---*/
-    int nLen = FindLastChar(pchBuffer, ')', nMaxLen - 1) - nStart - 1; //13
-    if (nLen < 1 || nLen > 31) { //Do some more sanity checks
-#ifdef P1_DEBUG
-        Serial.println("ERROR[2]");
 #endif
-        return 0;
-    }
-
-    /*--- Copy the text to the output buffer and terminate it with '\0x00' ---*/
-    strncpy(pchText, pchBuffer + nStart + 1, nLen);
-    pchText[nLen] = 0;
-
-    return nLen;
-}
 
+#ifdef MQTT_AGGREGATE
 /*------------------------------------------------------------------------------------------------*
- * GetFirstText: Get first text parameter from the string passed (between brackets)
+ * DoAggregate: Add a telegram to the aggregation windows.
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Retreive the text from the beginning of the passed string.
- *  Text is surrounded by brackets, like '(180924132132S)'.
+ *	Windows that end before the telegram are published first (not retained) to
+ *  MQTT_AGGREGATE_TOPIC/<window>, then the telegram starts the next windows. A failed publish of a
+ *  window is reported, but not retried.
  *INPUT:
- *	char* pchBuffer - string to read the first text from (looking from start of string)
- *  int nMaxLen - length of string to consider
- *  char* pchText - Pointer to start of the parsed text (max 32)
+ *	const DsmrReading *pxReading - readings of a telegram with a valid CRC16
  *OUTPUT:
- *	(int) length of parsed text, 0 if no text found and pchText is empty string.
+ *	None.
  *------------------------------------------------------------------------------------------------*/
-bool GetFirstText(char *pchBuffer, int nMaxLen, char *pchText)
+void DoAggregate(const DsmrReading *pxReading)
 {
-    pchText[0] = 0;
-
-    /*--- Find start of the text by looking at the corresponding opening bracket '(' ---*/
-    int nStart = FindFirstChar(pchBuffer, '(', nMaxLen - 2);
-    if (nStart < 8 || nStart > 12) { //Do some sanity checks
-#ifdef P1_DEBUG
-        Serial.println("ERROR[3]");
-#endif
-        return 0;
+    char achTopic[48];
+    char achName[4];
+    uint32_t uTime;
+    bool bDst;
+
+    if (!MeterTimeParse(pxReading->achPwrTime, &uTime, &bDst))
+        return; //No (valid) timestamp in the telegram
+    uTime = MeterTimeUtc(uTime, bDst);
+
+    uint8_t uClosed = AggClose(&xAgg, uTime);
+    for (int n = 0; n < cnAggWindows; n++) {
+        if (!(uClosed & (1 << n)))
+            continue;
+        strcpy(achTopic, MQTT_AGGREGATE_TOPIC);
+        strcat(achTopic, "/");
+        strcat(achTopic, AggName(n, achName));
+        int nLen = AggToJson(&xAgg, n, achPayload, sizeof(achPayload));
+        if (nLen < 0 || !hMqttClient.publish(achTopic, (const uint8_t *)achPayload, nLen, false)) {
+            CONSOLE.print("ERROR: PUBLISH OF AGGREGATE ");
+            CONSOLE.print(achName);
+            CONSOLE.println(" FAILED!");
+        }
     }
+    AggAdd(&xAgg, pxReading, uTime, bDst);
+}
 
-    /*--- Look for the ')', terminating the text ---*/
-    int nLen = FindFirstChar(pchBuffer, ')', nMaxLen) - nStart;
-    if (nLen < 1 || nLen > 31) { //Do some more sanity checks
-#ifdef P1_DEBUG
-        Serial.println("ERROR[4]");
 #endif
-        return 0;
-    }
-
-    /*--- Copy the text to the output buffer and terminate it with '\0x00' ---*/
-    strncpy(pchText, pchBuffer + nStart + 1, nLen - 1);
-    pchText[nLen - 1] = 0;
-
-    return nLen;
-}
 
+#ifdef MQTT_DIAG
 /*------------------------------------------------------------------------------------------------*
- * DecodeTelegram: Decode the current telegram line.
+ * PublishDiag: Publish the health and pipeline counters every MQTT_DIAG interval.
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Decode the telegram line stored in the buffer and extract any meter values we want to use.
+ *	Takes the counters kept elsewhere (parser, P1 input, WiFi link) and the platform gauges, and
+ *  sends the document (retained) to MQTT_DIAG_TOPIC: right after the first connect, then once per
+ *  interval. The longest loop() pass starts over after every document sent.
  *INPUT:
- *	int len - length of telegram line to decode, including trailing zero
- *  (the telegram line is stored in the global variable 'achTelegram')
+ *	None.
  *OUTPUT:
- *	(bool) true if decoded a valid message and CRC, false otherwise.
+ *	None.
  *------------------------------------------------------------------------------------------------*/
-bool DecodeTelegram(int nLen)
+void PublishDiag(void)
 {
-    /*--- Check for Message Start or Checksum Start character on this line --- */
-    int nStartChar = FindLastChar(achTelegram, '/', nLen);
-    int nEndChar = FindLastChar(achTelegram, '!', nLen);
-    bool bValidCrcFound = false;
-
-    /*--- Is this the start of P1 telegram line? ---*/
-    if (nStartChar >= 0) {
-        /*--- Start of telegram character found ('/'); restart CRC16 calculation ---*/
-        nCurrentCrc = Crc16(0x0000, (unsigned char *)achTelegram + nStartChar, nLen - nStartChar);
-#ifdef P1_DEBUG
-        /*--- Send the telegram also through the serial debug port ---*/
-        for (int cnt = nStartChar; cnt < nLen - nStartChar; cnt++)
-            Serial.print(achTelegram[cnt]);
-#endif
-    }
-    /*--- Is this the end of telegram line? ---*/
-    else if (nEndChar >= 0) {
-        /*--- Add to CRC16 calculation ---*/
-        nCurrentCrc = Crc16(nCurrentCrc, (unsigned char *)achTelegram + nEndChar, 1);
-        char achMessageCrc[4]; //Buffer for the CRC16 characters
-        strncpy(achMessageCrc, achTelegram + nEndChar + 1, 4);
-#ifdef P1_DEBUG
-        for (int cnt = 0; cnt < nLen; cnt++)
-            Serial.print(achTelegram[cnt]);
-#endif
-        /*--- Compare the CRC16 calculated with the CRC16 value received ---*/
-        bValidCrcFound = (strtoul(achMessageCrc, NULL, 16) == nCurrentCrc);
-        if (bValidCrcFound)
-            Serial.println("\nINFO: VALID CRC FOUND!");
-        else
-            Serial.println("\nERROR: INVALID CRC FOUND!");
-        nCurrentCrc = 0;
-    }
-    else {
-        /*--- This is a data line, update CRC16 ---*/
-        nCurrentCrc = Crc16(nCurrentCrc, (unsigned char *)achTelegram, nLen);
-#ifdef P1_DEBUG
-        for (int cnt = 0; cnt < nLen; cnt++)
-            Serial.print(achTelegram[cnt]);
-#endif
+    if (bDiagSent && millis() - ulLastDiag < MQTT_DIAG)
+        return;
+    if (!hMqttClient.connected())
+        return;
+
+    xDiag.uTruncated = xParser.uTruncated;
+    xDiag.uOverflows = P1ReaderOverflows();
+    xDiag.uWifiConnects = xWifi.uConnects;
+    xDiag.uWifiDisconnects = xWifi.uDisconnects;
+    xDiag.ulWifiDown = WifiLinkDowntime(&xWifi);
+    xDiag.ulUptime = millis() / 1000;
+    xDiag.lRssi = WiFi.RSSI();
+    xDiag.uHeapFree = ESP.getFreeHeap();
+    xDiag.uHeapMaxBlock = ESP.getMaxFreeBlockSize();
+    xDiag.uHeapFragmentation = ESP.getHeapFragmentation();
+
+    int nLen = DiagToJson(&xDiag, achPayload, sizeof(achPayload));
+    if (nLen >= 0 && hMqttClient.publish(MQTT_DIAG_TOPIC, (const uint8_t *)achPayload, nLen, true)) {
+        bDiagSent = true;
+        ulLastDiag = millis();
+        xDiag.ulLoopMax = 0;
     }
+}
 
-    /*--- Done processing CRC16, parse relevant data ---*/
-
-    // DSMR version
-    // Example: 1-3:0.2.8(42)
-    if (strncmp(achTelegram, DSMR_VERSION, strlen(DSMR_VERSION)) == 0)
-        lDsmrVersion = GetValue(achTelegram, nLen, false);
-
-    // Power reading timestamp (DSMR v4.0)
-    // Example: 0-0:1.0.0(180924132132S)
-    if (strncmp(achTelegram, DSMR_PWR_TIMESTAMP, strlen(DSMR_PWR_TIMESTAMP)) == 0) {
-        nLen = GetLastText(achTelegram, nLen, achPwrTime);
-    }
+#endif
 
-    // Power consumption low tariff (DSMR v4.0)
-    // Example: 1-0:1.8.1(000992.992*kWh)
-    if (strncmp(achTelegram, DSMR_PWR_LOW, strlen(DSMR_PWR_LOW)) == 0)
-        lPwrLow = GetValue(achTelegram, nLen);
-
-    // Power consumption high tariff (DSMR v4.0)
-    // Example: 1-0:1.8.2(000560.157*kWh)
-    if (strncmp(achTelegram, DSMR_PWR_HIGH, strlen(DSMR_PWR_HIGH)) == 0)
-        lPwrHigh = GetValue(achTelegram, nLen);
-
-    // Power return low tariff (DSMR v4.0)
-    // Example: 1-0:2.8.1(000348.890*kWh)
-    if (strncmp(achTelegram, DSMR_RET_LOW, strlen(DSMR_RET_LOW)) == 0)
-        lReturnLow = GetValue(achTelegram, nLen);
-
-    // Power return high tariff (DSMR v4.0)
-    // Example: 1-0:2.8.2(000859.885*kWh)
-    if (strncmp(achTelegram, DSMR_RET_HIGH, strlen(DSMR_RET_HIGH)) == 0)
-        lReturnHigh = GetValue(achTelegram, nLen);
-
-    // Power consumption actual total (DSMR v4.0)
-    // Example: 1-0:1.7.0(00.424*kW)
-    if (strncmp(achTelegram, DSMR_PWR_ACTUAL, strlen(DSMR_PWR_ACTUAL)) == 0)
-        lPwrActual = GetValue(achTelegram, nLen);
-
-    // Power consumption actual L1 (DSMR v4.0)
-    // Example: 1-0:21.7.0(00.086*kW)
-    if (strncmp(achTelegram, DSMR_PWR_L1, strlen(DSMR_PWR_L1)) == 0)
-        lPwrL1 = GetValue(achTelegram, nLen);
-
-    // Power consumption actual L2 (DSMR v4.0)
-    // Example: 1-0:41.7.0(00.086*kW)
-    if (strncmp(achTelegram, DSMR_PWR_L2, strlen(DSMR_PWR_L2)) == 0)
-        lPwrL2 = GetValue(achTelegram, nLen);
-
-    // Power consumption actual L3 (DSMR v4.0)
-    // Example: 1-0:61.7.0(00.086*kW)
-    if (strncmp(achTelegram, DSMR_PWR_L3, strlen(DSMR_PWR_L3)) == 0)
-        lPwrL3 = GetValue(achTelegram, nLen);
-
-    // Power return actual total (DSMR v4.0)
-    // Example: 1-0:2.7.0(00.000*kW)
-    if (strncmp(achTelegram, DSMR_RET_ACTUAL, strlen(DSMR_RET_ACTUAL)) == 0)
-        lReturnActual = GetValue(achTelegram, nLen);
-
-    // Power return actual L1 (DSMR v4.0)
-    // Example: 1-0:22.7.0(00.086*kW)
-    if (strncmp(achTelegram, DSMR_RET_L1, strlen(DSMR_RET_L1)) == 0)
-        lReturnL1 = GetValue(achTelegram, nLen);
-
-    // Power return actual L2 (DSMR v4.0)
-    // Example: 1-0:42.7.0(00.086*kW)
-    if (strncmp(achTelegram, DSMR_RET_L2, strlen(DSMR_RET_L2)) == 0)
-        lReturnL2 = GetValue(achTelegram, nLen);
-
-    // Power return actual L3 (DSMR v4.0)
-    // Example: 1-0:62.7.0(00.086*kW)
-    if (strncmp(achTelegram, DSMR_RET_L3, strlen(DSMR_RET_L3)) == 0)
-        lReturnL3 = GetValue(achTelegram, nLen);
-
-    // Power current tariff (DSMR v4.0)
-    // Example: 0-0:96.14.0(0002)
-    if (strncmp(achTelegram, DSMR_PWR_TARIFF, strlen(DSMR_PWR_TARIFF)) == 0)
-        lPwrTariff = GetValue(achTelegram, nLen, false);
-
-    // Gas (DSMR v4.0) on Kaifa MA105 and Landis+Gyr 350 meter
-    // Example: 0-1:24.2.1(150531200000S)(00811.923*m3)
-    if (strncmp(achTelegram, DSMR_GAS_METER, strlen(DSMR_GAS_METER)) == 0) {
-        lGasMeter = GetValue(achTelegram, nLen);
-        achGasTime[0] = 0;
-        (void)GetFirstText(achTelegram, nLen, achGasTime);
+#ifdef DSMR_PROFILE
+/*------------------------------------------------------------------------------------------------*
+ * PublishProfile: Publish the timing of the pipeline stages every PROFILE_INTERVAL.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The histograms (see Profile.h) are sent (not retained) to MQTT_PROFILE_TOPIC and cleared for the
+ *  next interval. While the broker is not reachable they keep accumulating.
+ *INPUT:
+ *	None.
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+void PublishProfile(void)
+{
+    unsigned long ulInterval = millis() - ulLastProfile;
+
+    if (ulInterval < PROFILE_INTERVAL || !hMqttClient.connected())
+        return;
+    int nLen = ProfileToJson(ulInterval, achPayload, sizeof(achPayload));
+    if (nLen >= 0 && hMqttClient.publish(MQTT_PROFILE_TOPIC, (const uint8_t *)achPayload, nLen, false)) {
+        ProfileReset();
+        ulLastProfile = millis();
     }
-
-    return bValidCrcFound;
 }
 
+#endif
+
 /*------------------------------------------------------------------------------------------------*
  * DoTelegramLines: Read and decode lines of the P1 telegram
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
- *	Keep reading lines from the P1 serial input, decode them one-by-one, and pubish the resulting
- *  smart meter values to the sensor MQTT topic (in JSON format).
+ *	Feed the bytes available on the P1 serial input to the telegram parser, decode the lines as they
+ *  complete, and publish the resulting smart meter values to the sensor MQTT topic (in JSON format)
+ *  once a telegram with a valid CRC16 is received.
  *INPUT:
- *	None. The message is stored in the global buffer 'telegram'.
+ *	None. The parser state is kept in the global 'xParser'.
  *OUTPUT:
- *	None. Returns when no more P1 serial input available.
+ *	None. Returns when no more P1 serial input is available (never waits for a complete line).
  *------------------------------------------------------------------------------------------------*/
 void DoTelegramLines(void)
 {
-    int nLen;
     bool bNew = false; //Indicates when new meter data is parsed
-
-    if (hP1Serial.available()) { //Any serial data available?
-        memset(achTelegram, 0, sizeof(achTelegram)); //Clear the telegram receive buffer
-
-        /*--- Keep reading and decoding telegram lines while available on the P1 interface ---*/
-        while (hP1Serial.available()) {
-            nLen = hP1Serial.readBytesUntil('\n', achTelegram, cnLineLen); //Read a line from the P1 telegram
-            achTelegram[nLen] = '\n';                                      //Terminate the line
-            achTelegram[nLen + 1] = 0;
-            yield();
-            if (DecodeTelegram(nLen + 1)) //Decode the value(s) on this telegram line, if any
-                bNew = true;
+    int nBudget = cnMaxBytesPerLoop;
+
+    /*--- Process what is available, but give MQTT/OTA a turn regularly ---*/
+    while (P1ReaderAvailable() && nBudget--) {
+        PROFILE_BEGIN(uTick);
+        char ch = P1ReaderRead();
+        PROFILE_ADD(PROFILE_READ, uTick);
+        P1Event nEvent = SnapshotFeed(&xSnapshot, &xParser, ch); //Decodes the lines, commits valid telegrams
+        PROFILE_ADD((nEvent == P1_EVENT_OBJECT || nEvent == P1_EVENT_GROUP) ? PROFILE_DECODE : PROFILE_PARSE, uTick);
+#ifdef P1_DEBUG
+        CONSOLE.print(ch); //Send the telegram also through the serial debug port
+#endif
+        switch (nEvent) {
+#ifdef MQTT_DIAG
+        case P1_EVENT_TELEGRAM_START:
+            xDiag.uTelegrams++;
+            break;
+#endif
+        case P1_EVENT_TELEGRAM_OK:
+            PROFILE_TELEGRAM();
+#ifdef MQTT_DIAG
+            xDiag.uCrcOk++;
+#endif
+            CONSOLE.println("\nINFO: VALID CRC FOUND!");
+            if (ulFirstTelegram == 0) {
+                ulFirstTelegram = millis();
+                CONSOLE.print("INFO: FIRST VALID TELEGRAM AFTER ");
+                CONSOLE.print(ulFirstTelegram);
+                CONSOLE.println("ms");
+            }
+#ifdef MQTT_DECIMATE
+            StatsAdd(&xStats, SnapshotPublished(&xSnapshot));
+#endif
+#ifdef MQTT_AGGREGATE
+            DoAggregate(SnapshotPublished(&xSnapshot));
+#endif
+#ifdef MQTT_DEMAND
+            DemandAdd(&xDemand, SnapshotPublished(&xSnapshot));
+            if (!DemandSave(&xDemand)) //Only writes when a quarter starts
+                CONSOLE.println("ERROR: DEMAND STATE NOT SAVED!");
+#endif
+            bNew = true;
+            break;
+        case P1_EVENT_TELEGRAM_BAD:
+            PROFILE_TELEGRAM();
+#ifdef MQTT_DIAG
+            xDiag.uCrcBad++;
+#endif
+            CONSOLE.println("\nERROR: INVALID CRC FOUND!");
+            break;
+        default:
+            break;
         }
+    }
+
+    /*--- Report lost P1 data (telegram will fail its CRC check) ---*/
+    uint32_t uOverflows = P1ReaderOverflows();
+    if (uOverflows != uLastOverflows) {
+        CONSOLE.print("WARNING: P1 RECEIVE BUFFER OVERFLOW, total ");
+        CONSOLE.println(uOverflows);
+        uLastOverflows = uOverflows;
+    }
+
+#ifdef MQTT_DECIMATE
+    /*--- Publish once per interval, the statistics cover the telegrams in between ---*/
+    if (bNew && bDecimating && millis() - ulLastPublish < MQTT_DECIMATE)
+        bNew = false;
+    if (bNew) {
+        ulLastPublish = millis();
+        bDecimating = true;
+    }
+#endif
 
-        /*--- Send any updated smart meter values to MQTT broker ---*/
-        if (bNew)
-            if (!PublishToTopic()) {
-                Serial.print(" MQTT Publish failed, state=");
-                Serial.print(hMqttClient.state());
-                Serial.println("");
+    /*--- Send any updated smart meter values to MQTT broker ---*/
+    if (bNew) {
+        if (PublishToTopic()) {
+            if (ulFirstPublish == 0) {
+                ulFirstPublish = millis();
+                CONSOLE.print("INFO: FIRST PUBLISH AFTER ");
+                CONSOLE.print(ulFirstPublish);
+                CONSOLE.println("ms");
+            }
+        }
+        else {
+#ifdef MQTT_DIAG
+            xDiag.uPublishFailed++;
+#endif
+            CONSOLE.print(" MQTT Publish failed, state=");
+            CONSOLE.print(hMqttClient.state());
+            CONSOLE.println("");
+#ifdef MQTT_JOURNAL
+            if (JournalPush(&xJournal, SnapshotPublished(&xSnapshot))) { //Keep it to send later
+                CONSOLE.print(" Reading queued, total ");
+                CONSOLE.println(JournalCount(&xJournal));
             }
+#endif
+        }
+#ifdef MQTT_DECIMATE
+        StatsReset(&xStats); //Start the next interval
+#endif
     }
 }
 
@@ -855,32 +991,62 @@ void DoTelegramLines(void)
  *------------------------------------------------------------------------------------------------*
  *DESCRIPTION:
  *	Called from the Arduino Framework at boot. Initializes the serial console (for status and
- *  debugging purposes), the MQTT connection , the OTA services and the WiFi connection.
+ *  debugging purposes) and the P1 input first, so meter data is captured within milliseconds of
+ *  power-on, then starts the WiFi connection and sets up MQTT. The network services come up from
+ *  loop(), the time to the first valid telegram and the first publish are reported on the console.
  *INPUT:
  *	None.
  *OUTPUT:
- *	None. Returns only when the WiFi and MQTT connections are succesful.
+ *	None. Never waits for the network: WiFi, MQTT and OTA are brought up from loop().
  *NOTES:
  *  During boot of the ESP8266 there will be some garbage characters on the serial debug output.
  *------------------------------------------------------------------------------------------------*/
 void setup()
 {
-    Serial.begin(BAUDRATE); //Setup the serial console (USB) @115,200 baud
+    CONSOLE.begin(BAUDRATE); //Setup the serial console (USB, or D4 with the UART backend) @115,200 baud
 
-    Serial.print("\r\n \r\nBooting DSMR P1 MQTT Sensor, version ");
-    Serial.println(SENSOR_VERSION); //Send our welcome message to console
+    /*--- Start receiving P1 data first, everything else can complete in the background ---*/
+    P1ParserReset(&xParser);
+    P1ReaderBegin(BAUDRATE, SERIAL_RX); //Initialize the P1 serial interface
+    ulP1Started = millis();
 
-    SetupWiFi(); //Setup the WiFi connection
+    CONSOLE.print("\r\n \r\nBooting DSMR P1 MQTT Sensor, version ");
+    CONSOLE.println(SENSOR_VERSION); //Send our welcome message to console
+    CONSOLE.print("P1 input started after ");
+    CONSOLE.print(ulP1Started);
+    CONSOLE.println("ms");
 
-    hP1Serial.begin(BAUDRATE, SERIAL_CONFIG, SERIAL_RX, -1, true, cnLineLen); //Initialize the P1 serial interface
+    WifiLinkBegin(&xWifi, WIFI_SSID, WIFI_PWD); //Start the WiFi connection, completes in the background
+
+#ifdef MQTT_JOURNAL
+    if (JournalBegin(&xJournal)) { //Pick up the readings queued before the reboot
+        CONSOLE.print("Journal ready, queued readings: ");
+        CONSOLE.println(JournalCount(&xJournal));
+    }
+    else
+        CONSOLE.println("ERROR: JOURNAL STORAGE NOT AVAILABLE!");
+#endif
 
-    SetupOTA(); //Setup OTA update service
+#ifdef MQTT_DECIMATE
+    StatsReset(&xStats);
+#endif
+#ifdef MQTT_AGGREGATE
+    AggReset(&xAgg);
+#endif
+#ifdef MQTT_DEMAND
+    if (DemandBegin(&xDemand)) //Pick up the quarter and the peak of the month
+        CONSOLE.println("Demand state restored");
+#endif
 
+    hEspClient.setTimeout(culMqttTcpTimeout); //Bound the time the TCP connect can block
     hMqttClient.setClient(hEspClient); //Initialzie the MQTT interface
     hMqttClient.setServer(MQTT_SERVER, MQTT_SERVER_PORT);
-    (void)ConnectMqtt(); //Setup MQTT connection
+    hMqttClient.setSocketTimeout(cuMqttSocketTimeout);
+    if (!hMqttClient.setBufferSize(cuMqttPacketLen)) //Allocated once, here
+        CONSOLE.println("ERROR: MQTT BUFFER INCREASE FAILED!");
+    MqttLinkBegin(&xMqttLink, millis(), ESP.random()); //MQTT connects from loop() once WiFi is up
 
-    Serial.println("READY\r\n");
+    CONSOLE.println("READY\r\n");
 }
 
 /*------------------------------------------------------------------------------------------------*
@@ -898,13 +1064,40 @@ void setup()
  *------------------------------------------------------------------------------------------------*/
 void loop()
 {
-    /*--- Make sure we have an MQTT connection ---*/
-    if (!hMqttClient.loop()) //Keep the MQTT connection alive
-        (void)ConnectMqtt();
+    PROFILE_BEGIN(uLoop);
+#ifdef MQTT_DIAG
+    unsigned long ulLoopStart = micros();
+#endif
+
+    /*--- Keep the WiFi connection up (never waits, see DoWiFi) ---*/
+    DoWiFi();
+
+    /*--- Make sure we have an MQTT connection (one bounded step per pass, see ConnectMqtt) ---*/
+    if (WifiLinkUp(&xWifi))
+        (void)hMqttClient.loop(); //Keep the MQTT connection alive
+    (void)ConnectMqtt();
 
     /*--- Read, decode and send smartmeter values ---*/
     DoTelegramLines();
 
+#ifdef MQTT_JOURNAL
+    /*--- Send readings queued while the broker was unreachable ---*/
+    DrainJournal();
+#endif
+
     /*--- Check for OTA updates ---*/
-    ArduinoOTA.handle();
+    if (bOtaStarted)
+        ArduinoOTA.handle();
+
+#ifdef MQTT_DIAG
+    /*--- Longest pass, publish the counters once per interval ---*/
+    DiagLoop(&xDiag, micros() - ulLoopStart, ESP.getFreeHeap());
+    PublishDiag();
+#endif
+
+#ifdef DSMR_PROFILE
+    /*--- Time this pass, publish the timing once per interval ---*/
+    PROFILE_SAMPLE(PROFILE_LOOP, uLoop);
+    PublishProfile();
+#endif
 }
@@ -0,0 +1,179 @@
+#ifndef TESTTELEGRAMS_H
+#define TESTTELEGRAMS_H
+
+#include <stdio.h>
+#include "DsmrReading.h"
+
+/*==================================================================================================*
+ * Recorded telegrams and helpers shared by the unit tests and benchmarks on the host.
+ *
+ * The telegrams are complete, with their CRC16, as received on the P1 port (lines end in \r\n).
+ * Tests that need a variation of one (another value, a corrupted byte) edit a copy with
+ * TestEdit(), which puts a correct CRC16 back unless told not to.
+ *==================================================================================================*/
+
+/*--- DSMR 4.2, Landis+Gyr E350 (the example in main.cpp): one telegram every 10 s ---*/
+static const char achTelegramV42[] =
+    "/XMX5LGBBFFB231314239\r\n"
+    "\r\n"
+    "1-3:0.2.8(42)\r\n"
+    "0-0:1.0.0(181121094755W)\r\n"
+    "0-0:96.1.1(4530303136303231363837393334353135)\r\n"
+    "1-0:1.8.1(012094.358*kWh)\r\n"
+    "1-0:1.8.2(010777.944*kWh)\r\n"
+    "1-0:2.8.1(000135.765*kWh)\r\n"
+    "1-0:2.8.2(000263.244*kWh)\r\n"
+    "0-0:96.14.0(0002)\r\n"
+    "1-0:1.7.0(00.000*kW)\r\n"
+    "1-0:2.7.0(00.606*kW)\r\n"
+    "0-0:96.7.21(00015)\r\n"
+    "0-0:96.7.9(00005)\r\n"
+    "1-0:99.97.0(5)(0-0:96.7.19)(170520130938S)(0000005627*s)(170325044014W)(0043178677*s)(160417214213S)"
+    "(0000002950*s)(151112223157W)(0000088450*s)(151111103556W)(0003079416*s)\r\n"
+    "1-0:32.32.0(00002)\r\n"
+    "1-0:52.32.0(00002)\r\n"
+    "1-0:72.32.0(00002)\r\n"
+    "1-0:32.36.0(00000)\r\n"
+    "1-0:52.36.0(00000)\r\n"
+    "1-0:72.36.0(00000)\r\n"
+    "0-0:96.13.1()\r\n"
+    "0-0:96.13.0()\r\n"
+    "1-0:31.7.0(001*A)\r\n"
+    "1-0:51.7.0(001*A)\r\n"
+    "1-0:71.7.0(001*A)\r\n"
+    "1-0:21.7.0(00.000*kW)\r\n"
+    "1-0:41.7.0(00.000*kW)\r\n"
+    "1-0:61.7.0(00.000*kW)\r\n"
+    "1-0:22.7.0(00.293*kW)\r\n"
+    "1-0:42.7.0(00.036*kW)\r\n"
+    "1-0:62.7.0(00.277*kW)\r\n"
+    "0-1:24.1.0(003)\r\n"
+    "0-1:96.1.0(4731303138353430323538383730343135)\r\n"
+    "0-1:24.2.1(181121090000W)(05135.305*m3)\r\n"
+    "!4BDE\r\n";
+
+/*--- DSMR 5.0, Iskra AM550 with a gas and a water meter: one telegram every second ---*/
+static const char achTelegramV50[] =
+    "/ISK5\\2M550T-1012\r\n"
+    "\r\n"
+    "1-3:0.2.8(50)\r\n"
+    "0-0:1.0.0(190307204732W)\r\n"
+    "0-0:96.1.1(4530303434303037313331363530363138)\r\n"
+    "1-0:1.8.1(004130.025*kWh)\r\n"
+    "1-0:1.8.2(003210.918*kWh)\r\n"
+    "1-0:2.8.1(000412.116*kWh)\r\n"
+    "1-0:2.8.2(000977.410*kWh)\r\n"
+    "0-0:96.14.0(0001)\r\n"
+    "1-0:1.7.0(00.487*kW)\r\n"
+    "1-0:2.7.0(00.000*kW)\r\n"
+    "0-0:96.7.21(00008)\r\n"
+    "0-0:96.7.9(00003)\r\n"
+    "1-0:99.97.0(2)(0-0:96.7.19)(180326103147S)(0000003605*s)(190101000341W)(0000000258*s)\r\n"
+    "1-0:32.32.0(00004)\r\n"
+    "1-0:52.32.0(00003)\r\n"
+    "1-0:72.32.0(00003)\r\n"
+    "1-0:32.36.0(00001)\r\n"
+    "1-0:52.36.0(00000)\r\n"
+    "1-0:72.36.0(00000)\r\n"
+    "0-0:96.13.0()\r\n"
+    "1-0:32.7.0(232.4*V)\r\n"
+    "1-0:52.7.0(231.1*V)\r\n"
+    "1-0:72.7.0(233.0*V)\r\n"
+    "1-0:31.7.0(001*A)\r\n"
+    "1-0:51.7.0(000*A)\r\n"
+    "1-0:71.7.0(001*A)\r\n"
+    "1-0:21.7.0(00.201*kW)\r\n"
+    "1-0:41.7.0(00.065*kW)\r\n"
+    "1-0:61.7.0(00.221*kW)\r\n"
+    "1-0:22.7.0(00.000*kW)\r\n"
+    "1-0:42.7.0(00.000*kW)\r\n"
+    "1-0:62.7.0(00.000*kW)\r\n"
+    "0-1:24.1.0(003)\r\n"
+    "0-1:96.1.0(4730303339303031383031323334353637)\r\n"
+    "0-1:24.2.1(190307204500W)(02485.117*m3)\r\n"
+    "0-2:24.1.0(007)\r\n"
+    "0-2:96.1.0(3757303031323334)\r\n"
+    "0-2:24.2.1(190307204500W)(00187.402*m3)\r\n"
+    "!31AA\r\n";
+
+const int cnTestTelegramLen = 2048;     //Room for an edited copy of a telegram
+
+/*------------------------------------------------------------------------------------------------*
+ * TestFeed: Feed bytes through SnapshotFeed(), like loop() does with the P1 input.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	DsmrSnapshot *pxSnapshot - double buffered readings
+ *  P1Parser *pxParser - telegram parser
+ *  const char *pchData - bytes received
+ *  int nLen - number of bytes, -1 for a '\0' terminated string
+ *OUTPUT:
+ *	(P1Event) the last P1_EVENT_TELEGRAM_OK/BAD, P1_EVENT_NONE if no telegram ended.
+ *------------------------------------------------------------------------------------------------*/
+static inline P1Event TestFeed(DsmrSnapshot *pxSnapshot, P1Parser *pxParser, const char *pchData, int nLen = -1)
+{
+    P1Event nLast = P1_EVENT_NONE;
+
+    if (nLen < 0)
+        nLen = (int)strlen(pchData);
+    for (int i = 0; i < nLen; i++) {
+        P1Event nEvent = SnapshotFeed(pxSnapshot, pxParser, pchData[i]);
+        if (nEvent == P1_EVENT_TELEGRAM_OK || nEvent == P1_EVENT_TELEGRAM_BAD)
+            nLast = nEvent;
+    }
+    return nLast;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * TestEdit: Copy a telegram, replacing the first occurrence of a text, and seal it again.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The copy ends at its first '!', which gets the CRC16 of the new contents (computed with the
+ *  bitwise reference, whatever CRC16_ENGINE is) and a line end. With bSeal false the copy is kept
+ *  as edited, so a changed telegram fails its CRC check.
+ *INPUT:
+ *	char *pchBuf - receives the edited telegram, '\0' terminated
+ *  int nSize - size of pchBuf
+ *  const char *pchTelegram - telegram to copy
+ *  const char *pchFind - text to replace, NULL to copy as it is
+ *  const char *pchReplace - replacement
+ *  bool bSeal - put a matching CRC16 after the '!'
+ *OUTPUT:
+ *	(int) length of the edited telegram, -1 if pchFind was not found or it does not fit.
+ *------------------------------------------------------------------------------------------------*/
+static inline int TestEdit(char *pchBuf, int nSize, const char *pchTelegram, const char *pchFind = NULL,
+                           const char *pchReplace = "", bool bSeal = true)
+{
+    const char *pchAt = pchFind ? strstr(pchTelegram, pchFind) : NULL;
+    int nLen;
+
+    if (pchFind && !pchAt)
+        return -1;
+    if (pchAt)
+        nLen = snprintf(pchBuf, nSize, "%.*s%s%s", (int)(pchAt - pchTelegram), pchTelegram, pchReplace,
+                        pchAt + strlen(pchFind));
+    else
+        nLen = snprintf(pchBuf, nSize, "%s", pchTelegram);
+    if (nLen < 0 || nLen >= nSize)
+        return -1;
+    if (!bSeal)
+        return nLen;
+
+    char *pchEnd = strchr(pchBuf, '!');
+    if (!pchEnd || pchEnd - pchBuf + 7 > nSize)
+        return -1;
+    nLen = (int)(pchEnd + 1 - pchBuf);
+    return nLen + snprintf(pchEnd + 1, nSize - nLen, "%04X\r\n", Crc16Bitwise(0, (unsigned char *)pchBuf, nLen));
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * TestLines: Count the lines of a telegram (or any number of them).
+ *------------------------------------------------------------------------------------------------*/
+static inline int TestLines(const char *pchData)
+{
+    int nLines = 0;
+
+    for (; *pchData; pchData++)
+        nLines += *pchData == '\n';
+    return nLines;
+}
+#endif
@@ -0,0 +1,6 @@
+# Build the native tests with AddressSanitizer and UndefinedBehaviorSanitizer (env:native_asan).
+# The flags must reach the linker too, which build_flags alone does not do.
+Import("env")
+
+SANITIZE = ["-fsanitize=address,undefined", "-fno-sanitize-recover=all", "-fno-omit-frame-pointer"]
+env.Append(CCFLAGS=SANITIZE, LINKFLAGS=SANITIZE)
@@ -0,0 +1,147 @@
+/*==================================================================================================*
+ * Unit tests of the power aggregation windows (Aggregate.h).
+ *
+ * Telegrams are made up with a given actual power at a given time: use total P, L1 P/2, and for
+ * the return channels nothing. All times are UTC seconds around the hour uHour (2018-11-21 10:00
+ * meter winter time, 09:00 UTC), which is a boundary of all three windows.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "Aggregate.h"
+
+Aggregator xAgg;
+DsmrReading xReading;
+uint32_t uHour;
+char achJson[800];
+
+void setUp(void)
+{
+    uint32_t uLocal;
+    bool bDst;
+
+    TEST_ASSERT_TRUE(MeterTimeParse("181121100000W", &uLocal, &bDst));
+    uHour = MeterTimeUtc(uLocal, bDst);
+    TEST_ASSERT_EQUAL(0, uHour % 3600);
+    AggReset(&xAgg);
+    memset(&xReading, 0, sizeof(xReading));
+}
+
+void tearDown(void)
+{
+}
+
+/*--- A telegram with power lPower (W) at uTime: close the windows it ends, then add it ---*/
+static uint8_t Telegram(uint32_t uTime, long lPower)
+{
+    xReading.lPwrActual = lPower;
+    xReading.lPwrL1 = lPower / 2;
+    uint8_t uClosed = AggClose(&xAgg, uTime);
+    AggAdd(&xAgg, &xReading, uTime, false);
+    return uClosed;
+}
+
+/*--- Energy of the use total channel of a window (Ws) ---*/
+static int64_t Energy(int nWindow)
+{
+    return xAgg.axWindow[nWindow].allEnergy[0];
+}
+
+/*--- The power of the last telegram before a boundary counts up to the boundary, the rest after it ---*/
+void test_energy_split_at_boundary(void)
+{
+    TEST_ASSERT_EQUAL(0, Telegram(uHour - 10, 1000));
+    TEST_ASSERT_EQUAL_HEX8(0x7, AggClose(&xAgg, uHour + 20));
+    for (int n = 0; n < cnAggWindows; n++) {
+        TEST_ASSERT_EQUAL(10 * 1000, Energy(n));            //Held from uHour - 10 to uHour
+        TEST_ASSERT_EQUAL(10 * 500, xAgg.axWindow[n].allEnergy[1]);
+    }
+
+    AggAdd(&xAgg, &xReading, uHour + 20, false);
+    for (int n = 0; n < cnAggWindows; n++) {
+        TEST_ASSERT_EQUAL(uHour, xAgg.axWindow[n].uStart);
+        TEST_ASSERT_EQUAL(20 * 1000, Energy(n));            //Held from uHour to uHour + 20
+    }
+}
+
+/*--- Constant power in telegrams that don't line up with the minute: exactly power x 60 s ---*/
+void test_energy_full_window(void)
+{
+    uint32_t uTime;
+
+    for (uTime = uHour + 3; uTime < uHour + 120; uTime += 7) //Every 7 s, the second minute is complete
+        (void)Telegram(uTime, 600);
+    TEST_ASSERT_EQUAL_HEX8(0x1, AggClose(&xAgg, uTime));
+    TEST_ASSERT_TRUE(xAgg.axWindow[0].bClosed);
+    TEST_ASSERT_EQUAL(uHour + 60, xAgg.axWindow[0].uStart);
+    TEST_ASSERT_EQUAL(60 * 600, Energy(0));
+    TEST_ASSERT_EQUAL(8, xAgg.axWindow[0].xStats.uCount);   //Telegrams in the minute
+    TEST_ASSERT_EQUAL((uTime - 7 - uHour - 3) * 600, Energy(1)); //Running: up to the last telegram
+}
+
+/*--- A gap of up to cuAggMaxGap is integrated, a longer one is not ---*/
+void test_gap_cut_off(void)
+{
+    TEST_ASSERT_EQUAL(0, Telegram(uHour - 10, 1000));
+    TEST_ASSERT_EQUAL_HEX8(0x7, Telegram(uHour - 10 + cuAggMaxGap, 2000));
+    TEST_ASSERT_EQUAL(uHour + 60, xAgg.axWindow[0].uStart);
+    TEST_ASSERT_EQUAL((cuAggMaxGap - 70) * 1000, Energy(0));    //From the window start
+    TEST_ASSERT_EQUAL((cuAggMaxGap - 10) * 1000, Energy(1));    //From the hour
+
+    AggReset(&xAgg);
+    TEST_ASSERT_EQUAL(0, Telegram(uHour - 10, 1000));
+    TEST_ASSERT_EQUAL_HEX8(0x7, AggClose(&xAgg, uHour - 10 + cuAggMaxGap + 1));
+    for (int n = 0; n < cnAggWindows; n++)
+        TEST_ASSERT_EQUAL(0, Energy(n));                        //Not even up to the boundary
+    AggAdd(&xAgg, &xReading, uHour - 10 + cuAggMaxGap + 1, false);
+    for (int n = 0; n < cnAggWindows; n++)
+        TEST_ASSERT_EQUAL(0, Energy(n));
+
+    /*--- Integration resumes with the next telegram ---*/
+    (void)Telegram(uHour - 10 + cuAggMaxGap + 12, 0);
+    TEST_ASSERT_EQUAL(11 * 1000, Energy(1));
+}
+
+/*--- Windows close at their own boundaries; on the hour all three close in the same telegram ---*/
+void test_windows_close_together(void)
+{
+    uint8_t auCount[8] = { 0 };
+
+    for (uint32_t uTime = uHour; uTime <= uHour + 3600; uTime += 10)
+        auCount[Telegram(uTime, 100)]++;
+    TEST_ASSERT_EQUAL(60 - 4, auCount[0x1]);     //Minutes that don't end a quarter
+    TEST_ASSERT_EQUAL(3, auCount[0x3]);          //Quarters that don't end the hour
+    TEST_ASSERT_EQUAL(1, auCount[0x7]);          //The hour
+    TEST_ASSERT_EQUAL(0, auCount[0x2] + auCount[0x4] + auCount[0x5] + auCount[0x6]);
+
+    /*--- The three windows have the energy of their own length ---*/
+    AggReset(&xAgg);
+    for (uint32_t uTime = uHour; uTime < uHour + 3600; uTime += 10)
+        (void)Telegram(uTime, 100);
+    TEST_ASSERT_EQUAL(0x7, AggClose(&xAgg, uHour + 3600));
+    TEST_ASSERT_EQUAL(60 * 100, Energy(0));
+    TEST_ASSERT_EQUAL(900 * 100, Energy(1));
+    TEST_ASSERT_EQUAL(3600 * 100, Energy(2));
+    TEST_ASSERT_EQUAL(360, xAgg.axWindow[2].xStats.uCount);
+}
+
+/*--- A window as JSON: start in meter time, energy in Wh ---*/
+void test_json(void)
+{
+    for (uint32_t uTime = uHour; uTime <= uHour + 60; uTime += 30)
+        (void)Telegram(uTime, uTime < uHour + 30 ? 1000 : 2000);
+    TEST_ASSERT_TRUE(AggToJson(&xAgg, 1, achJson, sizeof(achJson)) > 0);
+    TEST_ASSERT_NOT_NULL(strstr(achJson, "{\"window\":\"15m\",\"start\":\"181121100000W\",\"samples\":\"3\""));
+    TEST_ASSERT_NOT_NULL(strstr(achJson, "\"use\":{\"total\":{\"min\":\"1000\",\"max\":\"2000\",\"avg\":\"1667\","
+                                         "\"last\":\"2000\",\"energy\":\"25.000\"}"));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_energy_split_at_boundary);
+    RUN_TEST(test_energy_full_window);
+    RUN_TEST(test_gap_cut_off);
+    RUN_TEST(test_windows_close_together);
+    RUN_TEST(test_json);
+    return UNITY_END();
+}
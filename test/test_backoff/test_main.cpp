@@ -0,0 +1,132 @@
+/*==================================================================================================*
+ * Unit tests of the retry schedule (Backoff.h), with fixed seeds so every run sees the same jitter.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "Backoff.h"
+
+const uint32_t cuSeed = 20190307;       //Fixed jitter seed
+const int cnCapped = 1000;              //Attempts checked at the maximum delay
+
+Backoff xBackoff;
+
+void setUp(void)
+{
+    BackoffReset(&xBackoff, 0, cuSeed);
+}
+
+void tearDown(void)
+{
+}
+
+/*--- The first attempt is due right away, the next ones after the wait BackoffFailed() returns ---*/
+void test_due(void)
+{
+    TEST_ASSERT_TRUE(BackoffDue(&xBackoff, 0));
+    unsigned long ulWait = BackoffFailed(&xBackoff, 100);
+    TEST_ASSERT_FALSE(BackoffDue(&xBackoff, 100));
+    TEST_ASSERT_FALSE(BackoffDue(&xBackoff, 100 + ulWait - 1));
+    TEST_ASSERT_TRUE(BackoffDue(&xBackoff, 100 + ulWait));
+    TEST_ASSERT_EQUAL(1, xBackoff.uAttempts);
+}
+
+/*--- Every wait is between half and the full delay, which doubles from 1 s up to 60 s ---*/
+void test_bounds(void)
+{
+    const unsigned long aulDelay[] = { 1000, 2000, 4000, 8000, 16000, 32000, 60000, 60000, 60000 };
+    unsigned long ulNow = 0;
+
+    for (unsigned i = 0; i < sizeof(aulDelay) / sizeof(aulDelay[0]); i++) {
+        unsigned long ulWait = BackoffFailed(&xBackoff, ulNow);
+        TEST_ASSERT_TRUE(ulWait >= aulDelay[i] / 2);
+        TEST_ASSERT_TRUE(ulWait <= aulDelay[i]);
+        TEST_ASSERT_EQUAL(ulNow + ulWait, xBackoff.ulNextTry);
+        ulNow += ulWait;
+    }
+    for (int i = 0; i < cnCapped; i++) {
+        unsigned long ulWait = BackoffFailed(&xBackoff, ulNow);
+        TEST_ASSERT_TRUE(ulWait >= culBackoffMax / 2 && ulWait <= culBackoffMax);
+        ulNow += ulWait;
+    }
+    TEST_ASSERT_EQUAL(culBackoffMax, xBackoff.ulDelay);
+}
+
+/*--- At the maximum delay the waits spread over the whole 30-60 s range ---*/
+void test_jitter_spread(void)
+{
+    unsigned long ulMin = culBackoffMax, ulMax = 0;
+    double dSum = 0;
+    int anBucket[6] = { 0 };                        //5 s wide
+
+    xBackoff.ulDelay = culBackoffMax;
+    for (int i = 0; i < cnCapped; i++) {
+        unsigned long ulWait = BackoffFailed(&xBackoff, 0);
+        ulMin = ulWait < ulMin ? ulWait : ulMin;
+        ulMax = ulWait > ulMax ? ulWait : ulMax;
+        dSum += ulWait;
+        anBucket[ulWait == culBackoffMax ? 5 : (ulWait - culBackoffMax / 2) / 5000]++;
+    }
+    TEST_ASSERT_TRUE(ulMin < 33000);
+    TEST_ASSERT_TRUE(ulMax > 57000);
+    TEST_ASSERT_TRUE(dSum / cnCapped > 43500 && dSum / cnCapped < 46500);
+    for (int i = 0; i < 6; i++)
+        TEST_ASSERT_TRUE(anBucket[i] > cnCapped / 6 / 2); //Roughly uniform
+}
+
+/*--- Sensors with another seed retry at other times ---*/
+void test_seeds_differ(void)
+{
+    Backoff xOther;
+    int nSame = 0;
+
+    BackoffReset(&xOther, 0, cuSeed + 1);
+    xBackoff.ulDelay = xOther.ulDelay = culBackoffMax;
+    for (int i = 0; i < 100; i++)
+        nSame += BackoffFailed(&xBackoff, 0) == BackoffFailed(&xOther, 0);
+    TEST_ASSERT_TRUE(nSame < 5);
+
+    BackoffReset(&xOther, 0, 0);                    //A zero seed would stop xorshift32
+    xOther.ulDelay = culBackoffMax;
+    unsigned long ulFirst = BackoffFailed(&xOther, 0);
+    TEST_ASSERT_NOT_EQUAL(0, xOther.uRandom);
+    TEST_ASSERT_NOT_EQUAL(ulFirst, BackoffFailed(&xOther, 0));
+}
+
+/*--- A success starts over at the shortest delay ---*/
+void test_succeeded(void)
+{
+    for (int i = 0; i < 10; i++)
+        (void)BackoffFailed(&xBackoff, 0);
+    TEST_ASSERT_EQUAL(culBackoffMax, xBackoff.ulDelay);
+    BackoffSucceeded(&xBackoff);
+    TEST_ASSERT_EQUAL(0, xBackoff.uAttempts);
+    unsigned long ulWait = BackoffFailed(&xBackoff, 0);
+    TEST_ASSERT_TRUE(ulWait >= culBackoffMin / 2 && ulWait <= culBackoffMin);
+}
+
+/*--- The schedule keeps working when millis() wraps around (after 49.7 days on the ESP8266) ---*/
+void test_millis_wrap(void)
+{
+    unsigned long ulNow = (unsigned long)-1 - 200;
+
+    BackoffReset(&xBackoff, ulNow, cuSeed);
+    unsigned long ulWait = BackoffFailed(&xBackoff, ulNow);
+    TEST_ASSERT_TRUE(ulWait > 200);
+    TEST_ASSERT_FALSE(BackoffDue(&xBackoff, ulNow + 100));
+    TEST_ASSERT_TRUE(xBackoff.ulNextTry < ulNow);   //Wrapped
+    TEST_ASSERT_FALSE(BackoffDue(&xBackoff, ulNow + ulWait - 1));
+    TEST_ASSERT_TRUE(BackoffDue(&xBackoff, ulNow + ulWait));
+    TEST_ASSERT_TRUE(BackoffDue(&xBackoff, ulNow + ulWait + 1000));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_due);
+    RUN_TEST(test_bounds);
+    RUN_TEST(test_jitter_spread);
+    RUN_TEST(test_seeds_differ);
+    RUN_TEST(test_succeeded);
+    RUN_TEST(test_millis_wrap);
+    return UNITY_END();
+}
@@ -0,0 +1,274 @@
+#ifndef BASELINE_H
+#define BASELINE_H
+
+#include <ctype.h>
+#include "DsmrReading.h"
+
+/*--- ArduinoJson 5 (lib_deps of the bench environment) for the original serializer ---*/
+#if defined(__has_include)
+#if __has_include(<ArduinoJson.h>)
+#include <string>
+#include <ArduinoJson.h>
+#define BASELINE_JSON
+#endif
+#endif
+
+/*==================================================================================================*
+ * The original line based decoder, kept as the "before" of the benchmarks.
+ *
+ * This is the decoding of the first version of the sketch, without the Arduino parts: every line
+ * is read up to the '\n', added to the CRC16 with the bitwise loop, and compared with strncmp()
+ * against every DSMR_* reference; values are converted with atof(). Its results are checked
+ * against the streaming parser, so the comparison is between two decoders doing the same work.
+ * The MQTT document is built as it was, with ArduinoJson 5, when that library is available.
+ *==================================================================================================*/
+
+/*--- OBIS references of the original sketch ---*/
+#define DSMR_VERSION "1-3:0.2.8"                //DSMR version
+#define DSMR_PWR_TIMESTAMP "0-0:1.0.0"          //P1 telegram timestamp
+#define DSMR_PWR_LOW "1-0:1.8.1"                //Power consumption meter (low tariff)
+#define DSMR_PWR_HIGH "1-0:1.8.2"               //Power consumption meter (high tariff)
+#define DSMR_RET_LOW "1-0:2.8.1"                //Power return meter (low tariff)
+#define DSMR_RET_HIGH "1-0:2.8.2"               //Power return meter (high tariff)
+#define DSMR_PWR_ACTUAL "1-0:1.7.0"             //Power consumption actual
+#define DSMR_PWR_L1 "1-0:21.7.0"                //Power consumption L1 actual
+#define DSMR_PWR_L2 "1-0:41.7.0"                //Power consumption L2 actual
+#define DSMR_PWR_L3 "1-0:61.7.0"                //Power consumption L3 actual
+#define DSMR_RET_L1 "1-0:22.7.0"                //Power return L1 actual
+#define DSMR_RET_L2 "1-0:42.7.0"                //Power return L2 actual
+#define DSMR_RET_L3 "1-0:62.7.0"                //Power return L3 actual
+#define DSMR_RET_ACTUAL "1-0:2.7.0"             //Power return actual
+#define DSMR_PWR_TARIFF "0-0:96.14.0"           //Power current tariff (1=Low,2=High)
+#define DSMR_GAS_METER "0-1:24.2.1"             //Gas on Kaifa MA105 + Landis+Gyr 350 meters
+
+const int cnBaselineLineLen = 250;              //Longest normal line is 201 char (+3 for \r\n\0)
+
+struct Baseline
+{
+    DsmrReading xReading;                       //Only the fields of the original sketch are set
+    unsigned int uCrc;                          //Running CRC16
+    char achLine[cnBaselineLineLen + 2];        //Line being received
+    int nLen;
+};
+
+static bool BaselineIsNumber(char chNum)
+{
+    return (isdigit(chNum) || chNum == '.' || chNum == 0);
+}
+
+static int BaselineFindLastChar(const char achBuffer[], char chSearch, int nLen)
+{
+    for (int i = nLen - 1; i >= 0; i--)
+        if (achBuffer[i] == chSearch)
+            return i;
+    return -1;
+}
+
+static int BaselineFindFirstChar(const char achBuffer[], char chSearch, int nLen)
+{
+    for (int i = 0; i <= nLen; i++) {
+        if (achBuffer[i] == 0)
+            break;
+        if (achBuffer[i] == chSearch)
+            return i;
+    }
+    return -1;
+}
+
+static long BaselineGetValue(const char *pchBuffer, int nMaxLen, bool bMultiply = true)
+{
+    int nStart = BaselineFindLastChar(pchBuffer, '(', nMaxLen - 1);
+    if (nStart < 8 || nStart > 32)
+        return 0;
+    int nLen = BaselineFindLastChar(pchBuffer, '*', nMaxLen - 1) - nStart - 1;
+    if (nLen < 0)
+        nLen = BaselineFindLastChar(pchBuffer, ')', nMaxLen - 1) - nStart - 1;
+    if (nLen < 1 || nLen > 12)
+        return 0;
+    const char *pchValue = pchBuffer + nStart + 1;
+    for (int i = 0; i < nLen; i++)
+        if (!BaselineIsNumber(pchValue[i]))
+            return 0;
+    return bMultiply ? 1000 * atof(pchValue) : atof(pchValue);
+}
+
+static int BaselineGetLastText(const char *pchBuffer, int nMaxLen, char *pchText)
+{
+    pchText[0] = 0;
+    int nStart = BaselineFindLastChar(pchBuffer, '(', nMaxLen - 1);
+    if (nStart < 8 || nStart > 39)
+        return 0;
+    int nLen = BaselineFindLastChar(pchBuffer, ')', nMaxLen - 1) - nStart - 1;
+    if (nLen < 1 || nLen > 15)      //The original allowed 31, more than achPwrTime holds
+        return 0;
+    memcpy(pchText, pchBuffer + nStart + 1, nLen);
+    pchText[nLen] = 0;
+    return nLen;
+}
+
+static int BaselineGetFirstText(const char *pchBuffer, int nMaxLen, char *pchText)
+{
+    pchText[0] = 0;
+    int nStart = BaselineFindFirstChar(pchBuffer, '(', nMaxLen - 2);
+    if (nStart < 8 || nStart > 12)
+        return 0;
+    int nLen = BaselineFindFirstChar(pchBuffer, ')', nMaxLen) - nStart;
+    if (nLen < 1 || nLen > 16)      //The original allowed 31, more than achGasTime holds
+        return 0;
+    memcpy(pchText, pchBuffer + nStart + 1, nLen - 1);
+    pchText[nLen - 1] = 0;
+    return nLen;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * BaselineDispatch: Compare a line with every reference, like the original DecodeTelegram().
+ *------------------------------------------------------------------------------------------------*/
+static DsmrField BaselineDispatch(const char *pchLine)
+{
+    DsmrField nField = FIELD_NONE;
+
+    if (strncmp(pchLine, DSMR_VERSION, strlen(DSMR_VERSION)) == 0) nField = FIELD_VERSION;
+    if (strncmp(pchLine, DSMR_PWR_TIMESTAMP, strlen(DSMR_PWR_TIMESTAMP)) == 0) nField = FIELD_PWR_TIMESTAMP;
+    if (strncmp(pchLine, DSMR_PWR_LOW, strlen(DSMR_PWR_LOW)) == 0) nField = FIELD_PWR_LOW;
+    if (strncmp(pchLine, DSMR_PWR_HIGH, strlen(DSMR_PWR_HIGH)) == 0) nField = FIELD_PWR_HIGH;
+    if (strncmp(pchLine, DSMR_RET_LOW, strlen(DSMR_RET_LOW)) == 0) nField = FIELD_RET_LOW;
+    if (strncmp(pchLine, DSMR_RET_HIGH, strlen(DSMR_RET_HIGH)) == 0) nField = FIELD_RET_HIGH;
+    if (strncmp(pchLine, DSMR_PWR_ACTUAL, strlen(DSMR_PWR_ACTUAL)) == 0) nField = FIELD_PWR_ACTUAL;
+    if (strncmp(pchLine, DSMR_PWR_L1, strlen(DSMR_PWR_L1)) == 0) nField = FIELD_PWR_L1;
+    if (strncmp(pchLine, DSMR_PWR_L2, strlen(DSMR_PWR_L2)) == 0) nField = FIELD_PWR_L2;
+    if (strncmp(pchLine, DSMR_PWR_L3, strlen(DSMR_PWR_L3)) == 0) nField = FIELD_PWR_L3;
+    if (strncmp(pchLine, DSMR_RET_ACTUAL, strlen(DSMR_RET_ACTUAL)) == 0) nField = FIELD_RET_ACTUAL;
+    if (strncmp(pchLine, DSMR_RET_L1, strlen(DSMR_RET_L1)) == 0) nField = FIELD_RET_L1;
+    if (strncmp(pchLine, DSMR_RET_L2, strlen(DSMR_RET_L2)) == 0) nField = FIELD_RET_L2;
+    if (strncmp(pchLine, DSMR_RET_L3, strlen(DSMR_RET_L3)) == 0) nField = FIELD_RET_L3;
+    if (strncmp(pchLine, DSMR_PWR_TARIFF, strlen(DSMR_PWR_TARIFF)) == 0) nField = FIELD_PWR_TARIFF;
+    if (strncmp(pchLine, DSMR_GAS_METER, strlen(DSMR_GAS_METER)) == 0) nField = FIELD_GAS_METER;
+    return nField;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * BaselineDecodeLine: Decode a complete line (including its '\n'), like DecodeTelegram().
+ *------------------------------------------------------------------------------------------------*
+ *OUTPUT:
+ *	(bool) true if the line ends a telegram with a valid CRC16.
+ *------------------------------------------------------------------------------------------------*/
+static bool BaselineDecodeLine(Baseline *pxBase, const char *pchLine, int nLen)
+{
+    DsmrReading *pxReading = &pxBase->xReading;
+    int nStartChar = BaselineFindLastChar(pchLine, '/', nLen);
+    int nEndChar = BaselineFindLastChar(pchLine, '!', nLen);
+    bool bValidCrcFound = false;
+
+    if (nStartChar >= 0)
+        pxBase->uCrc = Crc16Bitwise(0x0000, (unsigned char *)pchLine + nStartChar, nLen - nStartChar);
+    else if (nEndChar >= 0) {
+        char achMessageCrc[5];
+        pxBase->uCrc = Crc16Bitwise(pxBase->uCrc, (unsigned char *)pchLine + nEndChar, 1);
+        memcpy(achMessageCrc, pchLine + nEndChar + 1, 4);
+        achMessageCrc[4] = 0;
+        bValidCrcFound = (strtoul(achMessageCrc, NULL, 16) == pxBase->uCrc);
+        pxBase->uCrc = 0;
+    }
+    else
+        pxBase->uCrc = Crc16Bitwise(pxBase->uCrc, (unsigned char *)pchLine, nLen);
+
+    switch (BaselineDispatch(pchLine)) {
+    case FIELD_VERSION: pxReading->lDsmrVersion = BaselineGetValue(pchLine, nLen, false); break;
+    case FIELD_PWR_TIMESTAMP: (void)BaselineGetLastText(pchLine, nLen, pxReading->achPwrTime); break;
+    case FIELD_PWR_LOW: pxReading->lPwrLow = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_PWR_HIGH: pxReading->lPwrHigh = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_RET_LOW: pxReading->lReturnLow = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_RET_HIGH: pxReading->lReturnHigh = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_PWR_ACTUAL: pxReading->lPwrActual = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_PWR_L1: pxReading->lPwrL1 = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_PWR_L2: pxReading->lPwrL2 = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_PWR_L3: pxReading->lPwrL3 = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_RET_ACTUAL: pxReading->lReturnActual = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_RET_L1: pxReading->lReturnL1 = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_RET_L2: pxReading->lReturnL2 = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_RET_L3: pxReading->lReturnL3 = BaselineGetValue(pchLine, nLen); break;
+    case FIELD_PWR_TARIFF: pxReading->lPwrTariff = BaselineGetValue(pchLine, nLen, false); break;
+    case FIELD_GAS_METER:
+        pxReading->lGasMeter = BaselineGetValue(pchLine, nLen);
+        (void)BaselineGetFirstText(pchLine, nLen, pxReading->achGasTime);
+        break;
+    default:
+        break;
+    }
+    return bValidCrcFound;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * BaselineFeed: Split received bytes into lines (like readBytesUntil('\n')) and decode them.
+ *------------------------------------------------------------------------------------------------*
+ *OUTPUT:
+ *	(int) number of telegrams with a valid CRC16 that ended in these bytes.
+ *------------------------------------------------------------------------------------------------*/
+static int BaselineFeed(Baseline *pxBase, const char *pchData, int nLen)
+{
+    int nValid = 0;
+
+    for (int i = 0; i < nLen; i++) {
+        char ch = pchData[i];
+        if (ch != '\n' && pxBase->nLen < cnBaselineLineLen) {
+            pxBase->achLine[pxBase->nLen++] = ch;
+            continue;
+        }
+        pxBase->achLine[pxBase->nLen] = '\n';
+        pxBase->achLine[pxBase->nLen + 1] = 0;
+        nValid += BaselineDecodeLine(pxBase, pxBase->achLine, pxBase->nLen + 1);
+        pxBase->nLen = 0;
+    }
+    return nValid;
+}
+
+#ifdef BASELINE_JSON
+/*------------------------------------------------------------------------------------------------*
+ * BaselineToJson: Build the MQTT document like the original PublishToTopic(), with ArduinoJson.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Every value is converted to a temporary string, copied into the document tree, and the tree
+ *  is measured and printed. std::string stands in for the Arduino String of the original. The
+ *  StaticJsonBuffer<800> of the original was sized for 32-bit pointers; the nodes are twice as
+ *  large on a 64-bit host.
+ *OUTPUT:
+ *	(int) length of the document.
+ *------------------------------------------------------------------------------------------------*/
+static int BaselineToJson(const DsmrReading *pxReading, char *pchBuf, int nSize)
+{
+    StaticJsonBuffer<800 * sizeof(void *) / 4> jsonBuffer;
+    JsonObject &root = jsonBuffer.createObject();
+    root["dsmr"] = std::to_string(pxReading->lDsmrVersion);
+    JsonObject &jPwr = root.createNestedObject("power");
+    jPwr["time"] = std::string(pxReading->achPwrTime);
+    jPwr["tariff"] = std::to_string(pxReading->lPwrTariff);
+    JsonObject &jGas = root.createNestedObject("gas");
+    jGas["time"] = std::string(pxReading->achGasTime);
+    jGas["total"] = std::to_string(pxReading->lGasMeter);
+    JsonObject &jUse = jPwr.createNestedObject("use");
+    JsonObject &jTotalUse = jUse.createNestedObject("total");
+    jTotalUse["T1"] = std::to_string(pxReading->lPwrLow);
+    jTotalUse["T2"] = std::to_string(pxReading->lPwrHigh);
+    JsonObject &jActualUse = jUse.createNestedObject("actual");
+    jActualUse["total"] = std::to_string(pxReading->lPwrActual);
+    jActualUse["L1"] = std::to_string(pxReading->lPwrL1);
+    jActualUse["L2"] = std::to_string(pxReading->lPwrL2);
+    jActualUse["L3"] = std::to_string(pxReading->lPwrL3);
+    JsonObject &jReturn = jPwr.createNestedObject("return");
+    JsonObject &jTotalReturn = jReturn.createNestedObject("total");
+    jTotalReturn["T1"] = std::to_string(pxReading->lReturnLow);
+    jTotalReturn["T2"] = std::to_string(pxReading->lReturnHigh);
+    JsonObject &jActualReturn = jReturn.createNestedObject("actual");
+    jActualReturn["total"] = std::to_string(pxReading->lReturnActual);
+    jActualReturn["L1"] = std::to_string(pxReading->lReturnL1);
+    jActualReturn["L2"] = std::to_string(pxReading->lReturnL2);
+    jActualReturn["L3"] = std::to_string(pxReading->lReturnL3);
+
+    int nLen = (int)root.measureLength();
+    if (nLen >= nSize)
+        return -1;
+    root.printTo(pchBuf, nLen + 1);
+    return nLen;
+}
+#endif
+#endif
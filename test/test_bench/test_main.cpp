@@ -0,0 +1,326 @@
+/*==================================================================================================*
+ * Micro-benchmarks of the P1 core on the host: pio test -e bench -v
+ *
+ * The recorded telegrams are replayed many times through the same code as on the device and the
+ * time per byte, line and telegram is reported as a test message. The absolute numbers are those
+ * of the host; what matters is how they compare between changes and between the alternatives
+ * measured side by side (the ESP8266 at 80 MHz is roughly a hundred times slower).
+ *==================================================================================================*/
+
+#include <unity.h>
+#include <time.h>
+#include "TestTelegrams.h"
+#include "Baseline.h"
+#include "DsmrJson.h"
+#include "DsmrBinary.h"
+#include "P1Reader.h"
+
+const int cnBenchPasses = 2000;         //Replays of a telegram per measurement
+static const char *const apchCrcEngine[] = { "bitwise", "table", "slice-by-4" }; //By CRC16_ENGINE
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+Baseline xBaseline;
+
+void setUp(void)
+{
+    memset(&xSnapshot, 0, sizeof(xSnapshot));
+    memset(&xBaseline, 0, sizeof(xBaseline));
+    P1ParserReset(&xParser);
+}
+
+void tearDown(void)
+{
+}
+
+/*--- Monotonic clock in nanoseconds ---*/
+static int64_t BenchNow(void)
+{
+    struct timespec xTime;
+
+    clock_gettime(CLOCK_MONOTONIC, &xTime);
+    return (int64_t)xTime.tv_sec * 1000000000LL + xTime.tv_nsec;
+}
+
+/*--- Print a result line in the test output ---*/
+#define BENCH_REPORT(...)                                       \
+    do {                                                        \
+        char achReport_[200];                                   \
+        snprintf(achReport_, sizeof(achReport_), __VA_ARGS__);  \
+        TEST_MESSAGE(achReport_);                               \
+    } while (0)
+
+/*------------------------------------------------------------------------------------------------*
+ * BenchParse: Replay a telegram through SnapshotFeed() and report the time per byte, line and
+ * telegram.
+ *------------------------------------------------------------------------------------------------*/
+static void BenchParse(const char *pchName, const char *pchTelegram)
+{
+    int nLen = (int)strlen(pchTelegram);
+    int nLines = TestLines(pchTelegram);
+    int nOk = 0;
+
+    (void)TestFeed(&xSnapshot, &xParser, pchTelegram); //Warm up
+    int64_t llStart = BenchNow();
+    for (int i = 0; i < cnBenchPasses; i++)
+        nOk += TestFeed(&xSnapshot, &xParser, pchTelegram, nLen) == P1_EVENT_TELEGRAM_OK;
+    double dNs = (double)(BenchNow() - llStart) / cnBenchPasses;
+
+    TEST_ASSERT_EQUAL(cnBenchPasses, nOk);
+    BENCH_REPORT("parse %s (%d bytes, %d lines, CRC16 %s): %.1f ns/byte, %.0f ns/line, %.0f ns/telegram",
+                 pchName, nLen, nLines, apchCrcEngine[CRC16_ENGINE], dNs / nLen, dNs / nLines, dNs);
+}
+
+void test_parse_v42(void)
+{
+    BenchParse("DSMR 4.2", achTelegramV42);
+}
+
+void test_parse_v50(void)
+{
+    BenchParse("DSMR 5.0", achTelegramV50);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * BenchCrc: Time a CRC16 engine over a telegram, in bytes/us.
+ *------------------------------------------------------------------------------------------------*/
+static void BenchCrc(const char *pchName, unsigned int (*pfnCrc)(unsigned int, unsigned char *, int))
+{
+    unsigned char *puData = (unsigned char *)achTelegramV50;
+    int nLen = (int)(strchr(achTelegramV50, '!') - achTelegramV50) + 1;
+    volatile unsigned int uCrc = 0;
+
+    int64_t llStart = BenchNow();
+    for (int i = 0; i < cnBenchPasses; i++)
+        uCrc = pfnCrc(0, puData, nLen);
+    double dNs = (double)(BenchNow() - llStart) / cnBenchPasses;
+
+    TEST_ASSERT_EQUAL_HEX16(0x31AA, uCrc);
+    BENCH_REPORT("CRC16 %s: %.0f bytes/us, %.0f ns/telegram", pchName, nLen * 1000.0 / dNs, dNs);
+}
+
+void test_crc16_engines(void)
+{
+    BenchCrc("bitwise", Crc16Bitwise);
+    BenchCrc("table", Crc16Table);
+#if CRC16_ENGINE == CRC16_SLICE4
+    BenchCrc("slice-by-4", Crc16Slice4);
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * BenchObisFind: Look up the object of a line the way the parser does: pack the reference while
+ * it is read, then search the table.
+ *------------------------------------------------------------------------------------------------*/
+static int BenchObisFind(P1Parser *pxParser, const char *pchLine)
+{
+    P1StartLine(pxParser);
+    while (pxParser->nState == P1_REFERENCE && *pchLine)
+        P1ReferenceChar(pxParser, *pchLine++);
+    return pxParser->nObject;
+}
+
+/*--- Finding the object of every line: strncmp() chain against the packed key lookup ---*/
+void test_obis_dispatch(void)
+{
+    const char *apchLine[64];
+    int nLines = 0;
+    volatile int nSink = 0;
+
+    for (const char *pch = achTelegramV50; *pch && nLines < 64; pch = strchr(pch, '\n') + 1)
+        apchLine[nLines++] = pch;
+    for (int i = 0; i < nLines; i++) {
+        DsmrField nBefore = BaselineDispatch(apchLine[i]);
+        int nObject = BenchObisFind(&xParser, apchLine[i]);
+        if (nBefore != FIELD_NONE)
+            TEST_ASSERT_EQUAL(nBefore == FIELD_GAS_METER ? FIELD_MBUS : nBefore, axObisTable[nObject].nField);
+    }
+
+    int64_t llStart = BenchNow();
+    for (int n = 0; n < cnBenchPasses; n++)
+        for (int i = 0; i < nLines; i++)
+            nSink += BaselineDispatch(apchLine[i]);
+    double dBefore = (double)(BenchNow() - llStart) / cnBenchPasses / nLines;
+    llStart = BenchNow();
+    for (int n = 0; n < cnBenchPasses; n++)
+        for (int i = 0; i < nLines; i++)
+            nSink += BenchObisFind(&xParser, apchLine[i]);
+    double dAfter = (double)(BenchNow() - llStart) / cnBenchPasses / nLines;
+
+    BENCH_REPORT("OBIS dispatch, strncmp chain (16 references): %.1f ns/line, %.1f M lines/s", dBefore, 1000 / dBefore);
+    BENCH_REPORT("OBIS dispatch, packed key + table (%d objects): %.1f ns/line, %.1f M lines/s",
+                 cnObisEntries, dAfter, 1000 / dAfter);
+}
+
+/*--- Complete decoding of a telegram: the original line based decoder against the streaming parser ---*/
+void test_lines_per_second(void)
+{
+    int nLen = (int)strlen(achTelegramV42);
+    int nLines = TestLines(achTelegramV42);
+    int nOk = 0;
+
+    TEST_ASSERT_EQUAL(1, BaselineFeed(&xBaseline, achTelegramV42, nLen));
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV42));
+    const DsmrReading *pxReading = SnapshotPublished(&xSnapshot);
+    TEST_ASSERT_EQUAL(pxReading->lPwrLow, xBaseline.xReading.lPwrLow);
+    TEST_ASSERT_EQUAL(pxReading->lReturnL3, xBaseline.xReading.lReturnL3);
+    TEST_ASSERT_EQUAL(pxReading->lGasMeter, xBaseline.xReading.lGasMeter);
+    TEST_ASSERT_EQUAL_STRING(pxReading->achGasTime, xBaseline.xReading.achGasTime);
+
+    int64_t llStart = BenchNow();
+    for (int i = 0; i < cnBenchPasses; i++)
+        nOk += BaselineFeed(&xBaseline, achTelegramV42, nLen);
+    double dBefore = (double)(BenchNow() - llStart) / cnBenchPasses;
+    llStart = BenchNow();
+    for (int i = 0; i < cnBenchPasses; i++)
+        nOk += TestFeed(&xSnapshot, &xParser, achTelegramV42, nLen) == P1_EVENT_TELEGRAM_OK;
+    double dAfter = (double)(BenchNow() - llStart) / cnBenchPasses;
+
+    TEST_ASSERT_EQUAL(2 * cnBenchPasses, nOk);
+    BENCH_REPORT("decode DSMR 4.2, line based (bitwise CRC16, strncmp, atof): %.0f ns/telegram, %.2f M lines/s",
+                 dBefore, nLines * 1000 / dBefore);
+    BENCH_REPORT("decode DSMR 4.2, streaming parser: %.0f ns/telegram, %.2f M lines/s", dAfter, nLines * 1000 / dAfter);
+}
+
+/*--- Building the MQTT document: ArduinoJson with String values against DsmrToJson() ---*/
+void test_json_serialize(void)
+{
+    const uint32_t cuLegacyFields = FieldBit(FIELD_VERSION) | cuPower | FieldBit(FIELD_GAS_METER);
+    char achAfter[1600];
+    volatile int nSink = 0;
+
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV42));
+    const DsmrReading *pxReading = SnapshotPublished(&xSnapshot);
+    int nLen = DsmrToJson(pxReading, cuLegacyFields, achAfter, sizeof(achAfter));
+    TEST_ASSERT_TRUE(nLen > 0);
+
+    int64_t llStart = BenchNow();
+    for (int i = 0; i < cnBenchPasses; i++)
+        nSink += DsmrToJson(pxReading, cuLegacyFields, achAfter, sizeof(achAfter));
+    double dAfter = (double)(BenchNow() - llStart) / cnBenchPasses;
+#ifdef BASELINE_JSON
+    char achBefore[1600];
+    TEST_ASSERT_EQUAL(nLen, BaselineToJson(pxReading, achBefore, sizeof(achBefore)));
+    TEST_ASSERT_EQUAL_STRING(achBefore, achAfter); //Byte for byte the same document
+
+    llStart = BenchNow();
+    for (int i = 0; i < cnBenchPasses; i++)
+        nSink += BaselineToJson(pxReading, achBefore, sizeof(achBefore));
+    double dBefore = (double)(BenchNow() - llStart) / cnBenchPasses;
+    BENCH_REPORT("JSON document (%d bytes), ArduinoJson + String: %.0f ns/document", nLen, dBefore);
+#else
+    BENCH_REPORT("JSON document, ArduinoJson + String: not measured, ArduinoJson 5 not available");
+#endif
+    BENCH_REPORT("JSON document (%d bytes), DsmrToJson: %.0f ns/document", nLen, dAfter);
+}
+
+/*--- The values of the binary payload (original document and M-Bus channels) as JSON and binary ---*/
+void test_binary_payload(void)
+{
+    char achJson[1600];
+    uint8_t auBinary[cnBinaryLen];
+    const uint32_t cuBinaryFields = FieldBit(FIELD_VERSION) | cuPower | FieldBit(FIELD_GAS_METER) | FieldBit(FIELD_MBUS);
+    volatile int nSink = 0;
+
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV50));
+    const DsmrReading *pxReading = SnapshotPublished(&xSnapshot);
+    int nJsonLen = DsmrToJson(pxReading, cuBinaryFields, achJson, sizeof(achJson));
+    TEST_ASSERT_TRUE(nJsonLen > 0);
+    TEST_ASSERT_EQUAL(cnBinaryLen, DsmrToBinary(pxReading, auBinary, sizeof(auBinary)));
+
+    int64_t llStart = BenchNow();
+    for (int i = 0; i < cnBenchPasses; i++)
+        nSink += DsmrToJson(pxReading, cuBinaryFields, achJson, sizeof(achJson));
+    double dJson = (double)(BenchNow() - llStart) / cnBenchPasses;
+    llStart = BenchNow();
+    for (int i = 0; i < cnBenchPasses; i++)
+        nSink += DsmrToBinary(pxReading, auBinary, sizeof(auBinary));
+    double dBinary = (double)(BenchNow() - llStart) / cnBenchPasses;
+
+    BENCH_REPORT("payload DSMR 5.0, JSON document: %d bytes, %.0f ns/encode", nJsonLen, dJson);
+    BENCH_REPORT("payload DSMR 5.0, binary schema %d: %d bytes, %.0f ns/encode", cuBinarySchema, cnBinaryLen, dBinary);
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * test_replay_10x: DSMR 5.0 telegrams (one per second) received at ten times the real rate.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	The bytes are put in the receive buffer when they arrive at 10x the line rate of 115,200 baud
+ *  8N1, one telegram per 100 ms. Each pass of the loop below reads at most cnReplayBytesPerLoop
+ *  bytes like loop() does, and a valid telegram gets the work of a publish without the network:
+ *  change detection, complete JSON document and binary payload. The replay clock advances by the
+ *  measured time of every pass and skips the idle time, so the result does not depend on the load
+ *  of the host. No byte may be lost, and the buffer must stay within the 256 bytes of SoftwareSerial.
+ *------------------------------------------------------------------------------------------------*/
+void test_replay_10x(void)
+{
+    const int cnReplayTelegrams = 60;       //A minute of DSMR 5.0 telegrams
+    const int cnReplayBytesPerLoop = 256;   //cnMaxBytesPerLoop in main.cpp
+    const double cdSpeed = 10;
+    const double cdByteNs = 10 * 1e9 / 115200 / cdSpeed;
+    const double cdIntervalNs = 1e9 / cdSpeed;
+    int nLen = (int)strlen(achTelegramV50);
+    char achJson[1600];
+    uint8_t auBinary[cnBinaryLen];
+    DsmrReading xSent;
+    int nSent = 0, nOk = 0, nMaxFill = 0;
+    double dClock = 0;                      //Replay time (ns)
+    double dBusy = 0;                       //Of which spent in the loop (ns)
+
+    memset(&xSent, 0, sizeof(xSent));
+    P1ReaderBegin(115200, 0);
+    (void)P1ReaderOverflows();
+    while (nSent < cnReplayTelegrams * nLen || P1ReaderAvailable()) {
+        /*--- Bytes that arrived by now; when there are none, wait for the next one ---*/
+        int nTelegram = nSent / nLen;
+        int nPos = nSent % nLen;
+        if (!P1ReaderAvailable() && nTelegram < cnReplayTelegrams) {
+            double dNext = nTelegram * cdIntervalNs + nPos * cdByteNs;
+            dClock = dClock > dNext ? dClock : dNext;
+        }
+        if (nTelegram < cnReplayTelegrams) {
+            int nDue = (int)((dClock - nTelegram * cdIntervalNs) / cdByteNs) + 1;
+            nDue = nDue < nLen ? nDue : nLen;
+            if (nDue > nPos)
+                nSent += P1ReaderInject(achTelegramV50 + nPos, nDue - nPos);
+        }
+        nMaxFill = P1ReaderAvailable() > nMaxFill ? P1ReaderAvailable() : nMaxFill;
+
+        /*--- One pass of loop() ---*/
+        int64_t llPass = BenchNow();
+        for (int nBudget = cnReplayBytesPerLoop; P1ReaderAvailable() && nBudget > 0; nBudget--) {
+            if (SnapshotFeed(&xSnapshot, &xParser, (char)P1ReaderRead()) != P1_EVENT_TELEGRAM_OK)
+                continue;
+            const DsmrReading *pxReading = SnapshotPublished(&xSnapshot);
+            uint32_t uMask = DsmrChanged(&xSent, pxReading);
+            TEST_ASSERT_TRUE(DsmrToJson(pxReading, cuAllFields | uMask, achJson, sizeof(achJson)) > 0);
+            TEST_ASSERT_EQUAL(cnBinaryLen, DsmrToBinary(pxReading, auBinary, sizeof(auBinary)));
+            xSent = *pxReading;
+            nOk++;
+        }
+        double dPass = (double)(BenchNow() - llPass);
+        dClock += dPass;
+        dBusy += dPass;
+    }
+
+    TEST_ASSERT_EQUAL(cnReplayTelegrams, nOk);
+    TEST_ASSERT_EQUAL(0, P1ReaderOverflows());
+    TEST_ASSERT_TRUE(nMaxFill < 256);
+    BENCH_REPORT("replay DSMR 5.0 at 10x real time (%d telegrams of %d bytes, 1 per %.0f ms): %.1f us/telegram, "
+                 "%.3f%% busy, buffer peak %d bytes", cnReplayTelegrams, nLen, cdIntervalNs / 1e6,
+                 dBusy / 1e3 / cnReplayTelegrams, 100.0 * dBusy / dClock, nMaxFill);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_v42);
+    RUN_TEST(test_parse_v50);
+    RUN_TEST(test_crc16_engines);
+    RUN_TEST(test_obis_dispatch);
+    RUN_TEST(test_lines_per_second);
+    RUN_TEST(test_json_serialize);
+    RUN_TEST(test_binary_payload);
+    RUN_TEST(test_replay_10x);
+    return UNITY_END();
+}
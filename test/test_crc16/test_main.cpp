@@ -0,0 +1,96 @@
+/*==================================================================================================*
+ * Unit tests of the CRC16 engines and of the CRC16 check in the parser.
+ *
+ * Built with the slice-by-4 engine, so all three engines are available and the parser hashes its
+ * spans with the one that has the most code paths (4 bytes at a time plus a 0..3 byte tail).
+ *==================================================================================================*/
+
+#define CRC16_ENGINE CRC16_SLICE4
+
+#include <unity.h>
+#include "TestTelegrams.h"
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+char achEdit[cnTestTelegramLen];
+unsigned char auData[300];
+
+void setUp(void)
+{
+    memset(&xSnapshot, 0, sizeof(xSnapshot));
+    P1ParserReset(&xParser);
+}
+
+void tearDown(void)
+{
+}
+
+/*--- CRC-16/ARC check value ---*/
+void test_check_value(void)
+{
+    unsigned char auCheck[] = "123456789";
+
+    TEST_ASSERT_EQUAL_HEX16(0xBB3D, Crc16Bitwise(0, auCheck, 9));
+    TEST_ASSERT_EQUAL_HEX16(0xBB3D, Crc16Table(0, auCheck, 9));
+    TEST_ASSERT_EQUAL_HEX16(0xBB3D, Crc16Slice4(0, auCheck, 9));
+    TEST_ASSERT_EQUAL_HEX16(0xBB3D, Crc16(0, auCheck, 9));
+}
+
+/*--- All engines are bit-exact with the bitwise loop, for any length, start value and split ---*/
+void test_engines_match_bitwise(void)
+{
+    uint32_t uRandom = 12345;
+
+    for (unsigned i = 0; i < sizeof(auData); i++) {
+        uRandom = uRandom * 1103515245 + 12345;
+        auData[i] = (unsigned char)(uRandom >> 16);
+    }
+    for (int nLen = 0; nLen <= (int)sizeof(auData); nLen++) {
+        unsigned int uStart = (nLen * 0x9E37) & 0xFFFF;
+        unsigned int uExpected = Crc16Bitwise(uStart, auData, nLen);
+        TEST_ASSERT_EQUAL_HEX16(uExpected, Crc16Table(uStart, auData, nLen));
+        TEST_ASSERT_EQUAL_HEX16(uExpected, Crc16Slice4(uStart, auData, nLen));
+        int nSplit = nLen / 3;
+        TEST_ASSERT_EQUAL_HEX16(uExpected, Crc16(Crc16(uStart, auData, nSplit), auData + nSplit, nLen - nSplit));
+    }
+}
+
+/*--- The parser accepts the recorded telegrams and rejects every single bit error ---*/
+void test_parser_detects_bit_errors(void)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV50));
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV42));
+
+    int nEnd = (int)(strchr(achTelegramV42, '!') - achTelegramV42);
+    for (int i = 1; i < nEnd; i++) {
+        for (int nBit = 0; nBit < 8; nBit++) {
+            int nLen = TestEdit(achEdit, sizeof(achEdit), achTelegramV42);
+            achEdit[i] ^= 1 << nBit;
+            TEST_ASSERT_TRUE(TestFeed(&xSnapshot, &xParser, achEdit, nLen) != P1_EVENT_TELEGRAM_OK);
+        }
+    }
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV42));
+}
+
+/*--- Telegrams of any length end on any position of the CRC16 span ---*/
+void test_parser_span_lengths(void)
+{
+    char achPadding[cnCrcSpanLen + 20];
+
+    for (int nPad = 0; nPad <= cnCrcSpanLen; nPad++) {
+        memset(achPadding, 'A', nPad);
+        snprintf(achPadding + nPad, sizeof(achPadding) - nPad, "\r\n");
+        TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "\r\n", achPadding) > 0);
+        TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achEdit));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_check_value);
+    RUN_TEST(test_engines_match_bitwise);
+    RUN_TEST(test_parser_detects_bit_errors);
+    RUN_TEST(test_parser_span_lengths);
+    return UNITY_END();
+}
@@ -0,0 +1,145 @@
+/*==================================================================================================*
+ * Unit tests of the change detection (DsmrChanged()) behind the delta documents of MQTT_DELTA.
+ *
+ * Every test decodes the DSMR 5.0 telegram, then a copy with one or more values edited, and checks
+ * the fields reported as changed and the sparse JSON document written for them.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "TestTelegrams.h"
+#include "DsmrJson.h"
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+DsmrReading xSent;                      //Readings of the previous telegram
+char achEdit[cnTestTelegramLen];
+char achPayload[1600];
+
+void setUp(void)
+{
+    memset(&xSnapshot, 0, sizeof(xSnapshot));
+    P1ParserReset(&xParser);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV50));
+    xSent = *SnapshotPublished(&xSnapshot);
+}
+
+void tearDown(void)
+{
+}
+
+/*--- Decode the telegram with a value replaced, return the changed fields ---*/
+static uint32_t ChangedBy(const char *pchFind, const char *pchReplace)
+{
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV50, pchFind, pchReplace) > 0);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achEdit));
+    return DsmrChanged(&xSent, SnapshotPublished(&xSnapshot));
+}
+
+/*--- The delta document for a set of fields ---*/
+static const char *Delta(uint32_t uMask)
+{
+    TEST_ASSERT_TRUE(DsmrToJson(SnapshotPublished(&xSnapshot), uMask, achPayload, sizeof(achPayload)) > 0);
+    return achPayload;
+}
+
+void test_nothing_changed(void)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV50));
+    TEST_ASSERT_EQUAL_HEX32(0, DsmrChanged(&xSent, SnapshotPublished(&xSnapshot)));
+}
+
+/*--- A new voltage only resends the voltages, not all objects ---*/
+void test_voltage_has_its_own_field(void)
+{
+    uint32_t uMask = ChangedBy("(232.4*V)", "(230.0*V)");
+
+    TEST_ASSERT_EQUAL_HEX32(FieldBit(FIELD_VOLTAGE), uMask);
+    TEST_ASSERT_EQUAL_STRING("{\"meter\":{\"voltage_L1\":\"230.0\",\"voltage_L2\":\"231.1\",\"voltage_L3\":\"233.0\"}}",
+                             Delta(uMask));
+}
+
+void test_current_has_its_own_field(void)
+{
+    uint32_t uMask = ChangedBy("1-0:51.7.0(000*A)", "1-0:51.7.0(002*A)");
+
+    TEST_ASSERT_EQUAL_HEX32(FieldBit(FIELD_CURRENT), uMask);
+    TEST_ASSERT_EQUAL_STRING("{\"meter\":{\"current_L1\":\"1.00\",\"current_L2\":\"2.00\",\"current_L3\":\"1.00\"}}",
+                             Delta(uMask));
+}
+
+/*--- The other objects, text and the failure log included, share FIELD_OBJECTS ---*/
+void test_other_objects(void)
+{
+    TEST_ASSERT_EQUAL_HEX32(FieldBit(FIELD_OBJECTS), ChangedBy("1-0:52.32.0(00003)", "1-0:52.32.0(00004)"));
+    TEST_ASSERT_EQUAL_HEX32(FieldBit(FIELD_OBJECTS), ChangedBy("0-0:96.13.0()", "0-0:96.13.0(4869)"));
+    TEST_ASSERT_EQUAL_HEX32(FieldBit(FIELD_OBJECTS), ChangedBy("(0000000258*s)", "(0000000259*s)"));
+
+    const char *pchDelta = Delta(FieldBit(FIELD_OBJECTS));
+    TEST_ASSERT_NOT_NULL(strstr(pchDelta, "\"failure_events\":[{"));
+    TEST_ASSERT_NULL(strstr(pchDelta, "voltage"));
+    TEST_ASSERT_NULL(strstr(pchDelta, "current"));
+}
+
+/*--- An entry of the failure log that doesn't decode leaves nothing behind to compare or publish ---*/
+void test_failure_log_bad_entry(void)
+{
+    char achStep[cnTestTelegramLen];
+    const char *pchBad[] = {"(0000000258*s)(190102000000W)(0000000060*V)", "(0000000258*s)(190103120000S)(0000000061*V)"};
+
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_TRUE(TestEdit(achStep, sizeof(achStep), achTelegramV50, "99.97.0(2)", "99.97.0(3)", false) > 0);
+        TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achStep, "(0000000258*s)", pchBad[i]) > 0);
+        TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achEdit));
+        const FailureLog *pxLog = &SnapshotPublished(&xSnapshot)->xObjects.xFailures;
+        TEST_ASSERT_EQUAL(3, pxLog->nCount);
+        TEST_ASSERT_EQUAL(2, pxLog->nEvents);
+        TEST_ASSERT_EQUAL(0, pxLog->axEvent[2].uEnd);
+        TEST_ASSERT_EQUAL(0, pxLog->uDst & ~3);
+        if (i == 0)
+            xSent = *SnapshotPublished(&xSnapshot);
+    }
+    TEST_ASSERT_EQUAL_HEX32(0, DsmrChanged(&xSent, SnapshotPublished(&xSnapshot)));
+}
+
+/*--- A typical second of a DSMR 5 meter: the delta holds what changed, the objects are not in it ---*/
+void test_typical_second(void)
+{
+    char achStep[cnTestTelegramLen];
+
+    TEST_ASSERT_TRUE(TestEdit(achStep, sizeof(achStep), achTelegramV50, "190307204732W", "190307204733W", false) > 0);
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achStep, "(00.487*kW)", "(00.512*kW)", false) > 0);
+    TEST_ASSERT_TRUE(TestEdit(achStep, sizeof(achStep), achEdit, "(233.0*V)", "(232.8*V)") > 0);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achStep));
+
+    uint32_t uMask = DsmrChanged(&xSent, SnapshotPublished(&xSnapshot));
+    TEST_ASSERT_EQUAL_HEX32(FieldBit(FIELD_PWR_TIMESTAMP) | FieldBit(FIELD_PWR_ACTUAL) | FieldBit(FIELD_VOLTAGE), uMask);
+    TEST_ASSERT_EQUAL_STRING("{\"power\":{\"time\":\"190307204733W\",\"use\":{\"actual\":{\"total\":\"512\"}}},"
+                             "\"meter\":{\"voltage_L1\":\"232.4\",\"voltage_L2\":\"231.1\",\"voltage_L3\":\"232.8\"}}",
+                             Delta(uMask));
+}
+
+/*--- Every field the first telegram fills in is part of the complete document ---*/
+void test_all_fields(void)
+{
+    DsmrReading xEmpty;
+
+    memset(&xEmpty, 0, sizeof(xEmpty));
+    uint32_t uMask = DsmrChanged(&xEmpty, SnapshotPublished(&xSnapshot));
+    TEST_ASSERT_EQUAL_HEX32(uMask, uMask & cuAllFields);
+    TEST_ASSERT_EQUAL_HEX32(cuObjectFields | FieldBit(FIELD_MBUS), uMask & (cuObjectFields | FieldBit(FIELD_MBUS)));
+    TEST_ASSERT_EQUAL_STRING(Delta(cuAllFields), Delta(uMask | FieldBit(FIELD_RET_ACTUAL) | FieldBit(FIELD_RET_L1) |
+                                                       FieldBit(FIELD_RET_L2) | FieldBit(FIELD_RET_L3)));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_nothing_changed);
+    RUN_TEST(test_voltage_has_its_own_field);
+    RUN_TEST(test_current_has_its_own_field);
+    RUN_TEST(test_other_objects);
+    RUN_TEST(test_failure_log_bad_entry);
+    RUN_TEST(test_typical_second);
+    RUN_TEST(test_all_fields);
+    return UNITY_END();
+}
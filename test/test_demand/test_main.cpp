@@ -0,0 +1,186 @@
+/*==================================================================================================*
+ * Unit tests of the quarter-hour demand and the monthly peak (Demand.h), and of the state record
+ * it is saved in (StateFile.h, RAM backend).
+ *
+ * Telegrams are made up with a meter timestamp and the use register only (T1, Wh); tariff 2 and
+ * the return registers stay at zero.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "Demand.h"
+
+Demand xDemand;
+DsmrReading xReading;
+char achJson[400];
+
+void setUp(void)
+{
+    memset(axStateRam, 0, sizeof(axStateRam));
+    TEST_ASSERT_FALSE(DemandBegin(&xDemand));
+    memset(&xReading, 0, sizeof(xReading));
+}
+
+void tearDown(void)
+{
+}
+
+/*--- A telegram at meter time pchTime with the use register at lUse (Wh) ---*/
+static void Telegram(const char *pchTime, long lUse)
+{
+    strcpy(xReading.achPwrTime, pchTime);
+    xReading.lPwrLow = lUse;
+    DemandAdd(&xDemand, &xReading);
+}
+
+/*--- UTC of a meter time ---*/
+static uint32_t Utc(const char *pchTime)
+{
+    uint32_t uLocal;
+    bool bDst;
+
+    TEST_ASSERT_TRUE(MeterTimeParse(pchTime, &uLocal, &bDst));
+    return MeterTimeUtc(uLocal, bDst);
+}
+
+/*--- The demand member as JSON ---*/
+static const char *Json(void)
+{
+    JsonWriter xWriter;
+
+    JsonBegin(&xWriter, achJson, sizeof(achJson));
+    JsonDemand(&xWriter, &xDemand);
+    TEST_ASSERT_TRUE(JsonEnd(&xWriter) > 0);
+    return achJson;
+}
+
+/*--- The running average follows the register; the first telegram of the next quarter completes it ---*/
+void test_quarter_completion(void)
+{
+    Telegram("181121100000W", 1000);
+    TEST_ASSERT_TRUE(xDemand.bRunning);
+    TEST_ASSERT_FALSE(xDemand.bLast);
+    TEST_ASSERT_EQUAL(Utc("181121100000W"), xDemand.xState.uQuarter);
+
+    Telegram("181121100730W", 1250);
+    TEST_ASSERT_EQUAL(250, xDemand.lUse);
+    TEST_ASSERT_EQUAL(2000, xDemand.lAverage);      //250 Wh in 450 s
+    TEST_ASSERT_EQUAL(0, xDemand.xState.uPeakStart);
+
+    xDemand.bDirty = false;
+    Telegram("181121101500W", 1500);
+    TEST_ASSERT_TRUE(xDemand.bDirty);               //A new base to save
+    TEST_ASSERT_TRUE(xDemand.bLast);
+    TEST_ASSERT_EQUAL(2000, xDemand.lLast);         //500 Wh in 900 s
+    TEST_ASSERT_EQUAL(2000, xDemand.xState.lPeak);
+    TEST_ASSERT_EQUAL(Utc("181121100000W"), xDemand.xState.uPeakStart);
+    TEST_ASSERT_EQUAL(Utc("181121101500W"), xDemand.xState.uQuarter);
+    TEST_ASSERT_EQUAL(0, xDemand.lUse);
+
+    /*--- A lower quarter is the last demand, not the peak; a late telegram stretches the span ---*/
+    Telegram("181121103010W", 2000);
+    TEST_ASSERT_EQUAL(1978, xDemand.lLast);         //500 Wh in 910 s
+    TEST_ASSERT_EQUAL(2000, xDemand.xState.lPeak);
+
+    /*--- A quarter over a gap longer than cuDemandMaxSpan doesn't count ---*/
+    Telegram("181121110011W", 5000);
+    TEST_ASSERT_FALSE(xDemand.bLast);
+    TEST_ASSERT_EQUAL(2000, xDemand.xState.lPeak);
+    TEST_ASSERT_NOT_NULL(strstr(Json(), "\"peak\":{\"start\":\"181121100000W\",\"avg\":\"2000\"}"));
+    TEST_ASSERT_NULL(strstr(achJson, "\"last\""));
+}
+
+/*--- The last quarter of the month still counts for its peak, which is kept as the previous one ---*/
+void test_month_rollover(void)
+{
+    Telegram("181130233000W", 1000);
+    Telegram("181130234500W", 1250);
+    TEST_ASSERT_EQUAL(1000, xDemand.xState.lPeak);
+    TEST_ASSERT_EQUAL(1811, xDemand.xState.uMonth);
+
+    Telegram("181201000000W", 2250);                //Completes 23:45-00:00: the peak of November
+    TEST_ASSERT_EQUAL(4000, xDemand.lLast);
+    TEST_ASSERT_EQUAL(1812, xDemand.xState.uMonth);
+    TEST_ASSERT_EQUAL(0, xDemand.xState.uPeakStart);
+    TEST_ASSERT_EQUAL(1811, xDemand.xState.uPrevMonth);
+    TEST_ASSERT_EQUAL(4000, xDemand.xState.lPrevPeak);
+    TEST_ASSERT_EQUAL(Utc("181130234500W"), xDemand.xState.uPrevPeakStart);
+    Json();
+    TEST_ASSERT_NULL(strstr(achJson, "\"peak\""));
+    TEST_ASSERT_NOT_NULL(strstr(achJson, "\"last\":\"4000\",\"previous\":{\"month\":\"1811\","
+                                         "\"start\":\"181130234500W\",\"avg\":\"4000\"}"));
+
+    /*--- The first quarter of December is its own peak, next to the previous one ---*/
+    Telegram("181201001500W", 2500);
+    TEST_ASSERT_EQUAL(1000, xDemand.xState.lPeak);
+    TEST_ASSERT_EQUAL(4000, xDemand.xState.lPrevPeak);
+    TEST_ASSERT_NOT_NULL(strstr(Json(), "\"peak\":{\"start\":\"181201000000W\",\"avg\":\"1000\"},"
+                                        "\"previous\":{\"month\":\"1811\""));
+
+    /*--- A month without a completed quarter leaves the previous peak as it was ---*/
+    Telegram("190101000000W", 9000);
+    TEST_ASSERT_EQUAL(1812, xDemand.xState.uPrevMonth);
+    TEST_ASSERT_EQUAL(1000, xDemand.xState.lPrevPeak);
+    Telegram("190201000000W", 9500);
+    TEST_ASSERT_EQUAL(1812, xDemand.xState.uPrevMonth);
+    TEST_ASSERT_NOT_NULL(strstr(Json(), "\"previous\":{\"month\":\"1812\""));
+}
+
+/*--- The saved state is picked up after a reboot; the quarter in progress completes across it ---*/
+void test_reload(void)
+{
+    Telegram("181130234500W", 1000);
+    Telegram("181201000000W", 2000);
+    TEST_ASSERT_TRUE(DemandSave(&xDemand));
+    TEST_ASSERT_FALSE(xDemand.bDirty);
+    Telegram("181201000500W", 2100);                //Not saved, the base didn't change
+    TEST_ASSERT_FALSE(xDemand.bDirty);
+
+    DemandState xSaved = xDemand.xState;
+    TEST_ASSERT_TRUE(DemandBegin(&xDemand));
+    TEST_ASSERT_EQUAL_MEMORY(&xSaved, &xDemand.xState, sizeof(xSaved));
+    TEST_ASSERT_FALSE(xDemand.bRunning);
+
+    Telegram("181201001500W", 2500);
+    TEST_ASSERT_TRUE(xDemand.bLast);
+    TEST_ASSERT_EQUAL(2000, xDemand.lLast);         //500 Wh from the saved base
+    TEST_ASSERT_EQUAL(2000, xDemand.xState.lPeak);
+    TEST_ASSERT_EQUAL(4000, xDemand.xState.lPrevPeak);
+}
+
+/*--- A corrupted record or one of another size is not loaded ---*/
+void test_reload_refused(void)
+{
+    Telegram("181130234500W", 1000);
+    Telegram("181201000000W", 2000);
+    TEST_ASSERT_TRUE(DemandSave(&xDemand));
+
+    StateRamRecord *pxRecord = StateRamFind(pchDemandFile, false);
+    TEST_ASSERT_NOT_NULL(pxRecord);
+    TEST_ASSERT_EQUAL(sizeof(DemandState) + 2, pxRecord->nLen);
+    pxRecord->auData[4] ^= 0x01;                    //Flip a bit of uPrevMonth
+    TEST_ASSERT_FALSE(DemandBegin(&xDemand));
+    TEST_ASSERT_EQUAL(0, xDemand.xState.uMonth);
+    TEST_ASSERT_FALSE(xDemand.xState.bBase);
+
+    pxRecord->auData[4] ^= 0x01;
+    TEST_ASSERT_TRUE(DemandBegin(&xDemand));
+    pxRecord->auData[pxRecord->nLen - 1] ^= 0x80;   //The CRC itself
+    TEST_ASSERT_FALSE(DemandBegin(&xDemand));
+
+    /*--- A record of the layout before the previous peak was added ---*/
+    DemandState xState;
+    memset(&xState, 0, sizeof(xState));
+    TEST_ASSERT_TRUE(StateSave(pchDemandFile, &xState, sizeof(xState) - 16));
+    TEST_ASSERT_FALSE(DemandBegin(&xDemand));
+    TEST_ASSERT_FALSE(StateSave(pchDemandFile, &xState, cnStateMaxLen + 1));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_quarter_completion);
+    RUN_TEST(test_month_rollover);
+    RUN_TEST(test_reload);
+    RUN_TEST(test_reload_refused);
+    return UNITY_END();
+}
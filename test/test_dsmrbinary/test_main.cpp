@@ -0,0 +1,177 @@
+/*==================================================================================================*
+ * Unit tests of the binary payload (DsmrBinary.h): the layout, and the round trip through the
+ * reference decoder DsmrFromBinary() for the current schema (2) and the original one (1).
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "TestTelegrams.h"
+#include "DsmrBinary.h"
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+DsmrReading xDecoded;
+char achEdit[cnTestTelegramLen];
+uint8_t auPayload[cnBinaryLen + 16];
+
+void setUp(void)
+{
+    memset(&xSnapshot, 0, sizeof(xSnapshot));
+    memset(&xDecoded, 0xA5, sizeof(xDecoded));  //Decoding must set every field
+    memset(auPayload, 0, sizeof(auPayload));
+    P1ParserReset(&xParser);
+}
+
+void tearDown(void)
+{
+}
+
+/*--- Decode a telegram and encode it ---*/
+static const DsmrReading *Encode(const char *pchTelegram)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, pchTelegram));
+    TEST_ASSERT_EQUAL(cnBinaryLen, DsmrToBinary(SnapshotPublished(&xSnapshot), auPayload, sizeof(auPayload)));
+    return SnapshotPublished(&xSnapshot);
+}
+
+/*--- The values of schema 1 came back the same ---*/
+static void CheckSchema1(const DsmrReading *pxReading)
+{
+    TEST_ASSERT_EQUAL(pxReading->lDsmrVersion, xDecoded.lDsmrVersion);
+    TEST_ASSERT_EQUAL(pxReading->lPwrTariff, xDecoded.lPwrTariff);
+    TEST_ASSERT_EQUAL_STRING(pxReading->achPwrTime, xDecoded.achPwrTime);
+    TEST_ASSERT_EQUAL_STRING(pxReading->achGasTime, xDecoded.achGasTime);
+    TEST_ASSERT_EQUAL(pxReading->lPwrLow, xDecoded.lPwrLow);
+    TEST_ASSERT_EQUAL(pxReading->lPwrHigh, xDecoded.lPwrHigh);
+    TEST_ASSERT_EQUAL(pxReading->lPwrActual, xDecoded.lPwrActual);
+    TEST_ASSERT_EQUAL(pxReading->lPwrL1, xDecoded.lPwrL1);
+    TEST_ASSERT_EQUAL(pxReading->lPwrL2, xDecoded.lPwrL2);
+    TEST_ASSERT_EQUAL(pxReading->lPwrL3, xDecoded.lPwrL3);
+    TEST_ASSERT_EQUAL(pxReading->lReturnLow, xDecoded.lReturnLow);
+    TEST_ASSERT_EQUAL(pxReading->lReturnHigh, xDecoded.lReturnHigh);
+    TEST_ASSERT_EQUAL(pxReading->lReturnActual, xDecoded.lReturnActual);
+    TEST_ASSERT_EQUAL(pxReading->lReturnL1, xDecoded.lReturnL1);
+    TEST_ASSERT_EQUAL(pxReading->lReturnL2, xDecoded.lReturnL2);
+    TEST_ASSERT_EQUAL(pxReading->lReturnL3, xDecoded.lReturnL3);
+    TEST_ASSERT_EQUAL(pxReading->lGasMeter, xDecoded.lGasMeter);
+}
+
+/*--- The M-Bus channels came back the same, without their identifiers ---*/
+static void CheckMbus(const DsmrReading *pxReading)
+{
+    for (int i = 0; i < cnMbusChannels; i++) {
+        const MbusChannel *pxSent = &pxReading->axMbus[i];
+        const MbusChannel *pxChannel = &xDecoded.axMbus[i];
+        TEST_ASSERT_EQUAL(pxSent->nType, pxChannel->nType);
+        TEST_ASSERT_EQUAL(pxSent->nUnit, pxChannel->nUnit);
+        TEST_ASSERT_EQUAL_HEX8(pxSent->uFlags & ~MBUS_ID, pxChannel->uFlags);
+        TEST_ASSERT_EQUAL(pxSent->uTime, pxChannel->uTime);
+        TEST_ASSERT_EQUAL(pxSent->lValue, pxChannel->lValue);
+        TEST_ASSERT_EQUAL_STRING("", pxChannel->achId);
+    }
+}
+
+/*--- Fixed offsets of the layout, little endian ---*/
+void test_layout(void)
+{
+    const DsmrReading *pxReading = Encode(achTelegramV42);
+
+    TEST_ASSERT_EQUAL(112, cnBinaryLen);
+    TEST_ASSERT_EQUAL(cuBinarySchema, auPayload[0]);
+    TEST_ASSERT_EQUAL(42, auPayload[1]);
+    TEST_ASSERT_EQUAL(2, auPayload[2]);
+    TEST_ASSERT_EQUAL_HEX8(BINARY_PWR_TIME | BINARY_GAS_TIME, auPayload[3]); //Both winter time
+    TEST_ASSERT_EQUAL_HEX32(pxReading->lPwrLow, BinaryGet32(auPayload + 12));
+    const uint8_t auPwrLow[] = { 0x96, 0x8B, 0xB8, 0x00 }; //12094358 Wh
+    TEST_ASSERT_EQUAL_MEMORY(auPwrLow, auPayload + 12, 4);
+    TEST_ASSERT_EQUAL(606, BinaryGet32(auPayload + 44));
+    TEST_ASSERT_EQUAL(5135305, BinaryGet32(auPayload + 60));
+    TEST_ASSERT_EQUAL(3, auPayload[64]);              //Channel 1: gas
+    TEST_ASSERT_EQUAL(5135305, BinaryGet32(auPayload + 72));
+    TEST_ASSERT_EQUAL(0, auPayload[76]);              //Channel 2 not in use
+}
+
+/*--- Schema 2 round trip, with one and with two M-Bus channels ---*/
+void test_round_trip_schema2(void)
+{
+    const DsmrReading *pxReading = Encode(achTelegramV42);
+    TEST_ASSERT_TRUE(DsmrFromBinary(auPayload, cnBinaryLen, &xDecoded));
+    CheckSchema1(pxReading);
+    CheckMbus(pxReading);
+
+    pxReading = Encode(achTelegramV50);
+    memset(&xDecoded, 0xA5, sizeof(xDecoded));
+    TEST_ASSERT_TRUE(DsmrFromBinary(auPayload, cnBinaryLen, &xDecoded));
+    CheckSchema1(pxReading);
+    CheckMbus(pxReading);
+    TEST_ASSERT_EQUAL(7, xDecoded.axMbus[1].nType);
+    TEST_ASSERT_EQUAL(187402, xDecoded.axMbus[1].lValue);
+}
+
+/*--- Summer time and a missing timestamp survive the round trip ---*/
+void test_round_trip_time_flags(void)
+{
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "(181121094755W)", "(180624132132S)") > 0);
+    const DsmrReading *pxReading = Encode(achEdit);
+    TEST_ASSERT_EQUAL_HEX8(BINARY_PWR_TIME | BINARY_PWR_DST | BINARY_GAS_TIME, auPayload[3]);
+    TEST_ASSERT_TRUE(DsmrFromBinary(auPayload, cnBinaryLen, &xDecoded));
+    CheckSchema1(pxReading);
+
+    DsmrReading xReading = *pxReading;
+    xReading.achGasTime[0] = '\0';
+    TEST_ASSERT_EQUAL(cnBinaryLen, DsmrToBinary(&xReading, auPayload, sizeof(auPayload)));
+    TEST_ASSERT_EQUAL_HEX8(BINARY_PWR_TIME | BINARY_PWR_DST, auPayload[3]);
+    TEST_ASSERT_TRUE(DsmrFromBinary(auPayload, cnBinaryLen, &xDecoded));
+    TEST_ASSERT_EQUAL_STRING("", xDecoded.achGasTime);
+}
+
+/*--- A schema 1 payload (64 bytes, before the M-Bus channels) decodes without channels ---*/
+void test_decode_schema1(void)
+{
+    const DsmrReading *pxReading = Encode(achTelegramV50);
+
+    auPayload[0] = 1;
+    TEST_ASSERT_TRUE(DsmrFromBinary(auPayload, cnBinaryLenV1, &xDecoded));
+    CheckSchema1(pxReading);
+    for (int i = 0; i < cnMbusChannels; i++) {
+        TEST_ASSERT_EQUAL(0, xDecoded.axMbus[i].nType);
+        TEST_ASSERT_EQUAL(0, xDecoded.axMbus[i].uFlags);
+    }
+}
+
+/*--- Fields appended by a later schema are ignored ---*/
+void test_decode_later_schema(void)
+{
+    const DsmrReading *pxReading = Encode(achTelegramV50);
+
+    auPayload[0] = cuBinarySchema + 1;
+    memset(auPayload + cnBinaryLen, 0x5A, 16);
+    TEST_ASSERT_TRUE(DsmrFromBinary(auPayload, cnBinaryLen + 16, &xDecoded));
+    CheckSchema1(pxReading);
+    CheckMbus(pxReading);
+}
+
+/*--- Payloads that are too short or of no schema are refused; so is a too small output buffer ---*/
+void test_refused(void)
+{
+    (void)Encode(achTelegramV50);
+
+    TEST_ASSERT_FALSE(DsmrFromBinary(auPayload, cnBinaryLen - 1, &xDecoded));
+    TEST_ASSERT_FALSE(DsmrFromBinary(auPayload, cnBinaryLenV1, &xDecoded));
+    auPayload[0] = 1;
+    TEST_ASSERT_FALSE(DsmrFromBinary(auPayload, cnBinaryLenV1 - 1, &xDecoded));
+    auPayload[0] = 0;
+    TEST_ASSERT_FALSE(DsmrFromBinary(auPayload, cnBinaryLen, &xDecoded));
+    TEST_ASSERT_EQUAL(-1, DsmrToBinary(SnapshotPublished(&xSnapshot), auPayload, cnBinaryLen - 1));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_layout);
+    RUN_TEST(test_round_trip_schema2);
+    RUN_TEST(test_round_trip_time_flags);
+    RUN_TEST(test_decode_schema1);
+    RUN_TEST(test_decode_later_schema);
+    RUN_TEST(test_refused);
+    return UNITY_END();
+}
@@ -0,0 +1,99 @@
+/*==================================================================================================*
+ * Unit tests of the JSON serialization (DsmrJson.h).
+ *
+ * The golden documents are those of the ArduinoJson based sketch for the same telegrams: its 17
+ * values, in its order, all as quoted strings and without whitespace. Subscribers parse them as
+ * they are, so DsmrToJson() must keep producing them byte for byte.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "TestTelegrams.h"
+#include "DsmrJson.h"
+
+/*--- The fields of the original document ---*/
+const uint32_t cuLegacyFields = FieldBit(FIELD_VERSION) | cuPower | FieldBit(FIELD_GAS_METER);
+
+static const char achGoldenV42[] =
+    "{\"dsmr\":\"42\",\"power\":{\"time\":\"181121094755W\",\"tariff\":\"2\","
+    "\"use\":{\"total\":{\"T1\":\"12094358\",\"T2\":\"10777944\"},\"actual\":{\"total\":\"0\",\"L1\":\"0\",\"L2\":\"0\",\"L3\":\"0\"}},"
+    "\"return\":{\"total\":{\"T1\":\"135765\",\"T2\":\"263244\"},\"actual\":{\"total\":\"606\",\"L1\":\"293\",\"L2\":\"36\",\"L3\":\"277\"}}},"
+    "\"gas\":{\"time\":\"181121090000W\",\"total\":\"5135305\"}}";
+
+static const char achGoldenV50[] =
+    "{\"dsmr\":\"50\",\"power\":{\"time\":\"190307204732W\",\"tariff\":\"1\","
+    "\"use\":{\"total\":{\"T1\":\"4130025\",\"T2\":\"3210918\"},\"actual\":{\"total\":\"487\",\"L1\":\"201\",\"L2\":\"65\",\"L3\":\"221\"}},"
+    "\"return\":{\"total\":{\"T1\":\"412116\",\"T2\":\"977410\"},\"actual\":{\"total\":\"0\",\"L1\":\"0\",\"L2\":\"0\",\"L3\":\"0\"}}},"
+    "\"gas\":{\"time\":\"190307204500W\",\"total\":\"2485117\"}}";
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+char achEdit[cnTestTelegramLen];
+char achPayload[1600];
+
+void setUp(void)
+{
+    memset(&xSnapshot, 0, sizeof(xSnapshot));
+    P1ParserReset(&xParser);
+}
+
+void tearDown(void)
+{
+}
+
+/*--- Decode a telegram and serialize it ---*/
+static int ToJson(const char *pchTelegram, uint32_t uMask)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, pchTelegram));
+    return DsmrToJson(SnapshotPublished(&xSnapshot), uMask, achPayload, sizeof(achPayload));
+}
+
+void test_golden_v42(void)
+{
+    TEST_ASSERT_EQUAL(strlen(achGoldenV42), ToJson(achTelegramV42, cuLegacyFields));
+    TEST_ASSERT_EQUAL_STRING(achGoldenV42, achPayload);
+}
+
+void test_golden_v50(void)
+{
+    TEST_ASSERT_EQUAL(strlen(achGoldenV50), ToJson(achTelegramV50, cuLegacyFields));
+    TEST_ASSERT_EQUAL_STRING(achGoldenV50, achPayload);
+}
+
+/*--- The complete document only adds members after the original ones ---*/
+void test_complete_document_extends_golden(void)
+{
+    int nGoldenLen = (int)strlen(achGoldenV42) - 1; //Without the closing '}'
+
+    TEST_ASSERT_TRUE(ToJson(achTelegramV42, cuAllFields) > nGoldenLen);
+    TEST_ASSERT_EQUAL_MEMORY(achGoldenV42, achPayload, nGoldenLen);
+    TEST_ASSERT_EQUAL_STRING_LEN(",\"mbus\":[{\"channel\":\"1\"", achPayload + nGoldenLen, 23);
+}
+
+/*--- The text message is escaped (control characters were already replaced by the decoder) ---*/
+void test_escaped_text(void)
+{
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "0-0:96.13.0()", "0-0:96.13.0(41225C0942)") > 0);
+    TEST_ASSERT_TRUE(ToJson(achEdit, FieldBit(FIELD_OBJECTS)) > 0);
+    TEST_ASSERT_NOT_NULL(strstr(achPayload, "\"message\":\"A\\\"\\\\?B\""));
+}
+
+/*--- A document that does not fit is refused, and the buffer stays terminated ---*/
+void test_buffer_too_small(void)
+{
+    int nLen = ToJson(achTelegramV42, cuLegacyFields);
+
+    TEST_ASSERT_EQUAL(nLen, DsmrToJson(SnapshotPublished(&xSnapshot), cuLegacyFields, achPayload, nLen + 1));
+    TEST_ASSERT_EQUAL(-1, DsmrToJson(SnapshotPublished(&xSnapshot), cuLegacyFields, achPayload, nLen));
+    TEST_ASSERT_TRUE((int)strlen(achPayload) < nLen);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_golden_v42);
+    RUN_TEST(test_golden_v50);
+    RUN_TEST(test_complete_document_extends_golden);
+    RUN_TEST(test_escaped_text);
+    RUN_TEST(test_buffer_too_small);
+    return UNITY_END();
+}
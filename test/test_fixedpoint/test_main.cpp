@@ -0,0 +1,214 @@
+/*==================================================================================================*
+ * Exhaustive test of the fixed-point value decoder (DecodeFixed()).
+ *
+ * Every number of integer and fraction digits up to past the 18 digit limit, every scale the OBIS
+ * table can ask for and more, is checked against a reference decoder that works on the decimal
+ * text instead of with arithmetic: it lines the digits up on the decimal point, drops the leading
+ * zeros and checks the length. Signs, garbage and overflow are checked explicitly.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include <stdio.h>
+#include "FixedPoint.h"
+
+const int cnMaxDecimals = 6;        //Scales tested (the OBIS table uses 0..3)
+const int cnMaxTestDigits = 21;     //Integer and fraction digits tested, past cnMaxFixedDigits
+
+uint32_t uRandom = 1;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+/*--- Random digit (xorshift32, repeatable) ---*/
+static char RandomDigit(void)
+{
+    uRandom ^= uRandom << 13;
+    uRandom ^= uRandom >> 17;
+    uRandom ^= uRandom << 5;
+    return '0' + uRandom % 10;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ReferenceDecode: Decode '[digits][.digits][*unit]' by manipulating the decimal text.
+ *------------------------------------------------------------------------------------------------*/
+static bool ReferenceDecode(const char *pchGroup, int nGroupLen, int nDecimals, int64_t *pllValue)
+{
+    char achInt[64] = "";
+    char achFrac[64] = "";
+    char achScaled[160];
+    int nInt = 0, nFrac = 0, nDots = 0;
+
+    *pllValue = 0;
+    for (int i = 0; i < nGroupLen && pchGroup[i] != '*'; i++) {
+        if (pchGroup[i] == '.')
+            nDots++;
+        else if (pchGroup[i] < '0' || pchGroup[i] > '9' || nInt >= 63 || nFrac >= 63)
+            return false;
+        else if (nDots == 0)
+            achInt[nInt++] = pchGroup[i];
+        else
+            achFrac[nFrac++] = pchGroup[i];
+    }
+    achInt[nInt] = achFrac[nFrac] = 0;
+    if (nDots > 1 || nInt + nFrac == 0)
+        return false;
+
+    /*--- Integer digits, then exactly nDecimals fraction digits (truncated or padded with zeros) ---*/
+    snprintf(achScaled, sizeof(achScaled), "%s%.*s%0*d", achInt, nDecimals, achFrac,
+             nDecimals > nFrac ? nDecimals - nFrac : 0, 0);
+    if (nDecimals <= nFrac)
+        achScaled[nInt + nDecimals] = 0; //No padding
+    const char *pchDigits = achScaled;
+    while (*pchDigits == '0')
+        pchDigits++;
+    if ((int)strlen(pchDigits) > cnMaxFixedDigits)
+        return false;
+    for (; *pchDigits; pchDigits++)
+        *pllValue = *pllValue * 10 + (*pchDigits - '0');
+    return true;
+}
+
+/*--- Compare both decoders on one value group ---*/
+static void CheckBoth(const char *pchGroup, int nDecimals)
+{
+    int64_t llExpected, llValue;
+    char achMessage[120];
+
+    bool bExpected = ReferenceDecode(pchGroup, (int)strlen(pchGroup), nDecimals, &llExpected);
+    bool bValid = DecodeFixed(pchGroup, (int)strlen(pchGroup), nDecimals, &llValue);
+    snprintf(achMessage, sizeof(achMessage), "'%s' with %d decimals", pchGroup, nDecimals);
+    TEST_ASSERT_EQUAL_MESSAGE(bExpected, bValid, achMessage);
+    TEST_ASSERT_EQUAL_INT64_MESSAGE(llExpected, llValue, achMessage);
+}
+
+/*--- Build a value group of nInt integer and nFrac fraction digits ('.' if nFrac >= 0) ---*/
+static void MakeGroup(char *pchGroup, int nInt, int nFrac, int nPattern, const char *pchUnit)
+{
+    int nPos = 0;
+
+    for (int i = 0; i < nInt + (nFrac > 0 ? nFrac : 0); i++) {
+        if (i == nInt)
+            pchGroup[nPos++] = '.';
+        switch (nPattern) {
+        case 0: pchGroup[nPos++] = '9'; break;                          //Largest value
+        case 1: pchGroup[nPos++] = '0'; break;                          //Zero
+        case 2: pchGroup[nPos++] = i == 0 ? '0' : RandomDigit(); break; //Leading zero
+        default: pchGroup[nPos++] = RandomDigit(); break;
+        }
+    }
+    if (nFrac == 0)
+        pchGroup[nPos++] = '.';                                          //'123.'
+    strcpy(pchGroup + nPos, pchUnit);
+}
+
+/*--- Every digit count, decimal position and scale, against the reference ---*/
+void test_all_digit_counts(void)
+{
+    char achGroup[80];
+
+    for (int nInt = 0; nInt <= cnMaxTestDigits; nInt++)
+        for (int nFrac = -1; nFrac <= cnMaxTestDigits; nFrac++)
+            for (int nDecimals = 0; nDecimals <= cnMaxDecimals; nDecimals++)
+                for (int nPattern = 0; nPattern < 8; nPattern++) {
+                    MakeGroup(achGroup, nInt, nFrac, nPattern, nPattern % 2 ? "*kWh" : "");
+                    CheckBoth(achGroup, nDecimals);
+                }
+}
+
+/*--- The 18 digit limit, with and without leading zeros and scaling ---*/
+void test_digit_limit(void)
+{
+    int64_t llValue;
+
+    TEST_ASSERT_TRUE(DecodeFixed("999999999999999999", 18, 0, &llValue));
+    TEST_ASSERT_EQUAL_INT64(999999999999999999LL, llValue);
+    TEST_ASSERT_FALSE(DecodeFixed("1000000000000000000", 19, 0, &llValue));
+    TEST_ASSERT_EQUAL_INT64(0, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed("0000000000000000000000000001", 28, 0, &llValue));
+    TEST_ASSERT_EQUAL_INT64(1, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed("999999999999999.999", 19, 3, &llValue));
+    TEST_ASSERT_EQUAL_INT64(999999999999999999LL, llValue);
+    TEST_ASSERT_FALSE(DecodeFixed("9999999999999999", 16, 3, &llValue)); //Scaled to 19 digits
+    TEST_ASSERT_TRUE(DecodeFixed("999999999999999.9999999", 23, 3, &llValue)); //Truncated fraction
+    TEST_ASSERT_EQUAL_INT64(999999999999999999LL, llValue);
+}
+
+/*--- Exact decimal semantics: no rounding, truncation of extra digits ---*/
+void test_exact_values(void)
+{
+    int64_t llValue;
+
+    TEST_ASSERT_TRUE(DecodeFixed("11522.839*kWh", 13, 3, &llValue)); //atof() made this 11522838
+    TEST_ASSERT_EQUAL_INT64(11522839, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed("012094.358*kWh", 14, 3, &llValue));
+    TEST_ASSERT_EQUAL_INT64(12094358, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed("230.1*V", 7, 1, &llValue));
+    TEST_ASSERT_EQUAL_INT64(2301, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed("1.999", 5, 1, &llValue));
+    TEST_ASSERT_EQUAL_INT64(19, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed("001*A", 5, 2, &llValue));
+    TEST_ASSERT_EQUAL_INT64(100, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed(".5", 2, 3, &llValue));
+    TEST_ASSERT_EQUAL_INT64(500, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed("7.", 2, 0, &llValue));
+    TEST_ASSERT_EQUAL_INT64(7, llValue);
+    TEST_ASSERT_TRUE(DecodeFixed("12345", 3, 0, &llValue)); //Only nGroupLen characters are read
+    TEST_ASSERT_EQUAL_INT64(123, llValue);
+}
+
+/*--- Meter values are never negative: signs are rejected, like any other non-digit ---*/
+void test_signs(void)
+{
+    int64_t llValue = 99;
+
+    TEST_ASSERT_FALSE(DecodeFixed("-1.5*kW", 7, 3, &llValue));
+    TEST_ASSERT_EQUAL_INT64(0, llValue);
+    TEST_ASSERT_FALSE(DecodeFixed("+1.5*kW", 7, 3, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed("1-5", 3, 0, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed("-0", 2, 0, &llValue));
+}
+
+/*--- Garbage: every character that is not a digit or '.', at every position of a value ---*/
+void test_garbage(void)
+{
+    static const char achValue[] = "012.345*kWh";
+    const int nNumberLen = 7;               //'012.345', the unit is not checked by DecodeFixed()
+    char achGroup[sizeof(achValue)];
+    int64_t llValue;
+
+    for (int ch = 1; ch < 256; ch++) {
+        if ((ch >= '0' && ch <= '9') || ch == '.' || ch == '*')
+            continue;
+        for (int nPos = 0; nPos < nNumberLen; nPos++) {
+            memcpy(achGroup, achValue, sizeof(achValue));
+            achGroup[nPos] = (char)ch;
+            TEST_ASSERT_FALSE(DecodeFixed(achGroup, sizeof(achValue) - 1, 3, &llValue));
+            CheckBoth(achGroup, 3);
+        }
+    }
+    TEST_ASSERT_FALSE(DecodeFixed("", 0, 3, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed(".", 1, 3, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed("*kWh", 4, 3, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed("1..2", 4, 3, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed("1.2.3", 5, 3, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed(" 1", 2, 0, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed("1 ", 2, 0, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed("1e3", 3, 0, &llValue));
+    TEST_ASSERT_FALSE(DecodeFixed("0x10", 4, 0, &llValue));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_all_digit_counts);
+    RUN_TEST(test_digit_limit);
+    RUN_TEST(test_exact_values);
+    RUN_TEST(test_signs);
+    RUN_TEST(test_garbage);
+    return UNITY_END();
+}
@@ -0,0 +1,292 @@
+/*==================================================================================================*
+ * Randomized robustness test of the P1 group tokenizer and the line/group decoders.
+ *
+ * Random bytes, truncated telegrams and telegrams with bit errors are fed through SnapshotFeed(),
+ * checking after every byte that the parser state stays within its buffers, and after every
+ * stream that the decoded readings hold terminated strings and still serialize. Memory errors
+ * outside the structs are caught by running the suite with AddressSanitizer and UBSan:
+ * pio test -e native_asan. The sequences are repeatable (fixed seed).
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "TestTelegrams.h"
+#include "DsmrJson.h"
+
+const int cnFuzzRounds = 400;           //Streams per test
+const int cnFuzzStreamLen = 3000;       //Longest random stream
+const int cnFuzzPayloadLen = 1600;      //Same as cnPayloadLen in main.cpp
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+DsmrReading xReferenceV42, xReferenceV50; //Published readings after the clean telegrams
+char achEdit[cnTestTelegramLen];
+char achStream[cnFuzzStreamLen];
+char achPayload[cnFuzzPayloadLen];
+uint32_t uRandom;
+
+void setUp(void)
+{
+    memset(&xSnapshot, 0, sizeof(xSnapshot));
+    P1ParserReset(&xParser);
+    uRandom = 20190307;
+}
+
+void tearDown(void)
+{
+}
+
+/*--- Random number (xorshift32, repeatable) ---*/
+static uint32_t Random(uint32_t uRange)
+{
+    uRandom ^= uRandom << 13;
+    uRandom ^= uRandom >> 17;
+    uRandom ^= uRandom << 5;
+    return uRandom % uRange;
+}
+
+/*--- Readings of the last valid telegram (the published copy changes with every telegram) ---*/
+static const DsmrReading *Published(void)
+{
+    return SnapshotPublished(&xSnapshot);
+}
+
+/*--- A string in a fixed buffer is terminated ---*/
+#define ASSERT_TERMINATED(achText) TEST_ASSERT_TRUE(memchr((achText), 0, sizeof(achText)) != NULL)
+
+/*------------------------------------------------------------------------------------------------*
+ * CheckParser: The parser state stays within its buffers and tables.
+ *------------------------------------------------------------------------------------------------*/
+static void CheckParser(const P1Parser *pxParser, P1Event nEvent)
+{
+    TEST_ASSERT_TRUE(pxParser->nState <= P1_CRC);
+    TEST_ASSERT_TRUE(pxParser->nCrcSpan < cnCrcSpanLen);
+    TEST_ASSERT_TRUE(pxParser->nCrcLen >= 0 && pxParser->nCrcLen <= 4);
+    TEST_ASSERT_TRUE(pxParser->nFirstLen >= 0 && pxParser->nFirstLen < cnGroupLen);
+    TEST_ASSERT_TRUE(pxParser->nLastLen >= 0 && pxParser->nLastLen < cnGroupLen);
+    TEST_ASSERT_TRUE(pxParser->nPart <= 5);
+    TEST_ASSERT_TRUE(pxParser->nObject >= -1 && pxParser->nObject < cnObisEntries);
+    if (pxParser->nState == P1_GROUP || nEvent == P1_EVENT_GROUP || nEvent == P1_EVENT_OBJECT)
+        TEST_ASSERT_TRUE(pxParser->nObject >= 0 && pxParser->nField != FIELD_NONE);
+    if (nEvent == P1_EVENT_GROUP || nEvent == P1_EVENT_OBJECT) {
+        TEST_ASSERT_EQUAL(0, pxParser->achLast[pxParser->nLastLen]);
+        TEST_ASSERT_EQUAL(0, pxParser->achFirst[pxParser->nFirstLen]);
+        TEST_ASSERT_FALSE(pxParser->bTruncated && nEvent == P1_EVENT_OBJECT);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * CheckReading: Decoded readings are consistent and serialize within the payload buffer.
+ *------------------------------------------------------------------------------------------------*/
+static void CheckReading(const DsmrReading *pxReading)
+{
+    const FailureLog *pxLog = &pxReading->xObjects.xFailures;
+
+    ASSERT_TERMINATED(pxReading->achPwrTime);
+    ASSERT_TERMINATED(pxReading->achGasTime);
+    for (int i = 0; i < cnObisTexts; i++)
+        ASSERT_TERMINATED(pxReading->xObjects.achText[i]);
+    for (int i = 0; i < cnMbusChannels; i++)
+        ASSERT_TERMINATED(pxReading->axMbus[i].achId);
+    TEST_ASSERT_TRUE(pxLog->nEvents <= cnFailureLogLen && pxLog->nEvents <= pxLog->nCount);
+
+    int nLen = DsmrToJson(pxReading, cuAllFields, achPayload, sizeof(achPayload));
+    TEST_ASSERT_TRUE(nLen > 0 && nLen < (int)sizeof(achPayload));
+    TEST_ASSERT_EQUAL(nLen, (int)strlen(achPayload));
+    TEST_ASSERT_EQUAL(-1, DsmrToJson(pxReading, cuAllFields, achPayload, nLen)); //One byte short
+}
+
+/*--- Feed a stream byte by byte, checking the parser after every byte ---*/
+static P1Event FuzzFeed(const char *pchData, int nLen)
+{
+    P1Event nLast = P1_EVENT_NONE;
+
+    for (int i = 0; i < nLen; i++) {
+        P1Event nEvent = SnapshotFeed(&xSnapshot, &xParser, pchData[i]);
+        CheckParser(&xParser, nEvent);
+        if (nEvent == P1_EVENT_TELEGRAM_OK || nEvent == P1_EVENT_TELEGRAM_BAD)
+            nLast = nEvent;
+    }
+    CheckReading(SnapshotStaging(&xSnapshot));
+    CheckReading(SnapshotPublished(&xSnapshot));
+    return nLast;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * CheckRecovery: After any stream, the parser is back in sync within one telegram.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	A '/' inside a value group is data, so a stream that ends in a group costs the next telegram:
+ *  its header ends the group and its lines are added to the broken one. The telegram after that
+ *  is decoded exactly as without the disturbance.
+ *------------------------------------------------------------------------------------------------*/
+static void CheckRecovery(const char *pchTelegram, const DsmrReading *pxReference)
+{
+    bool bInGroup = xParser.nState == P1_GROUP;
+    P1Event nFirst = FuzzFeed(pchTelegram, (int)strlen(pchTelegram));
+
+    if (!bInGroup)
+        TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, nFirst);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(pchTelegram, (int)strlen(pchTelegram)));
+    TEST_ASSERT_EQUAL_MEMORY(pxReference, SnapshotPublished(&xSnapshot), sizeof(DsmrReading));
+}
+
+/*--- Readings of the clean telegrams, to compare with after recovery ---*/
+static void MakeReferences(void)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achTelegramV50, (int)strlen(achTelegramV50)));
+    xReferenceV50 = *SnapshotPublished(&xSnapshot);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achTelegramV42, (int)strlen(achTelegramV42)));
+    xReferenceV42 = *SnapshotPublished(&xSnapshot);
+}
+
+/*--- Random bytes, mostly from the characters that drive the tokenizer ---*/
+void test_random_bytes(void)
+{
+    static const char achSyntax[] = "/!()*.:-\r\n0123456789ABCDEFSW";
+
+    MakeReferences();
+    for (int nRound = 0; nRound < cnFuzzRounds; nRound++) {
+        int nLen = Random(cnFuzzStreamLen);
+        for (int i = 0; i < nLen; i++)
+            achStream[i] = Random(4) ? achSyntax[Random(sizeof(achSyntax) - 1)] : (char)Random(256);
+        TEST_ASSERT_NOT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achStream, nLen));
+        CheckRecovery(achTelegramV42, &xReferenceV42);
+    }
+}
+
+/*--- Random fragments of the recorded telegrams, spliced together ---*/
+void test_random_fragments(void)
+{
+    MakeReferences();
+    for (int nRound = 0; nRound < cnFuzzRounds; nRound++) {
+        int nLen = 0;
+        while (nLen < cnFuzzStreamLen - 100) {
+            const char *pchSource = Random(2) ? achTelegramV42 : achTelegramV50;
+            int nSourceLen = (int)strlen(pchSource);
+            int nStart = Random(nSourceLen);
+            int nCopy = 1 + Random(nSourceLen - nStart < 100 ? nSourceLen - nStart : 100);
+            memcpy(achStream + nLen, pchSource + nStart, nCopy);
+            nLen += nCopy;
+        }
+        (void)FuzzFeed(achStream, nLen);
+        CheckRecovery(achTelegramV50, &xReferenceV50);
+    }
+}
+
+/*--- A telegram cut off at every position before it is complete, then complete telegrams ---*/
+void test_truncation(void)
+{
+    MakeReferences();
+    const char *apchTelegram[] = { achTelegramV42, achTelegramV50 };
+    const DsmrReading *apxReference[] = { &xReferenceV42, &xReferenceV50 };
+
+    for (int t = 0; t < 2; t++) {
+        int nComplete = (int)(strchr(apchTelegram[t], '!') - apchTelegram[t]) + 5; //Byte after the CRC16
+        for (int nCut = 0; nCut <= nComplete; nCut++) {
+            TEST_ASSERT_NOT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(apchTelegram[t], nCut));
+            CheckRecovery(apchTelegram[t], apxReference[t]);
+        }
+    }
+}
+
+/*--- Telegrams with 1 to 4 random bit errors are rejected and leave the readings untouched ---*/
+void test_bit_flips(void)
+{
+    MakeReferences();
+    for (int nRound = 0; nRound < 4 * cnFuzzRounds; nRound++) {
+        const char *pchTelegram = nRound % 2 ? achTelegramV42 : achTelegramV50;
+        const DsmrReading *pxReference = nRound % 2 ? &xReferenceV42 : &xReferenceV50;
+        int nLen = TestEdit(achEdit, sizeof(achEdit), pchTelegram);
+        int nFlips = 1 + Random(4);
+
+        for (int i = 0; i < nFlips; i++)
+            achEdit[1 + Random(nLen - 3)] ^= 1 << Random(8); //Not the '/' or the line end
+        if (memcmp(achEdit, pchTelegram, nLen) == 0)
+            continue; //Flips cancelled out
+        TEST_ASSERT_NOT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achEdit, nLen));
+        CheckRecovery(pchTelegram, pxReference);
+    }
+}
+
+/*--- Value groups of 47 characters fit, one more truncates the line and counts it ---*/
+void test_group_length_limit(void)
+{
+    char achValue[cnGroupLen + 8];
+
+    MakeReferences();
+    for (int nLen = cnGroupLen - 2; nLen <= cnGroupLen + 1; nLen++) {
+        snprintf(achValue, sizeof(achValue), "(%0*d.359*kWh)", nLen - 8, 12094);
+        TEST_ASSERT_EQUAL(nLen + 2, (int)strlen(achValue));
+        uint32_t uTruncated = xParser.uTruncated;
+        TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "(012094.358*kWh)", achValue) > 0);
+        TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achEdit, (int)strlen(achEdit)));
+        if (nLen < cnGroupLen) {
+            TEST_ASSERT_EQUAL(12094359, Published()->lPwrLow);
+            TEST_ASSERT_EQUAL(uTruncated, xParser.uTruncated);
+        }
+        else {
+            TEST_ASSERT_EQUAL(12094358, Published()->lPwrLow); //Line dropped, previous value kept
+            TEST_ASSERT_EQUAL(uTruncated + 1, xParser.uTruncated);
+        }
+        TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achTelegramV42, (int)strlen(achTelegramV42)));
+    }
+}
+
+/*--- A truncated group of the failure log skips that group only; the line is counted as truncated ---*/
+void test_log_group_truncated(void)
+{
+    char achValue[cnGroupLen + 8];
+
+    MakeReferences();
+    TEST_ASSERT_EQUAL(5, Published()->xObjects.xFailures.nEvents);
+    for (int nLen = cnGroupLen - 1; nLen <= cnGroupLen; nLen++) {
+        snprintf(achValue, sizeof(achValue), "(%0*d*s)", nLen - 2, 5627);
+        uint32_t uTruncated = xParser.uTruncated;
+        TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "(0000005627*s)", achValue) > 0);
+        TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achEdit, (int)strlen(achEdit)));
+        const FailureLog *pxLog = &Published()->xObjects.xFailures;
+        TEST_ASSERT_EQUAL(5, pxLog->nCount);
+        if (nLen < cnGroupLen) {
+            TEST_ASSERT_EQUAL(5, pxLog->nEvents);
+            TEST_ASSERT_EQUAL(5627, pxLog->axEvent[0].uDuration);
+            TEST_ASSERT_EQUAL(uTruncated, xParser.uTruncated);
+        }
+        else {
+            TEST_ASSERT_EQUAL(4, pxLog->nEvents); //The first entry lost its duration
+            TEST_ASSERT_EQUAL(43178677, pxLog->axEvent[0].uDuration);
+            TEST_ASSERT_EQUAL(uTruncated + 1, xParser.uTruncated);
+        }
+    }
+}
+
+/*--- A '/' inside a value group is data, not the start of a telegram ---*/
+void test_slash_in_group(void)
+{
+    MakeReferences();
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "0-0:96.13.0()", "0-0:96.13.0(A/B)") > 0);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achEdit, (int)strlen(achEdit)));
+    TEST_ASSERT_EQUAL_STRING("A/B", Published()->xObjects.achText[1]);
+
+    /*--- Cut inside a group: the next telegram is lost, the one after it is decoded ---*/
+    int nCut = (int)(strstr(achTelegramV42, "(012094.") - achTelegramV42) + 4;
+    TEST_ASSERT_EQUAL(P1_EVENT_NONE, FuzzFeed(achTelegramV42, nCut));
+    TEST_ASSERT_EQUAL(P1_GROUP, xParser.nState);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_BAD, FuzzFeed(achTelegramV50, (int)strlen(achTelegramV50)));
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, FuzzFeed(achTelegramV50, (int)strlen(achTelegramV50)));
+    TEST_ASSERT_EQUAL(50, Published()->lDsmrVersion);
+    TEST_ASSERT_EQUAL(2324, Published()->xObjects.alValue[9]);
+    TEST_ASSERT_EQUAL_STRING("", Published()->xObjects.achText[1]);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_random_bytes);
+    RUN_TEST(test_random_fragments);
+    RUN_TEST(test_truncation);
+    RUN_TEST(test_bit_flips);
+    RUN_TEST(test_group_length_limit);
+    RUN_TEST(test_log_group_truncated);
+    RUN_TEST(test_slash_in_group);
+    return UNITY_END();
+}
@@ -0,0 +1,144 @@
+/*==================================================================================================*
+ * The telegram pipeline does not allocate once running.
+ *
+ * The device has ~40KB of heap and runs for months, so the path from the P1 input to the MQTT
+ * payloads must not use it: bytes are received through the fake P1 backend, parsed and decoded
+ * with SnapshotFeed(), compared with the previous readings and serialized to JSON and binary,
+ * with the heap allocations counted after a warm-up telegram. Counting replaces malloc(), calloc()
+ * and realloc() and needs glibc; the test is ignored elsewhere and under AddressSanitizer, which
+ * replaces them itself.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "P1Reader.h"
+#include "TestTelegrams.h"
+#include "DsmrJson.h"
+#include "DsmrBinary.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define HEAP_SANITIZED
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define HEAP_SANITIZED
+#endif
+#endif
+
+const int cnHeapPayloadLen = 1600;      //Same as cnPayloadLen in main.cpp
+const int cnHeapTelegrams = 20;         //Telegrams checked after the warm-up
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+DsmrReading xSent;                      //Readings of the previous payload, for DsmrChanged()
+char achPayload[cnHeapPayloadLen];
+uint8_t auBinary[cnBinaryLen];
+
+/*--- Heap allocations while bHeapArmed ---*/
+bool bHeapArmed = false;
+uint32_t uHeapAllocs = 0;
+
+#if defined(__GLIBC__) && !defined(HEAP_SANITIZED)
+/*--- Count by replacing the allocation functions, the real ones do the work ---*/
+extern "C" void *__libc_malloc(size_t nSize);
+extern "C" void *__libc_calloc(size_t nCount, size_t nSize);
+extern "C" void *__libc_realloc(void *pvData, size_t nSize);
+extern "C" void *malloc(size_t nSize)
+{
+    uHeapAllocs += bHeapArmed;
+    return __libc_malloc(nSize);
+}
+extern "C" void *calloc(size_t nCount, size_t nSize)
+{
+    uHeapAllocs += bHeapArmed;
+    return __libc_calloc(nCount, nSize);
+}
+extern "C" void *realloc(void *pvData, size_t nSize)
+{
+    uHeapAllocs += bHeapArmed;
+    return __libc_realloc(pvData, nSize);
+}
+#define HEAP_COUNTED
+#endif
+
+void setUp(void)
+{
+    memset(&xSnapshot, 0, sizeof(xSnapshot));
+    memset(&xSent, 0, sizeof(xSent));
+    P1ParserReset(&xParser);
+    P1ReaderBegin(115200, 0);
+    bHeapArmed = false;
+    uHeapAllocs = 0;
+}
+
+void tearDown(void)
+{
+    bHeapArmed = false;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * HeapPipeline: Receive a telegram and produce its payloads, like loop() and the publish do.
+ *------------------------------------------------------------------------------------------------*
+ *OUTPUT:
+ *	(int) number of valid telegrams.
+ *------------------------------------------------------------------------------------------------*/
+static int HeapPipeline(const char *pchTelegram)
+{
+    int nLen = (int)strlen(pchTelegram);
+    int nValid = 0;
+
+    for (int nPos = 0; nPos < nLen;) {
+        nPos += P1ReaderInject(pchTelegram + nPos, nLen - nPos);
+        while (P1ReaderAvailable()) {
+            if (SnapshotFeed(&xSnapshot, &xParser, (char)P1ReaderRead()) != P1_EVENT_TELEGRAM_OK)
+                continue;
+            const DsmrReading *pxReading = SnapshotPublished(&xSnapshot);
+            uint32_t uMask = DsmrChanged(&xSent, pxReading);
+            if (DsmrToJson(pxReading, cuAllFields, achPayload, sizeof(achPayload)) > 0 &&
+                DsmrToJson(pxReading, uMask, achPayload, sizeof(achPayload)) > 0 &&
+                DsmrToBinary(pxReading, auBinary, sizeof(auBinary)) == cnBinaryLen)
+                nValid++;
+            xSent = *pxReading;
+        }
+    }
+    return nValid;
+}
+
+/*--- The counter sees allocations, so a zero below means something ---*/
+void test_counter_works(void)
+{
+#ifndef HEAP_COUNTED
+    TEST_IGNORE_MESSAGE("heap allocations are only counted with glibc, without AddressSanitizer");
+#else
+    bHeapArmed = true;
+    void *volatile pvData = malloc(16);
+    bHeapArmed = false;
+    free(pvData);
+    TEST_ASSERT_EQUAL(1, uHeapAllocs);
+#endif
+}
+
+/*--- No allocations from receiving a telegram to its payloads, after the first one ---*/
+void test_pipeline_does_not_allocate(void)
+{
+#ifndef HEAP_COUNTED
+    TEST_IGNORE_MESSAGE("heap allocations are only counted with glibc, without AddressSanitizer");
+#else
+    TEST_ASSERT_EQUAL(1, HeapPipeline(achTelegramV50)); //Warm-up
+    bHeapArmed = true;
+    int nValid = 0;
+    for (int i = 0; i < cnHeapTelegrams; i++)
+        nValid += HeapPipeline(i % 2 ? achTelegramV42 : achTelegramV50);
+    bHeapArmed = false;
+
+    TEST_ASSERT_EQUAL(cnHeapTelegrams, nValid);
+    TEST_ASSERT_EQUAL(0, P1ReaderOverflows());
+    TEST_ASSERT_EQUAL_MESSAGE(0, uHeapAllocs, "heap allocations after the warm-up");
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_counter_works);
+    RUN_TEST(test_pipeline_does_not_allocate);
+    return UNITY_END();
+}
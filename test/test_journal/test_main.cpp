@@ -0,0 +1,182 @@
+/*==================================================================================================*
+ * Unit tests of the store-and-forward journal, with the RAM backend (JOURNAL_SEGMENTS 4).
+ *
+ * A reading is identified by its lPwrLow value. A reboot is a fresh Journal struct opened with
+ * JournalBegin() on the segments left in axJournalRam, like the segment files left on LittleFS.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "Journal.h"
+
+const int cnRingRecords = JOURNAL_SEGMENTS * cnJournalSegRecords; //Most records the journal holds
+
+Journal xJournal;
+DsmrReading xReading;
+
+void setUp(void)
+{
+    memset(axJournalRam, 0, sizeof(axJournalRam));
+    memset(&xReading, 0, sizeof(xReading));
+    TEST_ASSERT_TRUE(JournalBegin(&xJournal));
+}
+
+void tearDown(void)
+{
+}
+
+/*--- Queue readings nFirst .. nFirst + nCount - 1 ---*/
+static void PushRange(int nFirst, int nCount)
+{
+    for (int i = nFirst; i < nFirst + nCount; i++) {
+        xReading.lPwrLow = i;
+        TEST_ASSERT_TRUE(JournalPush(&xJournal, &xReading));
+    }
+}
+
+/*--- Drain nCount readings, which must be nFirst .. nFirst + nCount - 1 ---*/
+static void DrainRange(int nFirst, int nCount)
+{
+    DsmrReading xQueued;
+
+    for (int i = nFirst; i < nFirst + nCount; i++) {
+        TEST_ASSERT_TRUE(JournalPeek(&xJournal, &xQueued));
+        TEST_ASSERT_EQUAL(i, xQueued.lPwrLow);
+        JournalPop(&xJournal);
+    }
+}
+
+/*--- Segments in use in the RAM backend ---*/
+static int RamSegments(void)
+{
+    int nUsed = 0;
+
+    for (int i = 0; i < JOURNAL_SEGMENTS; i++)
+        nUsed += axJournalRam[i].nRecords > 0;
+    return nUsed;
+}
+
+/*--- A record keeps the values and the meter timestamps with their DST flag ---*/
+void test_record_round_trip(void)
+{
+    DsmrReading xQueued;
+
+    xReading.lDsmrVersion = 50;
+    xReading.lPwrTariff = 2;
+    strcpy(xReading.achPwrTime, "190307204732W");
+    strcpy(xReading.achGasTime, "180626120000S");
+    xReading.lPwrLow = 4130025;
+    xReading.lReturnL3 = 221;
+    xReading.lGasMeter = 2485117;
+    TEST_ASSERT_TRUE(JournalPush(&xJournal, &xReading));
+    TEST_ASSERT_TRUE(JournalPeek(&xJournal, &xQueued));
+    TEST_ASSERT_EQUAL_MEMORY(&xReading, &xQueued, sizeof(xReading));
+}
+
+/*--- Readings come out in order across segments, and drained segments are freed ---*/
+void test_fifo_across_segments(void)
+{
+    PushRange(0, 2 * cnJournalSegRecords + 10);
+    TEST_ASSERT_EQUAL(2 * cnJournalSegRecords + 10, JournalCount(&xJournal));
+    TEST_ASSERT_EQUAL(3, RamSegments());
+    DrainRange(0, cnJournalSegRecords + 1);
+    TEST_ASSERT_EQUAL(2, RamSegments());
+    DrainRange(cnJournalSegRecords + 1, cnJournalSegRecords + 9);
+    TEST_ASSERT_EQUAL(0, JournalCount(&xJournal));
+    TEST_ASSERT_EQUAL(0, RamSegments());
+    TEST_ASSERT_FALSE(JournalPeek(&xJournal, &xReading));
+    TEST_ASSERT_EQUAL(0, xJournal.uDropped);
+}
+
+/*--- Draining about 2 segments behind the pushes runs through the ring many times ---*/
+void test_ring_rollover(void)
+{
+    int nNext = 0;
+
+    for (int i = 0; i < 10 * cnRingRecords; i += 7) {
+        PushRange(i, 7);
+        if (JournalCount(&xJournal) > 2 * cnJournalSegRecords) {
+            DrainRange(nNext, 7);
+            nNext += 7;
+        }
+    }
+    TEST_ASSERT_TRUE(RamSegments() <= 3);
+    DrainRange(nNext, JournalCount(&xJournal));
+    TEST_ASSERT_EQUAL(0, xJournal.uDropped);
+    TEST_ASSERT_TRUE(xJournal.uHead > 2 * JOURNAL_SEGMENTS); //Segment numbers moved on
+}
+
+/*--- When all segments are in use, the oldest segment is dropped and counted ---*/
+void test_overflow_drops_oldest_segment(void)
+{
+    PushRange(0, cnRingRecords);
+    TEST_ASSERT_EQUAL(cnRingRecords, JournalCount(&xJournal));
+    TEST_ASSERT_EQUAL(0, xJournal.uDropped);
+
+    PushRange(cnRingRecords, 1);
+    TEST_ASSERT_EQUAL(cnRingRecords - cnJournalSegRecords + 1, JournalCount(&xJournal));
+    TEST_ASSERT_EQUAL(cnJournalSegRecords, xJournal.uDropped);
+
+    /*--- A partly drained oldest segment only counts what was still queued ---*/
+    DrainRange(cnJournalSegRecords, 5);
+    PushRange(cnRingRecords + 1, cnJournalSegRecords);
+    TEST_ASSERT_EQUAL(2 * cnJournalSegRecords - 5, xJournal.uDropped);
+    DrainRange(2 * cnJournalSegRecords, cnRingRecords - cnJournalSegRecords + 1);
+    TEST_ASSERT_EQUAL(0, JournalCount(&xJournal));
+}
+
+/*--- A torn or corrupted record fails its CRC16: it is skipped and counted ---*/
+void test_torn_record_is_skipped(void)
+{
+    PushRange(0, 5);
+    axJournalRam[0].axRecord[1].alValue[0] ^= 0x100;   //Flipped bit
+    memset(&axJournalRam[0].axRecord[3].uGasTime, 0xFF, 12); //Write interrupted, erased flash
+
+    DrainRange(0, 1);
+    DrainRange(2, 1);
+    DrainRange(4, 1);
+    TEST_ASSERT_EQUAL(2, xJournal.uDropped);
+    TEST_ASSERT_EQUAL(0, JournalCount(&xJournal));
+}
+
+/*--- After a reboot the queue is found again; the partly drained segment is sent again ---*/
+void test_reboot_recovery(void)
+{
+    PushRange(0, 2 * cnJournalSegRecords + 10);
+    DrainRange(0, cnJournalSegRecords + 10);
+
+    TEST_ASSERT_TRUE(JournalBegin(&xJournal)); //Reboot
+    TEST_ASSERT_EQUAL(cnJournalSegRecords + 10, JournalCount(&xJournal));
+    PushRange(2 * cnJournalSegRecords + 10, cnJournalSegRecords); //Continues in the head segment
+    TEST_ASSERT_EQUAL(3, RamSegments());
+    DrainRange(cnJournalSegRecords, 2 * cnJournalSegRecords + 10); //At least once: 10 sent again
+    TEST_ASSERT_EQUAL(0, JournalCount(&xJournal));
+    TEST_ASSERT_EQUAL(0, xJournal.uDropped);
+}
+
+/*--- A power loss while appending leaves a torn last record, dropped after the reboot ---*/
+void test_reboot_with_torn_record(void)
+{
+    PushRange(0, 3);
+    axJournalRam[0].axRecord[2].uCrc ^= 0xFFFF;
+
+    TEST_ASSERT_TRUE(JournalBegin(&xJournal)); //Reboot
+    TEST_ASSERT_EQUAL(3, JournalCount(&xJournal));
+    PushRange(3, 2);
+    DrainRange(0, 2);
+    DrainRange(3, 2);
+    TEST_ASSERT_EQUAL(1, xJournal.uDropped);
+    TEST_ASSERT_EQUAL(0, RamSegments());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_record_round_trip);
+    RUN_TEST(test_fifo_across_segments);
+    RUN_TEST(test_ring_rollover);
+    RUN_TEST(test_overflow_drops_oldest_segment);
+    RUN_TEST(test_torn_record_is_skipped);
+    RUN_TEST(test_reboot_recovery);
+    RUN_TEST(test_reboot_with_torn_record);
+    return UNITY_END();
+}
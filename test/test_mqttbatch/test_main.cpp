@@ -0,0 +1,218 @@
+/*==================================================================================================*
+ * Unit tests of the MQTT publish batching (MqttBatch.h) and the per-field topics (DsmrTopics.h),
+ * whose names are put together from the base topic and a suffix in flash while encoding.
+ *
+ * A batch is checked by parsing it back as a broker would: PUBLISH packets back to back, each
+ * with its remaining length, topic and payload.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "MqttBatch.h"
+#include "DsmrTopics.h"
+
+MqttBatch xBatch;
+char achPayload[cnMqttBatchLen];
+char achTopic[300];
+
+void setUp(void)
+{
+    MqttBatchReset(&xBatch);
+    memset(achPayload, 'x', sizeof(achPayload));
+}
+
+void tearDown(void)
+{
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ParsePacket: Decode the PUBLISH packet at a position in the batch.
+ *------------------------------------------------------------------------------------------------*
+ *OUTPUT:
+ *	(int) position of the next packet; the topic and payload lengths in pnTopicLen, pnPayloadLen.
+ *------------------------------------------------------------------------------------------------*/
+static int ParsePacket(int nPos, int *pnTopicLen, int *pnPayloadLen)
+{
+    unsigned long ulRemaining = 0;
+    unsigned long ulScale = 1;
+    uint8_t uByte;
+
+    TEST_ASSERT_EQUAL_HEX8(0x31, xBatch.auBuf[nPos++]); //PUBLISH, QoS 0, retained
+    do {
+        TEST_ASSERT_TRUE(nPos < xBatch.nLen);
+        uByte = xBatch.auBuf[nPos++];
+        ulRemaining += (uByte & 0x7F) * ulScale;
+        ulScale *= 128;
+    } while (uByte & 0x80);
+
+    *pnTopicLen = (xBatch.auBuf[nPos] << 8) | xBatch.auBuf[nPos + 1];
+    *pnPayloadLen = (int)ulRemaining - 2 - *pnTopicLen;
+    TEST_ASSERT_TRUE(*pnPayloadLen >= 0);
+    nPos += (int)ulRemaining;
+    TEST_ASSERT_TRUE(nPos <= xBatch.nLen);
+    return nPos;
+}
+
+/*--- Remaining length: one more byte at every 7 bits ---*/
+void test_remaining_length(void)
+{
+    const struct {
+        unsigned long ulLength;
+        int nLen;
+        uint8_t auExpect[4];
+    } axCase[] = {
+        { 0, 1, { 0x00 } },
+        { 127, 1, { 0x7F } },
+        { 128, 2, { 0x80, 0x01 } },
+        { 321, 2, { 0xC1, 0x02 } },
+        { 16383, 2, { 0xFF, 0x7F } },
+        { 16384, 3, { 0x80, 0x80, 0x01 } },
+        { 2097151, 3, { 0xFF, 0xFF, 0x7F } },
+        { 2097152, 4, { 0x80, 0x80, 0x80, 0x01 } },
+        { 268435455, 4, { 0xFF, 0xFF, 0xFF, 0x7F } },
+    };
+    uint8_t auOut[5];
+
+    for (unsigned i = 0; i < sizeof(axCase) / sizeof(axCase[0]); i++) {
+        memset(auOut, 0xAA, sizeof(auOut));
+        TEST_ASSERT_EQUAL(axCase[i].nLen, MqttRemainingLength(axCase[i].ulLength, auOut));
+        TEST_ASSERT_EQUAL_MEMORY(axCase[i].auExpect, auOut, axCase[i].nLen);
+        TEST_ASSERT_EQUAL_HEX8(0xAA, auOut[axCase[i].nLen]);
+    }
+}
+
+/*--- A packet is laid out as MQTT 3.1.1 specifies, around the 1 to 2 byte length step ---*/
+void test_packet_layout(void)
+{
+    int nTopicLen, nPayloadLen;
+
+    TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, "a", "b", "293", 3, false));
+    const uint8_t auExpect[] = { 0x30, 8, 0, 3, 'a', '/', 'b', '2', '9', '3' };
+    TEST_ASSERT_EQUAL(sizeof(auExpect), xBatch.nLen);
+    TEST_ASSERT_EQUAL_MEMORY(auExpect, xBatch.auBuf, sizeof(auExpect));
+
+    /*--- Remaining length 127 (1 byte) and 128 (2 bytes) ---*/
+    MqttBatchReset(&xBatch);
+    TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, "a", "b", achPayload, 122, true));
+    TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, "a", "b", achPayload, 123, true));
+    TEST_ASSERT_EQUAL(2, xBatch.nPackets);
+    TEST_ASSERT_EQUAL(2 + 127 + 3 + 128, xBatch.nLen);
+    TEST_ASSERT_EQUAL(129, ParsePacket(0, &nTopicLen, &nPayloadLen));
+    TEST_ASSERT_EQUAL(122, nPayloadLen);
+    TEST_ASSERT_EQUAL(xBatch.nLen, ParsePacket(129, &nTopicLen, &nPayloadLen));
+    TEST_ASSERT_EQUAL(3, nTopicLen);
+    TEST_ASSERT_EQUAL(123, nPayloadLen);
+}
+
+/*--- A packet that fills the segment exactly fits, one byte more does not and leaves it unchanged ---*/
+void test_segment_boundary(void)
+{
+    TEST_ASSERT_FALSE(MqttBatchAdd(&xBatch, "a", "b", achPayload, cnMqttBatchLen - 7, true));
+    TEST_ASSERT_EQUAL(0, xBatch.nLen);
+    TEST_ASSERT_EQUAL(0, xBatch.nPackets);
+    TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, "a", "b", achPayload, cnMqttBatchLen - 8, true));
+    TEST_ASSERT_EQUAL(cnMqttBatchLen, xBatch.nLen);
+
+    /*--- The same behind a first packet: 10 bytes in use ---*/
+    MqttBatchReset(&xBatch);
+    TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, "a", "b", "293", 3, true));
+    TEST_ASSERT_FALSE(MqttBatchAdd(&xBatch, "a", "b", achPayload, cnMqttBatchLen - 17, true));
+    TEST_ASSERT_EQUAL(10, xBatch.nLen);
+    TEST_ASSERT_EQUAL(1, xBatch.nPackets);
+    TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, "a", "b", achPayload, cnMqttBatchLen - 18, true));
+    TEST_ASSERT_EQUAL(cnMqttBatchLen, xBatch.nLen);
+    TEST_ASSERT_FALSE(MqttBatchAdd(&xBatch, "a", "b", "", 0, true));
+}
+
+/*--- All topics, split over segments like PublishFields() does, arrive complete and in order ---*/
+void test_split_over_segments(void)
+{
+    char achValue[40];
+    int nWrites = 0;
+    int nLeaf = 0;
+    int nBytes = 0;
+
+    for (int nRound = 0; nRound < 4; nRound++) { //68 messages, about 3 segments
+        for (int i = 0; i < cnDsmrLeaves; i++) {
+            int nLen = snprintf(achValue, sizeof(achValue), "%d-%0*d", i, 4 + 3 * i % 19, nRound);
+            if (MqttBatchAdd(&xBatch, "sensor/dsmr", LeafTopic(i), achValue, nLen, true))
+                continue;
+            TEST_ASSERT_TRUE(xBatch.nLen > cnMqttBatchLen - 60); //Only split when (nearly) full
+
+            /*--- "Write" the batch: check every packet in it ---*/
+            for (int nPos = 0; nPos < xBatch.nLen; nLeaf++) {
+                int nTopicLen, nPayloadLen;
+                int nNext = ParsePacket(nPos, &nTopicLen, &nPayloadLen);
+                int nExpectLen = snprintf(achTopic, sizeof(achTopic), "sensor/dsmr/%s", LeafTopic(nLeaf % cnDsmrLeaves));
+                TEST_ASSERT_EQUAL(nExpectLen, nTopicLen);
+                TEST_ASSERT_EQUAL_MEMORY(achTopic, xBatch.auBuf + nPos + 4, nTopicLen);
+                nPos = nNext;
+            }
+            nBytes += xBatch.nLen;
+            nWrites++;
+            MqttBatchReset(&xBatch);
+            TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, "sensor/dsmr", LeafTopic(i), achValue, nLen, true));
+        }
+    }
+    nLeaf += xBatch.nPackets;
+    nBytes += xBatch.nLen;
+    TEST_ASSERT_EQUAL(4 * cnDsmrLeaves, nLeaf);
+    TEST_ASSERT_EQUAL((nBytes + cnMqttBatchLen - 1) / cnMqttBatchLen, nWrites + 1); //No more segments than needed
+}
+
+/*--- The topic of a packet as text ---*/
+static const char *PacketTopic(int nPos)
+{
+    int nTopicLen, nPayloadLen;
+
+    (void)ParsePacket(nPos, &nTopicLen, &nPayloadLen);
+    TEST_ASSERT_TRUE(nTopicLen < (int)sizeof(achTopic));
+    int nHeader = nPos + 1;         //Past the fixed header: type, then the remaining length
+    while (xBatch.auBuf[nHeader++] & 0x80)
+        ;
+    memcpy(achTopic, xBatch.auBuf + nHeader + 2, nTopicLen);
+    achTopic[nTopicLen] = '\0';
+    return achTopic;
+}
+
+/*--- Topic names: the base topic, '/' and the suffix from flash ---*/
+void test_leaf_topics(void)
+{
+    int anPos[cnDsmrLeaves];
+
+    for (int i = 0; i < cnDsmrLeaves; i++) {
+        anPos[i] = xBatch.nLen;
+        TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, "sensor/dsmr", LeafTopic(i), "1", 1, true));
+        TEST_ASSERT_TRUE(strlen(LeafTopic(i)) < (size_t)cnTopicSuffixLen);
+    }
+    TEST_ASSERT_EQUAL_STRING("sensor/dsmr/dsmr", PacketTopic(anPos[0]));
+    TEST_ASSERT_EQUAL_STRING("sensor/dsmr/power/use/actual/L1", PacketTopic(anPos[6]));
+    TEST_ASSERT_EQUAL_STRING("sensor/dsmr/power/return/actual/total", PacketTopic(anPos[11]));
+    TEST_ASSERT_EQUAL_STRING("sensor/dsmr/gas/total", PacketTopic(anPos[cnDsmrLeaves - 1]));
+    TEST_ASSERT_EQUAL(FieldBit(FIELD_GAS_METER), LeafField(cnDsmrLeaves - 1));
+}
+
+/*--- The base topic has no length limit of its own: a long one is encoded whole ---*/
+void test_long_base_topic(void)
+{
+    char achBase[201];
+
+    memset(achBase, 'b', 200);
+    achBase[200] = '\0';
+    TEST_ASSERT_TRUE(MqttBatchAdd(&xBatch, achBase, LeafTopic(cnDsmrLeaves - 1), "4890857", 7, true));
+    TEST_ASSERT_EQUAL(1 + 2 + 2 + 210 + 7, xBatch.nLen);
+    TEST_ASSERT_EQUAL(210, strlen(PacketTopic(0)));
+    TEST_ASSERT_EQUAL_STRING("/gas/total", achTopic + 200);
+    TEST_ASSERT_EQUAL_MEMORY(achBase, achTopic, 200);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_remaining_length);
+    RUN_TEST(test_packet_layout);
+    RUN_TEST(test_segment_boundary);
+    RUN_TEST(test_split_over_segments);
+    RUN_TEST(test_leaf_topics);
+    RUN_TEST(test_long_base_topic);
+    return UNITY_END();
+}
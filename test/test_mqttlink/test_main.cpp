@@ -0,0 +1,218 @@
+/*==================================================================================================*
+ * Unit tests of the MQTT connection sequencer (MqttLink.h).
+ *
+ * A simulated main loop on a virtual clock (ms) takes the steps the sequencer decides on, against
+ * a broker that refuses connections, doesn't answer at all, or accepts the TCP connection but
+ * never sends its CONNACK. Every pass reads the P1 input first; the longest time between two P1
+ * reads must stay below the time the SoftwareSerial receive buffer lasts (256 bytes at 115,200
+ * baud, 22 ms). Like ConnectMqtt() in main.cpp the TCP connect blocks at most 2/3 of that, and the
+ * wait for the CONNACK keeps the P1 input serviced (P1ReaderPump()).
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "MqttLink.h"
+
+const unsigned long culBufferTime = 256 * 10000UL / 115200;    //P1 receive buffer (ms)
+const unsigned long culTcpTimeout = culBufferTime * 2 / 3;      //Cap of the TCP connect (ms)
+const unsigned long culConnackTimeout = 1000;                   //Wait for the CONNACK (ms)
+const unsigned long culDnsTime = 30;                            //Time a name lookup takes (ms)
+const unsigned long culOutage = 10 * 60 * 1000UL;               //Broker outage (ms)
+const uint32_t cuSeed = 20190307;
+
+/*--- Behaviour of the simulated broker ---*/
+enum Broker
+{
+    BROKER_UP,                      //Connects in 1 ms, CONNACK after 2 ms
+    BROKER_REFUSED,                 //TCP connection refused after 1 ms
+    BROKER_SILENT,                  //No answer at all, the TCP connect runs into its timeout
+    BROKER_HUNG,                    //TCP connects, the CONNACK never comes
+    BROKER_NO_DNS                   //Name lookups are never answered
+};
+
+MqttLink xLink;
+unsigned long ulNow;                //Virtual clock (ms)
+unsigned long ulLastRead;           //Time of the last P1 read
+unsigned long ulMaxGap;             //Longest time between two P1 reads
+unsigned long ulResolveAt;          //Time the pending name lookup completes
+bool bConnected;                    //The MQTT client is connected
+uint32_t uTcpAttempts;              //TCP connects tried
+uint32_t uConnectAttempts;          //MQTT CONNECTs sent
+
+void setUp(void)
+{
+    ulNow = ulLastRead = ulMaxGap = 0;
+    bConnected = false;
+    uTcpAttempts = uConnectAttempts = 0;
+    MqttLinkBegin(&xLink, ulNow, cuSeed);
+}
+
+void tearDown(void)
+{
+}
+
+/*--- Read the P1 input: note the time since the previous read ---*/
+static void ReadP1(void)
+{
+    if (ulNow - ulLastRead > ulMaxGap)
+        ulMaxGap = ulNow - ulLastRead;
+    ulLastRead = ulNow;
+}
+
+/*--- Block the loop for a number of ms, optionally reading P1 every ms (P1ReaderPump()) ---*/
+static void Block(unsigned long ulTime, bool bPump)
+{
+    for (unsigned long i = 0; i < ulTime; i++) {
+        ulNow++;
+        if (bPump)
+            ReadP1();
+    }
+}
+
+/*--- One pass of the main loop: P1 input, then the connection step, like ConnectMqtt() ---*/
+static void Pass(Broker nBroker)
+{
+    ReadP1();
+    MqttLinkStep nStep = MqttLinkPoll(&xLink, bConnected, ulNow);
+    bool bOk = false;
+
+    switch (nStep) {
+    case MQTT_STEP_RESOLVE:
+        ulResolveAt = nBroker == BROKER_NO_DNS ? (unsigned long)-1 : ulNow + culDnsTime;
+        break;
+    case MQTT_STEP_TCP:
+        uTcpAttempts++;
+        bOk = nBroker == BROKER_UP || nBroker == BROKER_HUNG;
+        Block(nBroker == BROKER_SILENT ? culTcpTimeout : 1, false);
+        break;
+    case MQTT_STEP_CONNECT:
+        uConnectAttempts++;
+        bOk = nBroker == BROKER_UP;
+        Block(bOk ? 2 : culConnackTimeout, true);
+        bConnected = bOk;
+        break;
+    default:
+        break;
+    }
+    if (xLink.nState == MQTT_LINK_RESOLVING) {
+        if (ulNow < ulResolveAt)
+            nStep = MQTT_STEP_NONE;
+        else {
+            nStep = MQTT_STEP_RESOLVE;
+            bOk = true;
+        }
+    }
+    if (nStep != MQTT_STEP_NONE)
+        (void)MqttLinkDone(&xLink, nStep, bOk, ulNow);
+    ulNow++;                        //The rest of the pass
+}
+
+/*--- Run the main loop until a given time ---*/
+static void Run(Broker nBroker, unsigned long ulUntil)
+{
+    while (ulNow < ulUntil)
+        Pass(nBroker);
+}
+
+/*--- Outage of the broker (WiFi stays up), then the broker comes back ---*/
+static void Outage(Broker nBroker)
+{
+    MqttLinkNetwork(&xLink, true, ulNow);
+    Run(nBroker, culOutage);
+    TEST_ASSERT_FALSE(MqttLinkUp(&xLink));
+    TEST_ASSERT_TRUE(ulMaxGap < culBufferTime);
+
+    /*--- Backoff: 1, 2, 4, ... 32 s, then every 30-60 s ---*/
+    TEST_ASSERT_TRUE(uTcpAttempts >= 10 + (culOutage - 63000) / culBackoffMax);
+    TEST_ASSERT_TRUE(uTcpAttempts <= 10 + (culOutage - 31500) / (culBackoffMax / 2));
+    TEST_ASSERT_EQUAL(uTcpAttempts, xLink.uFailed);
+    TEST_ASSERT_EQUAL(1 + xLink.uFailed / cuMqttResolveAgain, xLink.uResolves); //Not on every attempt
+
+    Run(BROKER_UP, culOutage + culBackoffMax + culDnsTime + 10);
+    TEST_ASSERT_TRUE(MqttLinkUp(&xLink));
+    TEST_ASSERT_EQUAL(1, xLink.uConnects);
+    TEST_ASSERT_TRUE(ulMaxGap < culBufferTime);
+}
+
+/*--- Broker up: resolve, TCP and CONNECT each in their own pass ---*/
+void test_connect(void)
+{
+    MqttLinkNetwork(&xLink, true, ulNow);
+    TEST_ASSERT_EQUAL(MQTT_STEP_RESOLVE, MqttLinkPoll(&xLink, false, ulNow));
+    TEST_ASSERT_EQUAL(MQTT_STEP_NONE, MqttLinkPoll(&xLink, false, ulNow));  //Lookup in progress
+    TEST_ASSERT_EQUAL(0, MqttLinkDone(&xLink, MQTT_STEP_RESOLVE, true, ulNow));
+    TEST_ASSERT_EQUAL(MQTT_STEP_TCP, MqttLinkPoll(&xLink, false, ulNow));
+    (void)MqttLinkDone(&xLink, MQTT_STEP_TCP, true, ulNow);
+    TEST_ASSERT_EQUAL(MQTT_STEP_CONNECT, MqttLinkPoll(&xLink, false, ulNow));
+    (void)MqttLinkDone(&xLink, MQTT_STEP_CONNECT, true, ulNow);
+    TEST_ASSERT_TRUE(MqttLinkUp(&xLink));
+    TEST_ASSERT_EQUAL(MQTT_STEP_NONE, MqttLinkPoll(&xLink, true, ulNow));
+    TEST_ASSERT_EQUAL(1, xLink.uResolves);
+}
+
+/*--- 10 minutes of a refused connection: P1 keeps being read, and the broker is found again ---*/
+void test_outage_refused(void)
+{
+    Outage(BROKER_REFUSED);
+}
+
+/*--- 10 minutes without any answer: the TCP connect runs into its cap every attempt ---*/
+void test_outage_silent(void)
+{
+    Outage(BROKER_SILENT);
+    TEST_ASSERT_TRUE(ulMaxGap >= culTcpTimeout);
+}
+
+/*--- A broker that never sends its CONNACK: the wait reads P1, TCP and CONNECT are separate passes ---*/
+void test_outage_hung(void)
+{
+    Outage(BROKER_HUNG);
+    TEST_ASSERT_EQUAL(uTcpAttempts, uConnectAttempts);
+}
+
+/*--- A name lookup that never completes is given up on; its late answer is ignored ---*/
+void test_resolve_timeout(void)
+{
+    MqttLinkNetwork(&xLink, true, ulNow);
+    Run(BROKER_NO_DNS, culMqttResolveTimeout + 10);
+    TEST_ASSERT_EQUAL(1, xLink.uResolves);
+    TEST_ASSERT_EQUAL(1, xLink.uFailed);
+    TEST_ASSERT_EQUAL(MQTT_LINK_UNRESOLVED, xLink.nState);
+    TEST_ASSERT_EQUAL(0, MqttLinkDone(&xLink, MQTT_STEP_RESOLVE, true, ulNow));
+    TEST_ASSERT_EQUAL(MQTT_LINK_UNRESOLVED, xLink.nState);
+    TEST_ASSERT_EQUAL(0, uTcpAttempts);
+    TEST_ASSERT_TRUE(ulMaxGap < culBufferTime);
+}
+
+/*--- A lost connection is set up again without a lookup; WiFi down stops, WiFi up resolves again ---*/
+void test_lost_and_network(void)
+{
+    MqttLinkNetwork(&xLink, true, ulNow);
+    Run(BROKER_UP, 100);
+    TEST_ASSERT_TRUE(MqttLinkUp(&xLink));
+
+    bConnected = false;                         //Broker closed the connection
+    TEST_ASSERT_EQUAL(MQTT_STEP_TCP, MqttLinkPoll(&xLink, bConnected, ulNow));
+    (void)MqttLinkDone(&xLink, MQTT_STEP_TCP, true, ulNow);
+    TEST_ASSERT_EQUAL(MQTT_STEP_CONNECT, MqttLinkPoll(&xLink, bConnected, ulNow));
+    (void)MqttLinkDone(&xLink, MQTT_STEP_CONNECT, true, ulNow);
+    TEST_ASSERT_EQUAL(1, xLink.uResolves);
+    TEST_ASSERT_EQUAL(2, xLink.uConnects);
+
+    MqttLinkNetwork(&xLink, false, ulNow);
+    TEST_ASSERT_EQUAL(MQTT_STEP_NONE, MqttLinkPoll(&xLink, false, ulNow + 100000));
+    MqttLinkNetwork(&xLink, true, ulNow);
+    TEST_ASSERT_EQUAL(MQTT_STEP_RESOLVE, MqttLinkPoll(&xLink, false, ulNow));
+    TEST_ASSERT_EQUAL(2, xLink.uResolves);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_connect);
+    RUN_TEST(test_outage_refused);
+    RUN_TEST(test_outage_silent);
+    RUN_TEST(test_outage_hung);
+    RUN_TEST(test_resolve_timeout);
+    RUN_TEST(test_lost_and_network);
+    return UNITY_END();
+}
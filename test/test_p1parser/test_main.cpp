@@ -0,0 +1,144 @@
+/*==================================================================================================*
+ * Unit tests of the streaming P1 parser and the decoding of telegram lines into the readings.
+ *==================================================================================================*/
+
+#include <unity.h>
+#include "TestTelegrams.h"
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+char achEdit[cnTestTelegramLen];
+
+void setUp(void)
+{
+    memset(&xSnapshot, 0, sizeof(xSnapshot));
+    P1ParserReset(&xParser);
+}
+
+void tearDown(void)
+{
+}
+
+/*--- The example telegram decodes into the readings of the original sketch ---*/
+void test_v42_readings(void)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV42));
+    const DsmrReading *pxReading = SnapshotPublished(&xSnapshot);
+    TEST_ASSERT_EQUAL(42, pxReading->lDsmrVersion);
+    TEST_ASSERT_EQUAL_STRING("181121094755W", pxReading->achPwrTime);
+    TEST_ASSERT_EQUAL(12094358, pxReading->lPwrLow);
+    TEST_ASSERT_EQUAL(10777944, pxReading->lPwrHigh);
+    TEST_ASSERT_EQUAL(135765, pxReading->lReturnLow);
+    TEST_ASSERT_EQUAL(263244, pxReading->lReturnHigh);
+    TEST_ASSERT_EQUAL(0, pxReading->lPwrActual);
+    TEST_ASSERT_EQUAL(606, pxReading->lReturnActual);
+    TEST_ASSERT_EQUAL(293, pxReading->lReturnL1);
+    TEST_ASSERT_EQUAL(36, pxReading->lReturnL2);
+    TEST_ASSERT_EQUAL(277, pxReading->lReturnL3);
+    TEST_ASSERT_EQUAL(2, pxReading->lPwrTariff);
+    TEST_ASSERT_EQUAL_STRING("181121090000W", pxReading->achGasTime);
+    TEST_ASSERT_EQUAL(5135305, pxReading->lGasMeter);
+}
+
+/*--- Generic objects, the failure log and several M-Bus channels ---*/
+void test_v50_objects(void)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV50));
+    const DsmrReading *pxReading = SnapshotPublished(&xSnapshot);
+    const DsmrObjects *pxObjects = &pxReading->xObjects;
+    TEST_ASSERT_EQUAL(50, pxReading->lDsmrVersion);
+    TEST_ASSERT_EQUAL(2324, pxObjects->alValue[9]);     //voltage_L1, 1 decimal
+    TEST_ASSERT_EQUAL(2330, pxObjects->alValue[11]);    //voltage_L3
+    TEST_ASSERT_EQUAL(100, pxObjects->alValue[12]);     //current_L1, 2 decimals
+    TEST_ASSERT_EQUAL(8, pxObjects->alValue[0]);        //failures
+    TEST_ASSERT_EQUAL_STRING("E0044007131650618", pxObjects->achText[0]);
+    TEST_ASSERT_EQUAL(2, pxObjects->xFailures.nEvents);
+    TEST_ASSERT_EQUAL(258, pxObjects->xFailures.axEvent[1].uDuration);
+
+    TEST_ASSERT_EQUAL(cuMbusGas, pxReading->axMbus[0].nType);
+    TEST_ASSERT_EQUAL(7, pxReading->axMbus[1].nType);
+    TEST_ASSERT_EQUAL(187402, pxReading->axMbus[1].lValue);
+    TEST_ASSERT_EQUAL(UNIT_M3, pxReading->axMbus[1].nUnit);
+    TEST_ASSERT_EQUAL_STRING("7W001234", pxReading->axMbus[1].achId);
+    TEST_ASSERT_EQUAL(0, pxReading->axMbus[2].uFlags);
+    TEST_ASSERT_EQUAL(2485117, pxReading->lGasMeter);   //From the gas meter's channel
+}
+
+/*--- A telegram with a bad CRC16 is not published, the previous readings stay ---*/
+void test_bad_crc_keeps_previous(void)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV42));
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "012094.358", "099999.999", false) > 0);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_BAD, TestFeed(&xSnapshot, &xParser, achEdit));
+    TEST_ASSERT_EQUAL(12094358, SnapshotPublished(&xSnapshot)->lPwrLow);
+
+    /*--- Same edit with a matching CRC16 ---*/
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "012094.358", "099999.999") > 0);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achEdit));
+    TEST_ASSERT_EQUAL(99999999, SnapshotPublished(&xSnapshot)->lPwrLow);
+}
+
+/*--- Fewer than 4 CRC16 digits is a bad telegram ---*/
+void test_short_crc(void)
+{
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "!4BDE", "!4BD", false) > 0);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_BAD, TestFeed(&xSnapshot, &xParser, achEdit));
+    TEST_ASSERT_EQUAL(0, SnapshotPublished(&xSnapshot)->lDsmrVersion);
+}
+
+/*--- A telegram cut off halfway (between two lines) is dropped by the '/' of the next one ---*/
+void test_restart_on_slash(void)
+{
+    int nCut = (int)(strstr(achTelegramV50, "1-0:32.7.0") - achTelegramV50);
+    TEST_ASSERT_EQUAL(P1_EVENT_NONE, TestFeed(&xSnapshot, &xParser, achTelegramV50, nCut));
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV42));
+    TEST_ASSERT_EQUAL(42, SnapshotPublished(&xSnapshot)->lDsmrVersion);
+    TEST_ASSERT_EQUAL(0, SnapshotPublished(&xSnapshot)->xObjects.uValues & (1 << 9)); //No voltage from the V50 half
+}
+
+/*--- Objects we don't know and malformed references are skipped, a missing value keeps the last one ---*/
+void test_unknown_and_malformed_lines(void)
+{
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achTelegramV42));
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV42, "1-0:1.8.2(010777.944*kWh)\r\n",
+                              "0-0:96.1.4(50217)\r\n1-0:1.8.2x(1*kWh)\r\n1-0:1.8(2*kWh)\r\n1-0:1.8.2222(3*kWh)\r\n") > 0);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achEdit));
+    TEST_ASSERT_EQUAL(10777944, SnapshotPublished(&xSnapshot)->lPwrHigh);
+    TEST_ASSERT_EQUAL(12094358, SnapshotPublished(&xSnapshot)->lPwrLow);
+}
+
+/*--- A value with the wrong unit would be scaled wrong and is ignored ---*/
+void test_unit_mismatch(void)
+{
+    TEST_ASSERT_TRUE(TestEdit(achEdit, sizeof(achEdit), achTelegramV50, "(232.4*V)", "(232.4*kV)") > 0);
+    TEST_ASSERT_EQUAL(P1_EVENT_TELEGRAM_OK, TestFeed(&xSnapshot, &xParser, achEdit));
+    TEST_ASSERT_EQUAL(0, SnapshotPublished(&xSnapshot)->xObjects.uValues & (1 << 9));
+    TEST_ASSERT_EQUAL(2311, SnapshotPublished(&xSnapshot)->xObjects.alValue[10]);
+}
+
+/*--- Classification of the value groups of a log line ---*/
+void test_group_kinds(void)
+{
+    TEST_ASSERT_EQUAL(P1_GROUP_EMPTY, P1GroupKindOf("", 0));
+    TEST_ASSERT_EQUAL(P1_GROUP_NUMBER, P1GroupKindOf("00015", 5));
+    TEST_ASSERT_EQUAL(P1_GROUP_NUMBER, P1GroupKindOf("0000005627*s", 12));
+    TEST_ASSERT_EQUAL(P1_GROUP_NUMBER, P1GroupKindOf("230.1*V", 7));
+    TEST_ASSERT_EQUAL(P1_GROUP_TIME, P1GroupKindOf("170520130938S", 13));
+    TEST_ASSERT_EQUAL(P1_GROUP_REFERENCE, P1GroupKindOf("0-0:96.7.19", 11));
+    TEST_ASSERT_EQUAL(P1_GROUP_TEXT, P1GroupKindOf("4530AB", 6));
+    TEST_ASSERT_EQUAL(P1_GROUP_TEXT, P1GroupKindOf("1.2.3", 5));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_v42_readings);
+    RUN_TEST(test_v50_objects);
+    RUN_TEST(test_bad_crc_keeps_previous);
+    RUN_TEST(test_short_crc);
+    RUN_TEST(test_restart_on_slash);
+    RUN_TEST(test_unknown_and_malformed_lines);
+    RUN_TEST(test_unit_mismatch);
+    RUN_TEST(test_group_kinds);
+    return UNITY_END();
+}
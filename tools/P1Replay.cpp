@@ -0,0 +1,339 @@
+/*==================================================================================================*
+ * P1Replay: replay captured P1 telegrams through the parser on a PC.
+ *
+ * Field problems (CRC errors, truncated lines, long failure logs, odd meters) can be reproduced
+ * without the meter: a capture of the raw P1 byte stream is fed through the fake P1 input backend
+ * (P1Reader.h) into the same parser and decoding as on the device (SnapshotFeed()), paced at the
+ * line rate of the P1 port or as fast as possible. Bytes can be dropped or get a bit flipped on
+ * the way, to see how the parser recovers. For every telegram the CRC result, the CPU time spent
+ * on it (parsing its bytes and serializing the JSON document) and the document that would be
+ * published are reported, followed by a summary.
+ *
+ * Build (from the repository root):
+ *      g++ -std=gnu++11 -O2 -Isrc tools/P1Replay.cpp -o p1replay
+ * Capture the P1 port with any serial tool (115200 8N1, inverted), e.g.:
+ *      cat /dev/ttyUSB0 > capture.p1
+ * Usage:
+ *      p1replay [-s speed] [-i ms] [-b baud] [-n passes] [-d rate] [-f rate] [-r seed] [-q] file...
+ *          -s  0 = as fast as possible (default), 1 = real time, N = N times faster than real time
+ *          -i  time between the start of two telegrams in real time (ms), default 0 (back to back),
+ *              e.g. 1000 for DSMR 5 or 10000 for DSMR 4 meters
+ *          -b  baud rate of the P1 port, default 115200
+ *          -n  number of passes over the capture, default 1
+ *          -d  chance a byte is dropped, e.g. 0.001
+ *          -f  chance a byte gets a random bit flipped, e.g. 0.001
+ *          -r  seed of the fault injection, default 1 (runs are repeatable)
+ *          -q  only the summary, no line per telegram
+ * Built with -DDSMR_PROFILE, the timing histograms of the pipeline stages (Profile.h) are printed
+ * after the summary.
+ * The exit status is 1 if a telegram failed its CRC check or did not fit in the payload buffer
+ * while no faults were injected, so a capture of good telegrams can guard against regressions.
+ *==================================================================================================*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "P1Reader.h"
+#include "DsmrReading.h"
+#include "DsmrJson.h"
+#include "Profile.h"
+
+#if P1_BACKEND != P1_BACKEND_FAKE
+#error "P1Replay needs the fake P1 input backend (build without ARDUINO)"
+#endif
+
+const int cnReplayPayloadLen = 1600;    //Same as cnPayloadLen in main.cpp
+
+struct ReplayOptions
+{
+    double dSpeed;              //0 = as fast as possible, 1 = real time, N = N times faster
+    double dInterval;           //Time between the start of two telegrams, real time (s)
+    long lBaud;                 //Baud rate of the P1 port
+    int nPasses;                //Passes over the capture
+    double dDrop;               //Chance a byte is dropped
+    double dFlip;               //Chance a byte gets a bit flipped
+    uint32_t uSeed;             //Seed of the fault injection
+    bool bQuiet;                //Only the summary
+};
+
+struct ReplayStats
+{
+    uint32_t uTelegrams;        //Telegrams started ('/')
+    uint32_t uValid;            //Telegrams with a valid CRC16
+    uint32_t uBad;              //Telegrams with a CRC16 mismatch
+    uint32_t uIncomplete;       //Telegrams restarted before their end ('!' and CRC16 lost)
+    uint32_t uTooLarge;         //Documents that did not fit in the payload buffer
+    uint64_t ullBytes;          //Bytes of the capture replayed
+    uint64_t ullDropped;        //Bytes dropped by the fault injection
+    uint64_t ullFlipped;        //Bytes with a bit flipped by the fault injection
+    int64_t llMinNs;            //Shortest CPU time of a valid telegram
+    int64_t llMaxNs;            //Longest CPU time of a valid telegram
+    int64_t llSumNs;            //CPU time of all valid telegrams
+};
+
+DsmrSnapshot xSnapshot;
+P1Parser xParser;
+char achPayload[cnReplayPayloadLen];
+
+/*--- Monotonic clock in nanoseconds ---*/
+static int64_t ReplayNow(void)
+{
+    struct timespec xTime;
+
+    clock_gettime(CLOCK_MONOTONIC, &xTime);
+    return (int64_t)xTime.tv_sec * 1000000000LL + xTime.tv_nsec;
+}
+
+/*--- Fault injection random numbers (xorshift32): uniform in [0, 1) ---*/
+static double ReplayRandom(uint32_t *puState)
+{
+    uint32_t x = *puState;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *puState = x;
+    return x / 4294967296.0;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ReplayLoad: Read the capture files into one buffer.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	char **apchFile - file names
+ *  int nFiles - number of files
+ *  long *plLen - receives the total length
+ *OUTPUT:
+ *	(char *) the concatenated contents (malloc'ed), NULL if a file could not be read.
+ *------------------------------------------------------------------------------------------------*/
+static char *ReplayLoad(char **apchFile, int nFiles, long *plLen)
+{
+    char *pchData = NULL;
+    long lLen = 0;
+
+    for (int i = 0; i < nFiles; i++) {
+        FILE *hFile = fopen(apchFile[i], "rb");
+        if (!hFile) {
+            fprintf(stderr, "p1replay: cannot open %s\n", apchFile[i]);
+            free(pchData);
+            return NULL;
+        }
+        fseek(hFile, 0, SEEK_END);
+        long lSize = ftell(hFile);
+        fseek(hFile, 0, SEEK_SET);
+        char *pchMore = (char *)realloc(pchData, lLen + lSize + 1);
+        if (!pchMore || (long)fread(pchMore + lLen, 1, lSize, hFile) != lSize) {
+            fprintf(stderr, "p1replay: cannot read %s\n", apchFile[i]);
+            fclose(hFile);
+            free(pchMore ? pchMore : pchData);
+            return NULL;
+        }
+        fclose(hFile);
+        pchData = pchMore;
+        lLen += lSize;
+    }
+    *plLen = lLen;
+    return pchData;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ReplayTelegram: Report a completed telegram and add it to the statistics.
+ *------------------------------------------------------------------------------------------------*
+ *INPUT:
+ *	ReplayStats *pxStats - statistics
+ *  const ReplayOptions *pxOptions - options
+ *  P1Event nEvent - P1_EVENT_TELEGRAM_OK or P1_EVENT_TELEGRAM_BAD
+ *  int64_t llBusyNs - CPU time spent on the bytes of the telegram so far
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+static void ReplayTelegram(ReplayStats *pxStats, const ReplayOptions *pxOptions, P1Event nEvent, int64_t llBusyNs)
+{
+    if (nEvent == P1_EVENT_TELEGRAM_BAD) {
+        pxStats->uBad++;
+        if (!pxOptions->bQuiet)
+            printf("#%u BAD CRC\n", pxStats->uTelegrams);
+        return;
+    }
+
+    /*--- Serialize the document the device would publish ---*/
+    int64_t llStart = ReplayNow();
+    PROFILE_BEGIN(uTick);
+    int nLen = DsmrToJson(SnapshotPublished(&xSnapshot), cuAllFields, achPayload, sizeof(achPayload));
+    PROFILE_SAMPLE(PROFILE_SERIALIZE, uTick);
+    llBusyNs += ReplayNow() - llStart;
+
+    pxStats->uValid++;
+    pxStats->llSumNs += llBusyNs;
+    if (pxStats->uValid == 1 || llBusyNs < pxStats->llMinNs)
+        pxStats->llMinNs = llBusyNs;
+    if (llBusyNs > pxStats->llMaxNs)
+        pxStats->llMaxNs = llBusyNs;
+    if (nLen < 0)
+        pxStats->uTooLarge++;
+    if (!pxOptions->bQuiet) {
+        printf("#%u OK %.1fus\n", pxStats->uTelegrams, llBusyNs / 1000.0);
+        printf("%s\n", nLen < 0 ? "ERROR: MQTT MESSAGE TOO LARGE!" : achPayload);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ReplayRun: Replay the capture through the fake P1 input.
+ *------------------------------------------------------------------------------------------------*
+ *DESCRIPTION:
+ *	Every byte of the capture has a due time: one byte time (10 bits at the baud rate) after the
+ *  previous one, and a telegram ('/') at least the telegram interval after the previous telegram,
+ *  both divided by the speed. Due bytes are put in the receive buffer (dropped or bit flipped as
+ *  configured), then everything received is fed through SnapshotFeed(), like loop() does on the
+ *  device. At speed 0 the buffer is simply kept full.
+ *INPUT:
+ *	const char *pchData - capture
+ *  long lLen - length of the capture
+ *  const ReplayOptions *pxOptions - options
+ *  ReplayStats *pxStats - receives the statistics
+ *OUTPUT:
+ *	None.
+ *------------------------------------------------------------------------------------------------*/
+static void ReplayRun(const char *pchData, long lLen, const ReplayOptions *pxOptions, ReplayStats *pxStats)
+{
+    double dByteTime = pxOptions->dSpeed > 0 ? 10.0 / pxOptions->lBaud / pxOptions->dSpeed : 0;
+    double dInterval = pxOptions->dSpeed > 0 ? pxOptions->dInterval / pxOptions->dSpeed : 0;
+    double dDue = 0;                        //Due time of the next byte (s since the start)
+    double dTelegramDue = -dInterval;       //Due time of the last telegram start
+    uint32_t uRandom = pxOptions->uSeed ? pxOptions->uSeed : 1;
+    bool bInTelegram = false;
+    int64_t llBusyNs = 0;                   //CPU time spent on the current telegram
+    long lTotal = lLen * pxOptions->nPasses;
+    long lPos = 0;
+    int64_t llStart = ReplayNow();
+
+    while (lPos < lTotal || P1ReaderAvailable()) {
+        /*--- Receive the bytes that are due ---*/
+        double dNow = (ReplayNow() - llStart) / 1e9;
+        while (lPos < lTotal && (pxOptions->dSpeed > 0 || P1ReaderAvailable() < cnP1BufLen - 1)) {
+            char ch = pchData[lPos % lLen];
+            double dByteDue = dDue;
+            if (ch == '/' && dByteDue < dTelegramDue + dInterval)
+                dByteDue = dTelegramDue + dInterval;
+            if (pxOptions->dSpeed > 0 && dByteDue > dNow)
+                break; //Not received yet
+            if (ch == '/')
+                dTelegramDue = dByteDue;
+            dDue = dByteDue + dByteTime;
+            lPos++;
+            pxStats->ullBytes++;
+            if (pxOptions->dDrop > 0 && ReplayRandom(&uRandom) < pxOptions->dDrop) {
+                pxStats->ullDropped++;
+                continue;
+            }
+            if (pxOptions->dFlip > 0 && ReplayRandom(&uRandom) < pxOptions->dFlip) {
+                ch ^= 1 << (int)(ReplayRandom(&uRandom) * 8);
+                pxStats->ullFlipped++;
+            }
+            (void)P1ReaderInject(&ch, 1);
+        }
+
+        /*--- Parse and decode everything received ---*/
+        int64_t llMark = ReplayNow();
+        while (P1ReaderAvailable()) {
+            PROFILE_BEGIN(uTick);
+            char ch = (char)P1ReaderRead();
+            PROFILE_ADD(PROFILE_READ, uTick);
+            P1Event nEvent = SnapshotFeed(&xSnapshot, &xParser, ch);
+            PROFILE_ADD((nEvent == P1_EVENT_OBJECT || nEvent == P1_EVENT_GROUP) ? PROFILE_DECODE : PROFILE_PARSE, uTick);
+            if (nEvent == P1_EVENT_TELEGRAM_OK || nEvent == P1_EVENT_TELEGRAM_BAD)
+                PROFILE_TELEGRAM();
+            if (nEvent == P1_EVENT_TELEGRAM_START || nEvent == P1_EVENT_TELEGRAM_OK || nEvent == P1_EVENT_TELEGRAM_BAD) {
+                int64_t llNow = ReplayNow();
+                llBusyNs += llNow - llMark;
+                llMark = llNow;
+                if (nEvent == P1_EVENT_TELEGRAM_START) {
+                    pxStats->uTelegrams++;
+                    if (bInTelegram)
+                        pxStats->uIncomplete++;
+                    bInTelegram = true;
+                    llBusyNs = 0;
+                }
+                else if (bInTelegram) {
+                    ReplayTelegram(pxStats, pxOptions, nEvent, llBusyNs);
+                    bInTelegram = false;
+                    llMark = ReplayNow(); //Reporting is not part of the telegram
+                }
+            }
+        }
+        llBusyNs += ReplayNow() - llMark;
+
+        /*--- Nothing due yet: wait a little, like the device between two loop() calls ---*/
+        if (pxOptions->dSpeed > 0 && lPos < lTotal && dDue > (ReplayNow() - llStart) / 1e9)
+            usleep(1000);
+    }
+    if (bInTelegram)
+        pxStats->uIncomplete++;
+}
+
+/*------------------------------------------------------------------------------------------------*
+ * ReplayReport: Print the summary of a replay.
+ *------------------------------------------------------------------------------------------------*/
+static void ReplayReport(const ReplayStats *pxStats, double dSeconds)
+{
+    uint32_t uEnded = pxStats->uValid + pxStats->uBad;
+
+    printf("telegrams %u, valid %u, CRC failed %u (%.2f%%), incomplete %u, too large %u\n",
+           pxStats->uTelegrams, pxStats->uValid, pxStats->uBad, uEnded ? 100.0 * pxStats->uBad / uEnded : 0.0,
+           pxStats->uIncomplete, pxStats->uTooLarge);
+    printf("bytes %llu, dropped %llu, flipped %llu, receive buffer overflows %u\n",
+           (unsigned long long)pxStats->ullBytes, (unsigned long long)pxStats->ullDropped,
+           (unsigned long long)pxStats->ullFlipped, P1ReaderOverflows());
+    if (pxStats->uValid)
+        printf("CPU time per valid telegram: min %.1fus, avg %.1fus, max %.1fus\n", pxStats->llMinNs / 1000.0,
+               pxStats->llSumNs / 1000.0 / pxStats->uValid, pxStats->llMaxNs / 1000.0);
+    printf("replayed in %.3fs\n", dSeconds);
+#ifdef DSMR_PROFILE
+    if (ProfileToJson((unsigned long)(dSeconds * 1000), achPayload, sizeof(achPayload)) >= 0)
+        printf("%s\n", achPayload);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    ReplayOptions xOptions = { 0, 0, 115200, 1, 0, 0, 1, false };
+    ReplayStats xStats;
+    int nOption;
+
+    while ((nOption = getopt(argc, argv, "s:i:b:n:d:f:r:q")) != -1) {
+        switch (nOption) {
+        case 's': xOptions.dSpeed = atof(optarg); break;
+        case 'i': xOptions.dInterval = atof(optarg) / 1000.0; break;
+        case 'b': xOptions.lBaud = atol(optarg); break;
+        case 'n': xOptions.nPasses = atoi(optarg); break;
+        case 'd': xOptions.dDrop = atof(optarg); break;
+        case 'f': xOptions.dFlip = atof(optarg); break;
+        case 'r': xOptions.uSeed = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'q': xOptions.bQuiet = true; break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc || xOptions.dSpeed < 0 || xOptions.lBaud <= 0 || xOptions.nPasses < 1) {
+        fprintf(stderr, "usage: p1replay [-s speed] [-i ms] [-b baud] [-n passes] [-d rate] [-f rate] [-r seed] [-q] file...\n");
+        return 2;
+    }
+
+    long lLen;
+    char *pchData = ReplayLoad(argv + optind, argc - optind, &lLen);
+    if (!pchData)
+        return 2;
+
+    memset(&xStats, 0, sizeof(xStats));
+    P1ParserReset(&xParser);
+    P1ReaderBegin(xOptions.lBaud, 0);
+    int64_t llStart = ReplayNow();
+    if (lLen > 0)
+        ReplayRun(pchData, lLen, &xOptions, &xStats);
+    ReplayReport(&xStats, (ReplayNow() - llStart) / 1e9);
+    free(pchData);
+
+    bool bFaults = xOptions.dDrop > 0 || xOptions.dFlip > 0;
+    return (!bFaults && (xStats.uBad || xStats.uTooLarge)) ? 1 : 0;
+}